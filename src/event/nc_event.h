@@ -28,7 +28,6 @@
 #define EVENT_ERR   0xff0000
 
 typedef int (*event_cb_t)(void *, void *, uint32_t);
-typedef void (*event_stats_cb_t)(void *, void *);
 
 struct ev_data {
     int        mask;
@@ -96,6 +95,5 @@ int event_del_out(struct event_base *evb, struct conn *c);
 int event_add_conn(struct event_base *evb, struct conn *c);
 int event_del_conn(struct event_base *evb, struct conn *c);
 int event_wait(struct event_base *evb, int timeout);
-void event_loop_stats(event_stats_cb_t cb, void *arg);
 
 #endif /* _NC_EVENT_H */
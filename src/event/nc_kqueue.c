@@ -411,68 +411,4 @@ event_wait(struct event_base *evb, int timeout)
     NOT_REACHED();
 }
 
-void
-event_loop_stats(event_stats_cb_t cb, void *arg)
-{
-    struct stats *st = arg;
-    int status, kq;
-    struct kevent change, event;
-    struct timespec ts, *tsp;
-
-    kq = kqueue();
-    if (kq < 0) {
-        log_error("kqueue failed: %s", strerror(errno));
-        return;
-    }
-
-    EV_SET(&change, st->sd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, NULL);
-
-    /* kevent should block indefinitely if st->interval < 0 */
-    if (st->interval < 0) {
-        tsp = NULL;
-    } else {
-        tsp = &ts;
-        tsp->tv_sec = st->interval / 1000LL;
-        tsp->tv_nsec = (st->interval % 1000LL) * 1000000LL;
-    }
-
-    for (;;) {
-        int nreturned;
-
-        nreturned = kevent(kq, &change, 1, &event, 1, tsp);
-        if (nreturned < 0) {
-            if (errno == EINTR) {
-                continue;
-            }
-            log_error("kevent on kq %d with m %d failed: %s", kq, st->sd,
-                      strerror(errno));
-            goto error;
-        }
-
-        ASSERT(nreturned <= 1);
-
-        if (nreturned == 1) {
-            struct kevent *ev = &event;
-
-            if (ev->flags & EV_ERROR) {
-                if (ev->data == EINTR) {
-                    continue;
-                }
-                log_error("kevent on kq %d with m %d failed: %s", kq, st->sd,
-                          strerror(ev->data));
-                goto error;
-            }
-        }
-
-        cb(st, &nreturned);
-    }
-
-error:
-    status = close(kq);
-    if (status < 0) {
-        log_error("close kq %d failed, ignored: %s", kq, strerror(errno));
-    }
-    kq = -1;
-}
-
 #endif /* NC_HAVE_KQUEUE */
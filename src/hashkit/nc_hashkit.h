@@ -70,6 +70,7 @@ uint32_t hash_murmur(const char *key, size_t length);
 
 rstatus_t ketama_update(struct server_pool *pool);
 uint32_t ketama_dispatch(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash);
+uint32_t ketama_dispatch_replicas(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash, uint32_t *idx, uint32_t nidx);
 rstatus_t modula_update(struct server_pool *pool);
 uint32_t modula_dispatch(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash);
 rstatus_t random_update(struct server_pool *pool);
@@ -89,6 +89,11 @@ ketama_update(struct server_pool *pool)
     for (server_index = 0; server_index < nserver; server_index++) {
         struct server *server = array_get(&pool->server, server_index);
 
+        if (server->ejected) {
+            /* ejected by admin until restored */
+            continue;
+        }
+
         if (pool->auto_eject_hosts) {
             if (server->next_retry <= now) {
                 server->next_retry = 0LL;
@@ -154,7 +159,8 @@ ketama_update(struct server_pool *pool)
 
         server = array_get(&pool->server, server_index);
 
-        if (pool->auto_eject_hosts && server->next_retry > now) {
+        if (server->ejected ||
+            (pool->auto_eject_hosts && server->next_retry > now)) {
             continue;
         }
 
@@ -212,8 +218,8 @@ ketama_update(struct server_pool *pool)
     return NC_OK;
 }
 
-uint32_t
-ketama_dispatch(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash)
+static struct continuum *
+ketama_point(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash)
 {
     struct continuum *begin, *end, *left, *right, *middle;
 
@@ -236,5 +242,43 @@ ketama_dispatch(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash)
         right = begin;
     }
 
-    return right->index;
+    return right;
+}
+
+uint32_t
+ketama_dispatch(struct continuum *continuum, uint32_t ncontinuum, uint32_t hash)
+{
+    return ketama_point(continuum, ncontinuum, hash)->index;
+}
+
+/*
+ * Pick up to nidx distinct servers for hash into idx[]: the owner of hash,
+ * followed by the owners of the next points on the continuum. Return the
+ * number of servers picked.
+ */
+uint32_t
+ketama_dispatch_replicas(struct continuum *continuum, uint32_t ncontinuum,
+                         uint32_t hash, uint32_t *idx, uint32_t nidx)
+{
+    struct continuum *c, *end;
+    uint32_t i, j, n;
+
+    c = ketama_point(continuum, ncontinuum, hash);
+    end = continuum + ncontinuum;
+
+    for (i = 0, n = 0; i < ncontinuum && n < nidx; i++) {
+        for (j = 0; j < n && idx[j] != c->index; j++) {
+            ;
+        }
+        if (j == n) {
+            idx[n++] = c->index;
+        }
+
+        c++;
+        if (c == end) {
+            c = continuum;
+        }
+    }
+
+    return n;
 }
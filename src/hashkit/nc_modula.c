@@ -53,6 +53,11 @@ modula_update(struct server_pool *pool)
     for (server_index = 0; server_index < nserver; server_index++) {
         struct server *server = array_get(&pool->server, server_index);
 
+        if (server->ejected) {
+            /* ejected by admin until restored */
+            continue;
+        }
+
         if (pool->auto_eject_hosts) {
             if (server->next_retry <= now) {
                 server->next_retry = 0LL;
@@ -116,7 +121,8 @@ modula_update(struct server_pool *pool)
     for (server_index = 0; server_index < nserver; server_index++) {
         struct server *server = array_get(&pool->server, server_index);
 
-        if (pool->auto_eject_hosts && server->next_retry > now) {
+        if (server->ejected ||
+            (pool->auto_eject_hosts && server->next_retry > now)) {
             continue;
         }
 
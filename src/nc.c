@@ -51,11 +51,13 @@ static int show_version;
 static int test_conf;
 static int daemonize;
 static int describe_stats;
+static int compile_conf;
 
 static struct option long_options[] = {
     { "help",           no_argument,        NULL,   'h' },
     { "version",        no_argument,        NULL,   'V' },
     { "test-conf",      no_argument,        NULL,   't' },
+    { "compile-conf",   no_argument,        NULL,   'C' },
     { "daemonize",      no_argument,        NULL,   'd' },
     { "describe-stats", no_argument,        NULL,   'D' },
     { "verbose",        required_argument,  NULL,   'v' },
@@ -64,12 +66,13 @@ static struct option long_options[] = {
     { "stats-port",     required_argument,  NULL,   's' },
     { "stats-interval", required_argument,  NULL,   'i' },
     { "stats-addr",     required_argument,  NULL,   'a' },
+    { "stats-export",   required_argument,  NULL,   'e' },
     { "pid-file",       required_argument,  NULL,   'p' },
     { "mbuf-size",      required_argument,  NULL,   'm' },
     { NULL,             0,                  NULL,    0  }
 };
 
-static char short_options[] = "hVtdDv:o:c:s:i:a:p:m:";
+static char short_options[] = "hVtCdDv:o:c:s:i:a:e:p:m:";
 
 static rstatus_t
 nc_daemonize(int dump_core)
@@ -203,15 +206,17 @@ static void
 nc_show_usage(void)
 {
     log_stderr(
-        "Usage: nutcracker [-?hVdDt] [-v verbosity level] [-o output file]" CRLF
+        "Usage: nutcracker [-?hVdDtC] [-v verbosity level] [-o output file]" CRLF
         "                  [-c conf file] [-s stats port] [-a stats addr]" CRLF
-        "                  [-i stats interval] [-p pid file] [-m mbuf size]" CRLF
+        "                  [-i stats interval] [-e stats export]" CRLF
+        "                  [-p pid file] [-m mbuf size]" CRLF
         "");
     log_stderr(
         "Options:" CRLF
         "  -h, --help             : this help" CRLF
         "  -V, --version          : show version and exit" CRLF
         "  -t, --test-conf        : test configuration for syntax errors and exit" CRLF
+        "  -C, --compile-conf     : compile configuration into a binary snapshot and exit" CRLF
         "  -d, --daemonize        : run as a daemon" CRLF
         "  -D, --describe-stats   : print stats description and exit");
     log_stderr(
@@ -221,6 +226,7 @@ nc_show_usage(void)
         "  -s, --stats-port=N     : set stats monitoring port (default: %d)" CRLF
         "  -a, --stats-addr=S     : set stats monitoring ip (default: %s)" CRLF
         "  -i, --stats-interval=N : set stats aggregation interval in msec (default: %d msec)" CRLF
+        "  -e, --stats-export=S   : push stats to statsd://host:port or influx://host:port (default: off)" CRLF
         "  -p, --pid-file=S       : set pid file (default: %s)" CRLF
         "  -m, --mbuf-size=N      : set size of mbuf chunk in bytes (default: %d bytes)" CRLF
         "",
@@ -288,6 +294,7 @@ nc_set_default_options(struct instance *nci)
     nci->stats_port = NC_STATS_PORT;
     nci->stats_addr = NC_STATS_ADDR;
     nci->stats_interval = NC_STATS_INTERVAL;
+    nci->stats_export = NULL;
 
     status = nc_gethostname(nci->hostname, NC_MAXHOSTNAMELEN);
     if (status < 0) {
@@ -331,6 +338,10 @@ nc_get_options(int argc, char **argv, struct instance *nci)
             test_conf = 1;
             break;
 
+        case 'C':
+            compile_conf = 1;
+            break;
+
         case 'd':
             daemonize = 1;
             break;
@@ -386,6 +397,10 @@ nc_get_options(int argc, char **argv, struct instance *nci)
             nci->stats_addr = optarg;
             break;
 
+        case 'e':
+            nci->stats_export = optarg;
+            break;
+
         case 'p':
             nci->pid_filename = optarg;
             break;
@@ -423,6 +438,7 @@ nc_get_options(int argc, char **argv, struct instance *nci)
                 break;
 
             case 'a':
+            case 'e':
                 log_stderr("nutcracker: option -%c requires a string", optopt);
                 break;
 
@@ -567,6 +583,13 @@ main(int argc, char **argv)
         exit(0);
     }
 
+    if (compile_conf) {
+        if (conf_compile(nci.conf_filename) != NC_OK) {
+            exit(1);
+        }
+        exit(0);
+    }
+
     status = nc_pre_run(&nci);
     if (status != NC_OK) {
         nc_post_run(&nci);
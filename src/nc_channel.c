@@ -1,6 +1,8 @@
 #include <fcntl.h>
 #include <nc_core.h>
+#include <nc_server.h>
 #include <nc_process.h>
+#include <nc_tap.h>
 
 struct channel*
 nc_alloc_channel(void)
@@ -12,7 +14,12 @@ nc_alloc_channel(void)
         log_error("alloc channel failed:", strerror(errno));
         return NULL;
     }
-    if (socketpair(AF_UNIX, SOCK_STREAM, 0, ch->fds) == -1) {
+    /*
+     * A chan_msg is larger than what a nonblocking stream socket is sure to
+     * take in one go, so keep message boundaries: a chan_msg is then either
+     * sent and read whole, or not at all
+     */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, ch->fds) == -1) {
         nc_free(ch);
         log_error("socketpair() failed:", strerror(errno));
         return NULL;
@@ -43,11 +50,13 @@ nc_dealloc_channel(struct channel *ch)
 static rstatus_t
 channel_recv(void *evb, void *priv)
 {
+    struct context *ctx = priv;
     int fd;
     int n;
     struct chan_msg msg;
+    char *err;
 
-    fd = (int) priv;
+    fd = ctx->chan_sd;
     for (;;) {
         n = nc_read_channel(fd, &msg);
         if (n == NC_ERROR) {
@@ -75,6 +84,23 @@ channel_recv(void *evb, void *priv)
             case NC_CMD_LOG_LEVEL_DOWN:
                 log_level_down();
                 break;
+            case NC_CMD_ADMIN:
+                err = server_admin(ctx, &msg);
+                if (err != NULL) {
+                    log_warn("admin command %d on '%s' '%s' failed: %s",
+                             msg.admin, msg.pool, msg.server, err);
+                }
+                break;
+            case NC_CMD_TAP:
+                if (msg.fd >= 0) {
+                    tap_attach(msg.fd, msg.filter);
+                }
+                break;
+            case NC_CMD_DUMP:
+                if (msg.fd >= 0) {
+                    stats_dump(ctx, msg.fd, msg.filter);
+                }
+                break;
         }
     }
     return NC_OK;
@@ -89,9 +115,10 @@ channel_send(void  *evb, void *priv)
 static rstatus_t
 channel_error(void *evb, void *priv)
 {
+    struct context *ctx = priv;
     int fd;
 
-    fd = (int) priv;
+    fd = ctx->chan_sd;
     return event_del(evb, fd, EVENT_READ|EVENT_WRITE);
 
 }
@@ -112,17 +139,26 @@ channel_event_cb(void *evb, void *priv, uint32_t events)
 }
 
 int
-nc_add_channel_event(struct event_base *evb, int fd)
+nc_add_channel_event(struct context *ctx, int fd)
 {
-    return event_add(evb, fd, EVENT_WRITE|EVENT_READ, channel_event_cb, (void *)(long)fd);
+    ctx->chan_sd = fd;
+    return event_add(ctx->evb, fd, EVENT_WRITE|EVENT_READ, channel_event_cb, ctx);
 }
 
+/*
+ * Write chmsg to the channel fd. The socket of a NC_CMD_TAP or NC_CMD_DUMP is
+ * passed along, so that the reader gets its own descriptor for it.
+ */
 int
 nc_write_channel(int fd, struct chan_msg *chmsg)
 {
     ssize_t n;
     struct iovec iov[1];
     struct msghdr msg;
+    union {
+        struct cmsghdr cm;
+        char           space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
 
     iov[0].iov_base = (char *) chmsg;
     iov[0].iov_len  = sizeof(*chmsg);
@@ -133,6 +169,19 @@ nc_write_channel(int fd, struct chan_msg *chmsg)
     msg.msg_iovlen = 1;
     msg.msg_control = NULL;
     msg.msg_controllen = 0;
+    msg.msg_flags = 0;
+
+    if ((chmsg->command == NC_CMD_TAP || chmsg->command == NC_CMD_DUMP) &&
+        chmsg->fd >= 0) {
+        memset(&cmsg, 0, sizeof(cmsg));
+        msg.msg_control = cmsg.space;
+        msg.msg_controllen = sizeof(cmsg.space);
+
+        cmsg.cm.cmsg_len = CMSG_LEN(sizeof(int));
+        cmsg.cm.cmsg_level = SOL_SOCKET;
+        cmsg.cm.cmsg_type = SCM_RIGHTS;
+        nc_memcpy(CMSG_DATA(&cmsg.cm), &chmsg->fd, sizeof(int));
+    }
 
     n = sendmsg(fd, &msg, 0);
     if (n == -1) {
@@ -144,12 +193,21 @@ nc_write_channel(int fd, struct chan_msg *chmsg)
     return (int)n;
 }
 
+/*
+ * Read a chmsg from the channel fd. The fd of chmsg is the descriptor that
+ * came along with it, or -1 if there is none.
+ */
 int
 nc_read_channel(int fd, struct chan_msg *chmsg)
 {
     ssize_t n;
     struct iovec iov[1];
     struct msghdr msg;
+    struct cmsghdr *cm;
+    union {
+        struct cmsghdr cm;
+        char           space[CMSG_SPACE(sizeof(int))];
+    } cmsg;
 
     iov[0].iov_base = (char *) chmsg;
     iov[0].iov_len = sizeof(*chmsg);
@@ -158,6 +216,9 @@ nc_read_channel(int fd, struct chan_msg *chmsg)
     msg.msg_namelen = 0;
     msg.msg_iov = iov;
     msg.msg_iovlen = 1;
+    msg.msg_control = cmsg.space;
+    msg.msg_controllen = sizeof(cmsg.space);
+    msg.msg_flags = 0;
 
     n = recvmsg(fd, &msg, 0);
     if (n == -1) {
@@ -169,7 +230,18 @@ nc_read_channel(int fd, struct chan_msg *chmsg)
     if (n == 0) {
         return NC_ERROR;
     }
+
+    chmsg->fd = -1;
+    cm = CMSG_FIRSTHDR(&msg);
+    if (cm != NULL && cm->cmsg_level == SOL_SOCKET &&
+        cm->cmsg_type == SCM_RIGHTS && cm->cmsg_len == CMSG_LEN(sizeof(int))) {
+        nc_memcpy(&chmsg->fd, CMSG_DATA(cm), sizeof(int));
+    }
+
     if (n < (int)sizeof(*chmsg)) {
+        if (chmsg->fd >= 0) {
+            close(chmsg->fd);
+        }
         return NC_ERROR;
     }
     return (int)n;
@@ -5,8 +5,16 @@ struct channel {
     int fds[2];
 };
 
+#define NC_CHAN_NAMELEN 256
+
 struct chan_msg {
-    int command;
+    int      command;                 /* NC_CMD_* */
+    int      admin;                   /* server_admin_type_t of NC_CMD_ADMIN */
+    uint32_t weight;                  /* server weight of NC_CMD_ADMIN */
+    char     pool[NC_CHAN_NAMELEN];   /* pool name of NC_CMD_ADMIN */
+    char     server[NC_CHAN_NAMELEN]; /* server name of NC_CMD_ADMIN */
+    char     filter[NC_CHAN_NAMELEN]; /* filter line of NC_CMD_TAP or NC_CMD_DUMP */
+    int      fd;                      /* stats port socket of NC_CMD_TAP or NC_CMD_DUMP */
 };
 
 struct channel *nc_alloc_channel(void);
@@ -14,5 +22,5 @@ void nc_dealloc_channel(struct channel *ch);
 void nc_close_channel(struct channel *ch);
 int nc_read_channel(int fd, struct chan_msg *chmsg);
 int nc_write_channel(int fd, struct chan_msg *chmsg);
-int nc_add_channel_event(struct event_base  *evb, int fd);
+int nc_add_channel_event(struct context *ctx, int fd);
 #endif
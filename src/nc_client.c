@@ -177,6 +177,8 @@ client_close(struct context *ctx, struct conn *conn)
     }
     ASSERT(TAILQ_EMPTY(&conn->omsg_q));
 
+    req_tx_discard(conn);
+
     conn->unref(conn);
 
     status = close(conn->sd);
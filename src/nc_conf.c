@@ -15,8 +15,12 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
 #include <pwd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <nc_core.h>
 #include <nc_conf.h>
 #include <nc_server.h>
@@ -117,6 +121,86 @@ static struct command conf_pool_commands[] = {
       conf_add_server,
       offsetof(struct conf_pool, server) },
 
+    { string("servers_file"),
+      conf_set_string,
+      offsetof(struct conf_pool, servers_file) },
+
+    { string("routes"),
+      conf_add_route,
+      offsetof(struct conf_pool, route) },
+
+    { string("mirror"),
+      conf_set_string,
+      offsetof(struct conf_pool, mirror) },
+
+    { string("mirror_sample"),
+      conf_set_num,
+      offsetof(struct conf_pool, mirror_sample) },
+
+    { string("mirror_writes_only"),
+      conf_set_bool,
+      offsetof(struct conf_pool, mirror_writes_only) },
+
+    { string("migration_window"),
+      conf_set_num,
+      offsetof(struct conf_pool, migration_window) },
+
+    { string("migration_backfill_ttl"),
+      conf_set_num,
+      offsetof(struct conf_pool, migration_backfill_ttl) },
+
+    { string("migration_rate"),
+      conf_set_num,
+      offsetof(struct conf_pool, migration_rate) },
+
+    { string("replicas"),
+      conf_set_num,
+      offsetof(struct conf_pool, replicas) },
+
+    { string("read_fallback"),
+      conf_set_string,
+      offsetof(struct conf_pool, read_fallback) },
+
+    { string("failover"),
+      conf_set_string,
+      offsetof(struct conf_pool, failover) },
+
+    { string("warmup"),
+      conf_set_string,
+      offsetof(struct conf_pool, warmup) },
+
+    { string("warmup_ttl"),
+      conf_set_num,
+      offsetof(struct conf_pool, warmup_ttl) },
+
+    { string("distinct_keys_window"),
+      conf_set_num,
+      offsetof(struct conf_pool, distinct_keys_window) },
+
+    { string("namespace"),
+      conf_set_string,
+      offsetof(struct conf_pool, namespace) },
+
+    { string("namespace_top"),
+      conf_set_num,
+      offsetof(struct conf_pool, namespace_top) },
+
+    { string("slowlog_slower_than"),
+      conf_set_num,
+      offsetof(struct conf_pool, slowlog_slower_than) },
+
+    { string("slowlog_max_len"),
+      conf_set_num,
+      offsetof(struct conf_pool, slowlog_max_len) },
+
+    { string("client_top"),
+      conf_set_num,
+      offsetof(struct conf_pool, client_top) },
+
+    { string("splice_threshold"),
+      conf_set_num,
+      offsetof(struct conf_pool, splice_threshold) },
+
     null_command
 };
 
@@ -145,6 +229,12 @@ static struct command conf_global_commands[] = {
         offsetof(struct conf_global, group)
     },
 
+    {
+        string("stats_admin_remote"),
+        conf_set_bool,
+        offsetof(struct conf_global, stats_admin_remote)
+    },
+
     null_command
 };
 
@@ -187,6 +277,7 @@ conf_server_each_transform(void *elem, void *data)
     ASSERT(s != NULL);
 
     s->idx = array_idx(server, s);
+    s->stats_idx = 0;
     s->owner = NULL;
 
     s->pname = cs->pname;
@@ -202,6 +293,10 @@ conf_server_each_transform(void *elem, void *data)
 
     s->next_retry = 0LL;
     s->failure_count = 0;
+    s->delegate = NULL;
+    s->failover_until = 0LL;
+    s->hll = NULL;
+    s->ejected = 0;
 
     log_debug(LOG_VERB, "transform to server %"PRIu32" '%.*s'",
               s->idx, s->pname.len, s->pname.data);
@@ -219,6 +314,12 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
     string_init(&cp->listen.pname);
     string_init(&cp->listen.name);
     string_init(&cp->redis_auth);
+    string_init(&cp->servers_file);
+    string_init(&cp->mirror);
+    string_init(&cp->read_fallback);
+    string_init(&cp->failover);
+    string_init(&cp->warmup);
+    string_init(&cp->namespace);
     cp->listen.port = 0;
     memset(&cp->listen.info, 0, sizeof(cp->listen.info));
     cp->listen.valid = 0;
@@ -240,8 +341,22 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
     cp->server_connections = CONF_UNSET_NUM;
     cp->server_retry_timeout = CONF_UNSET_NUM;
     cp->server_failure_limit = CONF_UNSET_NUM;
+    cp->mirror_sample = CONF_UNSET_NUM;
+    cp->mirror_writes_only = CONF_UNSET_NUM;
+    cp->migration_window = CONF_UNSET_NUM;
+    cp->migration_backfill_ttl = CONF_UNSET_NUM;
+    cp->migration_rate = CONF_UNSET_NUM;
+    cp->warmup_ttl = CONF_UNSET_NUM;
+    cp->distinct_keys_window = CONF_UNSET_NUM;
+    cp->namespace_top = CONF_UNSET_NUM;
+    cp->slowlog_slower_than = CONF_UNSET_NUM;
+    cp->slowlog_max_len = CONF_UNSET_NUM;
+    cp->client_top = CONF_UNSET_NUM;
+    cp->splice_threshold = CONF_UNSET_NUM;
+    cp->replicas = CONF_UNSET_NUM;
 
     array_null(&cp->server);
+    array_null(&cp->route);
 
     cp->valid = 0;
 
@@ -262,6 +377,14 @@ conf_pool_init(struct conf_pool *cp, struct string *name)
         string_deinit(&cp->name);
         return status;
     }
+    status = array_init(&cp->route, CONF_DEFAULT_ROUTES,
+                        sizeof(struct conf_route));
+    if (status != NC_OK) {
+        array_deinit(&cp->redis_master);
+        array_deinit(&cp->server);
+        string_deinit(&cp->name);
+        return status;
+    }
 
     log_debug(LOG_VVERB, "init conf pool %p, '%.*s'", cp, name->len, name->data);
 
@@ -280,11 +403,26 @@ conf_pool_deinit(struct conf_pool *cp)
         string_deinit(&cp->redis_auth);
     }
 
+    string_deinit(&cp->servers_file);
+    string_deinit(&cp->mirror);
+    string_deinit(&cp->read_fallback);
+    string_deinit(&cp->failover);
+    string_deinit(&cp->warmup);
+    string_deinit(&cp->namespace);
+
     while (array_n(&cp->server) != 0) {
         conf_server_deinit(array_pop(&cp->server));
     }
     array_deinit(&cp->server);
 
+    while (array_n(&cp->route) != 0) {
+        struct conf_route *cr = array_pop(&cp->route);
+
+        string_deinit(&cr->prefix);
+        string_deinit(&cr->pool);
+    }
+    array_deinit(&cp->route);
+
     log_debug(LOG_VVERB, "deinit conf pool %p", cp);
 }
 
@@ -312,12 +450,58 @@ conf_pool_each_transform(void *elem, void *data)
 
     array_null(&sp->server);
     array_null(&sp->redis_master);
+    sp->nserver_conf = 0;
     sp->ncontinuum = 0;
     sp->nserver_continuum = 0;
     sp->continuum = NULL;
     sp->nlive_server = 0;
     sp->next_rebuild = 0LL;
 
+    array_null(&sp->route);
+    sp->server_base = 0;
+    sp->nbackend = 0;
+
+    sp->mirror = NULL;
+    sp->mirror_sample = (uint32_t)cp->mirror_sample;
+    sp->mirror_writes_only = cp->mirror_writes_only ? 1 : 0;
+
+    sp->nprev_continuum = 0;
+    sp->prev_continuum = NULL;
+    sp->migrate_until = 0LL;
+    sp->migration_window = (int64_t)cp->migration_window;
+    sp->migration_rate = (uint32_t)cp->migration_rate;
+    sp->move_server = 0;
+    sp->move_cursor = 0;
+    sp->move_scan = 0;
+    sp->move_next = 0LL;
+    sp->move_errors = 0;
+    sp->migration_backfill_ttl = cp->migration_backfill_ttl;
+    sp->replicas = (uint32_t)cp->replicas;
+    sp->read_fallback = NULL;
+    sp->read_fallback_successor = 0;
+    sp->failover = NULL;
+    sp->warmup = NULL;
+    sp->warmup_ttl = (uint32_t)cp->warmup_ttl;
+    sp->distinct_keys_window = (int64_t)cp->distinct_keys_window;
+    sp->hll = NULL;
+    sp->hll_rotate = 0LL;
+    sp->hll_publish = 0LL;
+    if (string_empty(&cp->namespace)) {
+        sp->namespace_top = 0;
+        sp->namespace_delimiter = 0;
+    } else {
+        sp->namespace_top = (uint32_t)cp->namespace_top;
+        sp->namespace_delimiter = cp->namespace.len == 1 ?
+                                  cp->namespace.data[0] : -1;
+    }
+    sp->ns = NULL;
+    sp->slowlog_slower_than = (int64_t)cp->slowlog_slower_than;
+    sp->slowlog_max_len = (uint32_t)cp->slowlog_max_len;
+    sp->slowlog = NULL;
+    sp->client_top = (uint32_t)cp->client_top;
+    sp->talker = NULL;
+    sp->splice_threshold = (uint32_t)cp->splice_threshold;
+
     sp->name = cp->name;
     sp->addrstr = cp->listen.pname;
     sp->port = (uint16_t)cp->listen.port;
@@ -347,12 +531,15 @@ conf_pool_each_transform(void *elem, void *data)
     sp->auto_eject_hosts = cp->auto_eject_hosts ? 1 : 0;
     sp->preconnect = cp->preconnect ? 1 : 0;
 
-    status = server_init(&sp->server, &cp->server, sp);
+    status = server_init(&sp->server, &cp->server,
+                         string_empty(&cp->servers_file) ? 0 : SERVER_JOIN_SPARE,
+                         sp);
     if (status != NC_OK) {
         return status;
     }
+    sp->nserver_conf = array_n(&sp->server);
     if (array_n(&cp->redis_master) > 0) {
-        status = server_init(&sp->redis_master, &cp->redis_master, sp);
+        status = server_init(&sp->redis_master, &cp->redis_master, 0, sp);
         if (status != NC_OK) {
             return status;
         }
@@ -369,11 +556,17 @@ conf_pool_each_transform(void *elem, void *data)
     return NC_OK;
 }
 
+/*
+ * Log the parsed pools, servers and routes; without debug logging there is
+ * nothing to log them to
+ */
+#ifdef NC_DEBUG_LOG
 static void
 conf_dump(struct conf *cf)
 {
-    uint32_t i, j, npool, nserver;
+    uint32_t i, j, npool, nserver, nroute;
     struct conf_pool *cp;
+    struct conf_route *cr;
     struct string *s;
 
     npool = array_n(&cf->pool);
@@ -407,6 +600,33 @@ conf_dump(struct conf *cf)
                   cp->server_retry_timeout);
         log_debug(LOG_VVERB, "  server_failure_limit: %d",
                   cp->server_failure_limit);
+        log_debug(LOG_VVERB, "  mirror: \"%.*s\"", cp->mirror.len,
+                  cp->mirror.data);
+        log_debug(LOG_VVERB, "  mirror_sample: %d", cp->mirror_sample);
+        log_debug(LOG_VVERB, "  mirror_writes_only: %d",
+                  cp->mirror_writes_only);
+        log_debug(LOG_VVERB, "  migration_window: %d", cp->migration_window);
+        log_debug(LOG_VVERB, "  migration_backfill_ttl: %d",
+                  cp->migration_backfill_ttl);
+        log_debug(LOG_VVERB, "  migration_rate: %d", cp->migration_rate);
+        log_debug(LOG_VVERB, "  replicas: %d", cp->replicas);
+        log_debug(LOG_VVERB, "  read_fallback: \"%.*s\"",
+                  cp->read_fallback.len, cp->read_fallback.data);
+        log_debug(LOG_VVERB, "  failover: \"%.*s\"", cp->failover.len,
+                  cp->failover.data);
+        log_debug(LOG_VVERB, "  warmup: \"%.*s\"", cp->warmup.len,
+                  cp->warmup.data);
+        log_debug(LOG_VVERB, "  warmup_ttl: %d", cp->warmup_ttl);
+        log_debug(LOG_VVERB, "  distinct_keys_window: %d",
+                  cp->distinct_keys_window);
+        log_debug(LOG_VVERB, "  namespace: \"%.*s\"", cp->namespace.len,
+                  cp->namespace.data);
+        log_debug(LOG_VVERB, "  namespace_top: %d", cp->namespace_top);
+        log_debug(LOG_VVERB, "  slowlog_slower_than: %d",
+                  cp->slowlog_slower_than);
+        log_debug(LOG_VVERB, "  slowlog_max_len: %d", cp->slowlog_max_len);
+        log_debug(LOG_VVERB, "  client_top: %d", cp->client_top);
+        log_debug(LOG_VVERB, "  splice_threshold: %d", cp->splice_threshold);
 
         nserver = array_n(&cp->server);
         log_debug(LOG_VVERB, "  servers: %"PRIu32"", nserver);
@@ -415,8 +635,23 @@ conf_dump(struct conf *cf)
             s = array_get(&cp->server, j);
             log_debug(LOG_VVERB, "    %.*s", s->len, s->data);
         }
+
+        nroute = array_n(&cp->route);
+        log_debug(LOG_VVERB, "  routes: %"PRIu32"", nroute);
+
+        for (j = 0; j < nroute; j++) {
+            cr = array_get(&cp->route, j);
+            log_debug(LOG_VVERB, "    %.*s %.*s", cr->prefix.len,
+                      cr->prefix.data, cr->pool.len, cr->pool.data);
+        }
     }
 }
+#else
+static void
+conf_dump(struct conf *cf)
+{
+}
+#endif
 
 static rstatus_t
 conf_yaml_init(struct conf *cf)
@@ -832,6 +1067,7 @@ conf_parse_global_section(struct conf *cf)
     // init global conf
     cf->global.worker_processes = CONF_UNSET_NUM;
     cf->global.worker_shutdown_timeout = CONF_UNSET_NUM;
+    cf->global.stats_admin_remote = CONF_UNSET_NUM;
     string_init(&cf->global.user);
     string_init(&cf->global.group);
 
@@ -913,6 +1149,10 @@ conf_parse(struct conf *cf)
         cf->global.worker_shutdown_timeout = CONF_DEFAULT_WORKER_SHUTDOWN_TIMEOUT;
     }
 
+    if (cf->global.stats_admin_remote == CONF_UNSET_NUM) {
+        cf->global.stats_admin_remote = CONF_DEFAULT_STATS_ADMIN_REMOTE;
+    }
+
     // get uid
     if (cf->global.user.data == CONF_UNSET_PTR) {
         string_copy(&cf->global.user, (uint8_t *)CONF_DEFAULT_USER, sizeof(CONF_DEFAULT_USER) - 1);
@@ -1244,13 +1484,8 @@ conf_validate_structure(struct conf *cf)
 
         case YAML_MAPPING_END_EVENT:
             if (pools_section && depth == CONF_POOL_MAX_DEPTH) {
-                if (seq) {
-                    seq = false;
-                } else {
-                    error = true;
-                    log_error("conf: '%s' missing sequence directive at depth "
-                                  "%d", cf->fname, depth);
-                }
+                /* sequence is optional, as servers_file: can replace it */
+                seq = false;
             } else if (pools_section && depth == CONF_SECTION_ROOT_DEPTH) {
                 pools_section = false; // "pools" section finish
             } else if (global_section) {
@@ -1280,6 +1515,8 @@ conf_validate_structure(struct conf *cf)
 
         case YAML_SEQUENCE_END_EVENT:
             ASSERT(depth == CONF_POOL_MAX_DEPTH);
+            /* a pool may have both servers: and routes: sequences */
+            seq = false;
             count[depth] = 0;
             break;
 
@@ -1367,6 +1604,14 @@ conf_pool_name_cmp(const void *t1, const void *t2)
     return string_compare(&p1->name, &p2->name);
 }
 
+static int
+conf_route_prefix_cmp(const void *t1, const void *t2)
+{
+    const struct conf_route *r1 = t1, *r2 = t2;
+
+    return string_compare(&r1->prefix, &r2->prefix);
+}
+
 static int
 conf_pool_listen_cmp(const void *t1, const void *t2)
 {
@@ -1416,6 +1661,317 @@ conf_validate_server(struct conf *cf, struct conf_pool *cp)
     return NC_OK;
 }
 
+static struct conf_pool *
+conf_pool_find(struct conf *cf, struct string *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(&cf->pool); i++) {
+        struct conf_pool *cp = array_get(&cf->pool, i);
+
+        if (string_compare(&cp->name, name) == 0) {
+            return cp;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Validate the servers of cp that reference another pool as "@pool:weight".
+ * depth bounds the chain of pools a key can be handed to, through such
+ * references and through the failover: pool, which must not loop.
+ */
+static rstatus_t
+conf_validate_delegate(struct conf *cf, struct conf_pool *cp, uint32_t depth)
+{
+    rstatus_t status;
+    struct conf_pool *target;
+    uint32_t i;
+
+    if (depth > array_n(&cf->pool)) {
+        log_error("conf: pool '%.*s' is part of a loop of pool references "
+                  "and failover pools",
+                  cp->name.len, cp->name.data);
+        return NC_ERROR;
+    }
+
+    for (i = 0; i < array_n(&cp->server); i++) {
+        struct conf_server *cs = array_get(&cp->server, i);
+        struct string name;
+
+        if (cs->addrstr.data[0] != '@') {
+            continue;
+        }
+
+        name.data = cs->addrstr.data + 1;
+        name.len = cs->addrstr.len - 1;
+
+        target = conf_pool_find(cf, &name);
+        if (target == NULL) {
+            log_error("conf: pool '%.*s' has server '%.*s' referencing "
+                      "unknown pool", cp->name.len, cp->name.data,
+                      cs->pname.len, cs->pname.data);
+            return NC_ERROR;
+        }
+
+        if (target->redis != cp->redis) {
+            log_error("conf: pool '%.*s' has server '%.*s' referencing pool "
+                      "of a different protocol", cp->name.len, cp->name.data,
+                      cs->pname.len, cs->pname.data);
+            return NC_ERROR;
+        }
+
+        status = conf_validate_delegate(cf, target, depth + 1);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    /* an unknown failover: pool is reported by conf_validate_failover */
+    if (string_empty(&cp->failover)) {
+        return NC_OK;
+    }
+
+    target = conf_pool_find(cf, &cp->failover);
+    if (target != NULL) {
+        return conf_validate_delegate(cf, target, depth + 1);
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_validate_mirror(struct conf *cf, struct conf_pool *cp)
+{
+    struct conf_pool *target;
+
+    if (string_empty(&cp->mirror)) {
+        return NC_OK;
+    }
+
+    target = conf_pool_find(cf, &cp->mirror);
+    if (target == NULL) {
+        log_error("conf: pool '%.*s' mirrors to unknown pool '%.*s'",
+                  cp->name.len, cp->name.data, cp->mirror.len,
+                  cp->mirror.data);
+        return NC_ERROR;
+    }
+
+    if (target == cp) {
+        log_error("conf: pool '%.*s' mirrors to itself", cp->name.len,
+                  cp->name.data);
+        return NC_ERROR;
+    }
+
+    if (target->redis != cp->redis) {
+        log_error("conf: pool '%.*s' mirrors to pool '%.*s' of a different "
+                  "protocol", cp->name.len, cp->name.data, target->name.len,
+                  target->name.data);
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_validate_fallback(struct conf *cf, struct conf_pool *cp)
+{
+    struct conf_pool *target;
+    struct string name;
+    struct string successor = string(CONF_READ_FALLBACK_SUCCESSOR);
+
+    if (string_empty(&cp->read_fallback)) {
+        return NC_OK;
+    }
+
+    if (string_compare(&cp->read_fallback, &successor) == 0) {
+        if (cp->distribution != DIST_KETAMA) {
+            log_error("conf: pool '%.*s' read fallback to the successor "
+                      "requires the ketama distribution", cp->name.len,
+                      cp->name.data);
+            return NC_ERROR;
+        }
+        return NC_OK;
+    }
+
+    if (cp->read_fallback.data[0] != '@') {
+        log_error("conf: pool '%.*s' read fallback '%.*s' is neither \"%s\" "
+                  "nor \"@pool\"", cp->name.len, cp->name.data,
+                  cp->read_fallback.len, cp->read_fallback.data,
+                  CONF_READ_FALLBACK_SUCCESSOR);
+        return NC_ERROR;
+    }
+
+    name.data = cp->read_fallback.data + 1;
+    name.len = cp->read_fallback.len - 1;
+
+    target = conf_pool_find(cf, &name);
+    if (target == NULL) {
+        log_error("conf: pool '%.*s' falls back to unknown pool '%.*s'",
+                  cp->name.len, cp->name.data, name.len, name.data);
+        return NC_ERROR;
+    }
+
+    if (target == cp) {
+        log_error("conf: pool '%.*s' falls back to itself", cp->name.len,
+                  cp->name.data);
+        return NC_ERROR;
+    }
+
+    if (target->redis != cp->redis) {
+        log_error("conf: pool '%.*s' falls back to pool '%.*s' of a different "
+                  "protocol", cp->name.len, cp->name.data, target->name.len,
+                  target->name.data);
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_validate_failover(struct conf *cf, struct conf_pool *cp)
+{
+    struct conf_pool *target;
+
+    if (string_empty(&cp->failover)) {
+        return NC_OK;
+    }
+
+    if (!cp->auto_eject_hosts) {
+        log_error("conf: pool '%.*s' has a failover pool but does not eject "
+                  "hosts", cp->name.len, cp->name.data);
+        return NC_ERROR;
+    }
+
+    target = conf_pool_find(cf, &cp->failover);
+    if (target == NULL) {
+        log_error("conf: pool '%.*s' fails over to unknown pool '%.*s'",
+                  cp->name.len, cp->name.data, cp->failover.len,
+                  cp->failover.data);
+        return NC_ERROR;
+    }
+
+    if (target == cp) {
+        log_error("conf: pool '%.*s' fails over to itself", cp->name.len,
+                  cp->name.data);
+        return NC_ERROR;
+    }
+
+    if (target->redis != cp->redis) {
+        log_error("conf: pool '%.*s' fails over to pool '%.*s' of a different "
+                  "protocol", cp->name.len, cp->name.data, target->name.len,
+                  target->name.data);
+        return NC_ERROR;
+    }
+
+    if (!string_empty(&target->failover)) {
+        log_error("conf: pool '%.*s' fails over to pool '%.*s' which has a "
+                  "failover pool itself", cp->name.len, cp->name.data,
+                  target->name.len, target->name.data);
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_validate_warmup(struct conf *cf, struct conf_pool *cp)
+{
+    struct conf_pool *target;
+
+    if (string_empty(&cp->warmup)) {
+        return NC_OK;
+    }
+
+    if (!string_empty(&cp->read_fallback)) {
+        log_error("conf: pool '%.*s' has both a warmup pool and a read "
+                  "fallback", cp->name.len, cp->name.data);
+        return NC_ERROR;
+    }
+
+    target = conf_pool_find(cf, &cp->warmup);
+    if (target == NULL) {
+        log_error("conf: pool '%.*s' warms up from unknown pool '%.*s'",
+                  cp->name.len, cp->name.data, cp->warmup.len,
+                  cp->warmup.data);
+        return NC_ERROR;
+    }
+
+    if (target == cp) {
+        log_error("conf: pool '%.*s' warms up from itself", cp->name.len,
+                  cp->name.data);
+        return NC_ERROR;
+    }
+
+    if (target->redis != cp->redis) {
+        log_error("conf: pool '%.*s' warms up from pool '%.*s' of a "
+                  "different protocol", cp->name.len, cp->name.data,
+                  target->name.len, target->name.data);
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_validate_route(struct conf *cf, struct conf_pool *cp)
+{
+    uint32_t i, nroute;
+
+    nroute = array_n(&cp->route);
+    if (nroute == 0) {
+        return NC_OK;
+    }
+
+    for (i = 0; i < nroute; i++) {
+        struct conf_route *cr = array_get(&cp->route, i);
+        struct conf_pool *target;
+
+        target = conf_pool_find(cf, &cr->pool);
+        if (target == NULL) {
+            log_error("conf: pool '%.*s' routes prefix '%.*s' to unknown "
+                      "pool '%.*s'", cp->name.len, cp->name.data,
+                      cr->prefix.len, cr->prefix.data, cr->pool.len,
+                      cr->pool.data);
+            return NC_ERROR;
+        }
+
+        if (target == cp) {
+            log_error("conf: pool '%.*s' routes prefix '%.*s' to itself",
+                      cp->name.len, cp->name.data, cr->prefix.len,
+                      cr->prefix.data);
+            return NC_ERROR;
+        }
+
+        if (target->redis != cp->redis) {
+            log_error("conf: pool '%.*s' routes prefix '%.*s' to pool '%.*s' "
+                      "of a different protocol", cp->name.len, cp->name.data,
+                      cr->prefix.len, cr->prefix.data, target->name.len,
+                      target->name.data);
+            return NC_ERROR;
+        }
+    }
+
+    /* disallow routes with duplicate prefixes */
+    array_sort(&cp->route, conf_route_prefix_cmp);
+    for (i = 0; i < nroute - 1; i++) {
+        struct conf_route *cr1, *cr2;
+
+        cr1 = array_get(&cp->route, i);
+        cr2 = array_get(&cp->route, i + 1);
+
+        if (string_compare(&cr1->prefix, &cr2->prefix) == 0) {
+            log_error("conf: pool '%.*s' has routes with same prefix '%.*s'",
+                      cp->name.len, cp->name.data, cr1->prefix.len,
+                      cr1->prefix.data);
+            return NC_ERROR;
+        }
+    }
+
+    return NC_OK;
+}
+
 static rstatus_t
 conf_validate_pool(struct conf *cf, struct conf_pool *cp)
 {
@@ -1484,31 +2040,177 @@ conf_validate_pool(struct conf *cf, struct conf_pool *cp)
         cp->server_failure_limit = CONF_DEFAULT_SERVER_FAILURE_LIMIT;
     }
 
-    if (!cp->redis && cp->redis_auth.len > 0) {
-        log_error("conf: directive \"redis_auth:\" is only valid for a redis pool");
+    if (cp->mirror_sample == CONF_UNSET_NUM) {
+        cp->mirror_sample = CONF_DEFAULT_MIRROR_SAMPLE;
+    } else if (cp->mirror_sample > 100) {
+        log_error("conf: directive \"mirror_sample:\" must be a percentage");
         return NC_ERROR;
     }
 
-    if (!cp->redis && array_n(&cp->redis_master) > 0) {
-        log_error("conf: directive \"redis_master:\" is only valid for a redis pool");
-        return NC_ERROR;
+    if (cp->mirror_writes_only == CONF_UNSET_NUM) {
+        cp->mirror_writes_only = CONF_DEFAULT_MIRROR_WRITES_ONLY;
     }
 
-    status = conf_validate_server(cf, cp);
-    if (status != NC_OK) {
-        return status;
+    if (cp->migration_window == CONF_UNSET_NUM) {
+        cp->migration_window = CONF_DEFAULT_MIGRATION_WINDOW;
     }
 
-    cp->valid = 1;
+    /* migration_backfill_ttl: stays unset, which disables backfill */
 
-    return NC_OK;
-}
+    if (cp->replicas == CONF_UNSET_NUM) {
+        cp->replicas = CONF_DEFAULT_REPLICAS;
+    } else if (cp->replicas < 1 || cp->replicas > CONF_MAX_REPLICAS) {
+        log_error("conf: directive \"replicas:\" must be between 1 and %d",
+                  CONF_MAX_REPLICAS);
+        return NC_ERROR;
+    } else if (cp->replicas > 1 && cp->distribution != DIST_KETAMA) {
+        log_error("conf: directive \"replicas:\" requires the ketama "
+                  "distribution");
+        return NC_ERROR;
+    }
 
-static rstatus_t
-conf_post_validate(struct conf *cf)
-{
-    rstatus_t status;
-    uint32_t i, npool;
+    if (cp->migration_rate == CONF_UNSET_NUM) {
+        cp->migration_rate = CONF_DEFAULT_MIGRATION_RATE;
+    } else if (cp->migration_rate < 0) {
+        log_error("conf: directive \"migration_rate:\" must not be negative");
+        return NC_ERROR;
+    } else if (cp->migration_rate > 0) {
+        if (!cp->redis) {
+            log_error("conf: directive \"migration_rate:\" is only valid for "
+                      "a redis pool");
+            return NC_ERROR;
+        }
+        if (cp->migration_window <= 0) {
+            log_error("conf: directive \"migration_rate:\" requires a "
+                      "\"migration_window:\"");
+            return NC_ERROR;
+        }
+        if (cp->replicas > 1 || cp->distribution == DIST_RANDOM) {
+            log_error("conf: directive \"migration_rate:\" requires keys "
+                      "with a single owner");
+            return NC_ERROR;
+        }
+    }
+
+    if (cp->warmup_ttl == CONF_UNSET_NUM) {
+        cp->warmup_ttl = CONF_DEFAULT_WARMUP_TTL;
+    } else if (cp->warmup_ttl < 0) {
+        log_error("conf: directive \"warmup_ttl:\" must not be negative");
+        return NC_ERROR;
+    }
+
+    if (cp->distinct_keys_window == CONF_UNSET_NUM) {
+        cp->distinct_keys_window = CONF_DEFAULT_DISTINCT_KEYS_WINDOW;
+    } else if (cp->distinct_keys_window < 0) {
+        log_error("conf: directive \"distinct_keys_window:\" must not be "
+                  "negative");
+        return NC_ERROR;
+    }
+
+    if (!string_empty(&cp->namespace)) {
+        struct string hash_tag = string(CONF_NAMESPACE_HASH_TAG);
+
+        if (string_compare(&cp->namespace, &hash_tag) == 0) {
+            if (string_empty(&cp->hash_tag)) {
+                log_error("conf: directive \"namespace: %s\" requires a "
+                          "\"hash_tag:\"", CONF_NAMESPACE_HASH_TAG);
+                return NC_ERROR;
+            }
+        } else if (cp->namespace.len != 1) {
+            log_error("conf: directive \"namespace:\" must be a single "
+                      "delimiter character or \"%s\"",
+                      CONF_NAMESPACE_HASH_TAG);
+            return NC_ERROR;
+        }
+    }
+
+    if (cp->namespace_top == CONF_UNSET_NUM) {
+        cp->namespace_top = CONF_DEFAULT_NAMESPACE_TOP;
+    } else if (cp->namespace_top <= 0 ||
+               cp->namespace_top > CONF_MAX_NAMESPACE_TOP) {
+        log_error("conf: directive \"namespace_top:\" must be between 1 and "
+                  "%d", CONF_MAX_NAMESPACE_TOP);
+        return NC_ERROR;
+    } else if (string_empty(&cp->namespace)) {
+        log_error("conf: directive \"namespace_top:\" requires a "
+                  "\"namespace:\"");
+        return NC_ERROR;
+    }
+
+    if (cp->slowlog_max_len == CONF_UNSET_NUM) {
+        cp->slowlog_max_len = CONF_DEFAULT_SLOWLOG_MAX_LEN;
+    } else if (cp->slowlog_max_len <= 0 ||
+               cp->slowlog_max_len > CONF_MAX_SLOWLOG_MAX_LEN) {
+        log_error("conf: directive \"slowlog_max_len:\" must be between 1 "
+                  "and %d", CONF_MAX_SLOWLOG_MAX_LEN);
+        return NC_ERROR;
+    } else if (cp->slowlog_slower_than == CONF_UNSET_NUM) {
+        log_error("conf: directive \"slowlog_max_len:\" requires a "
+                  "\"slowlog_slower_than:\"");
+        return NC_ERROR;
+    }
+
+    if (cp->client_top == CONF_UNSET_NUM) {
+        cp->client_top = CONF_DEFAULT_CLIENT_TOP;
+    } else if (cp->client_top > CONF_MAX_CLIENT_TOP) {
+        log_error("conf: directive \"client_top:\" must be at most %d",
+                  CONF_MAX_CLIENT_TOP);
+        return NC_ERROR;
+    }
+
+    if (cp->splice_threshold == CONF_UNSET_NUM) {
+        cp->splice_threshold = CONF_DEFAULT_SPLICE_THRESHOLD;
+    } else if (cp->splice_threshold > 0 && !cp->redis) {
+        log_error("conf: directive \"splice_threshold:\" is only valid for a "
+                  "redis pool");
+        return NC_ERROR;
+    }
+#ifndef NC_HAVE_SPLICE
+    if (cp->splice_threshold > 0) {
+        log_error("conf: directive \"splice_threshold:\" needs splice(), which "
+                  "is not available on this platform");
+        return NC_ERROR;
+    }
+#endif
+
+    if (!cp->redis && cp->redis_auth.len > 0) {
+        log_error("conf: directive \"redis_auth:\" is only valid for a redis pool");
+        return NC_ERROR;
+    }
+
+    if (!cp->redis && array_n(&cp->redis_master) > 0) {
+        log_error("conf: directive \"redis_master:\" is only valid for a redis pool");
+        return NC_ERROR;
+    }
+
+    if (!string_empty(&cp->servers_file)) {
+        if (array_n(&cp->server) != 0) {
+            log_error("conf: directives \"servers:\" and \"servers_file:\" "
+                      "are mutually exclusive");
+            return NC_ERROR;
+        }
+
+        status = conf_read_servers(&cp->servers_file, &cp->server);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    status = conf_validate_server(cf, cp);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    cp->valid = 1;
+
+    return NC_OK;
+}
+
+static rstatus_t
+conf_post_validate(struct conf *cf)
+{
+    rstatus_t status;
+    uint32_t i, npool;
     bool valid;
 
     ASSERT(cf->sound && cf->parsed);
@@ -1570,6 +2272,41 @@ conf_post_validate(struct conf *cf)
         return NC_ERROR;
     }
 
+    /* validate routes and pool references, once all pools are known */
+    for (i = 0; i < npool; i++) {
+        struct conf_pool *cp = array_get(&cf->pool, i);
+
+        status = conf_validate_route(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = conf_validate_delegate(cf, cp, 0);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = conf_validate_mirror(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = conf_validate_fallback(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = conf_validate_failover(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = conf_validate_warmup(cf, cp);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
     return NC_OK;
 }
 
@@ -1771,7 +2508,10 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
 
     value = array_top(&cf->arg);
 
-    /* parse "hostname:port:weight [name]" or "/path/unix_socket:weight [name]" from the end */
+    /*
+     * parse "hostname:port:weight [name]", "/path/unix_socket:weight [name]"
+     * or "@pool:weight [name]" from the end
+     */
     p = value->data + value->len - 1;
     start = value->data;
     addr = NULL;
@@ -1783,7 +2523,7 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
     name = NULL;
     namelen = 0;
 
-    delimlen = value->data[0] == '/' ? 2 : 3;
+    delimlen = (value->data[0] == '/' || value->data[0] == '@') ? 2 : 3;
 
     for (k = 0; k < sizeof(delim); k++) {
         q = nc_strrchr(p, start, delim[k]);
@@ -1842,7 +2582,7 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
         return "has a zero weight in \"hostname:port:weight [name]\" format string";
     }
 
-    if (value->data[0] != '/') {
+    if (value->data[0] != '/' && value->data[0] != '@') {
         field->port = nc_atoi(port, portlen);
         if (field->port < 0 || !nc_valid_port(field->port)) {
             return "has an invalid port in \"hostname:port:weight [name]\" format string";
@@ -1899,6 +2639,174 @@ conf_add_server(struct conf *cf, struct command *cmd, void *conf)
     return CONF_OK;
 }
 
+char *
+conf_add_route(struct conf *cf, struct command *cmd, void *conf)
+{
+    rstatus_t status;
+    struct array *a;
+    struct string *value;
+    struct conf_route *field;
+    uint8_t *p, *q;
+
+    p = conf;
+    a = (struct array *)(p + cmd->offset);
+
+    value = array_top(&cf->arg);
+
+    /* parse "prefix pool" from the end */
+    p = value->data + value->len - 1;
+    q = nc_strrchr(p, value->data, ' ');
+    if (q == NULL || q == value->data || q == p) {
+        return "has an invalid \"prefix pool\" format string";
+    }
+
+    field = array_push(a);
+    if (field == NULL) {
+        return CONF_ERROR;
+    }
+
+    string_init(&field->prefix);
+    string_init(&field->pool);
+
+    status = string_copy(&field->prefix, value->data,
+                         (uint32_t)(q - value->data));
+    if (status != NC_OK) {
+        return CONF_ERROR;
+    }
+
+    status = string_copy(&field->pool, q + 1, (uint32_t)(p - q));
+    if (status != NC_OK) {
+        return CONF_ERROR;
+    }
+
+    return CONF_OK;
+}
+
+/*
+ * Parse a "hostname:port:weight [name]" or "/path/unix_socket:weight [name]"
+ * server line of len bytes into server (conf_server[]), like an item of
+ * servers:. Returns CONF_OK on success, otherwise the reason of failure.
+ */
+char *
+conf_parse_server(struct array *server, uint8_t *line, uint32_t len)
+{
+    rstatus_t status;
+    struct conf cf;
+    struct conf_pool cp;
+    struct string *value;
+    char *err;
+
+    memset(&cf, 0, sizeof(cf));
+    memset(&cp, 0, sizeof(cp));
+
+    status = array_init(&cf.arg, CONF_DEFAULT_ARGS, sizeof(struct string));
+    if (status != NC_OK) {
+        return CONF_ERROR;
+    }
+
+    status = array_init(&cp.redis_master, 1, sizeof(struct conf_server));
+    if (status != NC_OK) {
+        array_deinit(&cf.arg);
+        return CONF_ERROR;
+    }
+
+    /* conf_add_server() pushes into cp.server, which may grow it */
+    cp.server = *server;
+
+    err = CONF_ERROR;
+
+    value = array_push(&cf.arg);
+    if (value != NULL) {
+        string_init(value);
+        if (string_copy(value, line, len) == NC_OK) {
+            err = conf_add_server(&cf, NULL, &cp);
+        }
+        string_deinit(array_pop(&cf.arg));
+    }
+
+    if (err == CONF_OK && array_n(&cp.redis_master) != 0) {
+        err = "cannot name a redis master";
+    }
+
+    *server = cp.server;
+
+    while (array_n(&cp.redis_master) != 0) {
+        conf_server_deinit(array_pop(&cp.redis_master));
+    }
+    array_deinit(&cp.redis_master);
+    array_deinit(&cf.arg);
+
+    return err;
+}
+
+/*
+ * Read servers from a servers_file: into server (conf_server[]). The file
+ * has one "hostname:port:weight [name]" or "/path/unix_socket:weight [name]"
+ * server per line, like the items of servers:. Blank lines and lines
+ * starting with '#' are ignored.
+ */
+rstatus_t
+conf_read_servers(struct string *filename, struct array *server)
+{
+    rstatus_t status;
+    FILE *fh;
+    char line[NC_MAXHOSTNAMELEN + 256], *p;
+    size_t len;
+    uint32_t lineno;
+    char *err;
+
+    fh = fopen((char *)filename->data, "r");
+    if (fh == NULL) {
+        log_error("conf: failed to open servers file '%.*s': %s",
+                  filename->len, filename->data, strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = NC_OK;
+
+    for (lineno = 1; fgets(line, sizeof(line), fh) != NULL; lineno++) {
+        p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+
+        len = strlen(p);
+        while (len > 0 && isspace((unsigned char)p[len - 1])) {
+            len--;
+        }
+
+        if (len == 0 || *p == '#') {
+            continue;
+        }
+
+        err = conf_parse_server(server, (uint8_t *)p, (uint32_t)len);
+        if (err != CONF_OK) {
+            log_error("conf: servers file '%.*s' line %"PRIu32" %s",
+                      filename->len, filename->data, lineno, err);
+            status = NC_ERROR;
+            break;
+        }
+    }
+
+    if (status == NC_OK && ferror(fh)) {
+        log_error("conf: failed to read servers file '%.*s': %s",
+                  filename->len, filename->data, strerror(errno));
+        status = NC_ERROR;
+    }
+
+    fclose(fh);
+
+    return status;
+}
+
+void
+conf_free_servers(struct array *server)
+{
+    while (array_n(server) != 0) {
+        conf_server_deinit(array_pop(server));
+    }
+}
+
 char *
 conf_set_num(struct conf *cf, struct command *cmd, void *conf)
 {
@@ -2039,3 +2947,619 @@ conf_set_hashtag(struct conf *cf, struct command *cmd, void *conf)
 
     return CONF_OK;
 }
+
+/*
+ * A conf snapshot is the validated configuration, with listen addresses
+ * resolved, serialized into a flat binary file next to the yaml file. It
+ * is tied to the size, mtime and inode of the yaml file it was compiled
+ * from, so that an edit of the yaml file makes the snapshot stale.
+ */
+struct conf_snapshot {
+    uint8_t *data; /* snapshot data */
+    size_t  len;   /* snapshot length */
+    size_t  size;  /* snapshot alloc size */
+    bool    err;   /* overflow or alloc failure? */
+};
+
+static void
+conf_snapshot_put(struct conf_snapshot *sn, const void *src, size_t len)
+{
+    if (sn->err) {
+        return;
+    }
+
+    if (sn->len + len > sn->size) {
+        size_t size = MAX(sn->size * 2, sn->len + len);
+        uint8_t *data;
+
+        data = nc_realloc(sn->data, size);
+        if (data == NULL) {
+            sn->err = true;
+            return;
+        }
+        sn->data = data;
+        sn->size = size;
+    }
+
+    nc_memcpy(sn->data + sn->len, src, len);
+    sn->len += len;
+}
+
+static void
+conf_snapshot_put_num(struct conf_snapshot *sn, int64_t num)
+{
+    conf_snapshot_put(sn, &num, sizeof(num));
+}
+
+static void
+conf_snapshot_put_string(struct conf_snapshot *sn, struct string *str)
+{
+    conf_snapshot_put_num(sn, str->len);
+    conf_snapshot_put(sn, str->data, str->len);
+}
+
+static void
+conf_snapshot_get(struct conf_snapshot *sn, void *dst, size_t len)
+{
+    if (sn->err || sn->len + len > sn->size) {
+        sn->err = true;
+        memset(dst, 0, len);
+        return;
+    }
+
+    nc_memcpy(dst, sn->data + sn->len, len);
+    sn->len += len;
+}
+
+static int64_t
+conf_snapshot_get_num(struct conf_snapshot *sn)
+{
+    int64_t num;
+
+    conf_snapshot_get(sn, &num, sizeof(num));
+
+    return num;
+}
+
+static void
+conf_snapshot_get_string(struct conf_snapshot *sn, struct string *str)
+{
+    int64_t len;
+
+    string_deinit(str);
+
+    len = conf_snapshot_get_num(sn);
+    if (sn->err || len < 0 || (size_t)len > sn->size - sn->len) {
+        sn->err = true;
+        return;
+    }
+
+    if (len == 0) {
+        return;
+    }
+
+    if (string_copy(str, sn->data + sn->len, (uint32_t)len) != NC_OK) {
+        sn->err = true;
+        return;
+    }
+    sn->len += (size_t)len;
+}
+
+static void
+conf_snapshot_put_servers(struct conf_snapshot *sn, struct array *server)
+{
+    uint32_t i;
+
+    conf_snapshot_put_num(sn, array_n(server));
+
+    for (i = 0; i < array_n(server); i++) {
+        struct conf_server *cs = array_get(server, i);
+
+        conf_snapshot_put_string(sn, &cs->pname);
+        conf_snapshot_put_string(sn, &cs->name);
+        conf_snapshot_put_string(sn, &cs->addrstr);
+        conf_snapshot_put_num(sn, cs->port);
+        conf_snapshot_put_num(sn, cs->weight);
+        conf_snapshot_put(sn, &cs->info, sizeof(cs->info));
+    }
+}
+
+static void
+conf_snapshot_get_servers(struct conf_snapshot *sn, struct array *server)
+{
+    int64_t i, nserver;
+
+    nserver = conf_snapshot_get_num(sn);
+    if (nserver < 0 || nserver > UINT32_MAX) {
+        sn->err = true;
+        return;
+    }
+
+    for (i = 0; i < nserver && !sn->err; i++) {
+        struct conf_server *cs = array_push(server);
+
+        if (cs == NULL) {
+            sn->err = true;
+            return;
+        }
+        conf_server_init(cs);
+
+        conf_snapshot_get_string(sn, &cs->pname);
+        conf_snapshot_get_string(sn, &cs->name);
+        conf_snapshot_get_string(sn, &cs->addrstr);
+        cs->port = (int)conf_snapshot_get_num(sn);
+        cs->weight = (int)conf_snapshot_get_num(sn);
+        conf_snapshot_get(sn, &cs->info, sizeof(cs->info));
+        cs->valid = 1;
+    }
+}
+
+static void
+conf_snapshot_put_routes(struct conf_snapshot *sn, struct array *route)
+{
+    uint32_t i;
+
+    conf_snapshot_put_num(sn, array_n(route));
+
+    for (i = 0; i < array_n(route); i++) {
+        struct conf_route *cr = array_get(route, i);
+
+        conf_snapshot_put_string(sn, &cr->prefix);
+        conf_snapshot_put_string(sn, &cr->pool);
+    }
+}
+
+static void
+conf_snapshot_get_routes(struct conf_snapshot *sn, struct array *route)
+{
+    int64_t i, nroute;
+
+    nroute = conf_snapshot_get_num(sn);
+    if (nroute < 0 || nroute > UINT32_MAX) {
+        sn->err = true;
+        return;
+    }
+
+    for (i = 0; i < nroute && !sn->err; i++) {
+        struct conf_route *cr = array_push(route);
+
+        if (cr == NULL) {
+            sn->err = true;
+            return;
+        }
+        string_init(&cr->prefix);
+        string_init(&cr->pool);
+
+        conf_snapshot_get_string(sn, &cr->prefix);
+        conf_snapshot_get_string(sn, &cr->pool);
+    }
+}
+
+static void
+conf_snapshot_put_pool(struct conf_snapshot *sn, struct conf_pool *cp)
+{
+    conf_snapshot_put_string(sn, &cp->name);
+
+    conf_snapshot_put_string(sn, &cp->listen.pname);
+    conf_snapshot_put_string(sn, &cp->listen.name);
+    conf_snapshot_put_num(sn, cp->listen.port);
+    conf_snapshot_put_num(sn, cp->listen.perm);
+    conf_snapshot_put(sn, &cp->listen.info, sizeof(cp->listen.info));
+
+    conf_snapshot_put_num(sn, cp->hash);
+    conf_snapshot_put_string(sn, &cp->hash_tag);
+    conf_snapshot_put_num(sn, cp->distribution);
+    conf_snapshot_put_num(sn, cp->timeout);
+    conf_snapshot_put_num(sn, cp->backlog);
+    conf_snapshot_put_num(sn, cp->client_connections);
+    conf_snapshot_put_num(sn, cp->tcpkeepalive);
+    conf_snapshot_put_num(sn, cp->redis);
+    conf_snapshot_put_string(sn, &cp->redis_auth);
+    conf_snapshot_put_num(sn, cp->redis_db);
+    conf_snapshot_put_num(sn, cp->preconnect);
+    conf_snapshot_put_num(sn, cp->auto_eject_hosts);
+    conf_snapshot_put_num(sn, cp->server_connections);
+    conf_snapshot_put_num(sn, cp->server_retry_timeout);
+    conf_snapshot_put_num(sn, cp->server_failure_limit);
+
+    conf_snapshot_put_servers(sn, &cp->server);
+    conf_snapshot_put_servers(sn, &cp->redis_master);
+
+    conf_snapshot_put_routes(sn, &cp->route);
+    conf_snapshot_put_string(sn, &cp->mirror);
+    conf_snapshot_put_num(sn, cp->mirror_sample);
+    conf_snapshot_put_num(sn, cp->mirror_writes_only);
+    conf_snapshot_put_num(sn, cp->migration_window);
+    conf_snapshot_put_num(sn, cp->migration_backfill_ttl);
+    conf_snapshot_put_num(sn, cp->migration_rate);
+    conf_snapshot_put_num(sn, cp->replicas);
+    conf_snapshot_put_string(sn, &cp->read_fallback);
+    conf_snapshot_put_string(sn, &cp->failover);
+    conf_snapshot_put_string(sn, &cp->warmup);
+    conf_snapshot_put_num(sn, cp->warmup_ttl);
+    conf_snapshot_put_num(sn, cp->distinct_keys_window);
+    conf_snapshot_put_string(sn, &cp->namespace);
+    conf_snapshot_put_num(sn, cp->namespace_top);
+    conf_snapshot_put_num(sn, cp->slowlog_slower_than);
+    conf_snapshot_put_num(sn, cp->slowlog_max_len);
+    conf_snapshot_put_num(sn, cp->client_top);
+    conf_snapshot_put_num(sn, cp->splice_threshold);
+
+    conf_snapshot_put_string(sn, &cp->servers_file);
+    if (!string_empty(&cp->servers_file)) {
+        struct stat st;
+
+        if (stat((char *)cp->servers_file.data, &st) < 0) {
+            memset(&st, 0, sizeof(st));
+        }
+        conf_snapshot_put_num(sn, (int64_t)st.st_size);
+        conf_snapshot_put_num(sn, (int64_t)st.st_mtime);
+        conf_snapshot_put_num(sn, (int64_t)st.st_ino);
+    }
+}
+
+static rstatus_t
+conf_snapshot_get_pool(struct conf_snapshot *sn, struct conf *cf)
+{
+    rstatus_t status;
+    struct conf_pool *cp;
+    struct string name;
+
+    string_init(&name);
+    conf_snapshot_get_string(sn, &name);
+    if (sn->err) {
+        return NC_ERROR;
+    }
+
+    cp = array_push(&cf->pool);
+    if (cp == NULL) {
+        string_deinit(&name);
+        return NC_ENOMEM;
+    }
+
+    status = conf_pool_init(cp, &name);
+    string_deinit(&name);
+    if (status != NC_OK) {
+        array_pop(&cf->pool);
+        return status;
+    }
+
+    conf_snapshot_get_string(sn, &cp->listen.pname);
+    conf_snapshot_get_string(sn, &cp->listen.name);
+    cp->listen.port = (int)conf_snapshot_get_num(sn);
+    cp->listen.perm = (mode_t)conf_snapshot_get_num(sn);
+    conf_snapshot_get(sn, &cp->listen.info, sizeof(cp->listen.info));
+    cp->listen.valid = 1;
+
+    cp->hash = (hash_type_t)conf_snapshot_get_num(sn);
+    conf_snapshot_get_string(sn, &cp->hash_tag);
+    cp->distribution = (dist_type_t)conf_snapshot_get_num(sn);
+    cp->timeout = (int)conf_snapshot_get_num(sn);
+    cp->backlog = (int)conf_snapshot_get_num(sn);
+    cp->client_connections = (int)conf_snapshot_get_num(sn);
+    cp->tcpkeepalive = (int)conf_snapshot_get_num(sn);
+    cp->redis = (int)conf_snapshot_get_num(sn);
+    conf_snapshot_get_string(sn, &cp->redis_auth);
+    cp->redis_db = (int)conf_snapshot_get_num(sn);
+    cp->preconnect = (int)conf_snapshot_get_num(sn);
+    cp->auto_eject_hosts = (int)conf_snapshot_get_num(sn);
+    cp->server_connections = (int)conf_snapshot_get_num(sn);
+    cp->server_retry_timeout = (int)conf_snapshot_get_num(sn);
+    cp->server_failure_limit = (int)conf_snapshot_get_num(sn);
+
+    conf_snapshot_get_servers(sn, &cp->server);
+    conf_snapshot_get_servers(sn, &cp->redis_master);
+
+    conf_snapshot_get_routes(sn, &cp->route);
+    conf_snapshot_get_string(sn, &cp->mirror);
+    cp->mirror_sample = (int)conf_snapshot_get_num(sn);
+    cp->mirror_writes_only = (int)conf_snapshot_get_num(sn);
+    cp->migration_window = (int)conf_snapshot_get_num(sn);
+    cp->migration_backfill_ttl = (int)conf_snapshot_get_num(sn);
+    cp->migration_rate = (int)conf_snapshot_get_num(sn);
+    cp->replicas = (int)conf_snapshot_get_num(sn);
+    conf_snapshot_get_string(sn, &cp->read_fallback);
+    conf_snapshot_get_string(sn, &cp->failover);
+    conf_snapshot_get_string(sn, &cp->warmup);
+    cp->warmup_ttl = (int)conf_snapshot_get_num(sn);
+    cp->distinct_keys_window = (int)conf_snapshot_get_num(sn);
+    conf_snapshot_get_string(sn, &cp->namespace);
+    cp->namespace_top = (int)conf_snapshot_get_num(sn);
+    cp->slowlog_slower_than = (int)conf_snapshot_get_num(sn);
+    cp->slowlog_max_len = (int)conf_snapshot_get_num(sn);
+    cp->client_top = (int)conf_snapshot_get_num(sn);
+    cp->splice_threshold = (int)conf_snapshot_get_num(sn);
+
+    /* servers read from a servers_file: are stale once the file changes */
+    conf_snapshot_get_string(sn, &cp->servers_file);
+    if (!sn->err && !string_empty(&cp->servers_file)) {
+        struct stat st;
+        int64_t size, mtime, ino;
+
+        size = conf_snapshot_get_num(sn);
+        mtime = conf_snapshot_get_num(sn);
+        ino = conf_snapshot_get_num(sn);
+
+        if (stat((char *)cp->servers_file.data, &st) < 0 ||
+            size != (int64_t)st.st_size || mtime != (int64_t)st.st_mtime ||
+            ino != (int64_t)st.st_ino) {
+            log_debug(LOG_INFO, "conf snapshot servers file '%.*s' is stale",
+                      cp->servers_file.len, cp->servers_file.data);
+            return NC_ERROR;
+        }
+    }
+
+    if (sn->err) {
+        return NC_ERROR;
+    }
+
+    if (cp->hash < 0 || cp->hash >= HASH_SENTINEL ||
+        cp->distribution < 0 || cp->distribution >= DIST_SENTINEL) {
+        return NC_ERROR;
+    }
+
+    cp->valid = 1;
+
+    return NC_OK;
+}
+
+static void
+conf_snapshot_put_header(struct conf_snapshot *sn, struct stat *st)
+{
+    conf_snapshot_put(sn, CONF_SNAPSHOT_MAGIC, sizeof(CONF_SNAPSHOT_MAGIC));
+    conf_snapshot_put_num(sn, CONF_SNAPSHOT_VERSION);
+    conf_snapshot_put_num(sn, (int64_t)st->st_size);
+    conf_snapshot_put_num(sn, (int64_t)st->st_mtime);
+    conf_snapshot_put_num(sn, (int64_t)st->st_ino);
+}
+
+/*
+ * Returns true if the snapshot header matches this build and the yaml file
+ * it was compiled from, otherwise returns false
+ */
+static bool
+conf_snapshot_get_header(struct conf_snapshot *sn, struct stat *st)
+{
+    char magic[sizeof(CONF_SNAPSHOT_MAGIC)];
+
+    conf_snapshot_get(sn, magic, sizeof(magic));
+    if (sn->err || memcmp(magic, CONF_SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+        return false;
+    }
+
+    if (conf_snapshot_get_num(sn) != CONF_SNAPSHOT_VERSION) {
+        return false;
+    }
+
+    if (conf_snapshot_get_num(sn) != (int64_t)st->st_size ||
+        conf_snapshot_get_num(sn) != (int64_t)st->st_mtime ||
+        conf_snapshot_get_num(sn) != (int64_t)st->st_ino) {
+        return false;
+    }
+
+    return !sn->err;
+}
+
+static void
+conf_snapshot_name(char *dst, size_t size, char *filename)
+{
+    nc_snprintf(dst, size, "%s%s", filename, CONF_SNAPSHOT_SUFFIX);
+}
+
+/*
+ * Compile the yaml configuration file into a snapshot that is loaded
+ * instead of the yaml file as long as the yaml file is unchanged
+ */
+rstatus_t
+conf_compile(char *filename)
+{
+    rstatus_t status;
+    struct conf *cf;
+    struct conf_snapshot sn;
+    struct stat st;
+    char name[PATH_MAX], tmpname[PATH_MAX + NC_UINTMAX_MAXLEN];
+    uint32_t i;
+    ssize_t n;
+    int fd;
+
+    cf = conf_create(filename);
+    if (cf == NULL) {
+        return NC_ERROR;
+    }
+
+    status = stat(filename, &st);
+    if (status < 0) {
+        log_error("conf: failed to stat configuration '%s': %s", filename,
+                  strerror(errno));
+        conf_destroy(cf);
+        return NC_ERROR;
+    }
+
+    sn.data = NULL;
+    sn.len = 0;
+    sn.size = 0;
+    sn.err = false;
+
+    conf_snapshot_put_header(&sn, &st);
+
+    conf_snapshot_put_num(&sn, cf->global.worker_processes);
+    conf_snapshot_put_num(&sn, cf->global.worker_shutdown_timeout);
+    conf_snapshot_put_num(&sn, cf->global.stats_admin_remote);
+    conf_snapshot_put_string(&sn, &cf->global.user);
+    conf_snapshot_put_string(&sn, &cf->global.group);
+    conf_snapshot_put_num(&sn, cf->global.uid);
+    conf_snapshot_put_num(&sn, cf->global.gid);
+
+    conf_snapshot_put_num(&sn, array_n(&cf->pool));
+    for (i = 0; i < array_n(&cf->pool); i++) {
+        conf_snapshot_put_pool(&sn, array_get(&cf->pool, i));
+    }
+
+    conf_destroy(cf);
+
+    if (sn.err) {
+        log_error("conf: failed to compile '%s': %s", filename,
+                  strerror(ENOMEM));
+        if (sn.data != NULL) {
+            nc_free(sn.data);
+        }
+        return NC_ENOMEM;
+    }
+
+    conf_snapshot_name(name, sizeof(name), filename);
+    nc_snprintf(tmpname, sizeof(tmpname), "%s.%d", name, (int)getpid());
+
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_error("conf: failed to open '%s': %s", tmpname, strerror(errno));
+        nc_free(sn.data);
+        return NC_ERROR;
+    }
+
+    n = nc_write(fd, sn.data, sn.len);
+    close(fd);
+    nc_free(sn.data);
+
+    if (n < 0 || (size_t)n != sn.len) {
+        log_error("conf: failed to write '%s': %s", tmpname, strerror(errno));
+        unlink(tmpname);
+        return NC_ERROR;
+    }
+
+    /* replace atomically, so that a concurrent load never sees half */
+    status = rename(tmpname, name);
+    if (status < 0) {
+        log_error("conf: failed to rename '%s' to '%s': %s", tmpname, name,
+                  strerror(errno));
+        unlink(tmpname);
+        return NC_ERROR;
+    }
+
+    log_stderr("nutcracker: configuration file '%s' compiled to '%s'",
+               filename, name);
+
+    return NC_OK;
+}
+
+/*
+ * Load configuration from the snapshot compiled from filename. Returns
+ * NULL if there is no snapshot, or if it is stale or corrupt
+ */
+static struct conf *
+conf_load_snapshot(char *filename)
+{
+    rstatus_t status;
+    struct conf *cf;
+    struct conf_snapshot sn;
+    struct stat st, snst;
+    char name[PATH_MAX];
+    int64_t i, npool;
+    void *addr;
+    int fd;
+
+    conf_snapshot_name(name, sizeof(name), filename);
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (stat(filename, &st) < 0 || fstat(fd, &snst) < 0 ||
+        snst.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    addr = mmap(NULL, (size_t)snst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        log_warn("conf: failed to mmap '%s': %s", name, strerror(errno));
+        return NULL;
+    }
+
+    sn.data = addr;
+    sn.len = 0;
+    sn.size = (size_t)snst.st_size;
+    sn.err = false;
+
+    cf = NULL;
+
+    if (!conf_snapshot_get_header(&sn, &st)) {
+        log_warn("conf: snapshot '%s' is stale, loading '%s'", name, filename);
+        goto done;
+    }
+
+    cf = nc_zalloc(sizeof(*cf));
+    if (cf == NULL) {
+        goto done;
+    }
+
+    status = array_init(&cf->arg, CONF_DEFAULT_ARGS, sizeof(struct string));
+    if (status != NC_OK) {
+        nc_free(cf);
+        cf = NULL;
+        goto done;
+    }
+
+    status = array_init(&cf->pool, CONF_DEFAULT_POOL, sizeof(struct conf_pool));
+    if (status != NC_OK) {
+        array_deinit(&cf->arg);
+        nc_free(cf);
+        cf = NULL;
+        goto done;
+    }
+
+    cf->fname = filename;
+    cf->fh = NULL;
+
+    cf->global.worker_processes = (int)conf_snapshot_get_num(&sn);
+    cf->global.worker_shutdown_timeout = (int)conf_snapshot_get_num(&sn);
+    cf->global.stats_admin_remote = (int)conf_snapshot_get_num(&sn);
+    conf_snapshot_get_string(&sn, &cf->global.user);
+    conf_snapshot_get_string(&sn, &cf->global.group);
+    cf->global.uid = (uid_t)conf_snapshot_get_num(&sn);
+    cf->global.gid = (gid_t)conf_snapshot_get_num(&sn);
+
+    npool = conf_snapshot_get_num(&sn);
+    for (i = 0; i < npool && !sn.err; i++) {
+        status = conf_snapshot_get_pool(&sn, cf);
+        if (status != NC_OK) {
+            sn.err = true;
+        }
+    }
+
+    if (sn.err || npool == 0 || sn.len != sn.size) {
+        log_warn("conf: snapshot '%s' is corrupt, loading '%s'", name,
+                 filename);
+        conf_destroy(cf);
+        cf = NULL;
+        goto done;
+    }
+
+    cf->sound = 1;
+    cf->parsed = 1;
+
+    log_debug(LOG_NOTICE, "conf: loaded %"PRId64" pools from snapshot '%s'",
+              npool, name);
+
+done:
+    munmap(addr, (size_t)snst.st_size);
+    return cf;
+}
+
+/*
+ * Load configuration from its compiled snapshot if there is a fresh one,
+ * otherwise from the yaml configuration file
+ */
+struct conf *
+conf_load(char *filename)
+{
+    struct conf *cf;
+
+    cf = conf_load_snapshot(filename);
+    if (cf != NULL) {
+        return cf;
+    }
+
+    return conf_create(filename);
+}
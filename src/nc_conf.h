@@ -36,6 +36,7 @@
 #define CONF_DEFAULT_ARGS       3
 #define CONF_DEFAULT_POOL       8
 #define CONF_DEFAULT_SERVERS    8
+#define CONF_DEFAULT_ROUTES     4
 
 #define CONF_UNSET_NUM  -1
 #define CONF_UNSET_PTR  NULL
@@ -56,10 +57,32 @@
 #define CONF_DEFAULT_SERVER_CONNECTIONS      1
 #define CONF_DEFAULT_KETAMA_PORT             11211
 #define CONF_DEFAULT_TCPKEEPALIVE            false
+#define CONF_DEFAULT_MIRROR_SAMPLE           100            /* in percent */
+#define CONF_DEFAULT_MIRROR_WRITES_ONLY      false
+#define CONF_DEFAULT_MIGRATION_WINDOW        0              /* in msec */
+#define CONF_DEFAULT_MIGRATION_RATE          0              /* in keys per sec, no move */
+#define CONF_DEFAULT_REPLICAS                1
+#define CONF_MAX_REPLICAS                    8
+#define CONF_READ_FALLBACK_SUCCESSOR         "successor"
+#define CONF_NAMESPACE_HASH_TAG              "hash_tag"
+#define CONF_DEFAULT_WARMUP_TTL              0              /* in sec, no expiry */
+#define CONF_DEFAULT_DISTINCT_KEYS_WINDOW    0              /* in sec, no estimate */
+#define CONF_DEFAULT_NAMESPACE_TOP           64
+#define CONF_MAX_NAMESPACE_TOP               1024
+#define CONF_DEFAULT_SLOWLOG_MAX_LEN         128
+#define CONF_MAX_SLOWLOG_MAX_LEN             4096
+#define CONF_DEFAULT_CLIENT_TOP              0              /* no tracking */
+#define CONF_MAX_CLIENT_TOP                  1024
+#define CONF_DEFAULT_SPLICE_THRESHOLD        0              /* no splice */
 #define CONF_DEFAULT_WORKER_SHUTDOWN_TIMEOUT 30
+#define CONF_DEFAULT_STATS_ADMIN_REMOTE      false          /* loopback only */
 #define CONF_DEFAULT_USER                    "nobody"
 #define CONF_DEFAULT_GROUP                   "nobody"
 
+#define CONF_SNAPSHOT_MAGIC     "NCCONF\0"  /* conf snapshot magic */
+#define CONF_SNAPSHOT_VERSION   16          /* conf snapshot format version */
+#define CONF_SNAPSHOT_SUFFIX    ".bin"      /* conf snapshot file suffix */
+
 struct conf_listen {
     struct string   pname;   /* listen: as "hostname:port" */
     struct string   name;    /* hostname:port */
@@ -79,6 +102,11 @@ struct conf_server {
     unsigned        valid:1;    /* valid? */
 };
 
+struct conf_route {
+    struct string   prefix;     /* key prefix */
+    struct string   pool;       /* target pool name */
+};
+
 struct conf_pool {
     struct string      name;                  /* pool name (root node) */
     struct conf_listen listen;                /* listen: */
@@ -99,12 +127,33 @@ struct conf_pool {
     int                server_retry_timeout;  /* server_retry_timeout: in msec */
     int                server_failure_limit;  /* server_failure_limit: */
     struct array       server;                /* servers: conf_server[] */
+    struct string      servers_file;          /* servers_file: */
+    struct array       route;                 /* routes: conf_route[] */
+    struct string      mirror;                /* mirror: */
+    int                mirror_sample;         /* mirror_sample: in percent */
+    int                mirror_writes_only;    /* mirror_writes_only: */
+    int                migration_window;      /* migration_window: in msec */
+    int                migration_backfill_ttl; /* migration_backfill_ttl: in sec */
+    int                migration_rate;        /* migration_rate: in keys per sec */
+    int                replicas;              /* replicas: */
+    struct string      read_fallback;         /* read_fallback: */
+    struct string      failover;              /* failover: */
+    struct string      warmup;                /* warmup: */
+    int                warmup_ttl;            /* warmup_ttl: in sec */
+    int                distinct_keys_window;  /* distinct_keys_window: in sec */
+    struct string      namespace;             /* namespace: */
+    int                namespace_top;         /* namespace_top: */
+    int                slowlog_slower_than;   /* slowlog_slower_than: in usec */
+    int                slowlog_max_len;       /* slowlog_max_len: */
+    int                client_top;            /* client_top: */
+    int                splice_threshold;      /* splice_threshold: in bytes */
     unsigned           valid:1;               /* valid? */
 };
 
 struct conf_global {
     int           worker_processes; // number of worker processes
     int           worker_shutdown_timeout; // number of seconds that worker would be quit after signal terminate was received
+    int           stats_admin_remote; // take admin and tap commands on the stats port from non loopback peers?
     struct string user;
     struct string group;
     uid_t         uid;
@@ -147,11 +196,18 @@ char *conf_set_hash(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_distribution(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_hashtag(struct conf *cf, struct command *cmd, void *conf);
 char *conf_set_master(struct conf *cf, struct command *cmd, void *conf);
+char *conf_add_route(struct conf *cf, struct command *cmd, void *conf);
+
+char *conf_parse_server(struct array *server, uint8_t *line, uint32_t len);
+rstatus_t conf_read_servers(struct string *filename, struct array *server);
+void conf_free_servers(struct array *server);
 
 rstatus_t conf_server_each_transform(void *elem, void *data);
 rstatus_t conf_pool_each_transform(void *elem, void *data);
 
 struct conf *conf_create(char *filename);
+struct conf *conf_load(char *filename);
+rstatus_t conf_compile(char *filename);
 void conf_destroy(struct conf *cf);
 
 #endif
@@ -21,6 +21,7 @@
 #include <nc_server.h>
 #include <nc_client.h>
 #include <nc_proxy.h>
+#include <nc_slab.h>
 #include <proto/nc_proto.h>
 
 /*
@@ -81,8 +82,7 @@
  * the queue.
  */
 
-static uint32_t nfree_connq;       /* # free conn q */
-static struct conn_tqh free_connq; /* free conn q */
+static struct slab_cache conn_cache; /* conn slabs */
 static uint64_t ntotal_conn;       /* total # connections counter from start */
 static uint32_t ncurr_conn;        /* current # connections */
 static uint32_t ncurr_cconn;       /* current # client connections */
@@ -110,17 +110,9 @@ _conn_get(void)
 {
     struct conn *conn;
 
-    if (!TAILQ_EMPTY(&free_connq)) {
-        ASSERT(nfree_connq > 0);
-
-        conn = TAILQ_FIRST(&free_connq);
-        nfree_connq--;
-        TAILQ_REMOVE(&free_connq, conn, conn_tqe);
-    } else {
-        conn = nc_alloc(sizeof(*conn));
-        if (conn == NULL) {
-            return NULL;
-        }
+    conn = slab_get(&conn_cache);
+    if (conn == NULL) {
+        return NULL;
     }
 
     conn->owner = NULL;
@@ -142,6 +134,15 @@ _conn_get(void)
     conn->send_bytes = 0;
     conn->recv_bytes = 0;
 
+    conn->nomsg = 0;
+    conn->talker = -1;
+    conn->peerlen = 0;
+
+    TAILQ_INIT(&conn->tx_q);
+    conn->tx_server = NULL;
+
+    conn->splice = NULL;
+
     conn->events = 0;
     conn->err = 0;
     conn->recv_active = 0;
@@ -157,6 +158,9 @@ _conn_get(void)
     conn->done = 0;
     conn->redis = 0;
     conn->authenticated = 0;
+    conn->paused = 0;
+    conn->multi = 0;
+    conn->tx_abort = 0;
 
     ntotal_conn++;
     ncurr_conn++;
@@ -289,7 +293,7 @@ static void
 conn_free(struct conn *conn)
 {
     log_debug(LOG_VVERB, "free conn %p", conn);
-    nc_free(conn);
+    slab_put(&conn_cache, conn);
 }
 
 void
@@ -300,35 +304,26 @@ conn_put(struct conn *conn)
 
     log_debug(LOG_VVERB, "put conn %p", conn);
 
-    nfree_connq++;
-    TAILQ_INSERT_HEAD(&free_connq, conn, conn_tqe);
-
     if (conn->client) {
         ncurr_cconn--;
     }
     ncurr_conn--;
+
+    conn_free(conn);
 }
 
 void
 conn_init(void)
 {
     log_debug(LOG_DEBUG, "conn size %d", sizeof(struct conn));
-    nfree_connq = 0;
-    TAILQ_INIT(&free_connq);
+    /* swallowed requests of a closed client still point to its conn */
+    slab_cache_init(&conn_cache, "conn", sizeof(struct conn), true);
 }
 
 void
 conn_deinit(void)
 {
-    struct conn *conn, *nconn; /* current and next connection */
-
-    for (conn = TAILQ_FIRST(&free_connq); conn != NULL;
-         conn = nconn, nfree_connq--) {
-        ASSERT(nfree_connq > 0);
-        nconn = TAILQ_NEXT(conn, conn_tqe);
-        conn_free(conn);
-    }
-    ASSERT(nfree_connq == 0);
+    slab_cache_deinit(&conn_cache);
 }
 
 ssize_t
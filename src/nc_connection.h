@@ -39,7 +39,7 @@ typedef void (*conn_post_connect_t)(struct context *ctx, struct conn *, struct s
 typedef void (*conn_swallow_msg_t)(struct conn *, struct msg *, struct msg *);
 
 struct conn {
-    TAILQ_ENTRY(conn)   conn_tqe;        /* link in server_pool / server / free q */
+    TAILQ_ENTRY(conn)   conn_tqe;        /* link in server_pool / server */
     void                *owner;          /* connection owner - server_pool / server */
 
     int                 sd;              /* socket descriptor */
@@ -74,6 +74,16 @@ struct conn {
     size_t              recv_bytes;      /* received (read) bytes */
     size_t              send_bytes;      /* sent (written) bytes */
 
+    uint32_t            nomsg;           /* # outstanding requests (client) */
+    int32_t             talker;          /* talker entry of the peer or -1 (client) */
+    uint8_t             peerlen;         /* peer address length (client) */
+    uint8_t             peer[16];        /* peer ipv4 or ipv6 address (client) */
+
+    struct msg_tqh      tx_q;            /* commands queued after MULTI (client) */
+    struct server       *tx_server;      /* server of the queued commands (client) */
+
+    struct splice       *splice;         /* relay of the value being read, or NULL (server) */
+
     uint32_t            events;          /* connection io events */
     err_t               err;             /* connection errno */
     unsigned            recv_active:1;   /* recv active? */
@@ -89,6 +99,9 @@ struct conn {
     unsigned            done:1;          /* done? aka close? */
     unsigned            redis:1;         /* redis? */
     unsigned            authenticated:1; /* authenticated? */
+    unsigned            paused:1;        /* paused? aka accept masked out */
+    unsigned            multi:1;         /* in a transaction? (client) */
+    unsigned            tx_abort:1;      /* transaction aborted by an error? */
 };
 
 TAILQ_HEAD(conn_tqh, conn);
@@ -22,6 +22,9 @@
 #include <nc_server.h>
 #include <nc_proxy.h>
 #include <nc_process.h>
+#include <nc_migrate.h>
+#include <nc_hll.h>
+#include <nc_splice.h>
 
 static uint32_t ctx_id; /* context generation */
 
@@ -65,10 +68,12 @@ core_ctx_create(struct instance *nci) {
     ctx->max_nfd = 0;
     ctx->max_ncconn = 0;
     ctx->max_nsconn = 0;
+    ctx->npaused = 0;
+    ctx->chan_sd = -1;
     ctx->shared_mem = NULL;
 
     /* parse and create configuration */
-    ctx->cf = conf_create(nci->conf_filename);
+    ctx->cf = conf_load(nci->conf_filename);
     if (ctx->cf == NULL) {
         nc_free(ctx);
         return NULL;
@@ -121,14 +126,14 @@ core_init_stats(struct instance *nci)
     loop = get_loop_callback(nci->role, nci->ctx->cf->global.worker_processes);
     /* create stats per server pool */
     ctx->stats = stats_create(nci->stats_port, nci->stats_addr, nci->stats_interval,
-                              nci->hostname, &ctx->pool, loop);
+                              nci->stats_export, nci->hostname, &ctx->pool,
+                              loop, ctx);
     if (ctx->stats == NULL) {
         server_pool_deinit(&ctx->pool);
         conf_destroy(ctx->cf);
         nc_free(ctx);
         return NC_ERROR;
     }
-    ctx->stats->owner = ctx;
 
     return NC_OK;
 }
@@ -304,6 +309,10 @@ core_close(struct context *ctx, struct conn *conn)
     }
 
     conn->close(ctx, conn);
+
+    if (ctx->npaused > 0) {
+        proxy_resume(ctx);
+    }
 }
 
 static void
@@ -424,6 +433,12 @@ core_loop(struct context *ctx)
 
     core_timeout(ctx);
 
+    migrate_run(ctx);
+
+    hll_run(ctx);
+
+    splice_run(ctx);
+
     stats_swap(ctx->stats);
 
     return NC_OK;
@@ -58,6 +58,18 @@
 # define NC_HAVE_BACKTRACE 1
 #endif
 
+#ifdef HAVE_ACCEPT4
+# define NC_HAVE_ACCEPT4 1
+#endif
+
+#ifdef HAVE_INOTIFY_INIT1
+# define NC_HAVE_INOTIFY 1
+#endif
+
+#ifdef HAVE_SPLICE
+# define NC_HAVE_SPLICE 1
+#endif
+
 #include <sys/socket.h>
 #ifdef SO_REUSEPORT
 #define NC_HAVE_REUSEPORT
@@ -88,6 +100,7 @@ struct mhdr;
 struct conf;
 struct stats;
 struct instance;
+struct chan_msg;
 struct event_base;
 
 #include <stddef.h>
@@ -139,6 +152,8 @@ struct context {
     uint32_t           max_nfd;     /* max # files */
     uint32_t           max_ncconn;  /* max # client connections */
     uint32_t           max_nsconn;  /* max # server connections */
+    uint32_t           npaused;     /* # listeners paused on fd exhaustion */
+    int                chan_sd;     /* channel descriptor to the master */
 };
 
 
@@ -150,6 +165,7 @@ struct instance {
     uint16_t         stats_port;                  /* stats monitoring port */
     int              stats_interval;              /* stats aggregation interval */
     char             *stats_addr;                 /* stats monitoring addr */
+    char             *stats_export;               /* stats push export url */
     char             hostname[NC_MAXHOSTNAMELEN]; /* hostname */
     size_t           mbuf_chunk_size;             /* mbuf chunk size */
     pid_t            pid;                         /* process id */
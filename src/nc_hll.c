@@ -0,0 +1,235 @@
+#include <math.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_hll.h>
+#include <hashkit/nc_hashkit.h>
+
+/*
+ * Distinct key estimates of a pool with distinct_keys_window: and of each of
+ * its servers. Keys are counted into the current window of a HyperLogLog;
+ * the previous window is kept, so that the estimate, the union of both,
+ * always covers between one and two full windows of traffic.
+ *
+ * A 32-bit murmur hash of the key picks one of HLL_REGISTERS registers with
+ * its first HLL_PRECISION bits, and the register keeps the highest position
+ * of the first set bit in the rest of the hash. With 4096 registers of a
+ * byte each, the standard error of the estimate is about 1.6%.
+ */
+
+static struct hll *
+hll_create(void)
+{
+    struct hll *hll;
+
+    hll = nc_zalloc(sizeof(*hll));
+    if (hll == NULL) {
+        return NULL;
+    }
+
+    hll->cur = 0;
+    hll->estimate = 0;
+
+    return hll;
+}
+
+static void
+hll_add(struct hll *hll, uint32_t hash)
+{
+    uint32_t idx, rest;
+    uint8_t rank;
+
+    idx = hash >> (32 - HLL_PRECISION);
+    rest = hash << HLL_PRECISION;
+
+    for (rank = 1; rank <= 32 - HLL_PRECISION && (rest & 0x80000000) == 0;
+         rank++) {
+        rest <<= 1;
+    }
+
+    if (rank > hll->reg[hll->cur][idx]) {
+        hll->reg[hll->cur][idx] = rank;
+    }
+}
+
+/*
+ * Drop the previous window of hll, and start a new current window
+ */
+static void
+hll_rotate(struct hll *hll)
+{
+    hll->cur ^= 1;
+    memset(hll->reg[hll->cur], 0, sizeof(hll->reg[hll->cur]));
+}
+
+/*
+ * Return the estimated # distinct keys in both windows of hll
+ */
+static int64_t
+hll_count(struct hll *hll)
+{
+    double m, sum, estimate;
+    uint32_t i, zeros;
+    uint8_t rank;
+
+    m = (double)HLL_REGISTERS;
+    sum = 0.0;
+    zeros = 0;
+
+    for (i = 0; i < HLL_REGISTERS; i++) {
+        rank = MAX(hll->reg[0][i], hll->reg[1][i]);
+        if (rank == 0) {
+            zeros++;
+        }
+        sum += ldexp(1.0, -rank);
+    }
+
+    estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+
+    if (estimate <= 2.5 * m && zeros != 0) {
+        /* small range: linear counting */
+        estimate = m * log(m / zeros);
+    } else if (estimate > 4294967296.0 / 30.0) {
+        /* large range: collisions of the 32-bit hash */
+        estimate = -4294967296.0 * log(1.0 - estimate / 4294967296.0);
+    }
+
+    return (int64_t)(estimate + 0.5);
+}
+
+/*
+ * Count the keys of msg, forwarded to server, into the distinct key
+ * estimates of server and of its pool
+ */
+void
+hll_forward(struct server *server, struct msg *msg)
+{
+    struct server_pool *pool;
+    struct keypos *kpos;
+    uint32_t i, hash;
+
+    pool = server->owner;
+    if (pool->distinct_keys_window == 0) {
+        return;
+    }
+
+    if (pool->hll == NULL) {
+        pool->hll = hll_create();
+        if (pool->hll == NULL) {
+            return;
+        }
+        pool->hll_rotate = nc_usec_now() + pool->distinct_keys_window * 1000000LL;
+    }
+
+    if (server->hll == NULL) {
+        server->hll = hll_create();
+    }
+
+    for (i = 0; i < array_n(msg->keys); i++) {
+        kpos = array_get(msg->keys, i);
+        hash = hash_murmur((char *)kpos->start,
+                           (size_t)(kpos->end - kpos->start));
+
+        hll_add(pool->hll, hash);
+        if (server->hll != NULL) {
+            hll_add(server->hll, hash);
+        }
+    }
+}
+
+static void
+hll_publish_server(struct context *ctx, struct array *server, bool rotate)
+{
+    struct server *s;
+    int64_t estimate;
+    uint32_t i;
+
+    for (i = 0; i < array_n(server); i++) {
+        s = array_get(server, i);
+        if (s->hll == NULL) {
+            continue;
+        }
+
+        if (rotate) {
+            hll_rotate(s->hll);
+        }
+
+        estimate = hll_count(s->hll);
+        stats_server_incr_by(ctx, s, distinct_keys, estimate - s->hll->estimate);
+        s->hll->estimate = estimate;
+    }
+}
+
+/*
+ * Rotate the windows that ended, publish the estimates to stats at most
+ * every HLL_PUBLISH msec, and shorten the event wait of ctx to the end of
+ * the next window
+ */
+void
+hll_run(struct context *ctx)
+{
+    struct server_pool *pool;
+    int64_t now, estimate;
+    bool rotate;
+    int delta;
+    uint32_t i;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        pool = array_get(&ctx->pool, i);
+
+        if (pool->hll == NULL) {
+            continue;
+        }
+
+        now = nc_usec_now();
+        if (now < 0) {
+            continue;
+        }
+
+        rotate = now >= pool->hll_rotate;
+        if (rotate) {
+            hll_rotate(pool->hll);
+            pool->hll_rotate = now + pool->distinct_keys_window * 1000000LL;
+        }
+
+        if (rotate || now >= pool->hll_publish) {
+            estimate = hll_count(pool->hll);
+            stats_pool_incr_by(ctx, pool, distinct_keys,
+                               estimate - pool->hll->estimate);
+            pool->hll->estimate = estimate;
+
+            hll_publish_server(ctx, &pool->server, rotate);
+            hll_publish_server(ctx, &pool->redis_master, rotate);
+
+            pool->hll_publish = now + HLL_PUBLISH * 1000LL;
+        }
+
+        delta = (int)((pool->hll_rotate - now) / 1000LL) + 1;
+        ctx->timeout = ctx->timeout < 0 ? delta : MIN(ctx->timeout, delta);
+    }
+}
+
+static void
+hll_deinit_server(struct array *server)
+{
+    struct server *s;
+    uint32_t i;
+
+    for (i = 0; i < array_n(server); i++) {
+        s = array_get(server, i);
+        if (s->hll != NULL) {
+            nc_free(s->hll);
+        }
+    }
+}
+
+void
+hll_deinit(struct server_pool *pool)
+{
+    if (pool->hll != NULL) {
+        nc_free(pool->hll);
+    }
+
+    hll_deinit_server(&pool->server);
+    hll_deinit_server(&pool->redis_master);
+}
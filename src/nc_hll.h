@@ -0,0 +1,24 @@
+#ifndef _NC_HLL_H_
+#define _NC_HLL_H_
+
+#include <nc_core.h>
+
+#define HLL_PRECISION       12                      /* # index bits of a hash */
+#define HLL_REGISTERS       (1 << HLL_PRECISION)    /* # registers of a window */
+#define HLL_PUBLISH         1000                    /* estimate interval in msec */
+
+/*
+ * HyperLogLog of the keys seen by a pool or a server, over the current and
+ * the previous window of distinct_keys_window: seconds
+ */
+struct hll {
+    uint8_t  reg[2][HLL_REGISTERS]; /* registers of both windows */
+    uint32_t cur;                   /* index of the current window */
+    int64_t  estimate;              /* estimate last published to stats */
+};
+
+void hll_forward(struct server *server, struct msg *msg);
+void hll_run(struct context *ctx);
+void hll_deinit(struct server_pool *pool);
+
+#endif
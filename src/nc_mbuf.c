@@ -23,6 +23,9 @@
 static uint32_t nfree_mbufq;   /* # free mbuf */
 static struct mhdr free_mbufq; /* free mbuf q */
 
+static uint32_t nfree_shareq;   /* # free shared mbuf header */
+static struct mhdr free_shareq; /* free shared mbuf header q */
+
 static size_t mbuf_chunk_size; /* mbuf chunk size - header + data (const) */
 static size_t mbuf_offset;     /* mbuf offset in chunk (const) */
 
@@ -96,6 +99,9 @@ mbuf_get(void)
     mbuf->pos = mbuf->start;
     mbuf->last = mbuf->start;
 
+    mbuf->shared = NULL;
+    mbuf->nref = 1;
+
     log_debug(LOG_VVERB, "get mbuf %p", mbuf);
 
     return mbuf;
@@ -115,18 +121,83 @@ mbuf_free(struct mbuf *mbuf)
     nc_free(buf);
 }
 
+/*
+ * Put mbuf. The data of an mbuf that is shared is only recycled once the
+ * last mbuf sharing it is put as well.
+ */
 void
 mbuf_put(struct mbuf *mbuf)
 {
+    struct mbuf *owner;
+
     log_debug(LOG_VVERB, "put mbuf %p len %d", mbuf, mbuf->last - mbuf->pos);
 
     ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
     ASSERT(mbuf->magic == MBUF_MAGIC);
 
+    owner = mbuf->shared;
+    if (owner != NULL) {
+        mbuf->shared = NULL;
+        nfree_shareq++;
+        STAILQ_INSERT_HEAD(&free_shareq, mbuf, next);
+        mbuf = owner;
+    }
+
+    ASSERT(mbuf->nref > 0);
+    if (--mbuf->nref > 0) {
+        return;
+    }
+
+    ASSERT(STAILQ_NEXT(mbuf, next) == NULL);
+
     nfree_mbufq++;
     STAILQ_INSERT_HEAD(&free_mbufq, mbuf, next);
 }
 
+/*
+ * Return a new mbuf holding the unread data of mbuf, without copying it:
+ * the new mbuf points into the buffer of mbuf, which stays allocated until
+ * both are put. The shared data is read only; the new mbuf is full, so
+ * that nothing is ever appended to it.
+ */
+struct mbuf *
+mbuf_share(struct mbuf *mbuf)
+{
+    struct mbuf *nbuf, *owner;
+
+    ASSERT(mbuf->magic == MBUF_MAGIC);
+
+    if (!STAILQ_EMPTY(&free_shareq)) {
+        ASSERT(nfree_shareq > 0);
+
+        nbuf = STAILQ_FIRST(&free_shareq);
+        nfree_shareq--;
+        STAILQ_REMOVE_HEAD(&free_shareq, next);
+    } else {
+        nbuf = nc_alloc(MBUF_HSIZE);
+        if (nbuf == NULL) {
+            return NULL;
+        }
+        nbuf->magic = MBUF_MAGIC;
+    }
+
+    owner = mbuf->shared != NULL ? mbuf->shared : mbuf;
+    owner->nref++;
+
+    STAILQ_NEXT(nbuf, next) = NULL;
+    nbuf->start = mbuf->pos;
+    nbuf->pos = mbuf->pos;
+    nbuf->last = mbuf->last;
+    nbuf->end = mbuf->last;
+    nbuf->shared = owner;
+    nbuf->nref = 1;
+
+    log_debug(LOG_VVERB, "share mbuf %p len %"PRIu32" as %p", mbuf,
+              mbuf_length(nbuf), nbuf);
+
+    return nbuf;
+}
+
 /*
  * Rewind the mbuf by discarding any of the read or unread data that it
  * might hold.
@@ -265,6 +336,9 @@ mbuf_init(struct instance *nci)
     nfree_mbufq = 0;
     STAILQ_INIT(&free_mbufq);
 
+    nfree_shareq = 0;
+    STAILQ_INIT(&free_shareq);
+
     mbuf_chunk_size = nci->mbuf_chunk_size;
     mbuf_offset = mbuf_chunk_size - MBUF_HSIZE;
 
@@ -282,4 +356,12 @@ mbuf_deinit(void)
         nfree_mbufq--;
     }
     ASSERT(nfree_mbufq == 0);
+
+    while (!STAILQ_EMPTY(&free_shareq)) {
+        struct mbuf *mbuf = STAILQ_FIRST(&free_shareq);
+        mbuf_remove(&free_shareq, mbuf);
+        nc_free(mbuf);
+        nfree_shareq--;
+    }
+    ASSERT(nfree_shareq == 0);
 }
@@ -22,6 +22,9 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_slab.h>
+#include <nc_splice.h>
+#include <nc_tap.h>
 #include <proto/nc_proto.h>
 
 #if (IOV_MAX > 128)
@@ -111,8 +114,9 @@
 
 static uint64_t msg_id;          /* message id counter */
 static uint64_t frag_id;         /* fragment id counter */
-static uint32_t nfree_msgq;      /* # free msg q */
-static struct msg_tqh free_msgq; /* free msg q */
+static struct slab_cache msg_cache;  /* msg slabs */
+static struct slab_cache keys_cache; /* keypos array slabs */
+static struct slab_cache frag_cache; /* fragment array slabs */
 static struct rbtree tmo_rbt;    /* timeout rbtree */
 static struct rbnode tmo_rbs;    /* timeout rbtree sentinel */
 
@@ -194,22 +198,13 @@ static struct msg *
 _msg_get(void)
 {
     struct msg *msg;
+    struct array *keys;
 
-    if (!TAILQ_EMPTY(&free_msgq)) {
-        ASSERT(nfree_msgq > 0);
-
-        msg = TAILQ_FIRST(&free_msgq);
-        nfree_msgq--;
-        TAILQ_REMOVE(&free_msgq, msg, m_tqe);
-        goto done;
-    }
-
-    msg = nc_alloc(sizeof(*msg));
+    msg = slab_get(&msg_cache);
     if (msg == NULL) {
         return NULL;
     }
 
-done:
     /* c_tqe, s_tqe, and m_tqe are left uninitialized */
     msg->id = ++msg_id;
     msg->peer = NULL;
@@ -220,6 +215,9 @@ done:
     STAILQ_INIT(&msg->mhdr);
     msg->mlen = 0;
     msg->start_ts = 0;
+    msg->send_ts = 0;
+    msg->backend_us = 0;
+    msg->server = NULL;
 
     msg->state = 0;
     msg->pos = NULL;
@@ -236,27 +234,36 @@ done:
 
     msg->type = MSG_UNKNOWN;
 
-    msg->keys = array_create(1, sizeof(struct keypos));
-    if (msg->keys == NULL) {
-        nc_free(msg);
+    /* the first MSG_NKEY_SLAB keypos live in the slab object of the array */
+    keys = slab_get(&keys_cache);
+    if (keys == NULL) {
+        slab_put(&msg_cache, msg);
         return NULL;
     }
+    array_set(keys, keys + 1, sizeof(struct keypos), MSG_NKEY_SLAB);
+    msg->keys = keys;
 
     msg->vlen = 0;
     msg->end = NULL;
 
     msg->frag_owner = NULL;
     msg->frag_seq = NULL;
+    msg->frag_slab = 0;
     msg->nfrag = 0;
     msg->nfrag_done = 0;
     msg->frag_id = 0;
 
+    msg->migrate = NULL;
+    msg->fallback = NULL;
+    msg->splice = NULL;
+
     msg->narg_start = NULL;
     msg->narg_end = NULL;
     msg->narg = 0;
     msg->rnarg = 0;
     msg->rlen = 0;
     msg->integer = 0;
+    msg->vleft = 0;
 
     msg->err = 0;
     msg->error = 0;
@@ -269,6 +276,9 @@ done:
     msg->fdone = 0;
     msg->swallow = 0;
     msg->redis = 0;
+    msg->retried = 0;
+    msg->miss = 0;
+    msg->failover = 0;
 
     return msg;
 }
@@ -277,6 +287,7 @@ struct msg *
 msg_get(struct conn *conn, bool request, bool redis)
 {
     struct msg *msg;
+    struct server_pool *pool;
 
     msg = _msg_get();
     if (msg == NULL) {
@@ -312,7 +323,10 @@ msg_get(struct conn *conn, bool request, bool redis)
         msg->post_coalesce = memcache_post_coalesce;
     }
 
-    if (log_loggable(LOG_NOTICE) != 0) {
+    pool = request && conn->client ? conn->owner : NULL;
+    if (ntap != 0 || log_loggable(LOG_NOTICE) != 0 ||
+        (pool != NULL && (pool->namespace_top != 0 ||
+                          pool->slowlog_slower_than >= 0))) {
         msg->start_ts = nc_usec_now();
     }
 
@@ -362,7 +376,7 @@ msg_free(struct msg *msg)
     ASSERT(STAILQ_EMPTY(&msg->mhdr));
 
     log_debug(LOG_VVERB, "free msg %p id %"PRIu64"", msg, msg->id);
-    nc_free(msg);
+    slab_put(&msg_cache, msg);
 }
 
 void
@@ -377,18 +391,71 @@ msg_put(struct msg *msg)
     }
 
     if (msg->frag_seq) {
-        nc_free(msg->frag_seq);
+        if (msg->frag_slab) {
+            slab_put(&frag_cache, msg->frag_seq);
+        } else {
+            nc_free(msg->frag_seq);
+        }
         msg->frag_seq = NULL;
     }
 
     if (msg->keys) {
-        msg->keys->nelem = 0; /* a hack here */
-        array_destroy(msg->keys);
+        if (msg->keys->elem != msg->keys + 1) {
+            nc_free(msg->keys->elem);
+        }
+        slab_put(&keys_cache, msg->keys);
         msg->keys = NULL;
     }
 
-    nfree_msgq++;
-    TAILQ_INSERT_HEAD(&free_msgq, msg, m_tqe);
+    if (msg->splice != NULL) {
+        splice_put(msg);
+    }
+
+    msg_free(msg);
+}
+
+/*
+ * Push a keypos to the keys of msg, moving them out of the slab object of
+ * the array when it has no room left
+ */
+struct keypos *
+msg_key_push(struct msg *msg)
+{
+    struct array *keys = msg->keys;
+    void *elem;
+
+    if (keys->nelem == keys->nalloc && keys->elem == keys + 1) {
+        elem = nc_alloc(2 * keys->nalloc * keys->size);
+        if (elem == NULL) {
+            return NULL;
+        }
+        nc_memcpy(elem, keys->elem, keys->nelem * keys->size);
+        keys->elem = elem;
+        keys->nalloc *= 2;
+    }
+
+    return array_push(keys);
+}
+
+/*
+ * Allocate the sequence of fragments of msg, one for each of its keys
+ */
+rstatus_t
+msg_frag_seq_alloc(struct msg *msg)
+{
+    uint32_t nkey = array_n(msg->keys);
+
+    ASSERT(msg->frag_seq == NULL);
+
+    if (nkey <= MSG_NFRAG_SLAB) {
+        msg->frag_seq = slab_get(&frag_cache);
+        msg->frag_slab = 1;
+    } else {
+        msg->frag_seq = nc_alloc(nkey * sizeof(*msg->frag_seq));
+        msg->frag_slab = 0;
+    }
+
+    return msg->frag_seq != NULL ? NC_OK : NC_ENOMEM;
 }
 
 void
@@ -422,23 +489,20 @@ msg_init(void)
     log_debug(LOG_DEBUG, "msg size %d", sizeof(struct msg));
     msg_id = 0;
     frag_id = 0;
-    nfree_msgq = 0;
-    TAILQ_INIT(&free_msgq);
+    slab_cache_init(&msg_cache, "msg", sizeof(struct msg), false);
+    slab_cache_init(&keys_cache, "keys", sizeof(struct array) +
+                    MSG_NKEY_SLAB * sizeof(struct keypos), false);
+    slab_cache_init(&frag_cache, "frag_seq", MSG_NFRAG_SLAB *
+                    sizeof(struct msg *), false);
     rbtree_init(&tmo_rbt, &tmo_rbs);
 }
 
 void
 msg_deinit(void)
 {
-    struct msg *msg, *nmsg;
-
-    for (msg = TAILQ_FIRST(&free_msgq); msg != NULL;
-         msg = nmsg, nfree_msgq--) {
-        ASSERT(nfree_msgq > 0);
-        nmsg = TAILQ_NEXT(msg, m_tqe);
-        msg_free(msg);
-    }
-    ASSERT(nfree_msgq == 0);
+    slab_cache_deinit(&frag_cache);
+    slab_cache_deinit(&keys_cache);
+    slab_cache_deinit(&msg_cache);
 }
 
 struct string *
@@ -447,6 +511,32 @@ msg_type_string(msg_type_t type)
     return &msg_type_strings[type];
 }
 
+/*
+ * Copy the command of type in lower case, like "get" for REQ_REDIS_GET or
+ * REQ_MC_GET, into cmd of size bytes, and return its length
+ */
+uint32_t
+msg_type_cmd(msg_type_t type, char *cmd, uint32_t size)
+{
+    struct string *str;
+    uint32_t i, n, len;
+
+    str = msg_type_string(type);
+    for (i = 0, n = 0; i < str->len; i++) {
+        if (str->data[i] == '_') {
+            n++;
+        } else if (n == 2) {
+            break;
+        }
+    }
+    for (len = 0; i < str->len && len < size - 1; i++) {
+        cmd[len++] = (char)tolower(str->data[i]);
+    }
+    cmd[len] = '\0';
+
+    return len;
+}
+
 bool
 msg_empty(struct msg *msg)
 {
@@ -459,7 +549,7 @@ msg_backend_idx(struct msg *msg, uint8_t *key, uint32_t keylen)
     struct conn *conn = msg->owner;
     struct server_pool *pool = conn->owner;
 
-    return server_pool_idx(pool, key, keylen);
+    return server_pool_backend_idx(pool, key, keylen);
 }
 
 struct mbuf *
@@ -505,6 +595,79 @@ msg_append(struct msg *msg, uint8_t *pos, size_t n)
     return NC_OK;
 }
 
+/*
+ * Copy the unsent data of request msg into a new request owned by conn.
+ * The copy shares the mbufs of msg rather than copying their data, see
+ * mbuf_share(). It is not parsed; it carries the type of msg but no keys.
+ */
+struct msg *
+msg_clone(struct msg *msg, struct conn *conn)
+{
+    struct msg *nmsg;
+    struct mbuf *mbuf, *nbuf;
+
+    ASSERT(msg->request);
+
+    nmsg = msg_get(conn, true, msg->redis);
+    if (nmsg == NULL) {
+        return NULL;
+    }
+
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        if (mbuf_empty(mbuf)) {
+            continue;
+        }
+
+        nbuf = mbuf_share(mbuf);
+        if (nbuf == NULL) {
+            msg_put(nmsg);
+            return NULL;
+        }
+        mbuf_insert(&nmsg->mhdr, nbuf);
+        nmsg->mlen += mbuf_length(nbuf);
+    }
+
+    nmsg->type = msg->type;
+    nmsg->noreply = msg->noreply;
+    nmsg->result = MSG_PARSE_OK;
+
+    return nmsg;
+}
+
+/*
+ * Append n bytes of the unsent data of src, starting offset bytes into it,
+ * to msg
+ */
+rstatus_t
+msg_append_msg(struct msg *msg, struct msg *src, uint32_t offset, uint32_t n)
+{
+    rstatus_t status;
+    struct mbuf *mbuf;
+
+    STAILQ_FOREACH(mbuf, &src->mhdr, next) {
+        uint32_t len = mbuf_length(mbuf);
+
+        if (offset >= len) {
+            offset -= len;
+            continue;
+        }
+
+        len = MIN(len - offset, n);
+        status = msg_append(msg, mbuf->pos + offset, len);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        offset = 0;
+        n -= len;
+        if (n == 0) {
+            return NC_OK;
+        }
+    }
+
+    return NC_ERROR;
+}
+
 /*
  * Prepend n bytes of data, with n <= mbuf_size(mbuf)
  * into mbuf
@@ -648,6 +811,9 @@ msg_parse(struct context *ctx, struct conn *conn, struct msg *msg)
 
     case MSG_PARSE_AGAIN:
         status = NC_OK;
+        if (!msg->request && msg->vleft > 0) {
+            status = splice_start(ctx, conn, msg);
+        }
         break;
 
     default:
@@ -722,6 +888,15 @@ msg_recv(struct context *ctx, struct conn *conn)
 
     conn->recv_ready = 1;
     do {
+        if (conn->splice != NULL) {
+            /* the value being relayed comes ahead of the next response */
+            status = splice_recv(ctx, conn);
+            if (status != NC_OK) {
+                return status;
+            }
+            continue;
+        }
+
         msg = conn->recv_next(ctx, conn, true);
         if (msg == NULL) {
             return NC_OK;
@@ -789,6 +964,11 @@ msg_send_chain(struct context *ctx, struct conn *conn, struct msg *msg)
             nsend += mlen;
         }
 
+        /* the rest of a relayed msg is sent from its pipe, before any other */
+        if (msg->splice != NULL) {
+            break;
+        }
+
         if (array_n(&sendv) >= NC_IOV_MAX || nsend >= limit) {
             break;
         }
@@ -849,7 +1029,7 @@ msg_send_chain(struct context *ctx, struct conn *conn, struct msg *msg)
         }
 
         /* message has been sent completely, finalize it */
-        if (mbuf == NULL) {
+        if (mbuf == NULL && msg->splice == NULL) {
             conn->send_done(ctx, conn, msg);
         }
     }
@@ -879,7 +1059,11 @@ msg_send(struct context *ctx, struct conn *conn)
             return NC_OK;
         }
 
-        status = msg_send_chain(ctx, conn, msg);
+        if (splice_sending(msg)) {
+            status = splice_send(ctx, conn, msg);
+        } else {
+            status = msg_send_chain(ctx, conn, msg);
+        }
         if (status != NC_OK) {
             return status;
         }
@@ -171,7 +171,12 @@ typedef enum msg_parse_result {
     ACTION( REQ_REDIS_PING )                   /* redis requests - ping/quit */                     \
     ACTION( REQ_REDIS_QUIT)                                                                         \
     ACTION( REQ_REDIS_AUTH)                                                                         \
+    ACTION( REQ_REDIS_SLOWLOG)                 /* answered by the proxy */                          \
+    ACTION( REQ_REDIS_MULTI)                   /* redis requests - transactions */                  \
+    ACTION( REQ_REDIS_EXEC)                                                                         \
+    ACTION( REQ_REDIS_DISCARD)                                                                      \
     ACTION( REQ_REDIS_SELECT)                  /* only during init */                               \
+    ACTION( REQ_REDIS_MIGRATE)                 /* only by the key mover */                          \
     ACTION( RSP_REDIS_STATUS )                 /* redis response */                                 \
     ACTION( RSP_REDIS_ERROR )                                                                       \
     ACTION( RSP_REDIS_ERROR_ERR )                                                                   \
@@ -204,10 +209,13 @@ struct keypos {
     uint8_t             *end;             /* key end pos */
 };
 
+#define MSG_NKEY_SLAB   4   /* # keypos kept in the slab object of keys */
+#define MSG_NFRAG_SLAB  16  /* max # keys of a frag_seq from a slab */
+
 struct msg {
     TAILQ_ENTRY(msg)     c_tqe;           /* link in client q */
     TAILQ_ENTRY(msg)     s_tqe;           /* link in server q */
-    TAILQ_ENTRY(msg)     m_tqe;           /* link in send q / free q */
+    TAILQ_ENTRY(msg)     m_tqe;           /* link in send q / frag q */
 
     uint64_t             id;              /* message id */
     struct msg           *peer;           /* message peer */
@@ -218,6 +226,9 @@ struct msg {
     struct mhdr          mhdr;            /* message mbuf header */
     uint32_t             mlen;            /* message length */
     int64_t              start_ts;        /* request start timestamp in usec */
+    int64_t              send_ts;         /* request sent to server in usec */
+    int64_t              backend_us;      /* time on the server in usec */
+    struct server        *server;         /* server sent to, or slowest fragment's */
 
     int                  state;           /* current parser state */
     uint8_t              *pos;            /* parser position marker */
@@ -247,6 +258,7 @@ struct msg {
     uint32_t             rnarg;           /* running # arg used by parsing fsa (redis) */
     uint32_t             rlen;            /* running length in parsing fsa (redis) */
     uint32_t             integer;         /* integer reply value (redis) */
+    uint32_t             vleft;           /* # bulk value and crlf bytes left to receive (redis) */
 
     struct msg           *frag_owner;     /* owner of fragment message */
     uint32_t             nfrag;           /* # fragment */
@@ -254,6 +266,10 @@ struct msg {
     uint64_t             frag_id;         /* id of fragmented message */
     struct msg           **frag_seq;      /* sequence of fragment message, map from keys to fragments*/
 
+    struct server        *migrate;        /* new owner of req retried on its previous owner */
+    struct server_pool   *fallback;       /* pool of req retried on its read fallback */
+    struct splice        *splice;         /* relay of the value of rsp, or NULL */
+
     err_t                err;             /* errno on error? */
     unsigned             error:1;         /* error? */
     unsigned             ferror:1;        /* one or more fragments are in error? */
@@ -264,7 +280,11 @@ struct msg {
     unsigned             done:1;          /* done? */
     unsigned             fdone:1;         /* all fragments are done? */
     unsigned             swallow:1;       /* swallow response? */
+    unsigned             frag_slab:1;     /* frag_seq from a slab? */
     unsigned             redis:1;         /* redis? */
+    unsigned             retried:1;       /* sent again to another server? */
+    unsigned             miss:1;          /* single key read that missed? */
+    unsigned             failover:1;      /* failed over to the next replica? */
 };
 
 TAILQ_HEAD(msg_tqh, msg);
@@ -276,6 +296,7 @@ void msg_tmo_delete(struct msg *msg);
 void msg_init(void);
 void msg_deinit(void);
 struct string *msg_type_string(msg_type_t type);
+uint32_t msg_type_cmd(msg_type_t type, char *cmd, uint32_t size);
 struct msg *msg_get(struct conn *conn, bool request, bool redis);
 void msg_put(struct msg *msg);
 struct msg *msg_get_error(bool redis, err_t err);
@@ -286,7 +307,11 @@ rstatus_t msg_send(struct context *ctx, struct conn *conn);
 uint64_t msg_gen_frag_id(void);
 uint32_t msg_backend_idx(struct msg *msg, uint8_t *key, uint32_t keylen);
 struct mbuf *msg_ensure_mbuf(struct msg *msg, size_t len);
+struct keypos *msg_key_push(struct msg *msg);
+rstatus_t msg_frag_seq_alloc(struct msg *msg);
+struct msg *msg_clone(struct msg *msg, struct conn *conn);
 rstatus_t msg_append(struct msg *msg, uint8_t *pos, size_t n);
+rstatus_t msg_append_msg(struct msg *msg, struct msg *src, uint32_t offset, uint32_t n);
 rstatus_t msg_prepend(struct msg *msg, uint8_t *pos, size_t n);
 rstatus_t msg_prepend_format(struct msg *msg, const char *fmt, ...);
 
@@ -305,6 +330,12 @@ struct msg *req_recv_next(struct context *ctx, struct conn *conn, bool alloc);
 void req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg, struct msg *nmsg);
 struct msg *req_send_next(struct context *ctx, struct conn *conn);
 void req_send_done(struct context *ctx, struct conn *conn, struct msg *msg);
+bool req_retryable(struct msg *msg);
+rstatus_t req_tx_queue(struct conn *c_conn, struct msg *req);
+void req_tx_discard(struct conn *c_conn);
+bool req_retry(struct context *ctx, struct msg *msg, struct server *server);
+bool req_fallback(struct context *ctx, struct msg *msg, struct server *server);
+bool req_replica_failover(struct context *ctx, struct msg *msg, struct server *server);
 
 struct msg *rsp_get(struct conn *conn);
 void rsp_put(struct msg *msg);
@@ -0,0 +1,351 @@
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_migrate.h>
+#include <proto/nc_proto.h>
+
+/*
+ * The key mover of a redis pool with migration_rate: walks every server of
+ * the pool with SCAN after a change of the distribution, and has the server
+ * MIGRATE each key that is now owned by another server over to that owner.
+ * Reads that miss on the new owner while keys are on the move are retried
+ * on the previous owner, as in the migration_window: of the pool.
+ *
+ * A pool has at most one SCAN in flight; the next one is not sent before
+ * the keys of the last one are paced out at migration_rate: keys per sec.
+ */
+
+static int
+migrate_timeout(struct server_pool *pool)
+{
+    return pool->timeout > 0 ? pool->timeout : MIGRATE_TIMEOUT;
+}
+
+/*
+ * Start moving the keys of pool to their owners under its current
+ * distribution. A mover that is still running starts over, as the owners
+ * of the keys it has moved may have changed again.
+ */
+void
+migrate_start(struct server_pool *pool)
+{
+    if (pool->migration_rate == 0) {
+        return;
+    }
+
+    pool->move_server = 0;
+    pool->move_cursor = 0;
+    pool->move_scan = 0;
+    pool->move_errors = 0;
+    pool->move_next = nc_usec_now();
+
+    log_warn("pool %"PRIu32" '%.*s' starts moving keys to their new owners",
+             pool->idx, pool->name.len, pool->name.data);
+}
+
+/*
+ * Return true, if pool is moving keys
+ */
+bool
+migrate_active(struct server_pool *pool)
+{
+    return pool->move_next != 0;
+}
+
+/*
+ * Move on to the next server of pool, and stop after the last one, leaving
+ * reads to retry on the previous owner for one more migration window
+ */
+static void
+migrate_next(struct server_pool *pool)
+{
+    pool->move_server++;
+    pool->move_cursor = 0;
+    pool->move_scan = 0;
+    pool->move_errors = 0;
+
+    if (pool->move_server < array_n(&pool->server)) {
+        return;
+    }
+
+    pool->move_next = 0;
+    pool->migrate_until = nc_usec_now() + pool->migration_window * 1000LL;
+
+    log_warn("pool %"PRIu32" '%.*s' moved all keys to their new owners",
+             pool->idx, pool->name.len, pool->name.data);
+}
+
+static void
+migrate_error(struct server_pool *pool)
+{
+    struct server *server;
+
+    pool->move_scan = 0;
+    pool->move_errors++;
+
+    if (pool->move_errors < MIGRATE_MAX_ERRORS) {
+        return;
+    }
+
+    server = array_get(&pool->server, pool->move_server);
+    log_warn("pool %"PRIu32" '%.*s' gives up moving keys off server '%.*s' "
+             "after %"PRIu32" failed scans", pool->idx, pool->name.len,
+             pool->name.data, server->pname.len, server->pname.data,
+             pool->move_errors);
+
+    migrate_next(pool);
+}
+
+/*
+ * Enqueue request msg of the mover on s_conn. Its response is swallowed,
+ * and handed to migrate_scan_done() or migrate_move_done().
+ */
+static rstatus_t
+migrate_send(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    rstatus_t status;
+
+    if (TAILQ_EMPTY(&s_conn->imsg_q)) {
+        status = event_add_out(ctx->evb, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            return status;
+        }
+    }
+
+    if (!conn_authenticated(s_conn)) {
+        status = msg->add_auth(ctx, s_conn, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            return status;
+        }
+    }
+
+    msg->swallow = 1;
+    msg->owner = NULL;
+
+    s_conn->enqueue_inq(ctx, s_conn, msg);
+
+    return NC_OK;
+}
+
+static void
+migrate_scan(struct context *ctx, struct server_pool *pool, int64_t now)
+{
+    rstatus_t status;
+    struct server *server;
+    struct conn *s_conn;
+    struct msg *msg;
+
+    server = array_get(&pool->server, pool->move_server);
+    if (server->delegate != NULL) {
+        /* keys of a "@pool" server live in that pool */
+        migrate_next(pool);
+        return;
+    }
+
+    /* a scan that gets no response by then is retried */
+    pool->move_next = now + migrate_timeout(pool) * 1000LL;
+
+    s_conn = server_get_conn(ctx, server);
+    if (s_conn == NULL) {
+        migrate_error(pool);
+        return;
+    }
+
+    msg = msg_get(s_conn, true, true);
+    if (msg == NULL) {
+        return;
+    }
+
+    status = redis_scan(msg, pool->move_cursor,
+                        MIN(pool->migration_rate, MIGRATE_BATCH));
+    if (status != NC_OK) {
+        msg_put(msg);
+        return;
+    }
+
+    status = migrate_send(ctx, s_conn, msg);
+    if (status != NC_OK) {
+        msg_put(msg);
+        return;
+    }
+
+    pool->move_scan = msg->id;
+
+    log_debug(LOG_VERB, "pool %"PRIu32" '%.*s' scans server '%.*s' from "
+              "cursor %"PRIu64" as req %"PRIu64"", pool->idx, pool->name.len,
+              pool->name.data, server->pname.len, server->pname.data,
+              pool->move_cursor, msg->id);
+}
+
+/*
+ * Send the scans that are due, and shorten the event wait of ctx to the
+ * next one
+ */
+void
+migrate_run(struct context *ctx)
+{
+    struct server_pool *pool;
+    int64_t now;
+    int delta;
+    uint32_t i;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        pool = array_get(&ctx->pool, i);
+
+        if (!migrate_active(pool)) {
+            continue;
+        }
+
+        now = nc_usec_now();
+        if (now < 0) {
+            continue;
+        }
+
+        if (now >= pool->move_next) {
+            if (pool->move_scan != 0) {
+                /* scan was lost with its server connection */
+                migrate_error(pool);
+            }
+            if (migrate_active(pool)) {
+                migrate_scan(ctx, pool, now);
+            }
+        }
+
+        if (migrate_active(pool)) {
+            delta = (int)((pool->move_next - now) / 1000LL) + 1;
+            ctx->timeout = ctx->timeout < 0 ? delta : MIN(ctx->timeout, delta);
+        }
+    }
+}
+
+/*
+ * Have the server of s_conn migrate {key, keylen} to its owner in pool.
+ * Return true, if a MIGRATE was sent.
+ */
+static bool
+migrate_move(struct context *ctx, struct server_pool *pool,
+             struct conn *s_conn, uint8_t *key, uint32_t keylen)
+{
+    struct server *server, *target;
+    struct msg *msg;
+
+    server = s_conn->owner;
+    target = array_get(&pool->server, server_pool_idx(pool, key, keylen));
+    if (target == server || target->delegate != NULL) {
+        return false;
+    }
+
+    msg = msg_get(s_conn, true, true);
+    if (msg == NULL) {
+        return false;
+    }
+
+    if (redis_migrate(msg, target, key, keylen, migrate_timeout(pool)) != NC_OK ||
+        migrate_send(ctx, s_conn, msg) != NC_OK) {
+        msg_put(msg);
+        stats_pool_incr(ctx, pool, migrate_move_errors);
+        return false;
+    }
+
+    log_debug(LOG_VERB, "pool %"PRIu32" '%.*s' moves key '%.*s' from '%.*s' "
+              "to '%.*s'", pool->idx, pool->name.len, pool->name.data, keylen,
+              key, server->pname.len, server->pname.data, target->pname.len,
+              target->pname.data);
+
+    return true;
+}
+
+/*
+ * Move the keys in msg, the response to the SCAN pmsg on s_conn, that have
+ * a new owner, and pace the next scan
+ */
+void
+migrate_scan_done(struct conn *s_conn, struct msg *pmsg, struct msg *msg)
+{
+    struct server *server;
+    struct server_pool *pool;
+    struct context *ctx;
+    struct array keys;
+    struct keypos *kpos;
+    uint8_t *buf;
+    uint64_t cursor;
+    uint32_t nkey;
+    int64_t now;
+
+    server = s_conn->owner;
+    pool = server->owner;
+    ctx = pool->ctx;
+
+    if (!migrate_active(pool) || pmsg->id != pool->move_scan) {
+        /* stale response to a scan of a mover that started over */
+        return;
+    }
+
+    now = nc_usec_now();
+
+    if (array_init(&keys, MIGRATE_BATCH, sizeof(struct keypos)) != NC_OK) {
+        migrate_error(pool);
+        return;
+    }
+
+    buf = redis_scan_keys(msg, &cursor, &keys);
+    if (buf == NULL) {
+        log_warn("pool %"PRIu32" '%.*s' scan of server '%.*s' failed",
+                 pool->idx, pool->name.len, pool->name.data,
+                 server->pname.len, server->pname.data);
+        while (array_n(&keys) != 0) {
+            array_pop(&keys);
+        }
+        array_deinit(&keys);
+        migrate_error(pool);
+        return;
+    }
+
+    nkey = array_n(&keys);
+    while (array_n(&keys) != 0) {
+        kpos = array_pop(&keys);
+        if (pool->ncontinuum != 0) {
+            migrate_move(ctx, pool, s_conn, kpos->start,
+                         (uint32_t)(kpos->end - kpos->start));
+        }
+    }
+    array_deinit(&keys);
+    nc_free(buf);
+
+    pool->move_scan = 0;
+    pool->move_errors = 0;
+    pool->move_cursor = cursor;
+    pool->move_next = now + (int64_t)nkey * 1000000LL / pool->migration_rate;
+
+    if (cursor == 0) {
+        migrate_next(pool);
+    }
+}
+
+/*
+ * Account msg, the response to the MIGRATE pmsg on s_conn
+ */
+void
+migrate_move_done(struct conn *s_conn, struct msg *pmsg, struct msg *msg)
+{
+    struct server_pool *pool;
+    struct mbuf *mbuf;
+
+    pool = ((struct server *)s_conn->owner)->owner;
+    mbuf = STAILQ_FIRST(&msg->mhdr);
+
+    if (msg->type == MSG_RSP_REDIS_STATUS && mbuf_length(mbuf) >= 3 &&
+        mbuf->pos[1] == 'O' && mbuf->pos[2] == 'K') {
+        stats_pool_incr(pool->ctx, pool, migrate_moves);
+        return;
+    }
+
+    if (msg->type != MSG_RSP_REDIS_STATUS) {
+        /* BUSYKEY: the new owner holds a newer value, which is kept */
+        log_debug(LOG_INFO, "pool %"PRIu32" '%.*s' move req %"PRIu64" failed "
+                  "with rsp type %d", pool->idx, pool->name.len,
+                  pool->name.data, pmsg->id, msg->type);
+        stats_pool_incr(pool->ctx, pool, migrate_move_errors);
+    }
+}
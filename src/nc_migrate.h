@@ -0,0 +1,16 @@
+#ifndef _NC_MIGRATE_H_
+#define _NC_MIGRATE_H_
+
+#include <nc_core.h>
+
+#define MIGRATE_BATCH       100     /* max # keys asked for by a SCAN */
+#define MIGRATE_TIMEOUT     1000    /* SCAN and MIGRATE timeout in msec */
+#define MIGRATE_MAX_ERRORS  3       /* # failed SCANs before a server is skipped */
+
+void migrate_start(struct server_pool *pool);
+bool migrate_active(struct server_pool *pool);
+void migrate_run(struct context *ctx);
+void migrate_scan_done(struct conn *s_conn, struct msg *pmsg, struct msg *msg);
+void migrate_move_done(struct conn *s_conn, struct msg *pmsg, struct msg *msg);
+
+#endif
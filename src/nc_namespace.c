@@ -0,0 +1,333 @@
+#include <stdlib.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_namespace.h>
+#include <hashkit/nc_hashkit.h>
+
+/*
+ * Traffic of a pool with namespace: broken down by the namespace of the
+ * key, which is the part of the key before the namespace: delimiter or,
+ * with namespace: hash_tag, the part within the hash_tag: of the pool.
+ * Keys without a namespace are counted under the empty namespace.
+ *
+ * A pool tracks at most namespace_top: namespaces, the top ones by requests
+ * (see nc_topk.c). A namespace that shows up while all of them are taken
+ * replaces the one with the fewest requests, whose traffic is folded into
+ * "other", and starts from the requests of the namespace it replaced, its
+ * overcount.
+ */
+
+static struct ns_table *
+ns_create(uint32_t size)
+{
+    struct ns_table *ns;
+
+    ns = nc_zalloc(sizeof(*ns));
+    if (ns == NULL) {
+        return NULL;
+    }
+
+    ns->entry = nc_zalloc(size * sizeof(*ns->entry));
+    if (ns->entry == NULL || topk_init(&ns->topk, size) != NC_OK) {
+        if (ns->entry != NULL) {
+            nc_free(ns->entry);
+        }
+        nc_free(ns);
+        return NULL;
+    }
+
+    return ns;
+}
+
+void
+ns_deinit(struct server_pool *pool)
+{
+    struct ns_table *ns = pool->ns;
+
+    if (ns == NULL) {
+        return;
+    }
+
+    topk_deinit(&ns->topk);
+    nc_free(ns->entry);
+    nc_free(pool->ns);
+}
+
+/*
+ * Return the namespace {name, namelen} of the first key of req in pool
+ */
+static void
+ns_name(struct server_pool *pool, struct msg *req, uint8_t **name,
+        uint32_t *namelen)
+{
+    struct keypos *kpos;
+    uint8_t *start, *end, *p, *q;
+
+    *name = NULL;
+    *namelen = 0;
+
+    if (array_n(req->keys) == 0) {
+        return;
+    }
+
+    kpos = array_get(req->keys, 0);
+    start = kpos->start;
+    end = kpos->end;
+
+    if (pool->namespace_delimiter < 0) {
+        p = nc_strchr(start, end, pool->hash_tag.data[0]);
+        if (p == NULL) {
+            return;
+        }
+        q = nc_strchr(p + 1, end, pool->hash_tag.data[1]);
+        if (q == NULL || q - p <= 1) {
+            return;
+        }
+        start = p + 1;
+        end = q;
+    } else {
+        q = nc_strchr(start, end, pool->namespace_delimiter);
+        if (q == NULL) {
+            return;
+        }
+        end = q;
+    }
+
+    *name = start;
+    *namelen = MIN((uint32_t)(end - start), NS_NAME_MAXLEN);
+}
+
+/*
+ * Fold the traffic of e, an entry that is evicted, into other
+ */
+static void
+ns_fold(struct ns_table *ns, struct ns_entry *e)
+{
+    struct ns_entry *other = &ns->other;
+
+    other->requests += e->requests;
+    other->request_bytes += e->request_bytes;
+    other->response_bytes += e->response_bytes;
+    other->hits += e->hits;
+    other->misses += e->misses;
+    other->errors += e->errors;
+    other->latency_us += e->latency_us;
+    other->max_latency_us = MAX(other->max_latency_us, e->max_latency_us);
+}
+
+static struct ns_entry *
+ns_lookup(struct ns_table *ns, uint8_t *name, uint32_t namelen)
+{
+    struct ns_entry *e;
+    uint32_t hash;
+    int32_t i;
+    bool evicted;
+
+    hash = hash_murmur((char *)name, namelen);
+
+    for (i = topk_first(&ns->topk, hash); i >= 0; i = ns->topk.node[i].next) {
+        e = &ns->entry[i];
+        if (ns->topk.node[i].hash == hash && e->namelen == namelen &&
+            (namelen == 0 || memcmp(e->name, name, namelen) == 0)) {
+            return e;
+        }
+    }
+
+    i = (int32_t)topk_insert(&ns->topk, hash, &evicted);
+    e = &ns->entry[i];
+    if (evicted) {
+        ns_fold(ns, e);
+    }
+
+    memset(e, 0, sizeof(*e));
+    if (namelen != 0) {
+        nc_memcpy(e->name, name, namelen);
+    }
+    e->namelen = namelen;
+    e->overcount = ns->topk.node[i].count;
+
+    return e;
+}
+
+static bool
+ns_error(struct msg *rsp)
+{
+    switch (rsp->type) {
+    case MSG_RSP_MC_ERROR:
+    case MSG_RSP_MC_CLIENT_ERROR:
+    case MSG_RSP_MC_SERVER_ERROR:
+        return true;
+
+    default:
+        break;
+    }
+
+    return rsp->error || (rsp->type >= MSG_RSP_REDIS_ERROR &&
+                          rsp->type <= MSG_RSP_REDIS_ERROR_NOREPLICAS);
+}
+
+/*
+ * Account req, a request received on c_conn, and rsp, its response, to the
+ * namespace of its first key. Fragments of a request are left out, as their
+ * owner stands for them.
+ */
+void
+ns_request(struct conn *c_conn, struct msg *req, struct msg *rsp)
+{
+    struct server_pool *pool;
+    struct ns_entry *e;
+    uint8_t *name;
+    uint32_t namelen;
+    int64_t latency;
+
+    pool = c_conn->owner;
+    if (pool->namespace_top == 0) {
+        return;
+    }
+
+    if (req->frag_owner != NULL && req->frag_owner != req) {
+        return;
+    }
+
+    if (pool->ns == NULL) {
+        pool->ns = ns_create(pool->namespace_top);
+        if (pool->ns == NULL) {
+            return;
+        }
+    }
+
+    ns_name(pool, req, &name, &namelen);
+    e = ns_lookup(pool->ns, name, namelen);
+
+    e->requests++;
+    e->request_bytes += req->mlen;
+    e->response_bytes += rsp->mlen;
+    topk_count(&pool->ns->topk, (uint32_t)(e - pool->ns->entry));
+
+    if (ns_error(rsp)) {
+        e->errors++;
+    } else if (req_retryable(req)) {
+        if (req->miss) {
+            e->misses++;
+        } else {
+            e->hits++;
+        }
+    }
+
+    if (req->start_ts > 0) {
+        latency = nc_usec_now() - req->start_ts;
+        e->latency_us += latency;
+        e->max_latency_us = MAX(e->max_latency_us, latency);
+    }
+}
+
+static rstatus_t
+ns_dump_entry(struct stats_buffer *buf, struct ns_entry *e)
+{
+    return stats_buf_printf(buf, "{\"requests\":%"PRId64", \"request_bytes\":"
+                            "%"PRId64", \"response_bytes\":%"PRId64", \"hits\":"
+                            "%"PRId64", \"misses\":%"PRId64", \"errors\":"
+                            "%"PRId64", \"latency_us\":%"PRId64", "
+                            "\"max_latency_us\":%"PRId64", \"overcount\":"
+                            "%"PRId64"}", e->requests, e->request_bytes,
+                            e->response_bytes, e->hits, e->misses, e->errors,
+                            e->latency_us, e->max_latency_us, e->overcount);
+}
+
+static int
+ns_entry_cmp(const void *t1, const void *t2)
+{
+    const struct ns_entry *e1 = *(const struct ns_entry * const *)t1;
+    const struct ns_entry *e2 = *(const struct ns_entry * const *)t2;
+
+    if (e1->requests != e2->requests) {
+        return e1->requests > e2->requests ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static rstatus_t
+ns_dump_pool(struct stats_buffer *buf, struct server_pool *pool)
+{
+    rstatus_t status;
+    struct ns_table *ns = pool->ns;
+    struct ns_entry **sorted;
+    uint32_t i;
+
+    sorted = nc_alloc(ns->topk.nitem * sizeof(*sorted) + 1);
+    if (sorted == NULL) {
+        return NC_ENOMEM;
+    }
+
+    for (i = 0; i < ns->topk.nitem; i++) {
+        sorted[i] = &ns->entry[i];
+    }
+    qsort(sorted, ns->topk.nitem, sizeof(*sorted), ns_entry_cmp);
+
+    status = stats_buf_printf(buf, ", \"%.*s\":{\"namespaces\":{",
+                              pool->name.len, pool->name.data);
+
+    for (i = 0; i < ns->topk.nitem && status == NC_OK; i++) {
+        if (i > 0) {
+            status = stats_buf_printf(buf, ", ");
+        }
+        if (status == NC_OK) {
+            status = stats_buf_add_json(buf, sorted[i]->name,
+                                        sorted[i]->namelen);
+        }
+        if (status == NC_OK) {
+            status = stats_buf_printf(buf, ":");
+        }
+        if (status == NC_OK) {
+            status = ns_dump_entry(buf, sorted[i]);
+        }
+    }
+
+    if (status == NC_OK) {
+        status = stats_buf_printf(buf, "}, \"other\":");
+    }
+    if (status == NC_OK) {
+        status = ns_dump_entry(buf, &ns->other);
+    }
+    if (status == NC_OK) {
+        status = stats_buf_printf(buf, "}");
+    }
+
+    nc_free(sorted);
+
+    return status;
+}
+
+/*
+ * Append the namespaces of every pool, or of the pool named by args, to
+ * buf
+ */
+rstatus_t
+ns_dump(struct context *ctx, struct stats_buffer *buf, char *args)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    uint32_t i;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        pool = array_get(&ctx->pool, i);
+
+        if (pool->ns == NULL) {
+            continue;
+        }
+
+        if (args != NULL && (pool->name.len != strlen(args) ||
+            nc_strncmp(pool->name.data, args, pool->name.len) != 0)) {
+            continue;
+        }
+
+        status = ns_dump_pool(buf, pool);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
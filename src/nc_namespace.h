@@ -0,0 +1,36 @@
+#ifndef _NC_NAMESPACE_H_
+#define _NC_NAMESPACE_H_
+
+#include <nc_core.h>
+#include <nc_topk.h>
+
+#define NS_NAME_MAXLEN  64  /* max # bytes of a namespace name */
+
+struct ns_entry {
+    uint8_t  name[NS_NAME_MAXLEN]; /* namespace name */
+    uint32_t namelen;              /* namespace name length */
+    int64_t  overcount;            /* # requests counted before it was tracked */
+    int64_t  requests;             /* # requests */
+    int64_t  request_bytes;        /* total request bytes */
+    int64_t  response_bytes;       /* total response bytes */
+    int64_t  hits;                 /* # single key reads that hit */
+    int64_t  misses;               /* # single key reads that missed */
+    int64_t  errors;               /* # error responses */
+    int64_t  latency_us;           /* total latency in usec */
+    int64_t  max_latency_us;       /* max latency in usec */
+};
+
+/*
+ * Traffic of the top namespaces of a pool, and of all the others
+ */
+struct ns_table {
+    struct topk     topk;     /* top namespace_top: namespaces by requests */
+    struct ns_entry other;    /* traffic of the evicted namespaces */
+    struct ns_entry *entry;   /* entry[] of each item of topk */
+};
+
+void ns_request(struct conn *c_conn, struct msg *req, struct msg *rsp);
+rstatus_t ns_dump(struct context *ctx, struct stats_buffer *buf, char *args);
+void ns_deinit(struct server_pool *pool);
+
+#endif
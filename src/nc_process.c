@@ -7,6 +7,7 @@
 #include <nc_conf.h>
 #include <nc_process.h>
 #include <nc_proxy.h>
+#include <nc_watch.h>
 
 
 static rstatus_t nc_migrate_proxies(struct context *dst, struct context *src);
@@ -18,12 +19,20 @@ static rstatus_t nc_shutdown_workers(struct array *workers);
 // Global process management states.
 bool pm_reload = false;
 bool pm_respawn = false;
+bool pm_reap = false;
 char pm_myrole = ROLE_MASTER;
 bool pm_quit = false; // quit right away
 bool pm_terminate= false; // quit after worker_shutdown_timeout
 
 struct instance *master_nci = NULL;
 
+/*
+ * Serializes the stats and watch threads, which read and admin the worker
+ * contexts kept in master_nci->workers, with the master loop, which reaps
+ * and respawns workers and replaces them all on reload
+ */
+static pthread_mutex_t pm_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static rstatus_t
 nc_clone_instance(struct instance *dst, struct instance *src)
 {
@@ -80,6 +89,15 @@ nc_multi_processes_cycle(struct instance *parent_nci)
     rstatus_t status;
     struct context *ctx, *prev_ctx;
     sigset_t set;
+    bool reloaded;
+
+    /*
+     * Signals are only taken in sigsuspend() below, so that no flag set by
+     * a signal handler is missed between its check and the wait
+     */
+    sigfillset(&set);
+    sigdelset(&set, SIGSEGV);
+    sigprocmask(SIG_BLOCK, &set, NULL);
 
     status = core_init_stats(parent_nci);
     if (status != NC_OK) {
@@ -93,13 +111,28 @@ nc_multi_processes_cycle(struct instance *parent_nci)
         return status;
     }
 
+    status = watch_start(parent_nci->ctx);
+    if (status != NC_OK) {
+        log_error("[master] failed to watch servers files");
+        return status;
+    }
+
     for (;;) {
+        nc_lock_workers();
+
+        if (pm_reap) {
+            pm_reap = false;
+            nc_reap_worker();
+        }
+
+        reloaded = false;
         if (pm_reload) {
             pm_reload = false; // restart workers
             log_debug(LOG_NOTICE, "reloading config");
             ctx = core_ctx_create(parent_nci);
             if (ctx == NULL) {
                 log_error("[master] failed to recreate context");
+                nc_unlock_workers();
                 continue;
             }
             prev_ctx = parent_nci->ctx;
@@ -110,21 +143,34 @@ nc_multi_processes_cycle(struct instance *parent_nci)
             if (status != NC_OK) {
                 // skip reloading
                 parent_nci->ctx = prev_ctx;
+                nc_unlock_workers();
                 continue;
             }
             prev_ctx->stats = NULL;
             core_ctx_destroy(prev_ctx);
             pm_respawn = true; // restart workers
+            reloaded = true;
         }
 
         if (pm_respawn) {
             pm_respawn = false;
             status = nc_spawn_workers(&parent_nci->workers);
             if (status != NC_OK) {
+                nc_unlock_workers();
                 break;
             }
         }
 
+        nc_unlock_workers();
+
+        /*
+         * Watch the servers files of the new config out of the lock, as the
+         * watch thread takes it while it holds the watch lock
+         */
+        if (reloaded && watch_start(parent_nci->ctx) != NC_OK) {
+            log_error("[master] failed to watch servers files");
+        }
+
         sigemptyset(&set);
         sigsuspend(&set); // wake when signal arrives.
     }
@@ -316,7 +362,7 @@ nc_worker_process(int worker_id, struct instance *nci)
         return;
     }
 
-    status = nc_add_channel_event(nci->ctx->evb, nci->chan->fds[1]);
+    status = nc_add_channel_event(nci->ctx, nci->chan->fds[1]);
     if (status != NC_OK) {
         log_error("failed to add channel event");
         return;
@@ -362,6 +408,23 @@ nc_single_process_cycle(struct instance *nci)
         return status;
     }
 
+    /* admin commands from the stats thread are applied in this loop */
+    nci->chan = nc_alloc_channel();
+    if (nci->chan == NULL) {
+        return NC_ENOMEM;
+    }
+
+    status = nc_add_channel_event(nci->ctx, nci->chan->fds[1]);
+    if (status != NC_OK) {
+        log_error("failed to add channel event");
+        return status;
+    }
+
+    status = watch_start(nci->ctx);
+    if (status != NC_OK) {
+        return status;
+    }
+
     for (;;) {
         status = core_loop(nci->ctx);
         if (status != NC_OK) {
@@ -377,6 +440,28 @@ nc_reload_config(void)
     pm_reload = true;
 }
 
+/*
+ * Workers are reaped and respawned in the master loop, under the lock that
+ * the stats and watch threads take, not in the SIGCHLD handler
+ */
+void
+nc_reap_workers_later(void)
+{
+    pm_reap = true;
+}
+
+void
+nc_lock_workers(void)
+{
+    pthread_mutex_lock(&pm_lock);
+}
+
+void
+nc_unlock_workers(void)
+{
+    pthread_mutex_unlock(&pm_lock);
+}
+
 void
 nc_reap_worker(void)
 {
@@ -483,9 +568,118 @@ nc_signal_workers(struct array *workers, int command)
     for (i = 0, nelem = array_n(workers); i < nelem; i++) {
         elem = array_get(workers, i);
         worker_nci = (struct instance *)elem;
+        memset(&msg, 0, sizeof(msg));
         msg.command = command;
         if (nc_write_channel(worker_nci->chan->fds[0], &msg) <= 0) {
             log_error("failed to write channel, err %s", strerror(errno));
         }
     }
 }
+
+/*
+ * Apply an admin command from the stats or watch thread. In multi process
+ * mode, the command is applied to the copies of worker contexts in the
+ * master, so that a respawned worker inherits it, and then sent to each
+ * worker over its channel. In single process mode, it is sent to the event
+ * loop over its own channel. Returns NULL on success, or an error string.
+ */
+char *
+nc_admin_workers(struct chan_msg *msg)
+{
+    struct instance *worker_nci;
+    uint32_t i, nelem;
+    char *err;
+
+    ASSERT(msg->command == NC_CMD_ADMIN);
+
+    nc_lock_workers();
+
+    nelem = array_n(&master_nci->workers);
+
+    if (nelem == 0) {
+        err = NULL;
+        if (msg->admin != SERVER_ADMIN_JOIN &&
+            server_admin_find(&master_nci->ctx->pool, msg) == NULL) {
+            err = "no such pool or server";
+        } else if (nc_write_channel(master_nci->chan->fds[0], msg) <= 0) {
+            log_error("failed to write channel, err %s", strerror(errno));
+            err = "failed to write channel";
+        }
+        nc_unlock_workers();
+        return err;
+    }
+
+    for (i = 0; i < nelem; i++) {
+        worker_nci = array_get(&master_nci->workers, i);
+
+        err = server_admin(worker_nci->ctx, msg);
+        if (err != NULL) {
+            nc_unlock_workers();
+            return err;
+        }
+    }
+
+    for (i = 0; i < nelem; i++) {
+        worker_nci = array_get(&master_nci->workers, i);
+
+        if (nc_write_channel(worker_nci->chan->fds[0], msg) <= 0) {
+            log_error("failed to write channel, err %s", strerror(errno));
+        }
+    }
+
+    nc_unlock_workers();
+
+    return NULL;
+}
+
+/*
+ * Hand a stats port connection over from the stats thread to the worker
+ * with index worker, or to every worker if worker is -1, or to the event
+ * loop in single process mode, each of which gets its own descriptor of it,
+ * to attach a tap to or to write a dump to. Returns NULL on success, or an
+ * error string.
+ */
+char *
+nc_handoff_workers(struct chan_msg *msg, int worker)
+{
+    struct instance *worker_nci;
+    uint32_t i, nelem, nsent;
+
+    ASSERT(msg->command == NC_CMD_TAP || msg->command == NC_CMD_DUMP);
+
+    nc_lock_workers();
+
+    nelem = array_n(&master_nci->workers);
+
+    if (worker >= (int)MAX(nelem, 1)) {
+        nc_unlock_workers();
+        return "no such worker";
+    }
+
+    if (nelem == 0) {
+        nsent = nc_write_channel(master_nci->chan->fds[0], msg) > 0 ? 1 : 0;
+        if (nsent == 0) {
+            log_error("failed to write channel, err %s", strerror(errno));
+        }
+        nc_unlock_workers();
+        return nsent > 0 ? NULL : "failed to write channel";
+    }
+
+    for (i = 0, nsent = 0; i < nelem; i++) {
+        if (worker >= 0 && i != (uint32_t)worker) {
+            continue;
+        }
+
+        worker_nci = array_get(&master_nci->workers, i);
+
+        if (nc_write_channel(worker_nci->chan->fds[0], msg) <= 0) {
+            log_error("failed to write channel, err %s", strerror(errno));
+            continue;
+        }
+        nsent++;
+    }
+
+    nc_unlock_workers();
+
+    return nsent > 0 ? NULL : "failed to write channel";
+}
@@ -13,9 +13,13 @@
 #define NC_CMD_LOG_REOPEN 3
 #define NC_CMD_LOG_LEVEL_UP 4
 #define NC_CMD_LOG_LEVEL_DOWN 5
+#define NC_CMD_ADMIN 6
+#define NC_CMD_TAP 7
+#define NC_CMD_DUMP 8
 
 extern bool pm_reload;
 extern bool pm_respawn;
+extern bool pm_reap;
 extern char pm_myrole;
 extern bool pm_quit;
 extern struct instance *master_nci;
@@ -25,6 +29,11 @@ rstatus_t nc_multi_processes_cycle(struct instance *parent_nci);
 rstatus_t nc_single_process_cycle(struct instance *nci);
 void      nc_reload_config(void);
 void      nc_reap_worker(void);
+void      nc_reap_workers_later(void);
+void      nc_lock_workers(void);
+void      nc_unlock_workers(void);
 void      nc_signal_workers(struct array *workers, int command);
+char      *nc_admin_workers(struct chan_msg *msg);
+char      *nc_handoff_workers(struct chan_msg *msg, int worker);
 
 #endif //_NC_PROCESS_H
@@ -21,6 +21,10 @@
 #include <nc_core.h>
 #include <nc_server.h>
 #include <nc_proxy.h>
+#include <nc_talker.h>
+
+/* max # connections accepted on a listener per readiness event */
+#define PROXY_ACCEPT_BATCH  64
 
 void
 proxy_ref(struct conn *conn, void *owner)
@@ -78,6 +82,11 @@ proxy_close(struct context *ctx, struct conn *conn)
     ASSERT(TAILQ_EMPTY(&conn->imsg_q));
     ASSERT(TAILQ_EMPTY(&conn->omsg_q));
 
+    if (conn->paused) {
+        conn->paused = 0;
+        ctx->npaused--;
+    }
+
     conn->unref(conn);
 
     status = close(conn->sd);
@@ -164,6 +173,16 @@ proxy_listen(struct context *ctx, struct conn *p)
         }
     }
 
+    /* accepted client connections inherit TCP_NODELAY from the listener */
+    if (p->family == AF_INET || p->family == AF_INET6) {
+        status = nc_set_tcpnodelay(p->sd);
+        if (status < 0) {
+            log_warn("set tcpnodelay on p %d on addr '%.*s' failed, ignored: "
+                     "%s", p->sd, pool->addrstr.len, pool->addrstr.data,
+                     strerror(errno));
+        }
+    }
+
     status = listen(p->sd, pool->backlog);
     if (status < 0) {
         log_error("listen on p %d on addr '%.*s' failed: %s", p->sd,
@@ -231,15 +250,13 @@ proxy_init(struct context *ctx)
     return NC_OK;
 }
 
-rstatus_t
-proxy_each_post_init(void *elem, void *data)
+static rstatus_t
+proxy_arm(struct context *ctx, struct conn *p)
 {
     rstatus_t status;
-    struct server_pool *pool = elem;
-    struct conn *p;
+    struct server_pool *pool = p->owner;
 
-    p = pool->p_conn;
-    status = event_add_conn(pool->ctx->evb, p);
+    status = event_add_conn(ctx->evb, p);
     if (status < 0) {
         log_error("event add conn p %d on addr '%.*s' failed: %s",
                   p->sd, pool->addrstr.len, pool->addrstr.data,
@@ -247,7 +264,7 @@ proxy_each_post_init(void *elem, void *data)
         return NC_ERROR;
     }
 
-    status = event_del_out(pool->ctx->evb, p);
+    status = event_del_out(ctx->evb, p);
     if (status < 0) {
         log_error("event del out p %d on addr '%.*s' failed: %s",
                   p->sd, pool->addrstr.len, pool->addrstr.data,
@@ -258,6 +275,14 @@ proxy_each_post_init(void *elem, void *data)
     return NC_OK;
 }
 
+rstatus_t
+proxy_each_post_init(void *elem, void *data)
+{
+    struct server_pool *pool = elem;
+
+    return proxy_arm(pool->ctx, pool->p_conn);
+}
+
 // Add proxy's listening sockets to event pool
 rstatus_t
 proxy_post_init(struct context *ctx)
@@ -315,13 +340,75 @@ proxy_each_unaccept(void *elem, void *data)
     struct context *ctx = pool->ctx;
 
     p = pool->p_conn;
-    if (p != NULL && ctx != NULL) {
-        event_del_conn(ctx->evb, p);
+    if (p == NULL || ctx == NULL) {
+        return NC_OK;
     }
 
+    if (p->paused) {
+        /* paused listener is already out of the event base */
+        p->paused = 0;
+        ctx->npaused--;
+        return NC_OK;
+    }
+
+    event_del_conn(ctx->evb, p);
+
     return NC_OK;
 }
 
+/*
+ * Mask out the listener on fd exhaustion, so that pending connections wait
+ * in the kernel backlog instead of waking us up over and over again. The
+ * listener is armed again by proxy_resume() when a connection gets closed.
+ */
+static void
+proxy_pause(struct context *ctx, struct conn *p)
+{
+    rstatus_t status;
+
+    ASSERT(p->proxy && !p->client);
+    ASSERT(!p->paused);
+
+    status = event_del_conn(ctx->evb, p);
+    if (status < 0) {
+        log_error("event del conn p %d failed: %s", p->sd, strerror(errno));
+        return;
+    }
+
+    p->paused = 1;
+    ctx->npaused++;
+
+    log_warn("pause accept on p %d with %"PRIu32" used connections",
+             p->sd, conn_ncurr_conn());
+}
+
+void
+proxy_resume(struct context *ctx)
+{
+    rstatus_t status;
+    uint32_t i, npool;
+
+    for (i = 0, npool = array_n(&ctx->pool); i < npool; i++) {
+        struct server_pool *pool = array_get(&ctx->pool, i);
+        struct conn *p = pool->p_conn;
+
+        if (p == NULL || !p->paused) {
+            continue;
+        }
+
+        p->paused = 0;
+        ctx->npaused--;
+
+        status = proxy_arm(ctx, p);
+        if (status != NC_OK) {
+            continue;
+        }
+
+        log_debug(LOG_INFO, "resume accept on p %d with %"PRIu32" used "
+                  "connections", p->sd, conn_ncurr_conn());
+    }
+}
+
 static rstatus_t
 proxy_accept(struct context *ctx, struct conn *p)
 {
@@ -335,7 +422,11 @@ proxy_accept(struct context *ctx, struct conn *p)
     ASSERT(p->recv_active && p->recv_ready);
 
     for (;;) {
+#ifdef NC_HAVE_ACCEPT4
+        sd = accept4(p->sd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
         sd = accept(p->sd, NULL, NULL);
+#endif
         if (sd < 0) {
             if (errno == EINTR) {
                 log_debug(LOG_VERB, "accept on p %d not ready - eintr", p->sd);
@@ -349,16 +440,13 @@ proxy_accept(struct context *ctx, struct conn *p)
             }
 
             /*
-             * Workaround of https://github.com/twitter/twemproxy/issues/97
+             * See: https://github.com/twitter/twemproxy/issues/97
              *
              * We should never reach here because the check for conn_ncurr_cconn()
              * against ctx->max_ncconn should catch this earlier in the cycle.
-             * If we reach here ignore EMFILE/ENFILE, return NC_OK will enable
-             * the server continue to run instead of close the server socket
-             *
-             * The right solution however, is on EMFILE/ENFILE to mask out IN
-             * event on the proxy and mask it back in when some existing
-             * connections gets closed
+             * If we reach here, we mask out the IN event on the proxy and mask
+             * it back in when some existing connection gets closed, instead
+             * of closing the listener or spinning on it
              */
             if (errno == EMFILE || errno == ENFILE) {
                 log_debug(LOG_CRIT, "accept on p %d with max fds %"PRIu32" "
@@ -368,6 +456,7 @@ proxy_accept(struct context *ctx, struct conn *p)
                           ctx->max_ncconn, conn_ncurr_cconn(), strerror(errno));
 
                 p->recv_ready = 0;
+                proxy_pause(ctx, p);
 
                 return NC_OK;
             }
@@ -404,6 +493,9 @@ proxy_accept(struct context *ctx, struct conn *p)
 
     stats_pool_incr(ctx, c->owner, client_connections);
 
+    talker_accept(c);
+
+#ifndef NC_HAVE_ACCEPT4
     status = nc_set_nonblocking(c->sd);
     if (status < 0) {
         log_error("set nonblock on c %d from p %d failed: %s", c->sd, p->sd,
@@ -411,6 +503,7 @@ proxy_accept(struct context *ctx, struct conn *p)
         c->close(ctx, c);
         return status;
     }
+#endif
 
     if (pool->tcpkeepalive) {
         status = nc_set_tcpkeepalive(c->sd);
@@ -420,14 +513,6 @@ proxy_accept(struct context *ctx, struct conn *p)
         }
     }
 
-    if (p->family == AF_INET || p->family == AF_INET6) {
-        status = nc_set_tcpnodelay(c->sd);
-        if (status < 0) {
-            log_warn("set tcpnodelay on c %d from p %d failed, ignored: %s",
-                     c->sd, p->sd, strerror(errno));
-        }
-    }
-
     status = event_add_conn(ctx->evb, c);
     if (status < 0) {
         log_error("event add conn from p %d failed: %s", p->sd,
@@ -446,17 +531,36 @@ rstatus_t
 proxy_recv(struct context *ctx, struct conn *conn)
 {
     rstatus_t status;
+    uint32_t naccept;
 
     ASSERT(conn->proxy && !conn->client);
     ASSERT(conn->recv_active);
 
     conn->recv_ready = 1;
+    naccept = 0;
     do {
         status = proxy_accept(ctx, conn);
         if (status != NC_OK) {
             return status;
         }
-    } while (conn->recv_ready);
+    } while (conn->recv_ready && ++naccept < PROXY_ACCEPT_BATCH);
+
+    if (conn->recv_ready) {
+        /*
+         * Accept batch is exhausted with connections still pending. Yield
+         * to the other connections and re-arm the edge-triggered listener,
+         * so that the backlog gets drained on the next event loop cycle
+         */
+        log_debug(LOG_VERB, "accept batch of %"PRIu32" exhausted on p %d",
+                  naccept, conn->sd);
+
+        status = event_del_conn(ctx->evb, conn);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        return proxy_arm(ctx, conn);
+    }
 
     return NC_OK;
 }
@@ -32,6 +32,7 @@ rstatus_t proxy_each_unaccept(void *elem, void *data);
 rstatus_t proxy_init(struct context *ctx);
 rstatus_t proxy_post_init(struct context *ctx);
 void proxy_deinit(struct context *ctx);
+void proxy_resume(struct context *ctx);
 rstatus_t proxy_recv(struct context *ctx, struct conn *conn);
 
 #endif
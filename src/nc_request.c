@@ -15,8 +15,15 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_conf.h>
+#include <nc_hll.h>
+#include <nc_slowlog.h>
+#include <nc_talker.h>
+#include <nc_splice.h>
 #include <proto/nc_proto.h>
 
 struct msg *
@@ -56,6 +63,11 @@ req_log(struct msg *req)
     if (req->mlen == 0) {
         return;
     }
+
+    /* swallowed copies of requests have no client */
+    if (req->owner == NULL) {
+        return;
+    }
     /*
      * there is a race scenario where a requests comes in, the log level is not LOG_NOTICE,
      * and before the response arrives you modify the log level to LOG_NOTICE
@@ -312,6 +324,11 @@ req_server_enqueue_imsgq(struct context *ctx, struct conn *conn, struct msg *msg
 
     TAILQ_INSERT_TAIL(&conn->imsg_q, msg, s_tqe);
 
+    /* a relay must not hold the request up on its client */
+    if (conn->splice != NULL) {
+        splice_queued(conn);
+    }
+
     stats_server_incr(ctx, conn->owner, in_queue);
     stats_server_incr_by(ctx, conn->owner, in_queue_bytes, msg->mlen);
 }
@@ -359,6 +376,7 @@ req_client_enqueue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
     ASSERT(conn->client && !conn->proxy);
 
     TAILQ_INSERT_TAIL(&conn->omsg_q, msg, c_tqe);
+    conn->nomsg++;
 }
 
 void
@@ -380,6 +398,7 @@ req_client_dequeue_omsgq(struct context *ctx, struct conn *conn, struct msg *msg
     ASSERT(conn->client && !conn->proxy);
 
     TAILQ_REMOVE(&conn->omsg_q, msg, c_tqe);
+    conn->nomsg--;
 }
 
 void
@@ -519,6 +538,16 @@ req_filter(struct context *ctx, struct conn *conn, struct msg *msg)
         pool = conn->owner;
         msg->noforward = array_n(&pool->redis_master) <= 0 ? 1 : 0;
     }
+
+    /*
+     * Commands after MULTI are queued and answered by the redis_reply
+     * handler. EXEC forwards them, unless there are none or one failed.
+     */
+    if (conn->multi && conn_authenticated(conn)) {
+        msg->noforward = (msg->type == MSG_REQ_REDIS_EXEC &&
+                          !TAILQ_EMPTY(&conn->tx_q) && !conn->tx_abort) ? 0 : 1;
+    }
+
     return false;
 }
 
@@ -551,6 +580,83 @@ req_forward_error(struct context *ctx, struct conn *conn, struct msg *msg)
     }
 }
 
+/*
+ * Return the server that a transaction sends key to: its master, if the pool
+ * serving key has one, or else its first replica
+ */
+static struct server *
+req_tx_server(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    struct server *replica[CONF_MAX_REPLICAS];
+
+    pool = server_pool_route(pool, key, keylen);
+    if (array_n(&pool->redis_master) > 0) {
+        return array_get(&pool->redis_master, 0);
+    }
+
+    if (server_pool_replicas(pool, key, keylen, replica) == 0) {
+        return NULL;
+    }
+
+    return replica[0];
+}
+
+/*
+ * Queue a copy of req, a command received on c_conn after MULTI, to be sent
+ * on EXEC. All the keys of a transaction must go to one server; if they do
+ * not, the transaction is aborted and NC_ERROR returned.
+ */
+rstatus_t
+req_tx_queue(struct conn *c_conn, struct msg *req)
+{
+    struct server *server;
+    struct keypos *kpos;
+    struct msg *tmsg;
+    uint32_t i;
+
+    ASSERT(c_conn->client && c_conn->multi);
+
+    for (i = 0; i < array_n(req->keys); i++) {
+        kpos = array_get(req->keys, i);
+        server = req_tx_server(c_conn->owner, kpos->start,
+                               (uint32_t)(kpos->end - kpos->start));
+        if (server == NULL ||
+            (c_conn->tx_server != NULL && server != c_conn->tx_server)) {
+            c_conn->tx_abort = 1;
+            return NC_ERROR;
+        }
+        c_conn->tx_server = server;
+    }
+
+    tmsg = msg_clone(req, c_conn);
+    if (tmsg == NULL) {
+        c_conn->tx_abort = 1;
+        return NC_ENOMEM;
+    }
+
+    TAILQ_INSERT_TAIL(&c_conn->tx_q, tmsg, c_tqe);
+
+    return NC_OK;
+}
+
+/*
+ * End the transaction of c_conn, dropping the commands still queued
+ */
+void
+req_tx_discard(struct conn *c_conn)
+{
+    struct msg *tmsg;
+
+    while ((tmsg = TAILQ_FIRST(&c_conn->tx_q)) != NULL) {
+        TAILQ_REMOVE(&c_conn->tx_q, tmsg, c_tqe);
+        req_put(tmsg);
+    }
+
+    c_conn->tx_server = NULL;
+    c_conn->multi = 0;
+    c_conn->tx_abort = 0;
+}
+
 static void
 req_forward_stats(struct context *ctx, struct server *server, struct msg *msg)
 {
@@ -560,6 +666,464 @@ req_forward_stats(struct context *ctx, struct server *server, struct msg *msg)
     stats_server_incr_by(ctx, server, request_bytes, msg->mlen);
 }
 
+static bool
+req_readonly(struct msg *msg)
+{
+    return msg->redis ? redis_readonly(msg) : memcache_readonly(msg);
+}
+
+/*
+ * Return true, if msg is a single key read that can be sent again to
+ * another server
+ */
+bool
+req_retryable(struct msg *msg)
+{
+    if (array_n(msg->keys) != 1) {
+        return false;
+    }
+
+    switch (msg->type) {
+    case MSG_REQ_MC_GET:
+    case MSG_REQ_MC_GETS:
+    case MSG_REQ_REDIS_GET:
+        return true;
+
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Requeue req msg, already sent to another server, on server to get a
+ * second answer. Return true, if msg was requeued.
+ */
+bool
+req_retry(struct context *ctx, struct msg *msg, struct server *server)
+{
+    rstatus_t status;
+    struct conn *s_conn;
+    struct mbuf *mbuf;
+
+    ASSERT(msg->request && !msg->done && !msg->swallow);
+
+    s_conn = server_get_conn(ctx, server);
+    if (s_conn == NULL) {
+        return false;
+    }
+
+    if (TAILQ_EMPTY(&s_conn->imsg_q)) {
+        status = event_add_out(ctx->evb, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            return false;
+        }
+    }
+
+    if (!conn_authenticated(s_conn)) {
+        status = msg->add_auth(ctx, msg->owner, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            return false;
+        }
+    }
+
+    /* rewind the already sent request */
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        mbuf->pos = mbuf->start;
+    }
+
+    msg->retried = 1;
+    s_conn->enqueue_inq(ctx, s_conn, msg);
+
+    log_debug(LOG_VERB, "retry req %"PRIu64" on s %d", msg->id, s_conn->sd);
+
+    return true;
+}
+
+/*
+ * Retry req msg, a read that missed or failed on server, on the
+ * read_fallback: of the pool of server. Return true, if msg was requeued.
+ */
+bool
+req_fallback(struct context *ctx, struct msg *msg, struct server *server)
+{
+    struct server_pool *pool;
+    struct server *target;
+    struct keypos *kpos;
+
+    pool = server->owner;
+
+    if (pool->read_fallback == NULL && !pool->read_fallback_successor) {
+        return false;
+    }
+
+    if (msg->retried || !req_retryable(msg)) {
+        return false;
+    }
+
+    kpos = array_get(msg->keys, 0);
+    target = server_pool_fallback(pool, server, kpos->start,
+                                  (uint32_t)(kpos->end - kpos->start));
+    if (target == NULL || target == server) {
+        return false;
+    }
+
+    if (!req_retry(ctx, msg, target)) {
+        return false;
+    }
+    msg->fallback = pool;
+
+    stats_pool_incr(ctx, pool, fallback_retries);
+
+    return true;
+}
+
+/*
+ * Retry req msg, a single key read that failed on server, on the next
+ * replica of its key in the pool of server. Reads fail over this way as
+ * soon as a server connection fails, before the server is ejected and
+ * with auto_eject_hosts: off. A read fails over once, even after a miss
+ * was retried on its first replica. Return true, if msg was requeued.
+ */
+bool
+req_replica_failover(struct context *ctx, struct msg *msg,
+                     struct server *server)
+{
+    struct server_pool *pool;
+    struct server *replica[CONF_MAX_REPLICAS];
+    struct keypos *kpos;
+    uint32_t i, j, nreplica;
+
+    pool = server->owner;
+
+    if (pool->replicas <= 1 || msg->failover || !req_retryable(msg)) {
+        return false;
+    }
+
+    kpos = array_get(msg->keys, 0);
+    nreplica = server_pool_replicas(pool, kpos->start,
+                                    (uint32_t)(kpos->end - kpos->start),
+                                    replica);
+
+    for (i = 0; i < nreplica && replica[i] != server; i++) {
+        ;
+    }
+
+    for (j = 1; j <= nreplica; j++) {
+        struct server *target = replica[(i + j) % nreplica];
+
+        if (target == server || !req_retry(ctx, msg, target)) {
+            continue;
+        }
+        msg->failover = 1;
+
+        stats_pool_incr(ctx, pool, replica_failovers);
+
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Enqueue on s_conn a copy of msg, received on c_conn. The copy is fire and
+ * forget: its response is swallowed, and a failure on s_conn only closes
+ * that server connection, never touching the client or msg.
+ */
+static rstatus_t
+req_copy(struct context *ctx, struct conn *c_conn, struct msg *msg,
+         struct conn *s_conn)
+{
+    rstatus_t status;
+    struct msg *cmsg;
+
+    if (TAILQ_EMPTY(&s_conn->imsg_q)) {
+        status = event_add_out(ctx->evb, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            return status;
+        }
+    }
+
+    if (!conn_authenticated(s_conn)) {
+        status = msg->add_auth(ctx, c_conn, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            return status;
+        }
+    }
+
+    cmsg = msg_clone(msg, s_conn);
+    if (cmsg == NULL) {
+        return NC_ENOMEM;
+    }
+    cmsg->swallow = 1;
+    cmsg->owner = NULL;
+
+    s_conn->enqueue_inq(ctx, s_conn, cmsg);
+
+    log_debug(LOG_VERB, "copy req %"PRIu64" as req %"PRIu64" to s %d",
+              msg->id, cmsg->id, s_conn->sd);
+
+    return NC_OK;
+}
+
+/*
+ * Send a copy of msg, forwarded on pool, to the mirror: pool of pool.
+ */
+static void
+req_mirror(struct context *ctx, struct conn *c_conn, struct server_pool *pool,
+           struct msg *msg, uint8_t *key, uint32_t keylen)
+{
+    rstatus_t status;
+    struct conn *s_conn;
+
+    if (pool->mirror == NULL) {
+        return;
+    }
+
+    if (pool->mirror_writes_only && req_readonly(msg)) {
+        return;
+    }
+
+    if (pool->mirror_sample < 100 &&
+        (uint32_t)(random() % 100) >= pool->mirror_sample) {
+        return;
+    }
+
+    s_conn = server_pool_conn(ctx, pool->mirror, key, keylen);
+    if (s_conn == NULL) {
+        stats_pool_incr(ctx, pool, mirror_drops);
+        return;
+    }
+
+    status = req_copy(ctx, c_conn, msg, s_conn);
+    if (status != NC_OK) {
+        stats_pool_incr(ctx, pool, mirror_drops);
+        return;
+    }
+
+    stats_pool_incr(ctx, pool, mirror_requests);
+}
+
+/*
+ * Send a copy of write msg, forwarded on pool, to the warmup: pool of pool,
+ * so that the warm pool stays current while the pool is warming up.
+ */
+static void
+req_warmup(struct context *ctx, struct conn *c_conn, struct server_pool *pool,
+           struct msg *msg, uint8_t *key, uint32_t keylen)
+{
+    rstatus_t status;
+    struct conn *s_conn;
+
+    if (pool->warmup == NULL || req_readonly(msg)) {
+        return;
+    }
+
+    s_conn = server_pool_conn(ctx, pool->warmup, key, keylen);
+    if (s_conn == NULL) {
+        return;
+    }
+
+    status = req_copy(ctx, c_conn, msg, s_conn);
+    if (status != NC_OK) {
+        return;
+    }
+
+    stats_pool_incr(ctx, pool, warmup_writes);
+}
+
+/*
+ * Pick a connection to one of the nreplica servers holding the key of msg,
+ * and return the index of that server in *primary. Writes and multi-key
+ * reads go to the first reachable replica, so that a fragment of a
+ * multi-key request is served by the server owning all its keys. Single
+ * key reads are spread over all replicas. Either fail over to the next
+ * replica when no connection to a server can be had, which is mostly once
+ * it is ejected with auto_eject_hosts:, as a connect is only found to fail
+ * later; a single key read that fails then is retried on the next replica
+ * by req_replica_failover.
+ */
+static struct conn *
+req_replica_conn(struct context *ctx, struct msg *msg, struct server **replica,
+                 uint32_t nreplica, uint32_t *primary)
+{
+    struct conn *s_conn;
+    uint32_t i, j, start;
+
+    start = 0;
+    if (nreplica > 1 && array_n(msg->keys) == 1 && req_readonly(msg)) {
+        start = (uint32_t)random() % nreplica;
+    }
+
+    for (i = 0; i < nreplica; i++) {
+        j = (start + i) % nreplica;
+        s_conn = server_get_conn(ctx, replica[j]);
+        if (s_conn != NULL) {
+            *primary = j;
+            return s_conn;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Copy write msg, forwarded to server, to the other replicas of each of
+ * its keys in pool. The first reply answers the client; the copies are
+ * swallowed like mirrored requests.
+ */
+static void
+req_replicate(struct context *ctx, struct conn *c_conn,
+              struct server_pool *pool, struct msg *msg, struct server *server)
+{
+    rstatus_t status;
+    struct server *replica[CONF_MAX_REPLICAS], *local[CONF_MAX_REPLICAS];
+    struct server **sent;
+    struct conn *s_conn;
+    struct keypos *kpos;
+    uint32_t i, j, k, n, nsent, nkey;
+
+    if (req_readonly(msg)) {
+        return;
+    }
+
+    nkey = array_n(msg->keys);
+    if (nkey == 1) {
+        sent = local;
+    } else {
+        sent = nc_alloc(nkey * CONF_MAX_REPLICAS * sizeof(*sent));
+        if (sent == NULL) {
+            return;
+        }
+    }
+    sent[0] = server;
+    nsent = 1;
+
+    for (i = 0; i < nkey; i++) {
+        kpos = array_get(msg->keys, i);
+        n = server_pool_replicas(pool, kpos->start,
+                                 (uint32_t)(kpos->end - kpos->start), replica);
+
+        for (j = 0; j < n; j++) {
+            for (k = 0; k < nsent && sent[k] != replica[j]; k++) {
+                ;
+            }
+            if (k < nsent) {
+                continue;
+            }
+            sent[nsent++] = replica[j];
+
+            s_conn = server_get_conn(ctx, replica[j]);
+            if (s_conn == NULL) {
+                stats_pool_incr(ctx, replica[j]->owner, replica_drops);
+                continue;
+            }
+
+            status = req_copy(ctx, c_conn, msg, s_conn);
+            if (status != NC_OK) {
+                stats_pool_incr(ctx, replica[j]->owner, replica_drops);
+                continue;
+            }
+
+            stats_pool_incr(ctx, replica[j]->owner, replica_requests);
+        }
+    }
+
+    if (sent != local) {
+        nc_free(sent);
+    }
+}
+
+/*
+ * Forward msg, the EXEC of the transaction of c_conn, to the server of its
+ * commands. MULTI and the queued commands are sent right ahead of it on the
+ * same server connection, where nothing else can get between them, and
+ * their replies are swallowed; the client gets the reply to EXEC.
+ */
+static void
+req_forward_tx(struct context *ctx, struct conn *c_conn, struct msg *msg)
+{
+    rstatus_t status;
+    struct conn *s_conn;
+    struct msg *tmsg;
+
+    ASSERT(c_conn->client && c_conn->multi);
+    ASSERT(c_conn->tx_server != NULL && !TAILQ_EMPTY(&c_conn->tx_q));
+
+    c_conn->enqueue_outq(ctx, c_conn, msg);
+
+    tmsg = msg_get(c_conn, true, c_conn->redis);
+    if (tmsg == NULL) {
+        req_tx_discard(c_conn);
+        req_forward_error(ctx, c_conn, msg);
+        return;
+    }
+
+    status = msg_prepend_format(tmsg, "*1\r\n$5\r\nMULTI\r\n");
+    if (status != NC_OK) {
+        msg_put(tmsg);
+        req_tx_discard(c_conn);
+        req_forward_error(ctx, c_conn, msg);
+        return;
+    }
+    tmsg->type = MSG_REQ_REDIS_MULTI;
+
+    s_conn = server_get_conn(ctx, c_conn->tx_server);
+    if (s_conn == NULL) {
+        msg_put(tmsg);
+        req_tx_discard(c_conn);
+        req_forward_error(ctx, c_conn, msg);
+        return;
+    }
+
+    if (TAILQ_EMPTY(&s_conn->imsg_q)) {
+        status = event_add_out(ctx->evb, s_conn);
+        if (status != NC_OK) {
+            msg_put(tmsg);
+            req_tx_discard(c_conn);
+            req_forward_error(ctx, c_conn, msg);
+            s_conn->err = errno;
+            return;
+        }
+    }
+
+    if (!conn_authenticated(s_conn)) {
+        status = msg->add_auth(ctx, c_conn, s_conn);
+        if (status != NC_OK) {
+            msg_put(tmsg);
+            req_tx_discard(c_conn);
+            req_forward_error(ctx, c_conn, msg);
+            s_conn->err = errno;
+            return;
+        }
+    }
+
+    /* as with req_copy, swallowed requests outlive their client */
+    tmsg->swallow = 1;
+    tmsg->owner = NULL;
+    s_conn->enqueue_inq(ctx, s_conn, tmsg);
+
+    while ((tmsg = TAILQ_FIRST(&c_conn->tx_q)) != NULL) {
+        TAILQ_REMOVE(&c_conn->tx_q, tmsg, c_tqe);
+        tmsg->swallow = 1;
+        tmsg->owner = NULL;
+        s_conn->enqueue_inq(ctx, s_conn, tmsg);
+    }
+    req_tx_discard(c_conn);
+
+    s_conn->enqueue_inq(ctx, s_conn, msg);
+
+    req_forward_stats(ctx, s_conn->owner, msg);
+
+    log_debug(LOG_VERB, "forward from c %d to s %d transaction req %"PRIu64,
+              c_conn->sd, s_conn->sd, msg->id);
+}
+
 static void
 req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
 {
@@ -569,6 +1133,8 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
     uint8_t *key;
     uint32_t keylen;
     struct keypos *kpos;
+    struct server *replica[CONF_MAX_REPLICAS];
+    uint32_t nreplica, primary;
 
     ASSERT(c_conn->client && !c_conn->proxy);
 
@@ -577,19 +1143,23 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
         c_conn->enqueue_outq(ctx, c_conn, msg);
     }
 
-    pool = c_conn->owner;
-
     ASSERT(array_n(msg->keys) > 0);
     kpos = array_get(msg->keys, 0);
     key = kpos->start;
     keylen = (uint32_t)(kpos->end - kpos->start);
 
+    /* pick the pool serving the key, through routes: if any */
+    pool = server_pool_route(c_conn->owner, key, keylen);
+    nreplica = 0;
+    primary = 0;
+
     if (pool->redis && !redis_readonly(msg) && array_n(&pool->redis_master) > 0) {
         struct server *master = array_get(&pool->redis_master, 0);
         /* pick a connection to a given server */
         s_conn = server_get_conn(ctx, master);
     } else {
-        s_conn = server_pool_conn(ctx, c_conn->owner, key, keylen);
+        nreplica = server_pool_replicas(pool, key, keylen, replica);
+        s_conn = req_replica_conn(ctx, msg, replica, nreplica, &primary);
     }
     if (s_conn == NULL) {
         req_forward_error(ctx, c_conn, msg);
@@ -620,9 +1190,19 @@ req_forward(struct context *ctx, struct conn *c_conn, struct msg *msg)
 
     req_forward_stats(ctx, s_conn->owner, msg);
 
+    hll_forward(s_conn->owner, msg);
+
+    if (nreplica > 1) {
+        req_replicate(ctx, c_conn, pool, msg, replica[primary]);
+    }
+
     log_debug(LOG_VERB, "forward from c %d to s %d req %"PRIu64" len %"PRIu32
               " type %d with key '%.*s'", c_conn->sd, s_conn->sd, msg->id,
               msg->mlen, msg->type, keylen, key);
+
+    req_warmup(ctx, c_conn, ((struct server *)s_conn->owner)->owner, msg, key,
+               keylen);
+    req_mirror(ctx, c_conn, pool, msg, key, keylen);
 }
 
 void
@@ -648,6 +1228,8 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         return;
     }
 
+    talker_request(conn, msg);
+
     if (msg->noforward) {
         status = req_make_reply(ctx, conn, msg);
         if (status != NC_OK) {
@@ -669,10 +1251,15 @@ req_recv_done(struct context *ctx, struct conn *conn, struct msg *msg,
         return;
     }
 
+    if (conn->multi) {
+        req_forward_tx(ctx, conn, msg);
+        return;
+    }
+
     /* do fragment */
     pool = conn->owner;
     TAILQ_INIT(&frag_msgq);
-    status = msg->fragment(msg, pool->ncontinuum, &frag_msgq);
+    status = msg->fragment(msg, server_pool_nbackend(pool), &frag_msgq);
     if (status != NC_OK) {
         if (!msg->noreply) {
             conn->enqueue_outq(ctx, conn, msg);
@@ -762,6 +1349,8 @@ req_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
     /* dequeue the message (request) from server inq */
     conn->dequeue_inq(ctx, conn, msg);
 
+    slowlog_send(conn, msg);
+
     /*
      * noreply request instructs the server not to send any response. So,
      * enqueue message (request) in server outq, if response is expected.
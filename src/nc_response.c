@@ -17,7 +17,13 @@
 
 #include <nc_core.h>
 #include <nc_server.h>
+#include <nc_conf.h>
 #include <nc_process.h>
+#include <nc_tap.h>
+#include <nc_namespace.h>
+#include <nc_slowlog.h>
+#include <nc_talker.h>
+#include <proto/nc_proto.h>
 
 struct msg *
 rsp_get(struct conn *conn)
@@ -231,6 +237,212 @@ rsp_forward_stats(struct context *ctx, struct server *server, struct msg *msg, u
     stats_server_incr_by(ctx, server, response_bytes, msgsize);
 }
 
+static bool
+rsp_miss(struct msg *pmsg, struct msg *msg)
+{
+    return pmsg->redis ? redis_miss(msg) : memcache_miss(msg);
+}
+
+/*
+ * Copy the hit msg for the single key read pmsg into s_conn, with expiry
+ * ttl. The copy is swallowed like a mirrored request, and never overwrites
+ * a value stored on the server in the meantime.
+ */
+static rstatus_t
+rsp_backfill(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+             struct msg *msg, uint32_t ttl)
+{
+    rstatus_t status;
+    struct msg *bmsg;
+
+    bmsg = msg_get(s_conn, true, s_conn->redis);
+    if (bmsg == NULL) {
+        return NC_ENOMEM;
+    }
+
+    if (pmsg->redis) {
+        status = redis_backfill(bmsg, pmsg, msg, ttl);
+    } else {
+        status = memcache_backfill(bmsg, pmsg, msg, ttl);
+    }
+    if (status != NC_OK) {
+        msg_put(bmsg);
+        return status;
+    }
+
+    if (TAILQ_EMPTY(&s_conn->imsg_q)) {
+        status = event_add_out(ctx->evb, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            msg_put(bmsg);
+            return status;
+        }
+    }
+
+    if (!conn_authenticated(s_conn)) {
+        status = pmsg->add_auth(ctx, pmsg->owner, s_conn);
+        if (status != NC_OK) {
+            s_conn->err = errno;
+            msg_put(bmsg);
+            return status;
+        }
+    }
+
+    bmsg->swallow = 1;
+    bmsg->owner = NULL;
+
+    s_conn->enqueue_inq(ctx, s_conn, bmsg);
+
+    log_debug(LOG_VERB, "backfill req %"PRIu64" as req %"PRIu64" to s %d",
+              pmsg->id, bmsg->id, s_conn->sd);
+
+    return NC_OK;
+}
+
+/*
+ * While the migration window of a pool is open, a miss from the current
+ * owner of a key is retried on the server that owned it before the last
+ * membership change. Return true, if req pmsg was requeued on the previous
+ * owner, in which case the response msg is dropped.
+ */
+static bool
+rsp_migrate(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+            struct msg *msg)
+{
+    struct server *server, *prev;
+    struct server_pool *pool;
+    struct conn *b_conn;
+    struct keypos *kpos;
+
+    server = s_conn->owner;
+    pool = server->owner;
+
+    if (pool->migration_window == 0 || !req_retryable(pmsg)) {
+        return false;
+    }
+
+    if (pmsg->migrate != NULL) {
+        /* response from the previous owner */
+        if (!rsp_miss(pmsg, msg)) {
+            stats_pool_incr(ctx, pool, migrate_hits);
+            if (pool->migration_backfill_ttl >= 0) {
+                /* copy the hit into the new owner */
+                b_conn = server_get_conn(ctx, pmsg->migrate);
+                if (b_conn != NULL &&
+                    rsp_backfill(ctx, b_conn, pmsg, msg,
+                                 (uint32_t)pool->migration_backfill_ttl) == NC_OK) {
+                    stats_pool_incr(ctx, pool, migrate_backfills);
+                }
+            }
+        }
+        return false;
+    }
+
+    if (pmsg->retried || !rsp_miss(pmsg, msg)) {
+        return false;
+    }
+
+    kpos = array_get(pmsg->keys, 0);
+    prev = server_pool_prev_server(pool, server, kpos->start,
+                                   (uint32_t)(kpos->end - kpos->start));
+    if (prev == NULL) {
+        return false;
+    }
+
+    if (!req_retry(ctx, pmsg, prev)) {
+        return false;
+    }
+    pmsg->migrate = server;
+
+    stats_pool_incr(ctx, pool, migrate_retries);
+
+    return true;
+}
+
+/*
+ * In a pool with replicas:, a miss on a single key read served by another
+ * replica than the first is retried on the first one. The first replica
+ * gets every write and, once the first replica of a key is ejected, it is
+ * the server that was the second replica of the key. Return true, if req
+ * pmsg was requeued, in which case the response msg is dropped.
+ */
+static bool
+rsp_replica_retry(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+                  struct msg *msg)
+{
+    struct server *server, *replica[CONF_MAX_REPLICAS];
+    struct server_pool *pool;
+    struct keypos *kpos;
+    uint32_t nreplica;
+
+    server = s_conn->owner;
+    pool = server->owner;
+
+    if (pool->replicas <= 1 || pmsg->retried || !req_retryable(pmsg) ||
+        !rsp_miss(pmsg, msg)) {
+        return false;
+    }
+
+    kpos = array_get(pmsg->keys, 0);
+    nreplica = server_pool_replicas(pool, kpos->start,
+                                    (uint32_t)(kpos->end - kpos->start),
+                                    replica);
+    if (nreplica == 0 || replica[0] == server) {
+        return false;
+    }
+
+    if (!req_retry(ctx, pmsg, replica[0])) {
+        return false;
+    }
+
+    stats_pool_incr(ctx, pool, replica_retries);
+
+    return true;
+}
+
+/*
+ * Retry a read that missed on the read_fallback: of its pool, and account
+ * the answer of the fallback. Return true, if req pmsg was requeued, in
+ * which case the response msg is dropped.
+ */
+static bool
+rsp_fallback(struct context *ctx, struct conn *s_conn, struct msg *pmsg,
+             struct msg *msg)
+{
+    struct server_pool *pool;
+    struct conn *b_conn;
+    struct keypos *kpos;
+
+    pool = pmsg->fallback;
+    if (pool != NULL) {
+        /* response from the fallback */
+        if (rsp_miss(pmsg, msg)) {
+            stats_pool_incr(ctx, pool, fallback_misses);
+            return false;
+        }
+
+        stats_pool_incr(ctx, pool, fallback_hits);
+
+        if (pool->warmup != NULL) {
+            /* warm the cold pool up with the hit */
+            kpos = array_get(pmsg->keys, 0);
+            b_conn = server_pool_conn(ctx, pool, kpos->start,
+                                      (uint32_t)(kpos->end - kpos->start));
+            if (b_conn != NULL &&
+                rsp_backfill(ctx, b_conn, pmsg, msg, pool->warmup_ttl) == NC_OK) {
+                stats_pool_incr(ctx, pool, warmup_backfills);
+            }
+        }
+        return false;
+    }
+
+    if (!req_retryable(pmsg) || !rsp_miss(pmsg, msg)) {
+        return false;
+    }
+
+    return req_fallback(ctx, pmsg, s_conn->owner);
+}
+
 static void
 rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
 {
@@ -251,12 +463,31 @@ rsp_forward(struct context *ctx, struct conn *s_conn, struct msg *msg)
     ASSERT(pmsg->request && !pmsg->done);
 
     s_conn->dequeue_outq(ctx, s_conn, pmsg);
+
+    slowlog_receive(pmsg);
+
+    if (rsp_migrate(ctx, s_conn, pmsg, msg) ||
+        rsp_replica_retry(ctx, s_conn, pmsg, msg) ||
+        rsp_fallback(ctx, s_conn, pmsg, msg)) {
+        rsp_forward_stats(ctx, s_conn->owner, msg, msgsize);
+        rsp_put(msg);
+        return;
+    }
+
     pmsg->done = 1;
 
     /* establish msg <-> pmsg (response <-> request) link */
     pmsg->peer = msg;
     msg->peer = pmsg;
 
+    /* tell a miss while the response is whole, before it is coalesced */
+    if (req_retryable(pmsg) && rsp_miss(pmsg, msg)) {
+        pmsg->miss = 1;
+        if (pmsg->frag_owner != NULL) {
+            pmsg->frag_owner->miss = 1;
+        }
+    }
+
     msg->pre_coalesce(msg);
 
     c_conn = pmsg->owner;
@@ -369,6 +600,14 @@ rsp_send_done(struct context *ctx, struct conn *conn, struct msg *msg)
     /* dequeue request from client outq */
     conn->dequeue_outq(ctx, conn, pmsg);
 
+    if (ntap != 0) {
+        tap_request(conn, pmsg, msg);
+    }
+
+    ns_request(conn, pmsg, msg);
+    slowlog_request(conn, pmsg, msg);
+    talker_response(conn, pmsg, msg);
+
     req_put(pmsg);
 
     if (pm_terminate) {
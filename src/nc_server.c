@@ -22,6 +22,12 @@
 #include <nc_server.h>
 #include <nc_conf.h>
 #include <nc_client.h>
+#include <nc_migrate.h>
+#include <nc_hll.h>
+#include <nc_namespace.h>
+#include <nc_slowlog.h>
+#include <nc_splice.h>
+#include <nc_talker.h>
 
 static void
 server_resolve(struct server *server, struct conn *conn)
@@ -134,7 +140,7 @@ server_each_set_owner(void *elem, void *data)
 }
 
 rstatus_t
-server_init(struct array *server, struct array *conf_server,
+server_init(struct array *server, struct array *conf_server, uint32_t nspare,
             struct server_pool *sp)
 {
     rstatus_t status;
@@ -144,7 +150,8 @@ server_init(struct array *server, struct array *conf_server,
     ASSERT(nserver != 0);
     ASSERT(array_n(server) == 0);
 
-    status = array_init(server, nserver, sizeof(struct server));
+    /* connections point to their server, so server[] must never move */
+    status = array_init(server, nserver + nspare, sizeof(struct server));
     if (status != NC_OK) {
         return status;
     }
@@ -227,6 +234,10 @@ server_each_preconnect(void *elem, void *data)
     server = elem;
     pool = server->owner;
 
+    if (server->delegate != NULL) {
+        return NC_OK;
+    }
+
     conn = server_conn(server);
     if (conn == NULL) {
         return NC_ENOMEM;
@@ -257,6 +268,10 @@ server_each_disconnect(void *elem, void *data)
         ASSERT(server->ns_conn_q > 0);
 
         conn = TAILQ_FIRST(&server->s_conn_q);
+        if (conn->sd >= 0) {
+            /* the descriptor is reused by the next connection */
+            event_del_conn(pool->ctx->evb, conn);
+        }
         conn->close(pool->ctx, conn);
     }
 
@@ -309,6 +324,13 @@ server_failure(struct context *ctx, struct server *server)
     stats_pool_incr(ctx, pool, server_ejects);
 
     server->failure_count = 0;
+
+    if (pool->failover != NULL) {
+        /* keys of server go to the failover pool, the others stay put */
+        server->failover_until = next;
+        return;
+    }
+
     server->next_retry = next;
 
     status = server_pool_run(pool);
@@ -371,6 +393,11 @@ server_close(struct context *ctx, struct conn *conn)
         return;
     }
 
+    if (conn->splice != NULL) {
+        /* the client of the response being relayed gets it truncated */
+        splice_close(ctx, conn);
+    }
+
     for (msg = TAILQ_FIRST(&conn->imsg_q); msg != NULL; msg = nmsg) {
         nmsg = TAILQ_NEXT(msg, s_tqe);
 
@@ -386,6 +413,14 @@ server_close(struct context *ctx, struct conn *conn)
             log_debug(LOG_INFO, "close s %d swallow req %"PRIu64" len %"PRIu32
                       " type %d", conn->sd, msg->id, msg->mlen, msg->type);
             req_put(msg);
+        } else if (req_replica_failover(ctx, msg, conn->owner)) {
+            log_debug(LOG_INFO, "close s %d retry req %"PRIu64" len %"PRIu32
+                      " type %d on next replica", conn->sd, msg->id,
+                      msg->mlen, msg->type);
+        } else if (req_fallback(ctx, msg, conn->owner)) {
+            log_debug(LOG_INFO, "close s %d retry req %"PRIu64" len %"PRIu32
+                      " type %d on read fallback", conn->sd, msg->id,
+                      msg->mlen, msg->type);
         } else {
             c_conn = msg->owner;
             ASSERT(c_conn->client && !c_conn->proxy);
@@ -420,6 +455,14 @@ server_close(struct context *ctx, struct conn *conn)
             log_debug(LOG_INFO, "close s %d swallow req %"PRIu64" len %"PRIu32
                       " type %d", conn->sd, msg->id, msg->mlen, msg->type);
             req_put(msg);
+        } else if (req_replica_failover(ctx, msg, conn->owner)) {
+            log_debug(LOG_INFO, "close s %d retry req %"PRIu64" len %"PRIu32
+                      " type %d on next replica", conn->sd, msg->id,
+                      msg->mlen, msg->type);
+        } else if (req_fallback(ctx, msg, conn->owner)) {
+            log_debug(LOG_INFO, "close s %d retry req %"PRIu64" len %"PRIu32
+                      " type %d on read fallback", conn->sd, msg->id,
+                      msg->mlen, msg->type);
         } else {
             c_conn = msg->owner;
             ASSERT(c_conn->client && !c_conn->proxy);
@@ -587,6 +630,7 @@ server_ok(struct context *ctx, struct conn *conn)
                   server->failure_count);
         server->failure_count = 0;
         server->next_retry = 0LL;
+        server->failover_until = 0LL;
     }
 }
 
@@ -652,46 +696,99 @@ server_pool_hash(struct server_pool *pool, uint8_t *key, uint32_t keylen)
     return pool->key_hash((char *)key, keylen);
 }
 
-uint32_t
-server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+/*
+ * If hash_tag: is configured for this server pool, narrow {key, keylen}
+ * down to the part of the key within the hash tag. Otherwise leave the
+ * full key.
+ */
+static void
+server_pool_tag(struct server_pool *pool, uint8_t **key, uint32_t *keylen)
 {
-    uint32_t hash, idx;
+    struct string *tag = &pool->hash_tag;
+    uint8_t *tag_start, *tag_end, *end;
 
-    ASSERT(array_n(&pool->server) != 0);
-    ASSERT(key != NULL);
+    if (string_empty(tag)) {
+        return;
+    }
 
-    /*
-     * If hash_tag: is configured for this server pool, we use the part of
-     * the key within the hash tag as an input to the distributor. Otherwise
-     * we use the full key
-     */
-    if (!string_empty(&pool->hash_tag)) {
-        struct string *tag = &pool->hash_tag;
-        uint8_t *tag_start, *tag_end;
-
-        tag_start = nc_strchr(key, key + keylen, tag->data[0]);
-        if (tag_start != NULL) {
-            tag_end = nc_strchr(tag_start + 1, key + keylen, tag->data[1]);
-            if ((tag_end != NULL) && (tag_end - tag_start > 1)) {
-                key = tag_start + 1;
-                keylen = (uint32_t)(tag_end - key);
+    end = *key + *keylen;
+
+    tag_start = nc_strchr(*key, end, tag->data[0]);
+    if (tag_start != NULL) {
+        tag_end = nc_strchr(tag_start + 1, end, tag->data[1]);
+        if ((tag_end != NULL) && (tag_end - tag_start > 1)) {
+            *key = tag_start + 1;
+            *keylen = (uint32_t)(tag_end - *key);
+        }
+    }
+}
+
+/*
+ * Return the pool that serves {key, keylen} for clients of pool: the
+ * target of the longest routes: prefix matching the key, or pool itself
+ * when no prefix matches. With hash_tag: the prefix is matched against the
+ * part of the key within the hash tag, so that a tag can name a namespace.
+ */
+struct server_pool *
+server_pool_route(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    struct server_pool *target;
+    struct route_node *node, *child;
+    uint32_t i, idx;
+
+    if (array_n(&pool->route) == 0) {
+        return pool;
+    }
+
+    server_pool_tag(pool, &key, &keylen);
+
+    target = pool;
+    node = array_get(&pool->route, 0);
+
+    for (i = 0; i < keylen; i++) {
+        for (idx = node->child; idx != 0; idx = child->sibling) {
+            child = array_get(&pool->route, idx);
+            if (child->ch == key[i]) {
+                break;
             }
         }
+        if (idx == 0) {
+            break;
+        }
+
+        node = child;
+        if (node->pool != NULL) {
+            target = node->pool;
+        }
     }
 
+    return target;
+}
+
+static uint32_t
+server_pool_dispatch(struct server_pool *pool, struct continuum *continuum,
+                     uint32_t ncontinuum, uint8_t *key, uint32_t keylen)
+{
+    uint32_t hash, idx;
+
+    ASSERT(array_n(&pool->server) != 0);
+    ASSERT(key != NULL);
+
+    server_pool_tag(pool, &key, &keylen);
+
     switch (pool->dist_type) {
     case DIST_KETAMA:
         hash = server_pool_hash(pool, key, keylen);
-        idx = ketama_dispatch(pool->continuum, pool->ncontinuum, hash);
+        idx = ketama_dispatch(continuum, ncontinuum, hash);
         break;
 
     case DIST_MODULA:
         hash = server_pool_hash(pool, key, keylen);
-        idx = modula_dispatch(pool->continuum, pool->ncontinuum, hash);
+        idx = modula_dispatch(continuum, ncontinuum, hash);
         break;
 
     case DIST_RANDOM:
-        idx = random_dispatch(pool->continuum, pool->ncontinuum, 0);
+        idx = random_dispatch(continuum, ncontinuum, 0);
         break;
 
     default:
@@ -702,6 +799,68 @@ server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
     return idx;
 }
 
+uint32_t
+server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen)
+{
+    return server_pool_dispatch(pool, pool->continuum, pool->ncontinuum, key,
+                                keylen);
+}
+
+static void
+server_pool_prev_free(struct server_pool *pool)
+{
+    if (pool->prev_continuum != NULL) {
+        nc_free(pool->prev_continuum);
+        pool->prev_continuum = NULL;
+        pool->nprev_continuum = 0;
+    }
+}
+
+/*
+ * Return the server that owned {key, keylen} in pool before the last
+ * membership change, if the migration window is still open or keys are
+ * still being moved, and that server differs from server, the current
+ * owner. Otherwise return NULL.
+ */
+struct server *
+server_pool_prev_server(struct server_pool *pool, struct server *server,
+                        uint8_t *key, uint32_t keylen)
+{
+    struct server *prev;
+    int64_t now;
+    uint32_t idx;
+
+    if (pool->prev_continuum == NULL) {
+        return NULL;
+    }
+
+    now = nc_usec_now();
+    if (now < 0 || (now >= pool->migrate_until && !migrate_active(pool))) {
+        server_pool_prev_free(pool);
+        return NULL;
+    }
+
+    idx = server_pool_dispatch(pool, pool->prev_continuum,
+                               pool->nprev_continuum, key, keylen);
+    prev = array_get(&pool->server, idx);
+
+    if (prev == server || prev->ejected || prev->next_retry > now) {
+        return NULL;
+    }
+
+    return prev;
+}
+
+uint32_t
+server_pool_nbackend(struct server_pool *pool)
+{
+    if (pool->nbackend == 0) {
+        return pool->ncontinuum;
+    }
+
+    return pool->nbackend;
+}
+
 static struct server *
 server_pool_server(struct server_pool *pool, uint8_t *key, uint32_t keylen)
 {
@@ -738,20 +897,181 @@ server_get_conn(struct context *ctx, struct server *srv)
     return conn;
 }
 
-struct conn *
-server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
-                 uint32_t keylen)
+/*
+ * Return true, if the keys of an ejected server go to the failover: pool
+ * of its pool
+ */
+static bool
+server_failed_over(struct server *server)
+{
+    int64_t now;
+
+    if (server->failover_until == 0LL) {
+        return false;
+    }
+
+    now = nc_usec_now();
+    if (now < 0) {
+        return false;
+    }
+
+    if (now >= server->failover_until) {
+        server->failover_until = 0LL;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Pick the server for {key, keylen} from pool. A server that references
+ * another pool hands the key to that pool's distribution, in process, and
+ * an ejected server of a pool with a failover: pool hands it to that pool.
+ * Conf validation rejects loops of such hand offs; a key handed off more
+ * often than there are pools gets no server all the same.
+ */
+static struct server *
+server_pool_resolve(struct server_pool *pool, uint8_t *key, uint32_t keylen)
 {
     rstatus_t status;
     struct server *server;
+    uint32_t hop, nhop;
 
-    status = server_pool_update(pool);
-    if (status != NC_OK) {
+    nhop = array_n(&pool->ctx->pool);
+
+    for (hop = 0; hop <= nhop; hop++) {
+        status = server_pool_update(pool);
+        if (status != NC_OK) {
+            return NULL;
+        }
+
+        /* from a given {key, keylen} pick a server from pool */
+        server = server_pool_server(pool, key, keylen);
+        if (server->delegate != NULL) {
+            pool = server->delegate;
+        } else if (pool->failover != NULL && server_failed_over(server)) {
+            pool = pool->failover;
+        } else {
+            return server;
+        }
+    }
+
+    log_warn("key '%.*s' is handed off between pools in a loop", keylen, key);
+
+    return NULL;
+}
+
+/*
+ * Pick the servers holding {key, keylen} into replica[], which has room for
+ * CONF_MAX_REPLICAS servers: the server picked by server_pool_resolve()
+ * followed, if its pool has replicas: > 1, by the next distinct servers on
+ * the continuum. Return the number of servers picked.
+ */
+uint32_t
+server_pool_replicas(struct server_pool *pool, uint8_t *key, uint32_t keylen,
+                     struct server **replica)
+{
+    struct server *server;
+    uint32_t idx[CONF_MAX_REPLICAS];
+    uint32_t i, n;
+    uint32_t hash;
+
+    server = server_pool_resolve(pool, key, keylen);
+    if (server == NULL) {
+        return 0;
+    }
+
+    pool = server->owner;
+    if (pool->replicas <= 1) {
+        replica[0] = server;
+        return 1;
+    }
+
+    ASSERT(pool->dist_type == DIST_KETAMA);
+    ASSERT(pool->replicas <= CONF_MAX_REPLICAS);
+
+    server_pool_tag(pool, &key, &keylen);
+    hash = server_pool_hash(pool, key, keylen);
+    n = ketama_dispatch_replicas(pool->continuum, pool->ncontinuum, hash, idx,
+                                 pool->replicas);
+
+    for (i = 0; i < n; i++) {
+        replica[i] = array_get(&pool->server, idx[i]);
+    }
+
+    return n;
+}
+
+/*
+ * Pick the read_fallback: server of pool for {key, keylen}, which missed
+ * or failed on server: the next distinct server on the continuum, or the
+ * server of the fallback pool. Return NULL, if there is none.
+ */
+struct server *
+server_pool_fallback(struct server_pool *pool, struct server *server,
+                     uint8_t *key, uint32_t keylen)
+{
+    uint32_t idx[2];
+    uint32_t i, n;
+    uint32_t hash;
+
+    if (pool->read_fallback != NULL) {
+        return server_pool_resolve(pool->read_fallback, key, keylen);
+    }
+
+    ASSERT(pool->read_fallback_successor);
+    ASSERT(pool->dist_type == DIST_KETAMA);
+
+    if (server_pool_update(pool) != NC_OK || pool->ncontinuum == 0) {
         return NULL;
     }
 
-    /* from a given {key, keylen} pick a server from pool */
-    server = server_pool_server(pool, key, keylen);
+    server_pool_tag(pool, &key, &keylen);
+    hash = server_pool_hash(pool, key, keylen);
+    n = ketama_dispatch_replicas(pool->continuum, pool->ncontinuum, hash, idx,
+                                 2);
+
+    for (i = 0; i < n; i++) {
+        if (idx[i] != server->idx) {
+            return array_get(&pool->server, idx[i]);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Index of the server for {key, keylen} among the fragment slots of pool,
+ * see server_pool_nbackend(). Keys of pools linked to other pools are
+ * spread over the servers of all pools, so that fragments of a multi-key
+ * request never mix servers of different pools.
+ */
+uint32_t
+server_pool_backend_idx(struct server_pool *pool, uint8_t *key,
+                        uint32_t keylen)
+{
+    struct server *server;
+
+    if (pool->nbackend == 0) {
+        return server_pool_idx(pool, key, keylen);
+    }
+
+    server = server_pool_resolve(server_pool_route(pool, key, keylen), key,
+                                 keylen);
+    if (server == NULL) {
+        return server_pool_idx(pool, key, keylen);
+    }
+
+    return server->owner->server_base + server->idx;
+}
+
+struct conn *
+server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key,
+                 uint32_t keylen)
+{
+    struct server *server;
+
+    server = server_pool_resolve(pool, key, keylen);
     if (server == NULL) {
         return NULL;
     }
@@ -826,6 +1146,186 @@ server_pool_each_set_owner(void *elem, void *data)
     return NC_OK;
 }
 
+static struct server_pool *
+server_pool_find(struct array *server_pool, struct string *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(server_pool); i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+
+        if (string_compare(&sp->name, name) == 0) {
+            return sp;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Compile the routes: (conf_route[]) of pool sp into its prefix trie.
+ */
+static rstatus_t
+server_pool_route_init(struct server_pool *sp, struct array *conf_route,
+                       struct array *server_pool)
+{
+    rstatus_t status;
+    uint32_t i, j, idx, nroute;
+    struct route_node *node, *child;
+
+    nroute = array_n(conf_route);
+    if (nroute == 0) {
+        return NC_OK;
+    }
+
+    status = array_init(&sp->route, nroute * 8, sizeof(struct route_node));
+    if (status != NC_OK) {
+        return status;
+    }
+
+    node = array_push(&sp->route);
+    node->ch = 0;
+    node->child = 0;
+    node->sibling = 0;
+    node->pool = NULL;
+
+    for (i = 0; i < nroute; i++) {
+        struct conf_route *cr = array_get(conf_route, i);
+        struct server_pool *target;
+        uint32_t cur;
+
+        target = server_pool_find(server_pool, &cr->pool);
+        ASSERT(target != NULL && target != sp);
+
+        for (cur = 0, j = 0; j < cr->prefix.len; j++) {
+            node = array_get(&sp->route, cur);
+            for (idx = node->child; idx != 0; idx = child->sibling) {
+                child = array_get(&sp->route, idx);
+                if (child->ch == cr->prefix.data[j]) {
+                    break;
+                }
+            }
+
+            if (idx == 0) {
+                idx = array_n(&sp->route);
+                child = array_push(&sp->route);
+                if (child == NULL) {
+                    return NC_ENOMEM;
+                }
+                /* array_push may have moved the nodes */
+                node = array_get(&sp->route, cur);
+
+                child->ch = cr->prefix.data[j];
+                child->child = 0;
+                child->sibling = node->child;
+                child->pool = NULL;
+                node->child = idx;
+            }
+
+            cur = idx;
+        }
+
+        node = array_get(&sp->route, cur);
+        node->pool = target;
+
+        log_debug(LOG_VERB, "pool %"PRIu32" '%.*s' routes prefix '%.*s' to "
+                  "pool %"PRIu32" '%.*s'", sp->idx, sp->name.len,
+                  sp->name.data, cr->prefix.len, cr->prefix.data, target->idx,
+                  target->name.len, target->name.data);
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Link pools to each other: compile routes:, resolve servers that
+ * reference another pool as "@pool:weight" and resolve mirror:,
+ * read_fallback:, failover: and warmup:.
+ */
+static rstatus_t
+server_pool_link(struct array *server_pool, struct array *conf_pool)
+{
+    rstatus_t status;
+    uint32_t i, j, npool, nserver;
+
+    npool = array_n(server_pool);
+
+    for (nserver = 0, i = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+
+        sp->server_base = nserver;
+        nserver += array_n(&sp->server);
+    }
+
+    for (i = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+        struct conf_pool *cp = array_get(conf_pool, i);
+        bool linked;
+
+        status = server_pool_route_init(sp, &cp->route, server_pool);
+        if (status != NC_OK) {
+            return status;
+        }
+        linked = array_n(&sp->route) != 0;
+
+        for (j = 0; j < array_n(&sp->server); j++) {
+            struct server *server = array_get(&sp->server, j);
+            struct string name;
+
+            if (server->addrstr.data[0] != '@') {
+                continue;
+            }
+
+            name.data = server->addrstr.data + 1;
+            name.len = server->addrstr.len - 1;
+
+            server->delegate = server_pool_find(server_pool, &name);
+            ASSERT(server->delegate != NULL && server->delegate != sp);
+            linked = true;
+
+            log_debug(LOG_VERB, "pool %"PRIu32" '%.*s' server '%.*s' hands "
+                      "requests to pool %"PRIu32"", sp->idx, sp->name.len,
+                      sp->name.data, server->pname.len, server->pname.data,
+                      server->delegate->idx);
+        }
+
+        if (!string_empty(&cp->failover)) {
+            sp->failover = server_pool_find(server_pool, &cp->failover);
+            ASSERT(sp->failover != NULL && sp->failover != sp);
+            linked = true;
+        }
+
+        /* keys of linked pools are fragmented over all servers */
+        sp->nbackend = linked ? nserver : 0;
+
+        if (!string_empty(&cp->mirror)) {
+            sp->mirror = server_pool_find(server_pool, &cp->mirror);
+            ASSERT(sp->mirror != NULL && sp->mirror != sp);
+        }
+
+        if (cp->read_fallback.len > 0 && cp->read_fallback.data[0] == '@') {
+            struct string name;
+
+            name.data = cp->read_fallback.data + 1;
+            name.len = cp->read_fallback.len - 1;
+
+            sp->read_fallback = server_pool_find(server_pool, &name);
+            ASSERT(sp->read_fallback != NULL && sp->read_fallback != sp);
+        } else if (!string_empty(&cp->read_fallback)) {
+            sp->read_fallback_successor = 1;
+        }
+
+        if (!string_empty(&cp->warmup)) {
+            /* misses are read from the warm pool, like a read fallback */
+            sp->warmup = server_pool_find(server_pool, &cp->warmup);
+            ASSERT(sp->warmup != NULL && sp->warmup != sp);
+            sp->read_fallback = sp->warmup;
+        }
+    }
+
+    return NC_OK;
+}
+
 static rstatus_t
 server_pool_each_calc_connections(void *elem, void *data)
 {
@@ -838,11 +1338,9 @@ server_pool_each_calc_connections(void *elem, void *data)
     return NC_OK;
 }
 
-rstatus_t
-server_pool_run(struct server_pool *pool)
+static rstatus_t
+server_pool_update_dist(struct server_pool *pool)
 {
-    ASSERT(array_n(&pool->server) != 0);
-
     switch (pool->dist_type) {
     case DIST_KETAMA:
         return ketama_update(pool);
@@ -861,6 +1359,60 @@ server_pool_run(struct server_pool *pool)
     return NC_OK;
 }
 
+/*
+ * Rebuild the distribution of pool. With migration_window:, a continuum
+ * that changes is kept as the previous continuum for the window, so that
+ * misses on the new owner of a key can be retried on its previous owner.
+ */
+rstatus_t
+server_pool_run(struct server_pool *pool)
+{
+    rstatus_t status;
+    struct continuum *prev;
+    uint32_t nprev;
+    size_t size;
+
+    ASSERT(array_n(&pool->server) != 0);
+
+    prev = NULL;
+    nprev = 0;
+    size = pool->ncontinuum * sizeof(*pool->continuum);
+
+    if (pool->migration_window > 0 && pool->dist_type != DIST_RANDOM &&
+        pool->ncontinuum != 0) {
+        prev = nc_alloc(size);
+        if (prev != NULL) {
+            nc_memcpy(prev, pool->continuum, size);
+            nprev = pool->ncontinuum;
+        }
+    }
+
+    status = server_pool_update_dist(pool);
+
+    if (prev == NULL) {
+        return status;
+    }
+
+    if (status != NC_OK || (nprev == pool->ncontinuum &&
+                            memcmp(prev, pool->continuum, size) == 0)) {
+        nc_free(prev);
+        return status;
+    }
+
+    server_pool_prev_free(pool);
+    pool->prev_continuum = prev;
+    pool->nprev_continuum = nprev;
+    pool->migrate_until = nc_usec_now() + pool->migration_window * 1000LL;
+
+    log_debug(LOG_INFO, "pool %"PRIu32" '%.*s' keeps previous continuum for "
+              "%"PRIi64" msec", pool->idx, pool->name.len, pool->name.data,
+              pool->migration_window);
+
+    migrate_start(pool);
+
+    return NC_OK;
+}
+
 static rstatus_t
 server_pool_each_run(void *elem, void *data)
 {
@@ -898,6 +1450,13 @@ server_pool_init(struct array *server_pool, struct array *conf_pool,
         return status;
     }
 
+    /* link pools through routes: and pool references */
+    status = server_pool_link(server_pool, conf_pool);
+    if (status != NC_OK) {
+        server_pool_deinit(server_pool);
+        return status;
+    }
+
     /* compute max server connections */
     ctx->max_nsconn = 0;
     status = array_each(server_pool, server_pool_each_calc_connections, ctx);
@@ -955,9 +1514,19 @@ server_pool_deinit(struct array *server_pool)
             sp->nserver_continuum = 0;
             sp->nlive_server = 0;
         }
+        server_pool_prev_free(sp);
 
+        hll_deinit(sp);
+        ns_deinit(sp);
+        slowlog_deinit(sp);
+        talker_deinit(sp);
         server_deinit(&sp->server);
 
+        while (array_n(&sp->route) != 0) {
+            array_pop(&sp->route);
+        }
+        array_deinit(&sp->route);
+
         log_debug(LOG_DEBUG, "deinit pool %"PRIu32" '%.*s'", sp->idx,
                   sp->name.len, sp->name.data);
     }
@@ -966,3 +1535,232 @@ server_pool_deinit(struct array *server_pool)
 
     log_debug(LOG_DEBUG, "deinit %"PRIu32" pools", npool);
 }
+
+/*
+ * Returns the pool named by an admin command, or NULL if there is no such
+ * pool
+ */
+static struct server_pool *
+server_admin_pool(struct array *server_pool, struct chan_msg *msg)
+{
+    uint32_t i;
+    size_t len;
+
+    len = strlen(msg->pool);
+
+    for (i = 0; i < array_n(server_pool); i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+
+        if (sp->name.len == len && nc_strncmp(sp->name.data, msg->pool, len) == 0) {
+            return sp;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns the server named by an admin command, matched by name or by
+ * hostname:port:weight, or NULL if there is no such server
+ */
+struct server *
+server_admin_find(struct array *server_pool, struct chan_msg *msg)
+{
+    struct server_pool *sp;
+    uint32_t j;
+    size_t len;
+
+    sp = server_admin_pool(server_pool, msg);
+    if (sp == NULL) {
+        return NULL;
+    }
+
+    len = strlen(msg->server);
+
+    for (j = 0; j < array_n(&sp->server); j++) {
+        struct server *s = array_get(&sp->server, j);
+
+        if ((s->name.len == len &&
+             nc_strncmp(s->name.data, msg->server, len) == 0) ||
+            (s->pname.len == len &&
+             nc_strncmp(s->pname.data, msg->server, len) == 0)) {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Join the server of the servers_file: line in an admin command to its
+ * pool. The conf_server is kept in the conf of ctx, which owns the strings
+ * of every server. The server takes a spare slot of the pool, as server[]
+ * must not move, and pools linked by fragment slots, which number all
+ * servers up front, are refused. Returns the joined server, or NULL with
+ * err set to the reason of failure
+ */
+static struct server *
+server_admin_join(struct context *ctx, struct chan_msg *msg, char **err)
+{
+    struct server_pool *pool, *sp;
+    struct conf_pool *cp;
+    struct conf_server *cs;
+    struct server *s;
+    struct array server;
+    uint32_t i;
+
+    pool = server_admin_pool(&ctx->pool, msg);
+    if (pool == NULL) {
+        *err = "no such pool";
+        return NULL;
+    }
+
+    if (msg->server[0] == '@') {
+        *err = "cannot join a pool";
+        return NULL;
+    }
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        sp = array_get(&ctx->pool, i);
+        if (sp->nbackend != 0) {
+            *err = "is in pools linked by fragment slots";
+            return NULL;
+        }
+    }
+
+    if (array_n(&pool->server) == pool->server.nalloc) {
+        *err = "has no room for more servers";
+        return NULL;
+    }
+
+    if (array_init(&server, 1, sizeof(struct conf_server)) != NC_OK) {
+        *err = "is out of memory";
+        return NULL;
+    }
+
+    *err = conf_parse_server(&server, (uint8_t *)msg->server,
+                             (uint32_t)strlen(msg->server));
+
+    for (i = 0; *err == CONF_OK && i < array_n(&pool->server); i++) {
+        s = array_get(&pool->server, i);
+        if (string_compare(&s->name, &((struct conf_server *)
+                           array_top(&server))->name) == 0) {
+            *err = "is already in the pool";
+        }
+    }
+
+    cp = array_get(&ctx->cf->pool, pool->idx);
+    cs = *err == CONF_OK ? array_push(&cp->server) : NULL;
+    if (cs == NULL) {
+        if (*err == CONF_OK) {
+            *err = "is out of memory";
+        }
+        conf_free_servers(&server);
+        array_deinit(&server);
+        return NULL;
+    }
+
+    nc_memcpy(cs, array_pop(&server), sizeof(*cs));
+    array_deinit(&server);
+
+    conf_server_each_transform(cs, &pool->server);
+
+    s = array_top(&pool->server);
+    s->owner = pool;
+    stats_server_join(ctx->stats, s);
+
+    ctx->max_nsconn += pool->server_connections;
+
+    return s;
+}
+
+/*
+ * Apply an admin command to the servers of ctx. Only the distribution of
+ * the owner pool is rebuilt; connections to other servers are untouched.
+ * Returns NULL on success, otherwise the reason of failure
+ */
+char *
+server_admin(struct context *ctx, struct chan_msg *msg)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    struct server *server;
+    uint32_t i, nlive;
+    char *err;
+
+    if (msg->admin == SERVER_ADMIN_JOIN) {
+        server = server_admin_join(ctx, msg, &err);
+        if (server == NULL) {
+            return err;
+        }
+    } else {
+        server = server_admin_find(&ctx->pool, msg);
+        if (server == NULL) {
+            return "no such pool or server";
+        }
+    }
+    pool = server->owner;
+
+    switch (msg->admin) {
+    case SERVER_ADMIN_EJECT:
+    case SERVER_ADMIN_REMOVE:
+        if (!server->ejected) {
+            for (i = 0, nlive = 0; i < array_n(&pool->server); i++) {
+                struct server *s = array_get(&pool->server, i);
+                nlive += s->ejected ? 0 : 1;
+            }
+            if (nlive == 1) {
+                return "is the last server of the pool";
+            }
+
+            server->ejected = 1;
+
+            if (ctx->stats != NULL) {
+                stats_server_set_ts(ctx, server, server_ejected_at,
+                                    nc_usec_now());
+                stats_pool_incr(ctx, pool, server_ejects);
+            }
+        }
+
+        if (msg->admin == SERVER_ADMIN_REMOVE) {
+            server_each_disconnect(server, NULL);
+        }
+        break;
+
+    case SERVER_ADMIN_JOIN:
+        break;
+
+    case SERVER_ADMIN_RESTORE:
+    case SERVER_ADMIN_ADD:
+        if (msg->admin == SERVER_ADMIN_ADD && !server->ejected) {
+            return "is already in the pool";
+        }
+
+        server->ejected = 0;
+        server->failure_count = 0;
+        server->next_retry = 0LL;
+        break;
+
+    case SERVER_ADMIN_WEIGHT:
+        if (msg->weight == 0) {
+            return "has a zero weight";
+        }
+        server->weight = msg->weight;
+        break;
+
+    default:
+        return "is an unknown command";
+    }
+
+    status = server_pool_run(pool);
+    if (status != NC_OK) {
+        return "failed to update the distribution";
+    }
+
+    log_warn("admin command %d on pool '%.*s' server '%.*s' applied, %"PRIu32
+             " of %"PRIu32" servers live", msg->admin, pool->name.len,
+             pool->name.data, server->pname.len, server->pname.data,
+             pool->nlive_server, array_n(&pool->server));
+
+    return NULL;
+}
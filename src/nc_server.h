@@ -59,15 +59,40 @@
  *            //
  */
 
+#define SERVER_JOIN_SPARE   64  /* room for servers joined to a pool with servers_file: */
+
 typedef uint32_t (*hash_t)(const char *, size_t);
 
+typedef enum server_admin_type {
+    SERVER_ADMIN_UNKNOWN,
+    SERVER_ADMIN_EJECT,   /* take server out of the distribution */
+    SERVER_ADMIN_RESTORE, /* put ejected server back into the distribution */
+    SERVER_ADMIN_WEIGHT,  /* change server weight */
+    SERVER_ADMIN_REMOVE,  /* eject server and close its connections */
+    SERVER_ADMIN_ADD,     /* put removed server back into the distribution */
+    SERVER_ADMIN_JOIN,    /* add a server that was never in the pool */
+} server_admin_type_t;
+
 struct continuum {
     uint32_t index;  /* server index */
     uint32_t value;  /* hash value */
 };
 
+/*
+ * routes: of a pool are compiled into a prefix trie of route_node, with the
+ * root at index 0. Children of a node are chained through sibling, and a
+ * node at which a configured prefix ends points to its target pool.
+ */
+struct route_node {
+    uint8_t            ch;            /* key byte */
+    uint32_t           child;         /* index of first child, 0 if none */
+    uint32_t           sibling;       /* index of next sibling, 0 if none */
+    struct server_pool *pool;         /* target pool or NULL */
+};
+
 struct server {
     uint32_t           idx;           /* server index */
+    uint32_t           stats_idx;     /* server index in stats counters */
     struct server_pool *owner;        /* owner pool */
 
     struct string      pname;         /* hostname:port:weight (ref in conf_server) */
@@ -82,6 +107,10 @@ struct server {
 
     int64_t            next_retry;    /* next retry time in usec */
     uint32_t           failure_count; /* # consecutive failures */
+    struct server_pool *delegate;     /* pool referenced as "@pool" or NULL */
+    int64_t            failover_until; /* keys go to failover pool until, in usec */
+    struct hll         *hll;          /* distinct keys seen or NULL */
+    unsigned           ejected:1;     /* ejected by admin? */
 };
 
 struct server_pool {
@@ -94,11 +123,47 @@ struct server_pool {
 
     struct array       server;               /* server[] */
     struct array       redis_master;         /* server[] */
+    uint32_t           nserver_conf;         /* # configured servers, the ones in stats */
     uint32_t           ncontinuum;           /* # continuum points */
     uint32_t           nserver_continuum;    /* # servers - live and dead on continuum (const) */
     struct continuum   *continuum;           /* continuum */
     uint32_t           nlive_server;         /* # live server */
     int64_t            next_rebuild;         /* next distribution rebuild time in usec */
+    uint32_t           nprev_continuum;      /* # previous continuum points */
+    struct continuum   *prev_continuum;      /* continuum before last membership change */
+    int64_t            migrate_until;        /* end of migration window in usec */
+    uint32_t           move_server;          /* index of server scanned by the key mover */
+    uint64_t           move_cursor;          /* SCAN cursor on that server */
+    uint64_t           move_scan;            /* id of SCAN in flight, or 0 */
+    int64_t            move_next;            /* time of next SCAN in usec, or 0 if idle */
+    uint32_t           move_errors;          /* # consecutive failed SCANs on that server */
+
+    struct array       route;                /* route_node[] - compiled routes: */
+    uint32_t           server_base;          /* index of first server across all pools */
+    uint32_t           nbackend;             /* # fragment slots if linked to other pools, or 0 */
+    struct server_pool *mirror;              /* mirror pool or NULL */
+    uint32_t           mirror_sample;        /* % of requests copied to mirror pool */
+    int64_t            migration_window;     /* migration window in msec */
+    int                migration_backfill_ttl; /* backfill ttl in sec, or -1 */
+    uint32_t           migration_rate;       /* keys moved per sec, or 0 */
+    uint32_t           replicas;             /* # servers holding each key */
+    struct server_pool *read_fallback;       /* read_fallback: pool or NULL */
+    struct server_pool *failover;            /* failover: pool or NULL */
+    struct server_pool *warmup;              /* warmup: pool or NULL */
+    uint32_t           warmup_ttl;           /* ttl of warmed up keys in sec */
+    int64_t            distinct_keys_window; /* distinct key window in sec, or 0 */
+    struct hll         *hll;                 /* distinct keys seen or NULL */
+    int64_t            hll_rotate;           /* end of current window in usec */
+    int64_t            hll_publish;          /* next estimate published in usec */
+    uint32_t           namespace_top;        /* # namespaces tracked, or 0 */
+    int                namespace_delimiter;  /* namespace delimiter, or -1 for hash tag */
+    struct ns_table    *ns;                  /* namespace traffic or NULL */
+    int64_t            slowlog_slower_than;  /* slow request latency in usec, or -1 */
+    uint32_t           slowlog_max_len;      /* # slow requests kept */
+    struct slowlog     *slowlog;             /* slow requests or NULL */
+    uint32_t           client_top;           /* # client addresses tracked, or 0 */
+    struct talker_table *talker;             /* client address traffic or NULL */
+    uint32_t           splice_threshold;     /* min length of a spliced response, or 0 */
 
     struct string      name;                 /* pool name (ref in conf_pool) */
     struct string      addrstr;              /* pool address - hostname:port (ref in conf_pool) */
@@ -122,13 +187,15 @@ struct server_pool {
     unsigned           preconnect:1;         /* preconnect? */
     unsigned           redis:1;              /* redis? */
     unsigned           tcpkeepalive:1;       /* tcpkeepalive? */
+    unsigned           mirror_writes_only:1; /* mirror writes only? */
+    unsigned           read_fallback_successor:1; /* read_fallback: successor? */
 };
 
 void server_ref(struct conn *conn, void *owner);
 void server_unref(struct conn *conn);
 int server_timeout(struct conn *conn);
 bool server_active(struct conn *conn);
-rstatus_t server_init(struct array *server, struct array *conf_server, struct server_pool *sp);
+rstatus_t server_init(struct array *server, struct array *conf_server, uint32_t nspare, struct server_pool *sp);
 void server_deinit(struct array *server);
 struct conn *server_conn(struct server *server);
 struct conn *server_get_conn(struct context *ctx, struct server *srv);
@@ -137,12 +204,20 @@ void server_close(struct context *ctx, struct conn *conn);
 void server_connected(struct context *ctx, struct conn *conn);
 void server_ok(struct context *ctx, struct conn *conn);
 
+struct server_pool *server_pool_route(struct server_pool *pool, uint8_t *key, uint32_t keylen);
 uint32_t server_pool_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+struct server *server_pool_prev_server(struct server_pool *pool, struct server *server, uint8_t *key, uint32_t keylen);
+uint32_t server_pool_backend_idx(struct server_pool *pool, uint8_t *key, uint32_t keylen);
+uint32_t server_pool_nbackend(struct server_pool *pool);
 struct conn *server_pool_conn(struct context *ctx, struct server_pool *pool, uint8_t *key, uint32_t keylen);
+struct server *server_pool_fallback(struct server_pool *pool, struct server *server, uint8_t *key, uint32_t keylen);
+uint32_t server_pool_replicas(struct server_pool *pool, uint8_t *key, uint32_t keylen, struct server **replica);
 rstatus_t server_pool_run(struct server_pool *pool);
 rstatus_t server_pool_preconnect(struct context *ctx);
 void server_pool_disconnect(struct context *ctx);
 rstatus_t server_pool_init(struct array *server_pool, struct array *conf_pool, struct context *ctx);
 void server_pool_deinit(struct array *server_pool);
+struct server *server_admin_find(struct array *server_pool, struct chan_msg *msg);
+char *server_admin(struct context *ctx, struct chan_msg *msg);
 
 #endif
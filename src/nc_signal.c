@@ -161,7 +161,7 @@ signal_handler(int signo)
     case SIGCHLD:
         ASSERT(pm_myrole == ROLE_MASTER);
         actionstr = ", reaping child";
-        action = nc_reap_worker;
+        action = nc_reap_workers_later;
         break;
 
     default:
@@ -0,0 +1,221 @@
+#include <sys/mman.h>
+
+#include <nc_core.h>
+#include <nc_slab.h>
+
+/*
+ * Objects of a fixed size, such as msg and conn, are packed into slabs:
+ * SLAB_SIZE chunks of memory mapped at a SLAB_SIZE boundary, with a header
+ * in front of the objects. The slab of an object is found by rounding its
+ * address down, and which of the objects of the slab are free is kept in a
+ * bitmap in its header.
+ *
+ * Objects are taken from the slab that had one freed most recently, lowest
+ * address first, so that the objects in use stay packed in a few slabs. A
+ * slab whose objects are all free is given back to the system, except for
+ * one per cache kept to absorb a burst of get and put around the boundary.
+ *
+ * A cache may instead keep all its slabs, for objects that can still be
+ * read through stale pointers once put, the way they could be when they
+ * were kept on a free list.
+ */
+
+static struct slab *
+slab_create(struct slab_cache *cache)
+{
+    uint8_t *p, *start;
+    size_t head, tail;
+    struct slab *slab;
+    uint32_t i;
+
+    /* map twice the size, to unmap what lies outside an aligned slab */
+    p = mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        log_error("slab: mmap of %d bytes for %s failed: %s", 2 * SLAB_SIZE,
+                  cache->name, strerror(errno));
+        return NULL;
+    }
+
+    start = NC_ALIGN_PTR(p, SLAB_SIZE);
+    head = (size_t)(start - p);
+    tail = SLAB_SIZE - head;
+    if (head > 0) {
+        munmap(p, head);
+    }
+    if (tail > 0) {
+        munmap(start + SLAB_SIZE, tail);
+    }
+
+    slab = (struct slab *)start;
+    slab->cache = cache;
+    slab->nfree = cache->nobj;
+    for (i = 0; i < SLAB_NMAP; i++) {
+        if (cache->nobj >= (i + 1) * 64) {
+            slab->map[i] = ~0ULL;
+        } else if (cache->nobj > i * 64) {
+            slab->map[i] = (1ULL << (cache->nobj - i * 64)) - 1;
+        } else {
+            slab->map[i] = 0;
+        }
+    }
+
+    cache->nslab++;
+
+    log_debug(LOG_VVERB, "slab: create slab %p of %s, %"PRIu32" slabs", slab,
+              cache->name, cache->nslab);
+
+    return slab;
+}
+
+static void
+slab_destroy(struct slab_cache *cache, struct slab *slab)
+{
+    ASSERT(cache->nslab > 0);
+
+    cache->nslab--;
+
+    log_debug(LOG_VVERB, "slab: destroy slab %p of %s, %"PRIu32" slabs", slab,
+              cache->name, cache->nslab);
+
+    munmap(slab, SLAB_SIZE);
+}
+
+void
+slab_cache_init(struct slab_cache *cache, const char *name, size_t size,
+                bool keep)
+{
+    size = NC_ALIGN(size, NC_ALIGNMENT);
+
+    ASSERT(size > 0 && size <= SLAB_SIZE / 2);
+
+    cache->name = name;
+    cache->size = size;
+    cache->offset = (uint32_t)NC_ALIGN(sizeof(struct slab), (size_t)64);
+    cache->nobj = MIN((uint32_t)((SLAB_SIZE - cache->offset) / size),
+                      SLAB_NMAP * 64);
+    TAILQ_INIT(&cache->partial_q);
+    TAILQ_INIT(&cache->full_q);
+    cache->empty = NULL;
+    cache->keep = keep ? 1 : 0;
+    cache->nslab = 0;
+    cache->nused = 0;
+
+    log_debug(LOG_DEBUG, "slab: %s objects of %zu bytes, %"PRIu32" per slab",
+              name, size, cache->nobj);
+}
+
+void
+slab_cache_deinit(struct slab_cache *cache)
+{
+    struct slab *slab;
+
+    while (!TAILQ_EMPTY(&cache->partial_q)) {
+        slab = TAILQ_FIRST(&cache->partial_q);
+        TAILQ_REMOVE(&cache->partial_q, slab, tqe);
+        slab_destroy(cache, slab);
+    }
+
+    while (!TAILQ_EMPTY(&cache->full_q)) {
+        slab = TAILQ_FIRST(&cache->full_q);
+        TAILQ_REMOVE(&cache->full_q, slab, tqe);
+        slab_destroy(cache, slab);
+    }
+
+    if (cache->empty != NULL) {
+        slab_destroy(cache, cache->empty);
+        cache->empty = NULL;
+    }
+
+    ASSERT(cache->nslab == 0);
+    cache->nused = 0;
+}
+
+void *
+slab_get(struct slab_cache *cache)
+{
+    struct slab *slab;
+    uint32_t i, idx;
+
+    slab = TAILQ_FIRST(&cache->partial_q);
+    if (slab == NULL) {
+        if (cache->empty != NULL) {
+            slab = cache->empty;
+            cache->empty = NULL;
+        } else {
+            slab = slab_create(cache);
+            if (slab == NULL) {
+                return NULL;
+            }
+        }
+        TAILQ_INSERT_HEAD(&cache->partial_q, slab, tqe);
+    }
+
+    ASSERT(slab->nfree > 0);
+
+    for (i = 0; slab->map[i] == 0; i++) {
+        ASSERT(i < SLAB_NMAP - 1);
+    }
+    idx = (uint32_t)__builtin_ctzll(slab->map[i]);
+    slab->map[i] &= ~(1ULL << idx);
+    idx += i * 64;
+
+    slab->nfree--;
+    if (slab->nfree == 0) {
+        TAILQ_REMOVE(&cache->partial_q, slab, tqe);
+        TAILQ_INSERT_HEAD(&cache->full_q, slab, tqe);
+    }
+
+    cache->nused++;
+
+    return (uint8_t *)slab + cache->offset + idx * cache->size;
+}
+
+void
+slab_put(struct slab_cache *cache, void *obj)
+{
+    struct slab *slab;
+    size_t off;
+    uint32_t idx;
+
+    slab = (struct slab *)((uintptr_t)obj & ~((uintptr_t)SLAB_SIZE - 1));
+    off = (size_t)((uint8_t *)obj - (uint8_t *)slab) - cache->offset;
+
+    ASSERT(slab->cache == cache);
+    ASSERT(off % cache->size == 0);
+
+    idx = (uint32_t)(off / cache->size);
+
+    ASSERT(idx < cache->nobj);
+    ASSERT((slab->map[idx / 64] & (1ULL << (idx % 64))) == 0);
+
+    slab->map[idx / 64] |= 1ULL << (idx % 64);
+
+    if (slab->nfree == 0) {
+        TAILQ_REMOVE(&cache->full_q, slab, tqe);
+        TAILQ_INSERT_HEAD(&cache->partial_q, slab, tqe);
+    } else if (slab != TAILQ_FIRST(&cache->partial_q)) {
+        TAILQ_REMOVE(&cache->partial_q, slab, tqe);
+        TAILQ_INSERT_HEAD(&cache->partial_q, slab, tqe);
+    }
+    slab->nfree++;
+
+    ASSERT(cache->nused > 0);
+    cache->nused--;
+
+    if (slab->nfree < cache->nobj) {
+        return;
+    }
+
+    /* a slab of a cache that keeps its slabs stays on the partial q */
+    if (cache->keep) {
+        return;
+    }
+
+    TAILQ_REMOVE(&cache->partial_q, slab, tqe);
+    if (cache->empty == NULL) {
+        cache->empty = slab;
+    } else {
+        slab_destroy(cache, slab);
+    }
+}
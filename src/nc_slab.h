@@ -0,0 +1,42 @@
+#ifndef _NC_SLAB_H_
+#define _NC_SLAB_H_
+
+#include <nc_core.h>
+
+#define SLAB_SIZE   65536   /* slab size, and alignment */
+#define SLAB_NMAP   16      /* # words of the free bitmap of a slab */
+
+struct slab_cache;
+
+struct slab {
+    TAILQ_ENTRY(slab) tqe;             /* link in partial_q or full_q */
+    struct slab_cache *cache;          /* owner cache */
+    uint32_t          nfree;           /* # free objects */
+    uint64_t          map[SLAB_NMAP];  /* free bitmap, a set bit for a free object */
+};
+
+TAILQ_HEAD(slab_tqh, slab);
+
+/*
+ * Objects of one size, carved out of slabs
+ */
+struct slab_cache {
+    const char      *name;      /* name, for logging */
+    size_t          size;       /* object size */
+    uint32_t        offset;     /* offset of the first object in a slab */
+    uint32_t        nobj;       /* # objects in a slab */
+    struct slab_tqh partial_q;  /* slabs with both free and used objects */
+    struct slab_tqh full_q;     /* slabs with no free object */
+    struct slab     *empty;     /* slab with no used object, kept for reuse */
+    unsigned        keep:1;     /* never give slabs back? */
+    uint32_t        nslab;      /* # slabs */
+    uint64_t        nused;      /* # objects in use */
+};
+
+void slab_cache_init(struct slab_cache *cache, const char *name, size_t size,
+                     bool keep);
+void slab_cache_deinit(struct slab_cache *cache);
+void *slab_get(struct slab_cache *cache);
+void slab_put(struct slab_cache *cache, void *obj);
+
+#endif
@@ -0,0 +1,285 @@
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_slowlog.h>
+
+/*
+ * Slow requests of a pool with slowlog_slower_than: whose latency, from the
+ * request being read to the response being sent, is at least that many usec.
+ * Each worker keeps the last slowlog_max_len: of them in a ring per pool.
+ *
+ * The time a request spends on the server, from being sent to its response
+ * being read, is told apart from the rest, its time in the proxy and on the
+ * network. A fragmented request takes the time of its slowest fragment.
+ */
+
+static struct slowlog *
+slowlog_create(uint32_t size)
+{
+    struct slowlog *sl;
+
+    sl = nc_zalloc(sizeof(*sl));
+    if (sl == NULL) {
+        return NULL;
+    }
+
+    sl->entry = nc_zalloc(size * sizeof(*sl->entry));
+    if (sl->entry == NULL) {
+        nc_free(sl);
+        return NULL;
+    }
+
+    sl->size = size;
+    sl->nentry = 0;
+    sl->head = 0;
+    sl->id = 0;
+
+    return sl;
+}
+
+void
+slowlog_deinit(struct server_pool *pool)
+{
+    struct slowlog *sl = pool->slowlog;
+
+    if (sl == NULL) {
+        return;
+    }
+
+    nc_free(sl->entry);
+    nc_free(pool->slowlog);
+}
+
+static bool
+slowlog_enabled(struct msg *req)
+{
+    struct conn *c_conn = req->owner;
+
+    return req->start_ts > 0 && c_conn != NULL && c_conn->client &&
+           ((struct server_pool *)c_conn->owner)->slowlog_slower_than >= 0;
+}
+
+/*
+ * Mark req as sent to the server of s_conn
+ */
+void
+slowlog_send(struct conn *s_conn, struct msg *req)
+{
+    if (!slowlog_enabled(req)) {
+        return;
+    }
+
+    req->send_ts = nc_usec_now();
+    req->server = s_conn->owner;
+}
+
+/*
+ * Account the time req spent on its server, now that its response is read,
+ * to req and to the owner of its fragments
+ */
+void
+slowlog_receive(struct msg *req)
+{
+    struct msg *owner;
+
+    if (req->send_ts <= 0) {
+        return;
+    }
+
+    req->backend_us += nc_usec_now() - req->send_ts;
+    req->send_ts = 0;
+
+    owner = req->frag_owner;
+    if (owner != NULL && owner != req && req->backend_us > owner->backend_us) {
+        owner->backend_us = req->backend_us;
+        owner->server = req->server;
+    }
+}
+
+/*
+ * Log req, a request received on c_conn, and rsp, its response, if req was
+ * slow. Fragments of a request are left out, as their owner stands for them,
+ * and so are requests answered by the proxy itself.
+ */
+void
+slowlog_request(struct conn *c_conn, struct msg *req, struct msg *rsp)
+{
+    struct server_pool *pool;
+    struct slowlog *sl;
+    struct slowlog_entry *e;
+    struct keypos *kpos;
+    int64_t duration;
+
+    pool = c_conn->owner;
+    if (pool->slowlog_slower_than < 0 || req->start_ts == 0) {
+        return;
+    }
+
+    if ((req->frag_owner != NULL && req->frag_owner != req) || req->noforward) {
+        return;
+    }
+
+    /* a request that timed out spent the time until now on its server */
+    slowlog_receive(req);
+
+    duration = nc_usec_now() - req->start_ts;
+    if (duration < pool->slowlog_slower_than) {
+        return;
+    }
+
+    if (pool->slowlog == NULL) {
+        pool->slowlog = slowlog_create(pool->slowlog_max_len);
+        if (pool->slowlog == NULL) {
+            return;
+        }
+    }
+    sl = pool->slowlog;
+
+    e = &sl->entry[sl->head];
+    sl->head = (sl->head + 1) % sl->size;
+    if (sl->nentry < sl->size) {
+        sl->nentry++;
+    }
+
+    e->id = sl->id++;
+    e->ts = req->start_ts;
+    e->duration_us = duration;
+    e->backend_us = MIN(req->backend_us, duration);
+    e->server = req->server;
+    e->type = req->type;
+    e->nkey = array_n(req->keys);
+    e->request_bytes = req->mlen;
+    e->response_bytes = rsp->mlen;
+
+    if (e->nkey > 0) {
+        kpos = array_get(req->keys, 0);
+        e->keylen = (uint32_t)(kpos->end - kpos->start);
+        nc_memcpy(e->key, kpos->start, MIN(e->keylen, SLOWLOG_KEY_MAXLEN));
+    } else {
+        e->keylen = 0;
+    }
+
+    nc_scnprintf(e->client, sizeof(e->client), "%s",
+                 nc_unresolve_peer_desc(c_conn->sd));
+}
+
+uint32_t
+slowlog_len(struct server_pool *pool)
+{
+    return pool->slowlog != NULL ? pool->slowlog->nentry : 0;
+}
+
+/*
+ * Return the idx-th most recent slow request of pool
+ */
+struct slowlog_entry *
+slowlog_get(struct server_pool *pool, uint32_t idx)
+{
+    struct slowlog *sl = pool->slowlog;
+
+    ASSERT(idx < slowlog_len(pool));
+
+    return &sl->entry[(sl->head + sl->size - 1 - idx) % sl->size];
+}
+
+void
+slowlog_reset(struct server_pool *pool)
+{
+    if (pool->slowlog != NULL) {
+        pool->slowlog->nentry = 0;
+        pool->slowlog->head = 0;
+    }
+}
+
+static rstatus_t
+slowlog_dump_entry(struct stats_buffer *buf, struct slowlog_entry *e)
+{
+    rstatus_t status;
+    char cmd[64];
+    uint32_t cmdlen;
+
+    cmdlen = msg_type_cmd(e->type, cmd, sizeof(cmd));
+
+    status = stats_buf_printf(buf, "{\"id\":%"PRIu64", \"ts\":%"PRId64", "
+                              "\"duration_us\":%"PRId64", \"backend_us\":"
+                              "%"PRId64", \"proxy_us\":%"PRId64", \"server\":",
+                              e->id, e->ts, e->duration_us, e->backend_us,
+                              e->duration_us - e->backend_us);
+    if (status == NC_OK) {
+        if (e->server != NULL) {
+            status = stats_buf_add_json(buf, e->server->name.data,
+                                        e->server->name.len);
+        } else {
+            status = stats_buf_printf(buf, "null");
+        }
+    }
+    if (status == NC_OK) {
+        status = stats_buf_printf(buf, ", \"client\":");
+    }
+    if (status == NC_OK) {
+        status = stats_buf_add_json(buf, (uint8_t *)e->client,
+                                    (uint32_t)strlen(e->client));
+    }
+    if (status == NC_OK) {
+        status = stats_buf_printf(buf, ", \"cmd\":\"%.*s\", \"key\":", cmdlen,
+                                  cmd);
+    }
+    if (status == NC_OK) {
+        status = stats_buf_add_json(buf, e->key,
+                                    MIN(e->keylen, SLOWLOG_KEY_MAXLEN));
+    }
+    if (status == NC_OK) {
+        status = stats_buf_printf(buf, ", \"keylen\":%"PRIu32", \"nkey\":"
+                                  "%"PRIu32", \"req_bytes\":%"PRIu32", "
+                                  "\"rsp_bytes\":%"PRIu32"}", e->keylen,
+                                  e->nkey, e->request_bytes,
+                                  e->response_bytes);
+    }
+
+    return status;
+}
+
+/*
+ * Append the slow requests of every pool, or of the pool named by args, to
+ * buf, most recent first
+ */
+rstatus_t
+slowlog_dump(struct context *ctx, struct stats_buffer *buf, char *args)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    uint32_t i, j;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        pool = array_get(&ctx->pool, i);
+
+        if (pool->slowlog_slower_than < 0) {
+            continue;
+        }
+
+        if (args != NULL && (pool->name.len != strlen(args) ||
+            nc_strncmp(pool->name.data, args, pool->name.len) != 0)) {
+            continue;
+        }
+
+        status = stats_buf_printf(buf, ", \"%.*s\":{\"slowlog\":[",
+                                  pool->name.len, pool->name.data);
+
+        for (j = 0; j < slowlog_len(pool) && status == NC_OK; j++) {
+            if (j > 0) {
+                status = stats_buf_printf(buf, ", ");
+            }
+            if (status == NC_OK) {
+                status = slowlog_dump_entry(buf, slowlog_get(pool, j));
+            }
+        }
+
+        if (status == NC_OK) {
+            status = stats_buf_printf(buf, "]}");
+        }
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
@@ -0,0 +1,44 @@
+#ifndef _NC_SLOWLOG_H_
+#define _NC_SLOWLOG_H_
+
+#include <nc_core.h>
+
+#define SLOWLOG_KEY_MAXLEN      128 /* max # bytes of a key kept */
+#define SLOWLOG_CLIENT_MAXLEN   64  /* max # bytes of a client address kept */
+
+struct slowlog_entry {
+    uint64_t      id;                            /* entry id */
+    int64_t       ts;                            /* request start timestamp in usec */
+    int64_t       duration_us;                   /* end to end latency in usec */
+    int64_t       backend_us;                    /* time on the server in usec */
+    struct server *server;                       /* slowest server or NULL */
+    msg_type_t    type;                          /* request type */
+    uint32_t      nkey;                          /* # keys */
+    uint32_t      keylen;                        /* first key length, untruncated */
+    uint32_t      request_bytes;                 /* request length */
+    uint32_t      response_bytes;                /* response length */
+    uint8_t       key[SLOWLOG_KEY_MAXLEN];       /* first key, truncated */
+    char          client[SLOWLOG_CLIENT_MAXLEN]; /* client address */
+};
+
+/*
+ * Ring of the last slowlog_max_len: slow requests of a pool
+ */
+struct slowlog {
+    uint32_t             size;    /* # entries, slowlog_max_len: */
+    uint32_t             nentry;  /* # entries in use */
+    uint32_t             head;    /* next entry to write */
+    uint64_t             id;      /* id of the next entry */
+    struct slowlog_entry *entry;  /* entry[] */
+};
+
+void slowlog_send(struct conn *s_conn, struct msg *req);
+void slowlog_receive(struct msg *req);
+void slowlog_request(struct conn *c_conn, struct msg *req, struct msg *rsp);
+uint32_t slowlog_len(struct server_pool *pool);
+struct slowlog_entry *slowlog_get(struct server_pool *pool, uint32_t idx);
+void slowlog_reset(struct server_pool *pool);
+rstatus_t slowlog_dump(struct context *ctx, struct stats_buffer *buf, char *args);
+void slowlog_deinit(struct server_pool *pool);
+
+#endif
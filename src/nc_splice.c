@@ -0,0 +1,594 @@
+#include <fcntl.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_splice.h>
+
+/*
+ * A response to a redis pool with splice_threshold: whose value makes it at
+ * least that long is, once its header is read, only partly read into mbufs.
+ * The rest is moved from the server socket to a pipe and from the pipe to
+ * the client socket with splice(), without being copied to user space.
+ *
+ * The response is forwarded as soon as its relay starts, so that it is sent
+ * as usual up to the end of its mbufs, and then from the pipe. Only a
+ * response whose client already has the responses ahead of it is relayed,
+ * and only when nothing needs its value, so that it is sent in turn and as
+ * is.
+ *
+ * Each side only does I/O on its own socket. The server connection stops
+ * reading while the pipe is full, and the client connection stops writing
+ * while it is empty; either side wakes the other up through the run q,
+ * which the event loop goes through after handling events, as though the
+ * connection were ready again. Once the value is read, the server
+ * connection goes on with the next response, while the client connection
+ * may still be draining the pipe.
+ *
+ * A server connection stopped on a full pipe holds up the responses behind
+ * it on a slow client. So once a request is queued behind it, the rest of
+ * the value is read into mbufs instead, as without splice, and these are
+ * fed to the pipe as it drains: the relay then costs the memory it would
+ * have saved, but never stalls other clients of the server.
+ *
+ * A client that goes away leaves the server connection to read and drop
+ * the rest of the value. A server that goes away leaves the client with a
+ * truncated response, so the client connection is closed.
+ */
+
+#ifdef NC_HAVE_SPLICE
+
+/* relays with a connection to wake up */
+static struct splice_tqh splice_runq = TAILQ_HEAD_INITIALIZER(splice_runq);
+
+static uint8_t splice_buf[MBUF_SIZE]; /* sink of values with no client */
+
+static void
+splice_wake(struct splice *sp, bool server)
+{
+    if (server) {
+        sp->wake_s = 1;
+    } else {
+        sp->wake_c = 1;
+    }
+
+    if (!sp->queued) {
+        TAILQ_INSERT_TAIL(&splice_runq, sp, tqe);
+        sp->queued = 1;
+    }
+}
+
+static void
+splice_free(struct splice *sp)
+{
+    ASSERT(sp->s_conn == NULL && sp->msg == NULL);
+    ASSERT(STAILQ_EMPTY(&sp->spill));
+
+    if (sp->queued) {
+        TAILQ_REMOVE(&splice_runq, sp, tqe);
+    }
+
+    nc_free(sp);
+}
+
+/*
+ * Relay the rest of msg, the response being read on s_conn, if it is long
+ * enough and can be sent as is. Once started, msg is done being read.
+ */
+rstatus_t
+splice_start(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    struct server *server = s_conn->owner;
+    struct server_pool *pool = server->owner;
+    struct conn *c_conn;
+    struct msg *pmsg, *m;
+    struct splice *sp;
+
+    ASSERT(!s_conn->client && !s_conn->proxy);
+    ASSERT(!msg->request && s_conn->rmsg == msg);
+
+    if (pool->splice_threshold == 0 || msg->vleft == 0 ||
+        (uint64_t)msg->mlen + msg->vleft < pool->splice_threshold) {
+        return NC_OK;
+    }
+
+    /* backfills copy the value of the response */
+    pmsg = TAILQ_FIRST(&s_conn->omsg_q);
+    if (pmsg == NULL || pmsg->swallow || pmsg->frag_owner != NULL ||
+        pmsg->migrate != NULL || pmsg->fallback != NULL) {
+        return NC_OK;
+    }
+
+    c_conn = pmsg->owner;
+    if (c_conn == NULL || !c_conn->client || c_conn->err != 0 ||
+        c_conn->done) {
+        return NC_OK;
+    }
+
+    /* the client must not wait on another server to get to the response */
+    for (m = TAILQ_FIRST(&c_conn->omsg_q); m != pmsg;
+         m = TAILQ_NEXT(m, c_tqe)) {
+        if (!req_done(c_conn, m)) {
+            return NC_OK;
+        }
+    }
+
+    sp = nc_alloc(sizeof(*sp));
+    if (sp == NULL) {
+        return NC_OK;
+    }
+
+    if (pipe2(sp->pipefd, O_NONBLOCK | O_CLOEXEC) < 0) {
+        log_warn("splice: pipe for rsp %"PRIu64" on s %d failed: %s", msg->id,
+                 s_conn->sd, strerror(errno));
+        nc_free(sp);
+        return NC_OK;
+    }
+#ifdef F_SETPIPE_SZ
+    /* a larger pipe takes fewer wake ups, but the default one will do */
+    (void)fcntl(sp->pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+#endif
+
+    sp->s_conn = s_conn;
+    sp->c_conn = c_conn;
+    sp->msg = msg;
+    sp->nrecv = msg->vleft;
+    sp->npipe = 0;
+    sp->nsend = msg->vleft;
+    STAILQ_INIT(&sp->spill);
+    sp->nspill = 0;
+    sp->stalled = 0;
+    sp->waiting = 0;
+    sp->wake_s = 0;
+    sp->wake_c = 0;
+    sp->queued = 0;
+    sp->spilling = 0;
+    sp->error = 0;
+
+    s_conn->splice = sp;
+    msg->splice = sp;
+
+    log_debug(LOG_VERB, "splice %zu bytes of rsp %"PRIu64" len %"PRIu32" from "
+              "s %d to c %d", sp->nrecv, msg->id, msg->mlen, s_conn->sd,
+              c_conn->sd);
+
+    msg->mlen += msg->vleft;
+    msg->vleft = 0;
+
+    s_conn->recv_done(ctx, s_conn, msg, NULL);
+
+    return NC_OK;
+}
+
+/*
+ * Read what there is of the value being relayed from sd into the spill
+ * mbufs. Returns what read() does.
+ */
+static ssize_t
+splice_spill_read(struct splice *sp, int sd)
+{
+    struct mbuf *mbuf;
+    ssize_t n;
+
+    mbuf = STAILQ_LAST(&sp->spill, mbuf, next);
+    if (mbuf == NULL || mbuf_full(mbuf)) {
+        mbuf = mbuf_get();
+        if (mbuf == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        mbuf_insert(&sp->spill, mbuf);
+    }
+
+    n = nc_read(sd, mbuf->last, MIN(sp->nrecv, (size_t)mbuf_size(mbuf)));
+    if (n > 0) {
+        mbuf->last += n;
+        sp->nspill += (size_t)n;
+    }
+
+    return n;
+}
+
+/*
+ * Move as much of the spill mbufs into the pipe as it takes
+ */
+static rstatus_t
+splice_spill_flush(struct splice *sp)
+{
+    struct mbuf *mbuf;
+    ssize_t n;
+
+    while ((mbuf = STAILQ_FIRST(&sp->spill)) != NULL) {
+        if (mbuf_empty(mbuf)) {
+            mbuf_remove(&sp->spill, mbuf);
+            mbuf_put(mbuf);
+            continue;
+        }
+
+        n = write(sp->pipefd[1], mbuf->pos, mbuf_length(mbuf));
+        if (n > 0) {
+            mbuf->pos += n;
+            sp->nspill -= (size_t)n;
+            sp->npipe += (size_t)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+static void
+splice_spill_free(struct splice *sp)
+{
+    struct mbuf *mbuf;
+
+    while ((mbuf = STAILQ_FIRST(&sp->spill)) != NULL) {
+        mbuf_remove(&sp->spill, mbuf);
+        mbuf_put(mbuf);
+    }
+    sp->nspill = 0;
+}
+
+/*
+ * Read the rest of the value being relayed from s_conn into the pipe, or
+ * into the spill mbufs once others wait on s_conn, or drop it if its client
+ * is gone
+ */
+rstatus_t
+splice_recv(struct context *ctx, struct conn *s_conn)
+{
+    struct splice *sp = s_conn->splice;
+    ssize_t n;
+
+    ASSERT(sp != NULL && sp->s_conn == s_conn);
+    ASSERT(sp->nrecv > 0);
+    ASSERT(s_conn->recv_ready);
+
+    sp->stalled = 0;
+
+    while (sp->nrecv > 0) {
+        if (sp->msg != NULL && sp->spilling) {
+            n = splice_spill_read(sp, s_conn->sd);
+        } else if (sp->msg != NULL) {
+            n = splice(s_conn->sd, NULL, sp->pipefd[1], NULL, sp->nrecv,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        } else {
+            n = nc_read(s_conn->sd, splice_buf, MIN(sp->nrecv,
+                                                    sizeof(splice_buf)));
+        }
+
+        log_debug(LOG_VERB, "splice recv on sd %d %zd of %zu", s_conn->sd, n,
+                  sp->nrecv);
+
+        if (n > 0) {
+            sp->nrecv -= (size_t)n;
+            s_conn->recv_bytes += (size_t)n;
+            if (sp->msg != NULL && !sp->spilling) {
+                sp->npipe += (size_t)n;
+            }
+            continue;
+        }
+
+        s_conn->recv_ready = 0;
+
+        if (n == 0) {
+            log_error("eof s %d with %zu bytes of spliced rsp to go",
+                      s_conn->sd, sp->nrecv);
+            s_conn->eof = 1;
+            s_conn->done = 1;
+            break;
+        }
+
+        if (errno == EINTR) {
+            s_conn->recv_ready = 1;
+            continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* either s_conn is drained or the pipe is full */
+            if (sp->msg != NULL && !sp->spilling && sp->npipe > 0 &&
+                (!TAILQ_EMPTY(&s_conn->imsg_q) ||
+                 !TAILQ_EMPTY(&s_conn->omsg_q))) {
+                log_debug(LOG_VERB, "splice recv on sd %d spills the %zu "
+                          "bytes left behind a full pipe", s_conn->sd,
+                          sp->nrecv);
+                sp->spilling = 1;
+                s_conn->recv_ready = 1;
+                continue;
+            }
+            sp->stalled = !sp->spilling && sp->npipe > 0 ? 1 : 0;
+            break;
+        }
+
+        s_conn->err = errno;
+        log_error("splice recv on sd %d failed: %s", s_conn->sd,
+                  strerror(errno));
+        break;
+    }
+
+    if (sp->waiting && (sp->npipe > 0 || sp->nspill > 0)) {
+        splice_wake(sp, false);
+    }
+
+    if (s_conn->err != 0) {
+        return NC_ERROR;
+    }
+
+    if (sp->nrecv == 0) {
+        /* the value is all read, s_conn goes on with the next response */
+        s_conn->splice = NULL;
+        sp->s_conn = NULL;
+        sp->stalled = 0;
+        if (sp->msg == NULL) {
+            splice_free(sp);
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Return true, if msg is being relayed and has been sent up to the end of
+ * its mbufs
+ */
+bool
+splice_sending(struct msg *msg)
+{
+    struct mbuf *mbuf;
+
+    if (msg->splice == NULL) {
+        return false;
+    }
+
+    STAILQ_FOREACH(mbuf, &msg->mhdr, next) {
+        if (!mbuf_empty(mbuf)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Send the rest of msg, the response being relayed to c_conn, from the pipe
+ */
+rstatus_t
+splice_send(struct context *ctx, struct conn *c_conn, struct msg *msg)
+{
+    struct splice *sp = msg->splice;
+    size_t nsend;
+    ssize_t n;
+
+    ASSERT(c_conn->client && c_conn->smsg == msg);
+    ASSERT(sp != NULL && sp->c_conn == c_conn);
+
+    /* send_next picks msg again, until it is done */
+    c_conn->smsg = NULL;
+
+    sp->waiting = 0;
+    nsend = sp->nsend;
+
+    while (sp->nsend > 0) {
+        if (sp->nspill > 0 && splice_spill_flush(sp) != NC_OK) {
+            c_conn->err = errno;
+            log_error("splice spill on sd %d failed: %s", c_conn->sd,
+                      strerror(errno));
+            return NC_ERROR;
+        }
+
+        if (sp->npipe == 0) {
+            c_conn->send_ready = 0;
+            if (sp->error) {
+                log_warn("c %d closed with %zu bytes of spliced rsp %"PRIu64
+                         " to go as its server is gone", c_conn->sd, sp->nsend,
+                         msg->id);
+                c_conn->done = 1;
+                return NC_OK;
+            }
+            sp->waiting = 1;
+            break;
+        }
+
+        n = splice(sp->pipefd[0], NULL, c_conn->sd, NULL, sp->npipe,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+        log_debug(LOG_VERB, "splice send on sd %d %zd of %zu", c_conn->sd, n,
+                  sp->npipe);
+
+        if (n > 0) {
+            sp->npipe -= (size_t)n;
+            sp->nsend -= (size_t)n;
+            c_conn->send_bytes += (size_t)n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        c_conn->send_ready = 0;
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        c_conn->err = n < 0 ? errno : EPIPE;
+        log_error("splice send on sd %d failed: %s", c_conn->sd,
+                  strerror(c_conn->err));
+        return NC_ERROR;
+    }
+
+    if (sp->stalled && sp->nsend < nsend) {
+        splice_wake(sp, true);
+    }
+
+    if (sp->nsend == 0) {
+        c_conn->send_done(ctx, c_conn, msg);
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Give up reading the value being relayed from s_conn, which is closing
+ */
+void
+splice_close(struct context *ctx, struct conn *s_conn)
+{
+    struct splice *sp = s_conn->splice;
+
+    ASSERT(sp != NULL && sp->s_conn == s_conn);
+
+    s_conn->splice = NULL;
+    sp->s_conn = NULL;
+    sp->stalled = 0;
+    sp->wake_s = 0;
+
+    if (sp->msg == NULL) {
+        splice_free(sp);
+        return;
+    }
+
+    sp->error = 1;
+    if (sp->waiting) {
+        splice_wake(sp, false);
+    }
+}
+
+/*
+ * Release the relay of msg, a response being put
+ */
+void
+splice_put(struct msg *msg)
+{
+    struct splice *sp = msg->splice;
+
+    ASSERT(sp != NULL && sp->msg == msg);
+
+    msg->splice = NULL;
+    sp->msg = NULL;
+    sp->c_conn = NULL;
+    sp->waiting = 0;
+    sp->wake_c = 0;
+
+    close(sp->pipefd[0]);
+    close(sp->pipefd[1]);
+    sp->npipe = 0;
+    splice_spill_free(sp);
+
+    if (sp->s_conn == NULL) {
+        splice_free(sp);
+        return;
+    }
+
+    /* the rest of the value is dropped, to keep s_conn in step */
+    if (sp->stalled) {
+        splice_wake(sp, true);
+    }
+}
+
+/*
+ * Wake s_conn up, if a request was just queued on it behind a relay that
+ * waits on a full pipe, so that it spills the rest of the value
+ */
+void
+splice_queued(struct conn *s_conn)
+{
+    struct splice *sp = s_conn->splice;
+
+    if (sp != NULL && sp->stalled) {
+        splice_wake(sp, true);
+    }
+}
+
+/*
+ * Handle the connections woken up by the other side of their relay
+ */
+void
+splice_run(struct context *ctx)
+{
+    struct splice *sp;
+    struct conn *s_conn, *c_conn;
+
+    while (!TAILQ_EMPTY(&splice_runq)) {
+        sp = TAILQ_FIRST(&splice_runq);
+        TAILQ_REMOVE(&splice_runq, sp, tqe);
+        sp->queued = 0;
+
+        s_conn = sp->wake_s ? sp->s_conn : NULL;
+        c_conn = sp->wake_c ? sp->c_conn : NULL;
+        sp->wake_s = 0;
+        sp->wake_c = 0;
+
+        /* sp may be gone once either conn is handled */
+
+        if (s_conn != NULL) {
+            core_core(ctx->evb, s_conn, EVENT_READ);
+        }
+
+        if (c_conn != NULL && c_conn->send_active) {
+            core_core(ctx->evb, c_conn, EVENT_WRITE);
+        }
+    }
+}
+
+#else
+
+rstatus_t
+splice_start(struct context *ctx, struct conn *s_conn, struct msg *msg)
+{
+    return NC_OK;
+}
+
+rstatus_t
+splice_recv(struct context *ctx, struct conn *s_conn)
+{
+    NOT_REACHED();
+    return NC_ERROR;
+}
+
+bool
+splice_sending(struct msg *msg)
+{
+    return false;
+}
+
+rstatus_t
+splice_send(struct context *ctx, struct conn *c_conn, struct msg *msg)
+{
+    NOT_REACHED();
+    return NC_ERROR;
+}
+
+void
+splice_close(struct context *ctx, struct conn *s_conn)
+{
+    NOT_REACHED();
+}
+
+void
+splice_put(struct msg *msg)
+{
+    NOT_REACHED();
+}
+
+void
+splice_queued(struct conn *s_conn)
+{
+}
+
+void
+splice_run(struct context *ctx)
+{
+}
+
+#endif
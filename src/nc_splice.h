@@ -0,0 +1,43 @@
+#ifndef _NC_SPLICE_H_
+#define _NC_SPLICE_H_
+
+#include <nc_core.h>
+
+#define SPLICE_PIPE_SIZE    (1024 * 1024)   /* pipe capacity asked for */
+
+/*
+ * Relay of the rest of a response, from its server connection to its client
+ * connection through a pipe
+ */
+struct splice {
+    TAILQ_ENTRY(splice) tqe;        /* link in run q */
+    struct conn         *s_conn;    /* server conn read from, or NULL when read */
+    struct conn         *c_conn;    /* client conn sent to, or NULL when gone */
+    struct msg          *msg;       /* response, or NULL when gone */
+    int                 pipefd[2];  /* pipe from s_conn to c_conn */
+    size_t              nrecv;      /* # bytes still to read from s_conn */
+    size_t              npipe;      /* # bytes in the pipe */
+    size_t              nsend;      /* # bytes still to send to c_conn */
+    struct mhdr         spill;      /* bytes read ahead of a full pipe */
+    size_t              nspill;     /* # bytes in spill */
+    unsigned            stalled:1;  /* s_conn stopped on a full pipe? */
+    unsigned            waiting:1;  /* c_conn stopped on an empty pipe? */
+    unsigned            wake_s:1;   /* s_conn to be read? */
+    unsigned            wake_c:1;   /* c_conn to be written? */
+    unsigned            queued:1;   /* in run q? */
+    unsigned            spilling:1; /* s_conn reads into spill? */
+    unsigned            error:1;    /* s_conn closed before all was read? */
+};
+
+TAILQ_HEAD(splice_tqh, splice);
+
+rstatus_t splice_start(struct context *ctx, struct conn *s_conn, struct msg *msg);
+rstatus_t splice_recv(struct context *ctx, struct conn *s_conn);
+bool splice_sending(struct msg *msg);
+rstatus_t splice_send(struct context *ctx, struct conn *c_conn, struct msg *msg);
+void splice_close(struct context *ctx, struct conn *s_conn);
+void splice_put(struct msg *msg);
+void splice_queued(struct conn *s_conn);
+void splice_run(struct context *ctx);
+
+#endif
@@ -18,13 +18,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
 #include <nc_core.h>
+#include <nc_conf.h>
 #include <nc_server.h>
 #include <nc_process.h>
+#include <nc_tap.h>
+#include <nc_namespace.h>
+#include <nc_slowlog.h>
+#include <nc_talker.h>
 
 struct stats_desc {
     char *name; /* stats name */
@@ -92,21 +99,6 @@ stats_metric_init(struct stats_metric *stm)
     }
 }
 
-static void
-stats_metric_reset(struct array *stats_metric)
-{
-    uint32_t i, nmetric;
-
-    nmetric = array_n(stats_metric);
-    ASSERT(nmetric == STATS_POOL_NFIELD || nmetric == STATS_SERVER_NFIELD);
-
-    for (i = 0; i < nmetric; i++) {
-        struct stats_metric *stm = array_get(stats_metric, i);
-
-        stats_metric_init(stm);
-    }
-}
-
 static rstatus_t
 stats_pool_metric_init(struct array *stats_metric)
 {
@@ -190,12 +182,12 @@ server_each_map_to_stats_server(void *elem, void *data)
 }
 
 static rstatus_t
-stats_server_map(struct array *stats_server, struct array *server, struct array *master)
+stats_server_map(struct array *stats_server, struct array *server,
+                 uint32_t nserver, struct array *master)
 {
     rstatus_t status;
-    uint32_t nserver, nmaster;
+    uint32_t i, nmaster;
 
-    nserver = array_n(server);
     ASSERT(nserver != 0);
     nmaster = array_n(master);
     /* nmaster can be 0 */
@@ -205,9 +197,13 @@ stats_server_map(struct array *stats_server, struct array *server, struct array
         return status;
     }
 
-    status = array_each(server, server_each_map_to_stats_server, stats_server);
-    if (status != NC_OK) {
-        return status;
+    /* servers joined after the config was read are not mapped */
+    for (i = 0; i < nserver; i++) {
+        status = server_each_map_to_stats_server(array_get(server, i),
+                                                 stats_server);
+        if (status != NC_OK) {
+            return status;
+        }
     }
 
     if (nmaster != 0) {
@@ -252,7 +248,8 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
         return status;
     }
 
-    status = stats_server_map(&stp->server, &sp->server, &sp->redis_master);
+    status = stats_server_map(&stp->server, &sp->server, sp->nserver_conf,
+                              &sp->redis_master);
     if (status != NC_OK) {
         stats_metric_deinit(&stp->metric);
         return status;
@@ -265,25 +262,102 @@ stats_pool_init(struct stats_pool *stp, struct server_pool *sp)
     return NC_OK;
 }
 
-static void
-stats_pool_reset(struct array *stats_pool)
+/*
+ * Assign every server of every pool its slot in the flat server counters.
+ * Redis master servers are already indexed after the regular servers of
+ * their pool. Servers joined to a pool after its config was read are not
+ * laid out until the next reload and share a sink slot past all others.
+ * Returns the # server slots.
+ */
+static uint32_t
+stats_server_index(struct array *server_pool)
 {
-    uint32_t i, npool;
+    uint32_t i, j, npool, base;
 
-    npool = array_n(stats_pool);
+    base = 0;
+    for (i = 0, npool = array_n(server_pool); i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+        uint32_t nserver = sp->nserver_conf;
+        uint32_t nmaster = array_n(&sp->redis_master);
 
-    for (i = 0; i < npool; i++) {
-        struct stats_pool *stp = array_get(stats_pool, i);
-        uint32_t j, nserver;
+        for (j = 0; j < nserver; j++) {
+            struct server *s = array_get(&sp->server, j);
+            s->stats_idx = base + s->idx;
+        }
 
-        stats_metric_reset(&stp->metric);
+        for (j = 0; j < nmaster; j++) {
+            struct server *s = array_get(&sp->redis_master, j);
+            s->stats_idx = base + s->idx;
+        }
 
-        nserver = array_n(&stp->server);
-        for (j = 0; j < nserver; j++) {
-            struct stats_server *sts = array_get(&stp->server, j);
-            stats_metric_reset(&sts->metric);
+        base += nserver + nmaster;
+    }
+
+    for (i = 0; i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+
+        for (j = sp->nserver_conf; j < array_n(&sp->server); j++) {
+            struct server *s = array_get(&sp->server, j);
+            s->stats_idx = base;
         }
     }
+
+    return base + 1;
+}
+
+/*
+ * Point the counters of a server joined to its pool at the sink slot
+ */
+void
+stats_server_join(struct stats *st, struct server *server)
+{
+    server->stats_idx = st != NULL ? st->current->nserver - 1 : 0;
+}
+
+static rstatus_t
+stats_counters_init(struct stats_counters *stc, uint32_t npool, uint32_t nserver)
+{
+    ASSERT(npool != 0 && nserver != 0);
+
+    stc->pool = nc_calloc(npool, sizeof(*stc->pool));
+    if (stc->pool == NULL) {
+        return NC_ENOMEM;
+    }
+    stc->npool = npool;
+
+    stc->server = nc_calloc(nserver, sizeof(*stc->server));
+    if (stc->server == NULL) {
+        nc_free(stc->pool);
+        stc->npool = 0;
+        return NC_ENOMEM;
+    }
+    stc->nserver = nserver;
+
+    log_debug(LOG_VVVERB, "init stats counters with %"PRIu32" pool and "
+              "%"PRIu32" server", npool, nserver);
+
+    return NC_OK;
+}
+
+static void
+stats_counters_deinit(struct stats_counters *stc)
+{
+    if (stc->pool != NULL) {
+        nc_free(stc->pool);
+    }
+    if (stc->server != NULL) {
+        nc_free(stc->server);
+    }
+    stc->npool = 0;
+    stc->nserver = 0;
+}
+
+static void
+stats_counters_reset(struct stats_counters *stc)
+{
+    /* all metrics (counter, gauge and timestamp) start out as 0 */
+    memset(stc->pool, 0, stc->npool * sizeof(*stc->pool));
+    memset(stc->server, 0, stc->nserver * sizeof(*stc->server));
 }
 
 static rstatus_t
@@ -375,6 +449,14 @@ stats_create_buf(struct stats *st)
     size += int64_max_digits;
     size += key_value_extra;
 
+    size += st->token_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
+    size += st->since_str.len;
+    size += int64_max_digits;
+    size += key_value_extra;
+
     /* server pools */
     for (i = 0; i < array_n(&st->sum); i++) {
         struct stats_pool *stp = array_get(&st->sum, i);
@@ -437,22 +519,129 @@ stats_destroy_buf(struct stats *st)
     }
 }
 
+static rstatus_t
+stats_grow_buf(struct stats_buffer *buf)
+{
+    uint8_t *data;
+    size_t size;
+
+    size = buf->size * 2;
+
+    data = nc_realloc(buf->data, size);
+    if (data == NULL) {
+        log_error("grow stats buffer to size %zu failed: %s", size,
+                  strerror(errno));
+        return NC_ENOMEM;
+    }
+    buf->data = data;
+    buf->size = size;
+
+    log_debug(LOG_DEBUG, "stats buffer size %zu", size);
+
+    return NC_OK;
+}
+
+/*
+ * Append the printf-style fmt to buf, growing it as needed
+ */
+rstatus_t
+stats_buf_printf(struct stats_buffer *buf, const char *fmt, ...)
+{
+    rstatus_t status;
+    va_list args;
+    size_t room;
+    int n;
+
+    for (;;) {
+        room = buf->size - buf->len;
+
+        va_start(args, fmt);
+        n = vsnprintf((char *)buf->data + buf->len, room, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            return NC_ERROR;
+        }
+        if ((size_t)n < room) {
+            break;
+        }
+
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    buf->len += (size_t)n;
+
+    return NC_OK;
+}
+
+/*
+ * Append {data, len} to buf as a json string
+ */
+rstatus_t
+stats_buf_add_json(struct stats_buffer *buf, uint8_t *data, uint32_t len)
+{
+    rstatus_t status;
+    uint8_t *p;
+    uint32_t i;
+
+    /* every byte takes at most 6, as \u00XX */
+    while (buf->size - buf->len < (size_t)len * 6 + 3) {
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    p = buf->data + buf->len;
+
+    *p++ = '"';
+    for (i = 0; i < len; i++) {
+        if (data[i] == '"' || data[i] == '\\') {
+            *p++ = '\\';
+            *p++ = data[i];
+        } else if (data[i] < 0x20 || data[i] >= 0x7f) {
+            p += nc_scnprintf(p, 7, "\\u%04x", data[i]);
+        } else {
+            *p++ = data[i];
+        }
+    }
+    *p++ = '"';
+
+    buf->len = (size_t)(p - buf->data);
+
+    return NC_OK;
+}
+
 static rstatus_t
 stats_add_string(struct stats *st, struct string *key, struct string *val)
 {
+    rstatus_t status;
     struct stats_buffer *buf;
     uint8_t *pos;
     size_t room;
     int n;
 
     buf = &st->buf;
-    pos = buf->data + buf->len;
-    room = buf->size - buf->len - 1;
 
-    n = nc_snprintf(pos, room, "\"%.*s\":\"%.*s\", ", key->len, key->data,
-                    val->len, val->data);
-    if (n < 0 || n >= (int)room) {
-        return NC_ERROR;
+    for (;;) {
+        pos = buf->data + buf->len;
+        room = buf->size - buf->len - 1;
+
+        n = nc_snprintf(pos, room, "\"%.*s\":\"%.*s\", ", key->len, key->data,
+                        val->len, val->data);
+        if (n < 0) {
+            return NC_ERROR;
+        }
+        if (n < (int)room) {
+            break;
+        }
+
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
     }
 
     buf->len += (size_t)n;
@@ -463,19 +652,31 @@ stats_add_string(struct stats *st, struct string *key, struct string *val)
 static rstatus_t
 stats_add_num(struct stats *st, struct string *key, int64_t val)
 {
+    rstatus_t status;
     struct stats_buffer *buf;
     uint8_t *pos;
     size_t room;
     int n;
 
     buf = &st->buf;
-    pos = buf->data + buf->len;
-    room = buf->size - buf->len - 1;
 
-    n = nc_snprintf(pos, room, "\"%.*s\":%"PRId64", ", key->len, key->data,
-                    val);
-    if (n < 0 || n >= (int)room) {
-        return NC_ERROR;
+    for (;;) {
+        pos = buf->data + buf->len;
+        room = buf->size - buf->len - 1;
+
+        n = nc_snprintf(pos, room, "\"%.*s\":%"PRId64", ", key->len, key->data,
+                        val);
+        if (n < 0) {
+            return NC_ERROR;
+        }
+        if (n < (int)room) {
+            break;
+        }
+
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
     }
 
     buf->len += (size_t)n;
@@ -484,18 +685,39 @@ stats_add_num(struct stats *st, struct string *key, int64_t val)
 }
 
 static rstatus_t
-stats_add_header(struct stats *st)
+stats_add_char(struct stats *st, uint8_t ch)
 {
     rstatus_t status;
     struct stats_buffer *buf;
-    int64_t cur_ts, uptime;
 
     buf = &st->buf;
-    buf->data[0] = '{';
-    buf->len = 1;
+
+    if (buf->len + 1 >= buf->size) {
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    buf->data[buf->len++] = ch;
+
+    return NC_OK;
+}
+
+static rstatus_t
+stats_add_header(struct stats *st, struct stats_snapshot *snap,
+                 struct stats_query *q, uint64_t since)
+{
+    rstatus_t status;
+    int64_t cur_ts, uptime;
+
+    status = stats_add_char(st, '{');
+    if (status != NC_OK) {
+        return status;
+    }
 
     cur_ts = (int64_t)time(NULL);
-    uptime = cur_ts - st->start_ts;
+    uptime = cur_ts - snap->start_ts;
 
     status = stats_add_string(st, &st->service_str, &st->service);
     if (status != NC_OK) {
@@ -522,34 +744,52 @@ stats_add_header(struct stats *st)
         return status;
     }
 
-    status = stats_add_num(st, &st->pid_str, (int64_t)getpid());
+    status = stats_add_num(st, &st->pid_str, (int64_t)snap->pid);
     if (status != NC_OK) {
         return status;
     }
 
-    status = stats_add_num(st, &st->ntotal_conn_str, (int64_t)conn_ntotal_conn());
+    status = stats_add_num(st, &st->ntotal_conn_str, snap->ntotal_conn);
     if (status != NC_OK) {
         return status;
     }
 
-    status = stats_add_num(st, &st->ncurr_conn_str, conn_ncurr_conn());
+    status = stats_add_num(st, &st->ncurr_conn_str, snap->ncurr_conn);
     if (status != NC_OK) {
         return status;
     }
 
+    if (q->token) {
+        status = stats_add_num(st, &st->token_str, (int64_t)st->ntoken + 1);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    if (since != 0) {
+        status = stats_add_num(st, &st->since_str, (int64_t)since);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
     return NC_OK;
 }
 
 static rstatus_t
 stats_add_footer(struct stats *st)
 {
+    rstatus_t status;
     struct stats_buffer *buf;
     uint8_t *pos;
 
     buf = &st->buf;
 
     if (buf->len == buf->size) {
-        return NC_ERROR;
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
     }
 
     /* overwrite the last byte and add a new byte */
@@ -564,18 +804,30 @@ stats_add_footer(struct stats *st)
 static rstatus_t
 stats_begin_nesting(struct stats *st, struct string *key)
 {
+    rstatus_t status;
     struct stats_buffer *buf;
     uint8_t *pos;
     size_t room;
     int n;
 
     buf = &st->buf;
-    pos = buf->data + buf->len;
-    room = buf->size - buf->len - 1;
 
-    n = nc_snprintf(pos, room, "\"%.*s\": {", key->len, key->data);
-    if (n < 0 || n >= (int)room) {
-        return NC_ERROR;
+    for (;;) {
+        pos = buf->data + buf->len;
+        room = buf->size - buf->len - 1;
+
+        n = nc_snprintf(pos, room, "\"%.*s\": {", key->len, key->data);
+        if (n < 0) {
+            return NC_ERROR;
+        }
+        if (n < (int)room) {
+            break;
+        }
+
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
     }
 
     buf->len += (size_t)n;
@@ -586,10 +838,19 @@ stats_begin_nesting(struct stats *st, struct string *key)
 static rstatus_t
 stats_end_nesting(struct stats *st)
 {
+    rstatus_t status;
     struct stats_buffer *buf;
     uint8_t *pos;
 
     buf = &st->buf;
+
+    if (buf->len == buf->size) {
+        status = stats_grow_buf(buf);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
     pos = buf->data + buf->len;
 
     pos -= 2; /* go back by 2 bytes */
@@ -603,9 +864,6 @@ stats_end_nesting(struct stats *st)
         break;
 
     case '}':
-        if (buf->len == buf->size) {
-            return NC_ERROR;
-        }
         /* overwrite the last byte and add a new byte */
         ASSERT(pos[1] == ',');
         pos[1] = '}';
@@ -620,49 +878,26 @@ stats_end_nesting(struct stats *st)
     return NC_OK;
 }
 
-static rstatus_t
-stats_copy_metric(struct stats *st, struct array *metric)
-{
-    rstatus_t status;
-    uint32_t i;
-
-    for (i = 0; i < array_n(metric); i++) {
-        struct stats_metric *stm = array_get(metric, i);
-
-        status = stats_add_num(st, &stm->name, stm->value.counter);
-        if (status != NC_OK) {
-            return status;
-        }
-    }
-
-    return NC_OK;
-}
-
 static void
-stats_aggregate_metric(struct array *dst, struct array *src)
+stats_aggregate_metric(struct array *dst, const int64_t *src)
 {
     uint32_t i;
 
-    for (i = 0; i < array_n(src); i++) {
-        struct stats_metric *stm1, *stm2;
+    for (i = 0; i < array_n(dst); i++) {
+        struct stats_metric *stm = array_get(dst, i);
 
-        stm1 = array_get(src, i);
-        stm2 = array_get(dst, i);
-
-        ASSERT(stm1->type == stm2->type);
-
-        switch (stm1->type) {
+        switch (stm->type) {
         case STATS_COUNTER:
-            stm2->value.counter += stm1->value.counter;
+            stm->value.counter += src[i];
             break;
 
         case STATS_GAUGE:
-            stm2->value.counter += stm1->value.counter;
+            stm->value.counter += src[i];
             break;
 
         case STATS_TIMESTAMP:
-            if (stm1->value.timestamp) {
-                stm2->value.timestamp = stm1->value.timestamp;
+            if (src[i]) {
+                stm->value.timestamp = src[i];
             }
             break;
 
@@ -675,259 +910,1668 @@ stats_aggregate_metric(struct array *dst, struct array *src)
 static void
 stats_aggregate(struct stats *st)
 {
-    uint32_t i;
+    struct stats_counters *stc;
+    uint32_t i, sidx;
 
     if (st->aggregate == 0) {
         log_debug(LOG_PVERB, "skip aggregate of shadow %p to sum %p as "
-                  "generator is slow", st->shadow.elem, st->sum.elem);
+                  "generator is slow", st->shadow, st->sum.elem);
         return;
     }
 
-    log_debug(LOG_PVERB, "aggregate stats shadow %p to sum %p", st->shadow.elem,
+    log_debug(LOG_PVERB, "aggregate stats shadow %p to sum %p", st->shadow,
               st->sum.elem);
 
-    for (i = 0; i < array_n(&st->shadow); i++) {
-        struct stats_pool *stp1, *stp2;
+    stc = st->shadow;
+    ASSERT(stc->npool == array_n(&st->sum));
+
+    /* servers of all pools are laid out back to back in shadow (b) */
+    for (i = 0, sidx = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
         uint32_t j;
 
-        stp1 = array_get(&st->shadow, i);
-        stp2 = array_get(&st->sum, i);
-        stats_aggregate_metric(&stp2->metric, &stp1->metric);
+        stats_aggregate_metric(&stp->metric, (int64_t *)&stc->pool[i]);
 
-        for (j = 0; j < array_n(&stp1->server); j++) {
-            struct stats_server *sts1, *sts2;
+        for (j = 0; j < array_n(&stp->server); j++, sidx++) {
+            struct stats_server *sts = array_get(&stp->server, j);
 
-            sts1 = array_get(&stp1->server, j);
-            sts2 = array_get(&stp2->server, j);
-            stats_aggregate_metric(&sts2->metric, &sts1->metric);
+            ASSERT(sidx < stc->nserver);
+            stats_aggregate_metric(&sts->metric, (int64_t *)&stc->server[sidx]);
         }
     }
 
     st->aggregate = 0;
 }
 
-static rstatus_t
-stats_make_rsp(struct stats *st)
+/*
+ * Returns the # metric values in a snapshot of the given server pools
+ */
+static uint32_t
+stats_nvalue(struct array *server_pool)
 {
-    rstatus_t status;
-    uint32_t i;
+    uint32_t i, npool, nvalue;
 
-    status = stats_add_header(st);
-    if (status != NC_OK) {
-        return status;
+    nvalue = 0;
+    for (i = 0, npool = array_n(server_pool); i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+        uint32_t nserver;
+
+        nserver = sp->nserver_conf + array_n(&sp->redis_master);
+        nvalue += STATS_POOL_NFIELD + nserver * STATS_SERVER_NFIELD;
     }
 
+    return nvalue;
+}
+
+/*
+ * Returns the # metric values in sum (c)
+ */
+static uint32_t
+stats_sum_nvalue(struct stats *st)
+{
+    uint32_t i, nvalue;
+
+    nvalue = 0;
     for (i = 0; i < array_n(&st->sum); i++) {
         struct stats_pool *stp = array_get(&st->sum, i);
-        uint32_t j;
+        nvalue += STATS_POOL_NFIELD + array_n(&stp->server) * STATS_SERVER_NFIELD;
+    }
 
-        status = stats_begin_nesting(st, &stp->name);
-        if (status != NC_OK) {
-            return status;
-        }
+    return nvalue;
+}
 
-        /* copy pool metric from sum(c) to buffer */
-        status = stats_copy_metric(st, &stp->metric);
-        if (status != NC_OK) {
-            return status;
-        }
+static size_t
+stats_snapshot_size(uint32_t nvalue)
+{
+    return offsetof(struct stats_snapshot, value) + nvalue * sizeof(int64_t);
+}
+
+/*
+ * Publish sum (c) into snapshot of given size. Readers retry while the
+ * sequence is odd or changes under them
+ */
+static void
+stats_snapshot_take(struct stats *st, struct stats_snapshot *snap, size_t size)
+{
+    uint32_t i, j, k, nvalue;
+
+    nvalue = stats_sum_nvalue(st);
+
+    snap->seq++;
+    __sync_synchronize();
+
+    snap->pid = getpid();
+    snap->start_ts = st->start_ts;
+    snap->ntotal_conn = (int64_t)conn_ntotal_conn();
+    snap->ncurr_conn = (int64_t)conn_ncurr_conn();
+
+    if (stats_snapshot_size(nvalue) > size) {
+        log_error("stats snapshot of %"PRIu32" values exceeds %zu bytes",
+                  nvalue, size);
+        nvalue = 0;
+    }
+
+    for (i = 0, k = 0; i < array_n(&st->sum) && k < nvalue; i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        for (j = 0; j < array_n(&stp->metric); j++) {
+            struct stats_metric *stm = array_get(&stp->metric, j);
+            snap->value[k++] = stm->value.counter;
+        }
 
         for (j = 0; j < array_n(&stp->server); j++) {
             struct stats_server *sts = array_get(&stp->server, j);
+            uint32_t l;
+
+            for (l = 0; l < array_n(&sts->metric); l++) {
+                struct stats_metric *stm = array_get(&sts->metric, l);
+                snap->value[k++] = stm->value.counter;
+            }
+        }
+    }
+    snap->nvalue = nvalue;
+
+    __sync_synchronize();
+    snap->seq++;
+}
+
+/*
+ * Copy a consistent snapshot published by another process into dst.
+ * Returns NULL if the snapshot is not available
+ */
+static struct stats_snapshot *
+stats_snapshot_copy(struct stats_snapshot *src, size_t size)
+{
+    struct stats_snapshot *dst;
+    uint32_t seq, nvalue;
+    int tries;
+
+    for (tries = 0; tries < 16; tries++) {
+        seq = src->seq;
+        __sync_synchronize();
+
+        if (seq == 0) {
+            /* nothing published yet */
+            return NULL;
+        }
+
+        nvalue = src->nvalue;
+        if ((seq & 1) != 0 || stats_snapshot_size(nvalue) > size) {
+            usleep(1000);
+            continue;
+        }
+
+        dst = nc_alloc(stats_snapshot_size(nvalue));
+        if (dst == NULL) {
+            return NULL;
+        }
+        nc_memcpy(dst, src, stats_snapshot_size(nvalue));
+
+        __sync_synchronize();
+        if (src->seq == seq && dst->nvalue == nvalue) {
+            return dst;
+        }
+
+        nc_free(dst);
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns true if name is in the comma separated list of names, or if the
+ * list is empty
+ */
+static bool
+stats_query_match(struct string *list, struct string *name)
+{
+    uint8_t *p, *end, *comma;
+
+    if (list->len == 0) {
+        return true;
+    }
+
+    p = list->data;
+    end = list->data + list->len;
+    while (p < end) {
+        comma = nc_strchr(p, end, ',');
+        if (comma == NULL) {
+            comma = end;
+        }
+
+        if ((uint32_t)(comma - p) == name->len &&
+            nc_strncmp(p, name->data, name->len) == 0) {
+            return true;
+        }
+
+        p = comma + 1;
+    }
+
+    return false;
+}
+
+static rstatus_t
+stats_parse_query(struct stats_query *q, char *line, bool worker)
+{
+    char *token, *value, *saveptr;
+
+    string_init(&q->pool);
+    string_init(&q->server);
+    q->since = 0;
+    q->worker = worker ? 1 : 0;
+    q->token = 0;
+
+    for (token = strtok_r(line, " ", &saveptr); token != NULL;
+         token = strtok_r(NULL, " ", &saveptr)) {
+
+        value = strchr(token, '=');
+        if (value == NULL) {
+            return NC_ERROR;
+        }
+        *value++ = '\0';
+
+        if (strcmp(token, "pool") == 0) {
+            string_set_raw(&q->pool, value);
+        } else if (strcmp(token, "server") == 0) {
+            string_set_raw(&q->server, value);
+        } else if (strcmp(token, "view") == 0) {
+            if (strcmp(value, "aggregate") == 0) {
+                q->worker = 0;
+            } else if (strcmp(value, "worker") == 0) {
+                q->worker = 1;
+            } else {
+                return NC_ERROR;
+            }
+        } else if (strcmp(token, "since") == 0) {
+            char *end;
+
+            errno = 0;
+            q->since = strtoull(value, &end, 10);
+            if (errno != 0 || *end != '\0') {
+                return NC_ERROR;
+            }
+        } else {
+            return NC_ERROR;
+        }
+
+        q->token = 1;
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Read what the stats client c has sent of its optional query line so far.
+ * Returns NC_OK once the line is complete, or the client has sent nothing
+ * within STATS_QUERY_TIMEOUT msec, which gets it everything like before,
+ * and NC_EAGAIN while the stats thread is to wait for more
+ */
+static rstatus_t
+stats_conn_recv(struct stats_conn *c, int64_t now)
+{
+    ssize_t n;
+
+    for (;;) {
+        n = nc_read(c->sd, c->line + c->len, sizeof(c->line) - c->len - 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return NC_ERROR;
+            }
+            if (now < c->deadline) {
+                return NC_EAGAIN;
+            }
+
+            /* no (complete) query, serve everything */
+            c->line[0] = '\0';
+            return NC_OK;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        c->len += (size_t)n;
+        c->line[c->len] = '\0';
+
+        if (strchr(c->line, '\n') != NULL || c->len == sizeof(c->line) - 1) {
+            break;
+        }
+    }
+
+    c->line[strcspn(c->line, "\r\n")] = '\0';
 
-            status = stats_begin_nesting(st, &sts->name);
+    return NC_OK;
+}
+
+/*
+ * Render values of the selected pools and servers. Counter deltas are
+ * reported against the nbase values in base, if any, and all rendered
+ * values are saved in render order for the next token
+ */
+static rstatus_t
+stats_render_values(struct stats *st, struct stats_query *q,
+                    struct array *server_pool, int64_t *value,
+                    int64_t *base, uint32_t nbase, struct stats_token *save)
+{
+    rstatus_t status;
+    uint32_t i, j, k, npool, vidx, start;
+
+    start = save->nvalue;
+    vidx = 0;
+    for (i = 0, npool = array_n(server_pool); i < npool; i++) {
+        struct server_pool *sp = array_get(server_pool, i);
+        uint32_t nserver = sp->nserver_conf;
+        uint32_t nmaster = array_n(&sp->redis_master);
+
+        if (!stats_query_match(&q->pool, &sp->name)) {
+            vidx += STATS_POOL_NFIELD + (nserver + nmaster) * STATS_SERVER_NFIELD;
+            continue;
+        }
+
+        status = stats_begin_nesting(st, &sp->name);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        for (k = 0; k < STATS_POOL_NFIELD; k++, vidx++) {
+            struct stats_metric *stm = &stats_pool_codec[k];
+            int64_t val = value[vidx];
+
+            if (stm->type == STATS_COUNTER && base != NULL &&
+                save->nvalue - start < nbase) {
+                val -= base[save->nvalue - start];
+            }
+            save->value[save->nvalue++] = value[vidx];
+
+            status = stats_add_num(st, &stm->name, val);
+            if (status != NC_OK) {
+                return status;
+            }
+        }
+
+        for (j = 0; j < nserver + nmaster; j++) {
+            struct server *s;
+
+            if (j < nserver) {
+                s = array_get(&sp->server, j);
+            } else {
+                s = array_get(&sp->redis_master, j - nserver);
+            }
+
+            if (!stats_query_match(&q->server, &s->name)) {
+                vidx += STATS_SERVER_NFIELD;
+                continue;
+            }
+
+            status = stats_begin_nesting(st, &s->name);
             if (status != NC_OK) {
                 return status;
             }
 
-            /* copy server metric from sum(c) to buffer */
-            status = stats_copy_metric(st, &sts->metric);
+            for (k = 0; k < STATS_SERVER_NFIELD; k++, vidx++) {
+                struct stats_metric *stm = &stats_server_codec[k];
+                int64_t val = value[vidx];
+
+                if (stm->type == STATS_COUNTER && base != NULL &&
+                    save->nvalue - start < nbase) {
+                    val -= base[save->nvalue - start];
+                }
+                save->value[save->nvalue++] = value[vidx];
+
+                status = stats_add_num(st, &stm->name, val);
+                if (status != NC_OK) {
+                    return status;
+                }
+            }
+
+            status = stats_end_nesting(st);
             if (status != NC_OK) {
                 return status;
             }
+        }
+
+        status = stats_end_nesting(st);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Return the values of the worker with pid in token tok, or NULL
+ */
+static struct stats_token_worker *
+stats_token_worker(struct stats_token *tok, pid_t pid)
+{
+    uint32_t i;
+
+    for (i = 0; i < tok->nworker; i++) {
+        if (tok->worker[i].pid == pid) {
+            return &tok->worker[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Render the snapshot of a worker. Counter deltas are reported against the
+ * values of the same worker in base, keyed by pid, so that a worker that was
+ * respawned, or left out of either reply, gets no deltas of another one
+ */
+static rstatus_t
+stats_render(struct stats *st, struct stats_query *q, struct array *server_pool,
+             struct stats_snapshot *snap, struct stats_token *base,
+             struct stats_token *save)
+{
+    rstatus_t status;
+    struct stats_token_worker *w, *bw;
+
+    status = stats_add_header(st, snap, q, base != NULL ? base->id : 0);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    w = &save->worker[save->nworker++];
+    w->pid = snap->pid;
+    w->start = save->nvalue;
+    w->nvalue = 0;
+
+    if (snap->nvalue != stats_nvalue(server_pool)) {
+        log_warn("skip stats values of pid %d with %"PRIu32" values",
+                 snap->pid, snap->nvalue);
+        return stats_add_footer(st);
+    }
+
+    bw = base != NULL ? stats_token_worker(base, snap->pid) : NULL;
+
+    status = stats_render_values(st, q, server_pool, snap->value,
+                                 bw != NULL ? base->value + bw->start : NULL,
+                                 bw != NULL ? bw->nvalue : 0, save);
+    if (status != NC_OK) {
+        return status;
+    }
+    w->nvalue = save->nvalue - w->start;
+
+    return stats_add_footer(st);
+}
+
+/*
+ * Return true if the values of each worker in save line up with its values
+ * in base, which holds when the layout has not changed in between
+ */
+static bool
+stats_token_aligned(struct stats_token *base, struct stats_token *save)
+{
+    struct stats_token_worker *bw;
+    uint32_t i;
+
+    for (i = 0; i < save->nworker; i++) {
+        bw = stats_token_worker(base, save->worker[i].pid);
+        if (bw != NULL && bw->nvalue != save->worker[i].nvalue) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void
+stats_sum_value(int64_t *dst, int64_t src, stats_type_t type)
+{
+    if (type == STATS_TIMESTAMP) {
+        *dst = MAX(*dst, src);
+    } else {
+        *dst += src;
+    }
+}
+
+/*
+ * Sum snapshots of all workers into one; gauges are summed like counters
+ * and the latest timestamp wins. Snapshots that don't match the layout of
+ * server pools are skipped
+ */
+static struct stats_snapshot *
+stats_snapshot_sum(struct stats *st, struct array *server_pool,
+                   struct stats_snapshot **snap, uint32_t nsnap)
+{
+    struct stats_snapshot *sum;
+    uint32_t i, nvalue;
+
+    nvalue = stats_nvalue(server_pool);
+
+    sum = nc_zalloc(stats_snapshot_size(nvalue));
+    if (sum == NULL) {
+        return NULL;
+    }
+    sum->pid = getpid();
+    sum->start_ts = st->start_ts;
+    sum->nvalue = nvalue;
+
+    for (i = 0; i < nsnap; i++) {
+        int64_t *value = snap[i]->value;
+        uint32_t j, k, l, vidx;
+
+        if (snap[i]->nvalue != nvalue) {
+            continue;
+        }
+
+        sum->ntotal_conn += snap[i]->ntotal_conn;
+        sum->ncurr_conn += snap[i]->ncurr_conn;
+
+        for (j = 0, vidx = 0; j < array_n(server_pool); j++) {
+            struct server_pool *sp = array_get(server_pool, j);
+            uint32_t nserver;
+
+            for (k = 0; k < STATS_POOL_NFIELD; k++, vidx++) {
+                stats_sum_value(&sum->value[vidx], value[vidx],
+                                stats_pool_codec[k].type);
+            }
+
+            nserver = sp->nserver_conf + array_n(&sp->redis_master);
+            for (l = 0; l < nserver; l++) {
+                for (k = 0; k < STATS_SERVER_NFIELD; k++, vidx++) {
+                    stats_sum_value(&sum->value[vidx], value[vidx],
+                                    stats_server_codec[k].type);
+                }
+            }
+        }
+    }
+
+    return sum;
+}
+
+static struct stats_token *
+stats_token_get(struct stats *st, uint64_t id, char *key)
+{
+    uint32_t i;
+
+    if (id == 0) {
+        return NULL;
+    }
+
+    for (i = 0; i < STATS_NTOKEN; i++) {
+        struct stats_token *tok = &st->token[i];
+
+        if (tok->id == id && strcmp(tok->key, key) == 0) {
+            return tok;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Render snapshots as a single object when aggregated, or as an array of
+ * objects, one per worker, when not
+ */
+static rstatus_t
+stats_make_rsp(struct stats *st, struct stats_query *q, struct array **pools,
+               struct stats_snapshot **snap, uint32_t nsnap,
+               struct stats_token *base, struct stats_token *save)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    st->buf.len = 0;
+    save->nvalue = 0;
+    save->nworker = 0;
+
+    if (!q->worker || st->loop != stats_master_loop_callback) {
+        return stats_render(st, q, pools[0], snap[0], base, save);
+    }
+
+    status = stats_add_char(st, '[');
+    if (status != NC_OK) {
+        return status;
+    }
+
+    for (i = 0; i < nsnap; i++) {
+        status = stats_render(st, q, pools[i], snap[i], base, save);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        /* replace the trailing newline with a separator */
+        st->buf.data[st->buf.len - 1] = ',';
+    }
+
+    if (nsnap == 0) {
+        return stats_add_char(st, ']');
+    }
+
+    st->buf.data[st->buf.len - 1] = ']';
+
+    return NC_OK;
+}
+
+/*
+ * Collect snapshots of all workers in the master, or of the only process
+ * in single process mode
+ */
+static uint32_t
+stats_collect(struct stats *st, struct array **pools,
+              struct stats_snapshot **snap, uint32_t max)
+{
+    uint32_t i, nsnap;
+    size_t size;
+
+    if (st->loop != stats_master_loop_callback) {
+        size = stats_snapshot_size(stats_nvalue(&st->owner->pool));
+
+        snap[0] = nc_zalloc(size);
+        if (snap[0] == NULL) {
+            return 0;
+        }
+        stats_snapshot_take(st, snap[0], size);
+        pools[0] = &st->owner->pool;
+
+        return 1;
+    }
+
+    for (i = 0, nsnap = 0; i < array_n(&master_nci->workers) && nsnap < max;
+         i++) {
+        struct instance *nci = array_get(&master_nci->workers, i);
+        struct context *ctx = nci->ctx;
+        struct stats_snapshot *s;
+
+        s = stats_snapshot_copy((struct stats_snapshot *)ctx->shared_mem,
+                                SHARED_MEMORY_SIZE);
+        if (s == NULL) {
+            log_debug(LOG_INFO, "no stats snapshot from worker %"PRIu32"", i);
+            continue;
+        }
+
+        if (s->nvalue != stats_nvalue(&ctx->pool)) {
+            log_warn("skip stats snapshot of worker pid %d with %"PRIu32" "
+                     "values", s->pid, s->nvalue);
+            nc_free(s);
+            continue;
+        }
+
+        snap[nsnap] = s;
+        pools[nsnap] = &ctx->pool;
+        nsnap++;
+    }
+
+    return nsnap;
+}
+
+static struct {
+    char                *name;  /* admin verb */
+    server_admin_type_t type;   /* admin command */
+    bool                weight; /* takes a weight? */
+} stats_admin_verbs[] = {
+    { "eject",   SERVER_ADMIN_EJECT,   false },
+    { "restore", SERVER_ADMIN_RESTORE, false },
+    { "weight",  SERVER_ADMIN_WEIGHT,  true },
+    { "remove",  SERVER_ADMIN_REMOVE,  false },
+    { "add",     SERVER_ADMIN_ADD,     false },
+    { NULL,      SERVER_ADMIN_UNKNOWN, false },
+};
+
+static void
+stats_admin_reply(int sd, char *status, char *line)
+{
+    char buf[STATS_QUERY_MAXLEN + 32];
+    int n;
+
+    n = nc_snprintf(buf, sizeof(buf), "{\"%s\":\"%s\"}\n", status, line);
+    if (n > 0) {
+        nc_sendn(sd, buf, MIN((size_t)n, sizeof(buf) - 1));
+    }
+}
+
+/*
+ * Admin and tap commands change or expose the traffic of every worker, so
+ * they are taken only from loopback peers, unless stats_admin_remote: is set
+ */
+static bool
+stats_admin_allowed(int sd)
+{
+    struct sockaddr_storage ss;
+    struct sockaddr_in *sin;
+    struct sockaddr_in6 *sin6;
+    socklen_t len;
+    bool remote;
+
+    /* the conf of the master context is replaced by a reload */
+    nc_lock_workers();
+    remote = master_nci->ctx->cf->global.stats_admin_remote ? true : false;
+    nc_unlock_workers();
+
+    if (remote) {
+        return true;
+    }
+
+    len = sizeof(ss);
+    if (getpeername(sd, (struct sockaddr *)&ss, &len) < 0) {
+        return false;
+    }
+
+    switch (ss.ss_family) {
+    case AF_UNIX:
+        return true;
+
+    case AF_INET:
+        sin = (struct sockaddr_in *)&ss;
+        return (ntohl(sin->sin_addr.s_addr) >> 24) == 127;
+
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *)&ss;
+        return IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr) ||
+               (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr) &&
+                sin6->sin6_addr.s6_addr[12] == 127);
+
+    default:
+        return false;
+    }
+}
+
+/*
+ * Handle an admin command of the form "<verb> <pool> <server> [weight]"
+ * on the stats port. Returns true if the line was an admin command.
+ */
+static bool
+stats_admin(struct stats *st, int sd, char *line)
+{
+    struct chan_msg msg;
+    char cmd[STATS_QUERY_MAXLEN];
+    char *verb, *pool, *server, *weight, *saveptr, *err;
+    uint32_t i;
+    int value;
+
+    nc_memcpy(cmd, line, sizeof(cmd));
+
+    verb = strtok_r(cmd, " ", &saveptr);
+    if (verb == NULL) {
+        return false;
+    }
+
+    for (i = 0; stats_admin_verbs[i].name != NULL; i++) {
+        if (strcmp(verb, stats_admin_verbs[i].name) == 0) {
+            break;
+        }
+    }
+    if (stats_admin_verbs[i].name == NULL) {
+        return false;
+    }
+
+    if (!stats_admin_allowed(sd)) {
+        stats_admin_reply(sd, "error", "admin commands are loopback only");
+        return true;
+    }
+
+    pool = strtok_r(NULL, " ", &saveptr);
+    server = strtok_r(NULL, " ", &saveptr);
+    weight = strtok_r(NULL, " ", &saveptr);
+
+    if (pool == NULL || server == NULL ||
+        (weight != NULL) != stats_admin_verbs[i].weight ||
+        strtok_r(NULL, " ", &saveptr) != NULL ||
+        strlen(pool) >= NC_CHAN_NAMELEN || strlen(server) >= NC_CHAN_NAMELEN) {
+        stats_admin_reply(sd, "error", "invalid admin command");
+        return true;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.command = NC_CMD_ADMIN;
+    msg.admin = stats_admin_verbs[i].type;
+    strcpy(msg.pool, pool);
+    strcpy(msg.server, server);
+
+    if (weight != NULL) {
+        value = nc_atoi(weight, strlen(weight));
+        if (value <= 0) {
+            stats_admin_reply(sd, "error", "invalid weight");
+            return true;
+        }
+        msg.weight = (uint32_t)value;
+    }
+
+    err = nc_admin_workers(&msg);
+    if (err != NULL) {
+        stats_admin_reply(sd, "error", err);
+        return true;
+    }
+
+    stats_admin_reply(sd, "ok", line);
+
+    return true;
+}
+
+/*
+ * Handle a "tap [filter]" command on the stats port, which hands the
+ * connection over to the worker of the worker= filter to stream matching
+ * requests to. Returns true if the line was a tap command.
+ */
+static bool
+stats_tap(int sd, char *line)
+{
+    struct chan_msg msg;
+    struct tap t;
+    char filter[NC_CHAN_NAMELEN], *err;
+    rstatus_t status;
+    size_t len;
+    uint32_t nworker;
+    int worker;
+
+    if (strncmp(line, "tap", 3) != 0 || (line[3] != '\0' && line[3] != ' ')) {
+        return false;
+    }
+
+    if (!stats_admin_allowed(sd)) {
+        stats_admin_reply(sd, "error", "tap commands are loopback only");
+        return true;
+    }
+
+    len = strlen(line + 3);
+    if (len >= sizeof(filter)) {
+        stats_admin_reply(sd, "error", "invalid tap filter");
+        return true;
+    }
+
+    nc_memcpy(filter, line + 3, len + 1);
+    status = tap_parse(&t, filter);
+    worker = t.worker;
+    tap_deinit(&t);
+    if (status != NC_OK) {
+        stats_admin_reply(sd, "error", "invalid tap filter");
+        return true;
+    }
+
+    nc_lock_workers();
+    nworker = array_n(&master_nci->workers);
+    nc_unlock_workers();
+
+    /* lines of several workers would interleave on one connection */
+    if (worker < 0 && nworker > 1) {
+        nc_snprintf(filter, sizeof(filter), "tap needs worker=0..%"PRIu32"",
+                    nworker - 1);
+        stats_admin_reply(sd, "error", filter);
+        return true;
+    }
+
+    if (worker >= (int)MAX(nworker, 1)) {
+        stats_admin_reply(sd, "error", "no such worker");
+        return true;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.command = NC_CMD_TAP;
+    msg.fd = sd;
+    nc_memcpy(msg.filter, line + 3, len + 1);
+
+    stats_admin_reply(sd, "ok", line);
+
+    err = nc_handoff_workers(&msg, worker);
+    if (err != NULL) {
+        stats_admin_reply(sd, "error", err);
+    }
+
+    return true;
+}
+
+static struct {
+    char      *name;                                   /* dump verb */
+    rstatus_t (*dump)(struct context *, struct stats_buffer *, char *);
+} stats_dump_verbs[] = {
+    { "namespaces", ns_dump },
+    { "slowlog",    slowlog_dump },
+    { "clients",    talker_dump },
+    { NULL,         NULL },
+};
+
+/*
+ * Handle a "<verb> [args]" dump command on the stats port, which hands the
+ * connection over to the workers to write their tables to. Returns true if
+ * the line was a dump command.
+ */
+static bool
+stats_dump_request(int sd, char *line)
+{
+    struct chan_msg msg;
+    char *err;
+    size_t len;
+    uint32_t i;
+
+    for (i = 0; stats_dump_verbs[i].name != NULL; i++) {
+        len = strlen(stats_dump_verbs[i].name);
+        if (strncmp(line, stats_dump_verbs[i].name, len) == 0 &&
+            (line[len] == '\0' || line[len] == ' ')) {
+            break;
+        }
+    }
+    if (stats_dump_verbs[i].name == NULL) {
+        return false;
+    }
+
+    len = strlen(line);
+    if (len >= sizeof(msg.filter)) {
+        stats_admin_reply(sd, "error", "invalid dump command");
+        return true;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.command = NC_CMD_DUMP;
+    msg.fd = sd;
+    nc_memcpy(msg.filter, line, len + 1);
+
+    err = nc_handoff_workers(&msg, -1);
+    if (err != NULL) {
+        stats_admin_reply(sd, "error", err);
+    }
+
+    return true;
+}
+
+/*
+ * Write one json line with the table asked for by the dump command line to
+ * sd, on behalf of the process of ctx, and close sd. The connection of the
+ * client is closed once every process is done with it.
+ */
+void
+stats_dump(struct context *ctx, int sd, char *line)
+{
+    rstatus_t status;
+    struct stats_buffer buf;
+    struct timeval tv;
+    char *args;
+    size_t len;
+    uint32_t i;
+
+    args = strchr(line, ' ');
+    len = args != NULL ? (size_t)(args - line) : strlen(line);
+    if (args != NULL) {
+        args++;
+    }
+
+    for (i = 0; stats_dump_verbs[i].name != NULL; i++) {
+        if (strlen(stats_dump_verbs[i].name) == len &&
+            strncmp(stats_dump_verbs[i].name, line, len) == 0) {
+            break;
+        }
+    }
+
+    buf.len = 0;
+    buf.size = STATS_DUMP_BUFLEN;
+    buf.data = nc_alloc(buf.size);
+
+    if (stats_dump_verbs[i].name == NULL || buf.data == NULL) {
+        if (buf.data != NULL) {
+            nc_free(buf.data);
+        }
+        close(sd);
+        return;
+    }
+
+    status = stats_buf_printf(&buf, "{\"pid\":%d", (int)getpid());
+    if (status == NC_OK) {
+        status = stats_dump_verbs[i].dump(ctx, &buf, args);
+    }
+    if (status == NC_OK) {
+        status = stats_buf_printf(&buf, "}\n");
+    }
+
+    if (status == NC_OK) {
+        /* never hold up the event loop for long on a slow client */
+        tv.tv_sec = 0;
+        tv.tv_usec = STATS_DUMP_TIMEOUT * 1000;
+        setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (nc_sendn(sd, buf.data, buf.len) < 0) {
+            log_debug(LOG_INFO, "send %s dump on sd %d failed: %s",
+                      stats_dump_verbs[i].name, sd, strerror(errno));
+        }
+    }
+
+    nc_free(buf.data);
+    close(sd);
+}
+
+/*
+ * Answer the query line of the stats client sd, and close sd
+ */
+static rstatus_t
+stats_send_rsp(struct stats *st, int sd, char *line)
+{
+    rstatus_t status;
+    struct stats_query q;
+    struct stats_token *base, save;
+    struct stats_snapshot **snap, *sum;
+    struct array **pools;
+    char key[STATS_QUERY_MAXLEN];
+    uint32_t i, nsnap, max, nvalue;
+    ssize_t n;
+    bool locked;
+
+    /* replies, taps and dumps are written with blocking sends */
+    status = nc_set_blocking(sd);
+    if (status < 0) {
+        log_error("set block on sd %d failed: %s", sd, strerror(errno));
+        close(sd);
+        return NC_ERROR;
+    }
+
+    if (stats_admin(st, sd, line)) {
+        close(sd);
+        return NC_OK;
+    }
+
+    if (stats_tap(sd, line)) {
+        /* workers hold their own descriptors of an attached tap */
+        close(sd);
+        return NC_OK;
+    }
+
+    if (stats_dump_request(sd, line)) {
+        close(sd);
+        return NC_OK;
+    }
+
+    status = stats_parse_query(&q, line, st->loop == stats_master_loop_callback);
+    if (status != NC_OK) {
+        static char err[] = "{\"error\":\"invalid stats query\"}\n";
+
+        log_debug(LOG_INFO, "invalid stats query on sd %d", sd);
+        nc_sendn(sd, err, sizeof(err) - 1);
+        close(sd);
+        return NC_OK;
+    }
+
+    nc_snprintf(key, sizeof(key), "%.*s|%.*s|%d", q.pool.len, q.pool.data,
+                q.server.len, q.server.data, q.worker);
+
+    /* pools of the worker contexts are freed by a reload */
+    nc_lock_workers();
+
+    max = st->loop == stats_master_loop_callback ?
+          array_n(&master_nci->workers) : 1;
+
+    snap = nc_zalloc(max * sizeof(*snap) + max * sizeof(*pools) + 1);
+    if (snap == NULL) {
+        nc_unlock_workers();
+        close(sd);
+        return NC_ENOMEM;
+    }
+    pools = (struct array **)(snap + max);
+    locked = true;
+
+    nsnap = stats_collect(st, pools, snap, max);
+
+    sum = NULL;
+    save.value = NULL;
+    if (!q.worker && nsnap > 0 && st->loop == stats_master_loop_callback) {
+        sum = stats_snapshot_sum(st, pools[0], snap, nsnap);
+        if (sum == NULL) {
+            status = NC_ENOMEM;
+            goto done;
+        }
+    }
+
+    for (i = 0, nvalue = 0; i < nsnap; i++) {
+        nvalue += snap[i]->nvalue;
+    }
+
+    /* worker values are kept behind the values, in the same allocation */
+    save.id = 0;
+    save.nvalue = 0;
+    save.nworker = 0;
+    save.value = nc_alloc((nvalue + 1) * sizeof(int64_t) +
+                          (nsnap + 1) * sizeof(*save.worker));
+    if (save.value == NULL) {
+        status = NC_ENOMEM;
+        goto done;
+    }
+    save.worker = (struct stats_token_worker *)(save.value + nvalue + 1);
+
+    if (nsnap == 0 && (!q.worker || st->loop != stats_master_loop_callback)) {
+        status = NC_ERROR;
+        goto done;
+    }
+
+    base = stats_token_get(st, q.since, key);
+
+    if (sum != NULL) {
+        status = stats_make_rsp(st, &q, pools, &sum, 1, base, &save);
+    } else {
+        status = stats_make_rsp(st, &q, pools, snap, nsnap, base, &save);
+    }
+    if (status == NC_OK && base != NULL && !stats_token_aligned(base, &save)) {
+        /* layout changed since the token was handed out; no deltas */
+        base = NULL;
+        status = stats_make_rsp(st, &q, pools, sum != NULL ? &sum : snap,
+                                sum != NULL ? 1 : nsnap, base, &save);
+    }
+    if (status != NC_OK) {
+        goto done;
+    }
+
+    nc_unlock_workers();
+    locked = false;
+
+    if (q.token) {
+        struct stats_token *tok = &st->token[st->ntoken % STATS_NTOKEN];
+
+        st->ntoken++;
+
+        if (tok->value != NULL) {
+            nc_free(tok->value);
+        }
+        tok->id = st->ntoken;
+        nc_memcpy(tok->key, key, sizeof(key));
+        tok->nvalue = save.nvalue;
+        tok->value = save.value;
+        tok->nworker = save.nworker;
+        tok->worker = save.worker;
+        save.value = NULL;
+    }
+
+    log_debug(LOG_VERB, "send stats on sd %d %d bytes", sd, st->buf.len);
+
+    n = nc_sendn(sd, st->buf.data, st->buf.len);
+    if (n < 0) {
+        log_error("send stats on sd %d failed: %s", sd, strerror(errno));
+        status = NC_ERROR;
+    }
+
+done:
+    if (locked) {
+        nc_unlock_workers();
+    }
+    close(sd);
+    if (save.value != NULL) {
+        nc_free(save.value);
+    }
+    if (sum != NULL) {
+        nc_free(sum);
+    }
+    for (i = 0; i < nsnap; i++) {
+        nc_free(snap[i]);
+    }
+    nc_free(snap);
+
+    return status;
+}
+
+/*
+ * Parse stats export url of the form statsd://host:port or
+ * influx://host:port and connect a udp socket to it
+ */
+static rstatus_t
+stats_export_init(struct stats *st, char *url)
+{
+    rstatus_t status;
+    struct string name;
+    struct sockinfo si;
+    char host[NC_MAXHOSTNAMELEN], *addr, *port;
+    int value;
+
+    if (url == NULL) {
+        return NC_OK;
+    }
+
+    if (strncmp(url, "statsd://", sizeof("statsd://") - 1) == 0) {
+        st->export = STATS_EXPORT_STATSD;
+        addr = url + sizeof("statsd://") - 1;
+    } else if (strncmp(url, "influx://", sizeof("influx://") - 1) == 0) {
+        st->export = STATS_EXPORT_INFLUX;
+        addr = url + sizeof("influx://") - 1;
+    } else {
+        log_error("stats export '%s' is not statsd:// or influx://", url);
+        return NC_ERROR;
+    }
+
+    port = strrchr(addr, ':');
+    if (port == NULL) {
+        log_error("stats export '%s' has no port", url);
+        return NC_ERROR;
+    }
+
+    value = nc_atoi(port + 1, strlen(port + 1));
+    if (!nc_valid_port(value)) {
+        log_error("stats export '%s' has invalid port", url);
+        return NC_ERROR;
+    }
+
+    if (port - addr >= NC_MAXHOSTNAMELEN) {
+        log_error("stats export '%s' has invalid host", url);
+        return NC_ERROR;
+    }
+    nc_memcpy(host, addr, port - addr);
+    host[port - addr] = '\0';
+
+    name.data = (uint8_t *)host;
+    name.len = (uint32_t)(port - addr);
+
+    status = nc_resolve(&name, value, &si);
+    if (status < 0) {
+        return NC_ERROR;
+    }
+
+    st->export_sd = socket(si.family, SOCK_DGRAM, 0);
+    if (st->export_sd < 0) {
+        log_error("socket failed: %s", strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = connect(st->export_sd, (struct sockaddr *)&si.addr, si.addrlen);
+    if (status < 0) {
+        log_error("connect on e %d to '%s' failed: %s", st->export_sd, url,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    status = nc_set_nonblocking(st->export_sd);
+    if (status < 0) {
+        log_error("set nonblock on e %d failed: %s", st->export_sd,
+                  strerror(errno));
+        return NC_ERROR;
+    }
+
+    st->exported = nc_zalloc((stats_sum_nvalue(st) + 1) * sizeof(int64_t));
+    if (st->exported == NULL) {
+        return NC_ENOMEM;
+    }
+
+    log_debug(LOG_NOTICE, "e %d exporting stats to '%s'", st->export_sd, url);
+
+    return NC_OK;
+}
+
+static void
+stats_export_deinit(struct stats *st)
+{
+    if (st->export_sd >= 0) {
+        close(st->export_sd);
+        st->export_sd = -1;
+    }
+
+    if (st->exported != NULL) {
+        nc_free(st->exported);
+        st->exported = NULL;
+    }
+}
+
+static void
+stats_export_flush(struct stats *st, struct stats_buffer *pkt)
+{
+    ssize_t n;
+
+    if (pkt->len == 0) {
+        return;
+    }
+
+    /* a lost datagram only loses deltas of one interval */
+    n = send(st->export_sd, pkt->data, pkt->len, 0);
+    if (n < 0) {
+        log_debug(LOG_INFO, "send stats on e %d failed: %s", st->export_sd,
+                  strerror(errno));
+    }
+
+    pkt->len = 0;
+}
+
+static void
+stats_export_line(struct stats *st, struct stats_buffer *pkt, char *line,
+                  int len)
+{
+    if (len <= 0) {
+        return;
+    }
+
+    if ((size_t)len >= pkt->size) {
+        log_debug(LOG_INFO, "skip stats export line of %d bytes", len);
+        return;
+    }
+
+    if (pkt->len + (size_t)len > pkt->size) {
+        stats_export_flush(st, pkt);
+    }
+
+    nc_memcpy(pkt->data + pkt->len, line, len);
+    pkt->len += (size_t)len;
+}
+
+/*
+ * statsd metric names are dot separated, so dots and colons of server
+ * names are replaced; influx tag values end at a comma, an equal sign or a
+ * space, which are escaped with a backslash
+ */
+static void
+stats_export_name(struct stats *st, char *dst, size_t size,
+                  struct string *name)
+{
+    uint32_t i, n;
+
+    for (i = 0, n = 0; i < name->len && n < size - 1; i++) {
+        uint8_t ch = name->data[i];
+
+        if (st->export != STATS_EXPORT_INFLUX) {
+            dst[n++] = (ch == '.' || ch == ':' || ch == ' ') ? '_' : (char)ch;
+            continue;
+        }
+
+        if (ch == ',' || ch == '=' || ch == ' ') {
+            if (n + 2 > size - 1) {
+                break;
+            }
+            dst[n++] = '\\';
+        }
+        dst[n++] = (char)ch;
+    }
+    dst[n] = '\0';
+}
+
+static void
+stats_export_statsd(struct stats *st, struct stats_buffer *pkt, char *prefix,
+                    struct array *metric, int64_t *exported)
+{
+    char line[STATS_EXPORT_MTU];
+    uint32_t i;
+    int len;
+
+    for (i = 0; i < array_n(metric); i++) {
+        struct stats_metric *stm = array_get(metric, i);
+        int64_t delta = stm->value.counter - exported[i];
+
+        if (delta == 0) {
+            continue;
+        }
+
+        switch (stm->type) {
+        case STATS_COUNTER:
+            len = nc_snprintf(line, sizeof(line), "%s.%.*s:%"PRId64"|c\n",
+                              prefix, stm->name.len, stm->name.data, delta);
+            break;
+
+        case STATS_GAUGE:
+            /* signed gauges add up across workers */
+            len = nc_snprintf(line, sizeof(line), "%s.%.*s:%+"PRId64"|g\n",
+                              prefix, stm->name.len, stm->name.data, delta);
+            break;
+
+        default:
+            len = 0;
+            break;
+        }
+
+        stats_export_line(st, pkt, line, len);
+    }
+}
+
+static void
+stats_export_influx(struct stats *st, struct stats_buffer *pkt, char *tags,
+                    struct array *metric, int64_t *exported)
+{
+    char line[STATS_EXPORT_MTU];
+    uint32_t i;
+    int len, n;
+
+    len = nc_snprintf(line, sizeof(line), "nutcracker,%s ", tags);
+
+    for (i = 0; i < array_n(metric); i++) {
+        struct stats_metric *stm = array_get(metric, i);
+        int64_t val;
+
+        switch (stm->type) {
+        case STATS_COUNTER:
+            val = stm->value.counter - exported[i];
+            break;
 
-            status = stats_end_nesting(st);
-            if (status != NC_OK) {
-                return status;
-            }
+        case STATS_GAUGE:
+            val = stm->value.counter;
+            break;
+
+        default:
+            continue;
         }
 
-        status = stats_end_nesting(st);
-        if (status != NC_OK) {
-            return status;
+        n = nc_snprintf(line + len, sizeof(line) - (size_t)len,
+                        "%.*s=%"PRId64"i,", stm->name.len, stm->name.data, val);
+        if (n < 0 || n >= (int)sizeof(line) - len) {
+            return;
         }
+        len += n;
     }
 
-    status = stats_add_footer(st);
-    if (status != NC_OK) {
-        return status;
-    }
+    /* replace the trailing separator with a newline */
+    line[len - 1] = '\n';
 
-    return NC_OK;
+    stats_export_line(st, pkt, line, len);
 }
 
-static rstatus_t
-stats_send_rsp(struct stats *st)
+static void
+stats_export_metric(struct array *metric, int64_t *exported)
 {
-    rstatus_t status;
-    ssize_t n;
-    int sd;
+    uint32_t i;
 
-    status = stats_make_rsp(st);
-    if (status != NC_OK) {
-        return status;
+    for (i = 0; i < array_n(metric); i++) {
+        struct stats_metric *stm = array_get(metric, i);
+        exported[i] = stm->value.counter;
     }
+}
 
-    sd = accept(st->sd, NULL, NULL);
-    if (sd < 0) {
-        log_error("accept on m %d failed: %s", st->sd, strerror(errno));
-        return NC_ERROR;
+/*
+ * Push counters in sum (c) as deltas since the last export to the
+ * export address, once every stats interval
+ */
+static void
+stats_export(struct stats *st)
+{
+    struct stats_buffer pkt;
+    uint8_t data[STATS_EXPORT_MTU];
+    char pname[STATS_EXPORT_MTU / 4], sname[STATS_EXPORT_MTU / 4];
+    char source[STATS_EXPORT_MTU / 4], key[STATS_EXPORT_MTU];
+    int64_t now;
+    uint32_t i, j, k;
+
+    if (st->export == STATS_EXPORT_NONE) {
+        return;
     }
 
-    log_debug(LOG_VERB, "send stats on sd %d %d bytes", sd, st->buf.len);
-
-    n = nc_sendn(sd, st->buf.data, st->buf.len);
-    if (n < 0) {
-        log_error("send stats on sd %d failed: %s", sd, strerror(errno));
-        close(sd);
-        return NC_ERROR;
+    now = nc_msec_now();
+    if (now < st->export_ts + st->interval) {
+        return;
     }
+    st->export_ts = now;
 
-    close(sd);
+    pkt.data = data;
+    pkt.len = 0;
+    pkt.size = sizeof(data);
 
-    return NC_OK;
+    stats_export_name(st, source, sizeof(source), &st->source);
+
+    for (i = 0, k = 0; i < array_n(&st->sum); i++) {
+        struct stats_pool *stp = array_get(&st->sum, i);
+
+        stats_export_name(st, pname, sizeof(pname), &stp->name);
+
+        if (st->export == STATS_EXPORT_STATSD) {
+            nc_snprintf(key, sizeof(key), "nutcracker.%s.%s", source, pname);
+            stats_export_statsd(st, &pkt, key, &stp->metric, &st->exported[k]);
+        } else {
+            nc_snprintf(key, sizeof(key), "source=%s,pid=%d,pool=%s",
+                        source, getpid(), pname);
+            stats_export_influx(st, &pkt, key, &stp->metric, &st->exported[k]);
+        }
+        stats_export_metric(&stp->metric, &st->exported[k]);
+        k += array_n(&stp->metric);
+
+        for (j = 0; j < array_n(&stp->server); j++) {
+            struct stats_server *sts = array_get(&stp->server, j);
+
+            stats_export_name(st, sname, sizeof(sname), &sts->name);
+
+            if (st->export == STATS_EXPORT_STATSD) {
+                nc_snprintf(key, sizeof(key), "nutcracker.%s.%s.%s", source,
+                            pname, sname);
+                stats_export_statsd(st, &pkt, key, &sts->metric,
+                                    &st->exported[k]);
+            } else {
+                nc_snprintf(key, sizeof(key),
+                            "source=%s,pid=%d,pool=%s,server=%s", source,
+                            getpid(), pname, sname);
+                stats_export_influx(st, &pkt, key, &sts->metric,
+                                    &st->exported[k]);
+            }
+            stats_export_metric(&sts->metric, &st->exported[k]);
+            k += array_n(&sts->metric);
+        }
+    }
+
+    stats_export_flush(st, &pkt);
 }
 
 void
 stats_loop_callback(void *arg1, void *arg2)
 {
     struct stats *st = arg1;
-    int n = *((int *)arg2);
 
     /* aggregate stats from shadow (b) -> sum (c) */
     stats_aggregate(st);
 
-    if (n == 0) {
-        return;
-    }
-
-    /* send aggregate stats sum (c) to collector */
-    stats_send_rsp(st);
+    /* push aggregate stats sum (c) to exporter */
+    stats_export(st);
 }
 
-static rstatus_t
-stats_each_calc_shared_mem_size(void *elem, void *data)
+void
+stats_master_loop_callback(void *arg1, void* arg2)
 {
-    char *shared_mem = ((struct instance *)elem)->ctx->shared_mem;
-    int *size = data;
-    *size += strlen(shared_mem);
-    /* use "," instead of "\0" */
-    return NC_OK;
-}
-
-static rstatus_t
-stats_each_shared_mem_aggregate(void *elem, void *data)
-{
-    char *shared_mem = ((struct instance *)elem)->ctx->shared_mem;
-    struct stats_buffer *buf = data;
-    size_t len = strlen(shared_mem);
-    uint8_t  *pos = buf->data + buf->len;
-    memcpy(pos, shared_mem, len);
-    buf->len += len;
-    pos[len-1] = ',';
-    return NC_OK;
+    /* master renders snapshots published by workers in stats_send_rsp */
 }
 
-static rstatus_t
-stats_master_send_resp(struct stats *st)
+/*
+ * Accept a stats client, which may send a query line first. The stats
+ * thread reads it along with the other clients, so that a client that is
+ * slow to send its query does not hold up everyone else
+ */
+static void
+stats_accept(struct stats *st)
 {
-    rstatus_t status;
-    ssize_t n;
+    struct stats_conn *c;
     int sd;
-    struct stats_buffer buf;
-    buf.len=0;
-    buf.size=0;
 
-    status = array_each(&master_nci->workers, stats_each_calc_shared_mem_size, &buf.size);
-    if (status) {
-        return NC_ERROR;
-    }
-    /* delete a "," and add "[","]","\0" */
-    buf.size+=2;
-    buf.data = nc_alloc(buf.size);
-    if (buf.data == NULL) {
-       log_error("new out buf for master to aggregate failed");
-        return NC_ERROR;
+    ASSERT(st->nconn < STATS_NCONN);
+
+    sd = accept(st->sd, NULL, NULL);
+    if (sd < 0) {
+        log_error("accept on m %d failed: %s", st->sd, strerror(errno));
+        return;
     }
 
-    buf.data[0] = '[';
-    buf.len = 1;
-    status = array_each(&master_nci->workers, stats_each_shared_mem_aggregate, &buf);
-    if (status) {
-        return NC_ERROR;
+    if (nc_set_nonblocking(sd) < 0) {
+        log_error("set nonblock on sd %d failed: %s", sd, strerror(errno));
+        close(sd);
+        return;
     }
-    buf.data[buf.len-1] = ']';
-    buf.data[buf.len] = 0;
 
-    sd = accept(st->sd, NULL, NULL);
-        if (sd < 0) {
-            log_error("accept on m %d failed: %s", st->sd, strerror(errno));
-            free(buf.data);
-            return NC_ERROR;
+    c = &st->conn[st->nconn++];
+    c->sd = sd;
+    c->deadline = nc_msec_now() + STATS_QUERY_TIMEOUT;
+    c->len = 0;
+    c->line[0] = '\0';
+}
+
+/*
+ * Wait for stats clients and their queries, and call the loop handler
+ * every interval msec, and before a query is answered
+ */
+static void
+stats_loop(struct stats *st)
+{
+    struct pollfd pfd[STATS_NCONN + 1];
+    struct stats_conn *c;
+    rstatus_t status;
+    int64_t now, next;
+    uint32_t i, npfd;
+    int n, timeout;
+    bool listening;
+
+    next = nc_msec_now() + st->interval;
+
+    for (;;) {
+        now = nc_msec_now();
+        timeout = st->interval < 0 ? -1 : (int)MAX(next - now, 0);
+
+        /* the backlog holds new clients while too many are waiting */
+        npfd = 0;
+        listening = st->nconn < STATS_NCONN;
+        if (listening) {
+            pfd[npfd].fd = st->sd;
+            pfd[npfd].events = POLLIN;
+            npfd++;
         }
 
-    log_debug(LOG_VERB, "send stats on sd %d %d bytes", sd, buf.len);
+        for (i = 0; i < st->nconn; i++) {
+            c = &st->conn[i];
 
-    n = nc_sendn(sd, buf.data, buf.len);
-    if (n < 0) {
-        log_error("send stats on sd %d failed: %s", sd, strerror(errno));
-        close(sd);
-        free(buf.data);
-        return NC_ERROR;
-    }
+            pfd[npfd].fd = c->sd;
+            pfd[npfd].events = POLLIN;
+            npfd++;
 
-    close(sd);
-    free(buf.data);
-    return NC_OK;
-};
+            if (timeout < 0 || c->deadline - now < timeout) {
+                timeout = (int)MAX(c->deadline - now, 0);
+            }
+        }
 
-void
-stats_master_loop_callback(void *arg1, void* arg2)
-{
-    struct stats *st = arg1;
-    int n = *((int *)arg2);
+        n = poll(pfd, npfd, timeout);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("poll with m %d failed: %s", st->sd, strerror(errno));
+            break;
+        }
 
-    if (n == 0) {
-        return;
+        now = nc_msec_now();
+
+        if (st->interval >= 0 && now >= next) {
+            n = 0;
+            st->loop(st, &n);
+            next = now + st->interval;
+        }
+
+        for (i = 0; i < st->nconn;) {
+            c = &st->conn[i];
+
+            status = stats_conn_recv(c, now);
+            if (status == NC_EAGAIN) {
+                i++;
+                continue;
+            }
+
+            if (status != NC_OK) {
+                log_error("recv stats query on sd %d failed: %s", c->sd,
+                          strerror(errno));
+                close(c->sd);
+            } else {
+                n = 1;
+                st->loop(st, &n);
+                stats_send_rsp(st, c->sd, c->line);
+            }
+
+            st->nconn--;
+            if (i < st->nconn) {
+                *c = st->conn[st->nconn];
+            }
+        }
+
+        if (listening && (pfd[0].revents & POLLIN)) {
+            stats_accept(st);
+        }
     }
+}
+
+/*
+ * Signals are for the main thread, which waits for them in the master and
+ * takes the workers lock in its loop
+ */
+static void
+stats_block_signals(void)
+{
+    sigset_t set;
 
-    /* master aggregate worker buf to collector */
-    stats_master_send_resp(st);
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
 }
 
 static void *
 stats_master_loop(void *arg)
 {
     struct stats *st = arg;
-    event_loop_stats(st->loop, arg);
+
+    stats_block_signals();
+
+    stats_loop(st);
     return NULL;
 }
 
 static void *
 stats_worker_loop(void *arg)
 {
-    rstatus_t status;
     struct stats *st = arg;
+
+    stats_block_signals();
+
     for (;;) {
         stats_aggregate(st);
-        status = stats_make_rsp(st);
-        if (status != NC_OK) {
-            return NULL;
-        }
-        memcpy(st->owner->shared_mem, st->buf.data, st->buf.len);
-        st->owner->shared_mem[st->buf.len] = 0;
+
+        /* publish sum (c) for the master to render */
+        stats_snapshot_take(st, (struct stats_snapshot *)st->owner->shared_mem,
+                            SHARED_MEMORY_SIZE);
+
+        stats_export(st);
+
         sleep((unsigned int)(st->interval/1000));
     }
+
+    return NULL;
 }
 
 static rstatus_t
@@ -1017,10 +2661,12 @@ stats_stop_aggregator(struct stats *st)
 
 struct stats *
 stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
-             char *source, struct array *server_pool, stats_loop_t loop)
+             char *stats_export, char *source, struct array *server_pool,
+             stats_loop_t loop, struct context *owner)
 {
     rstatus_t status;
     struct stats *st;
+    uint32_t nserver;
 
     st = nc_alloc(sizeof(*st));
     if (st == NULL) {
@@ -1037,15 +2683,25 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
     st->buf.data = NULL;
     st->buf.size = 0;
 
-    array_null(&st->current);
-    array_null(&st->shadow);
+    memset(st->counters, 0, sizeof(st->counters));
+    st->current = &st->counters[0];
+    st->shadow = &st->counters[1];
     array_null(&st->sum);
 
     st->tid = (pthread_t) -1;
     st->sd = -1;
+    st->nconn = 0;
+
+    st->export = STATS_EXPORT_NONE;
+    st->export_sd = -1;
+    st->export_ts = 0;
+    st->exported = NULL;
 
     st->loop = loop;
 
+    /* the aggregator of a worker publishes to owner as soon as it starts */
+    st->owner = owner;
+
     string_set_text(&st->service_str, "service");
     string_set_text(&st->service, "nutcracker");
 
@@ -1063,17 +2719,24 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
     string_set_text(&st->ntotal_conn_str, "total_connections");
     string_set_text(&st->ncurr_conn_str, "curr_connections");
 
-    st->updated = 0;
+    string_set_text(&st->token_str, "token");
+    string_set_text(&st->since_str, "since");
+
+    memset(st->token, 0, sizeof(st->token));
+    st->ntoken = 0;
+
     st->aggregate = 0;
 
     /* map server pool to current (a), shadow (b) and sum (c) */
 
-    status = stats_pool_map(&st->current, server_pool);
+    nserver = stats_server_index(server_pool);
+
+    status = stats_counters_init(st->current, array_n(server_pool), nserver);
     if (status != NC_OK) {
         goto error;
     }
 
-    status = stats_pool_map(&st->shadow, server_pool);
+    status = stats_counters_init(st->shadow, array_n(server_pool), nserver);
     if (status != NC_OK) {
         goto error;
     }
@@ -1088,6 +2751,14 @@ stats_create(uint16_t stats_port, char *stats_ip, int stats_interval,
         goto error;
     }
 
+    /* workers push their own stats; the master has none to push */
+    if (loop != stats_master_loop_callback) {
+        status = stats_export_init(st, stats_export);
+        if (status != NC_OK) {
+            goto error;
+        }
+    }
+
     status = stats_start_aggregator(st);
     if (status != NC_OK) {
         goto error;
@@ -1103,247 +2774,53 @@ error:
 void
 stats_destroy(struct stats *st)
 {
+    uint32_t i;
+
     //worker's stats will destroy in worker processes;
     if (st == NULL) {
         return;
     }
     stats_stop_aggregator(st);
+    stats_export_deinit(st);
     stats_pool_unmap(&st->sum);
-    stats_pool_unmap(&st->shadow);
-    stats_pool_unmap(&st->current);
+    stats_counters_deinit(&st->counters[1]);
+    stats_counters_deinit(&st->counters[0]);
     stats_destroy_buf(st);
+    for (i = 0; i < STATS_NTOKEN; i++) {
+        if (st->token[i].value != NULL) {
+            nc_free(st->token[i].value);
+        }
+    }
     nc_free(st);
 }
 
 void
 stats_swap(struct stats *st)
 {
+    struct stats_counters *stc;
+
     if (!stats_enabled) {
         return;
     }
 
     if (st->aggregate == 1) {
         log_debug(LOG_PVERB, "skip swap of current %p shadow %p as aggregator "
-                  "is busy", st->current.elem, st->shadow.elem);
-        return;
-    }
-
-    if (st->updated == 0) {
-        log_debug(LOG_PVERB, "skip swap of current %p shadow %p as there is "
-                  "nothing new", st->current.elem, st->shadow.elem);
+                  "is busy", st->current, st->shadow);
         return;
     }
 
-    log_debug(LOG_PVERB, "swap stats current %p shadow %p", st->current.elem,
-              st->shadow.elem);
+    log_debug(LOG_PVERB, "swap stats current %p shadow %p", st->current,
+              st->shadow);
 
-    array_swap(&st->current, &st->shadow);
+    stc = st->current;
+    st->current = st->shadow;
+    st->shadow = stc;
 
     /*
      * Reset current (a) stats before giving it back to generator to keep
      * stats addition idempotent
      */
-    stats_pool_reset(&st->current);
-    st->updated = 0;
+    stats_counters_reset(st->current);
 
     st->aggregate = 1;
 }
-
-static struct stats_metric *
-stats_pool_to_metric(struct context *ctx, struct server_pool *pool,
-                     stats_pool_field_t fidx)
-{
-    struct stats *st;
-    struct stats_pool *stp;
-    struct stats_metric *stm;
-    uint32_t pidx;
-
-    pidx = pool->idx;
-
-    st = ctx->stats;
-    stp = array_get(&st->current, pidx);
-    stm = array_get(&stp->metric, fidx);
-
-    st->updated = 1;
-
-    log_debug(LOG_VVVERB, "metric '%.*s' in pool %"PRIu32"", stm->name.len,
-              stm->name.data, pidx);
-
-    return stm;
-}
-
-void
-_stats_pool_incr(struct context *ctx, struct server_pool *pool,
-                 stats_pool_field_t fidx)
-{
-    struct stats_metric *stm;
-
-    stm = stats_pool_to_metric(ctx, pool, fidx);
-
-    ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-    stm->value.counter++;
-
-    log_debug(LOG_VVVERB, "incr field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_pool_decr(struct context *ctx, struct server_pool *pool,
-                 stats_pool_field_t fidx)
-{
-    struct stats_metric *stm;
-
-    stm = stats_pool_to_metric(ctx, pool, fidx);
-
-    ASSERT(stm->type == STATS_GAUGE);
-    stm->value.counter--;
-
-    log_debug(LOG_VVVERB, "decr field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_pool_incr_by(struct context *ctx, struct server_pool *pool,
-                    stats_pool_field_t fidx, int64_t val)
-{
-    struct stats_metric *stm;
-
-    stm = stats_pool_to_metric(ctx, pool, fidx);
-
-    ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-    stm->value.counter += val;
-
-    log_debug(LOG_VVVERB, "incr by field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_pool_decr_by(struct context *ctx, struct server_pool *pool,
-                    stats_pool_field_t fidx, int64_t val)
-{
-    struct stats_metric *stm;
-
-    stm = stats_pool_to_metric(ctx, pool, fidx);
-
-    ASSERT(stm->type == STATS_GAUGE);
-    stm->value.counter -= val;
-
-    log_debug(LOG_VVVERB, "decr by field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_pool_set_ts(struct context *ctx, struct server_pool *pool,
-                   stats_pool_field_t fidx, int64_t val)
-{
-    struct stats_metric *stm;
-
-    stm = stats_pool_to_metric(ctx, pool, fidx);
-
-    ASSERT(stm->type == STATS_TIMESTAMP);
-    stm->value.timestamp = val;
-
-    log_debug(LOG_VVVERB, "set ts field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.timestamp);
-}
-
-static struct stats_metric *
-stats_server_to_metric(struct context *ctx, struct server *server,
-                       stats_server_field_t fidx)
-{
-    struct stats *st;
-    struct stats_pool *stp;
-    struct stats_server *sts;
-    struct stats_metric *stm;
-    uint32_t pidx, sidx;
-
-    sidx = server->idx;
-    pidx = server->owner->idx;
-
-    st = ctx->stats;
-    stp = array_get(&st->current, pidx);
-    sts = array_get(&stp->server, sidx);
-    stm = array_get(&sts->metric, fidx);
-
-    st->updated = 1;
-
-    log_debug(LOG_VVVERB, "metric '%.*s' in pool %"PRIu32" server %"PRIu32"",
-              stm->name.len, stm->name.data, pidx, sidx);
-
-    return stm;
-}
-
-void
-_stats_server_incr(struct context *ctx, struct server *server,
-                   stats_server_field_t fidx)
-{
-    struct stats_metric *stm;
-
-    stm = stats_server_to_metric(ctx, server, fidx);
-
-    ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-    stm->value.counter++;
-
-    log_debug(LOG_VVVERB, "incr field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_server_decr(struct context *ctx, struct server *server,
-                   stats_server_field_t fidx)
-{
-    struct stats_metric *stm;
-
-    stm = stats_server_to_metric(ctx, server, fidx);
-
-    ASSERT(stm->type == STATS_GAUGE);
-    stm->value.counter--;
-
-    log_debug(LOG_VVVERB, "decr field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_server_incr_by(struct context *ctx, struct server *server,
-                      stats_server_field_t fidx, int64_t val)
-{
-    struct stats_metric *stm;
-
-    stm = stats_server_to_metric(ctx, server, fidx);
-
-    ASSERT(stm->type == STATS_COUNTER || stm->type == STATS_GAUGE);
-    stm->value.counter += val;
-
-    log_debug(LOG_VVVERB, "incr by field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_server_decr_by(struct context *ctx, struct server *server,
-                      stats_server_field_t fidx, int64_t val)
-{
-    struct stats_metric *stm;
-
-    stm = stats_server_to_metric(ctx, server, fidx);
-
-    ASSERT(stm->type == STATS_GAUGE);
-    stm->value.counter -= val;
-
-    log_debug(LOG_VVVERB, "decr by field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.counter);
-}
-
-void
-_stats_server_set_ts(struct context *ctx, struct server *server,
-                     stats_server_field_t fidx, int64_t val)
-{
-    struct stats_metric *stm;
-
-    stm = stats_server_to_metric(ctx, server, fidx);
-
-    ASSERT(stm->type == STATS_TIMESTAMP);
-    stm->value.timestamp = val;
-
-    log_debug(LOG_VVVERB, "set ts field '%.*s' to %"PRId64"", stm->name.len,
-              stm->name.data, stm->value.timestamp);
-}
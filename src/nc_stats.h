@@ -30,6 +30,29 @@
     /* forwarder behavior */                                                                                        \
     ACTION( forward_error,          STATS_COUNTER,      "# times we encountered a forwarding error")                \
     ACTION( fragments,              STATS_COUNTER,      "# fragments created from a multi-vector request")          \
+    /* mirror behavior */                                                                                           \
+    ACTION( mirror_requests,        STATS_COUNTER,      "# requests copied to the mirror pool")                     \
+    ACTION( mirror_drops,           STATS_COUNTER,      "# sampled requests not copied to the mirror pool")         \
+    /* migration behavior */                                                                                        \
+    ACTION( migrate_retries,        STATS_COUNTER,      "# misses retried on the previous owner of the key")        \
+    ACTION( migrate_hits,           STATS_COUNTER,      "# retried misses that hit on the previous owner")          \
+    ACTION( migrate_moves,          STATS_COUNTER,      "# keys moved to their new owner")                          \
+    ACTION( migrate_move_errors,    STATS_COUNTER,      "# keys that failed to move to their new owner")            \
+    ACTION( migrate_backfills,      STATS_COUNTER,      "# values backfilled into the new owner of the key")        \
+    /* replication behavior */                                                                                      \
+    ACTION( replica_requests,       STATS_COUNTER,      "# writes copied to the other replicas of their keys")      \
+    ACTION( replica_drops,          STATS_COUNTER,      "# writes not copied to an unreachable replica")            \
+    ACTION( replica_retries,        STATS_COUNTER,      "# read misses retried on the first replica of the key")    \
+    ACTION( replica_failovers,      STATS_COUNTER,      "# failed reads retried on the next replica of the key")    \
+    /* read fallback behavior */                                                                                    \
+    ACTION( fallback_retries,       STATS_COUNTER,      "# missed or failed reads retried on the read fallback")    \
+    ACTION( fallback_hits,          STATS_COUNTER,      "# retried reads that hit on the read fallback")            \
+    ACTION( fallback_misses,        STATS_COUNTER,      "# retried reads that missed on the read fallback")         \
+    /* warmup behavior */                                                                                           \
+    ACTION( warmup_writes,          STATS_COUNTER,      "# writes copied to the warmup pool")                       \
+    ACTION( warmup_backfills,       STATS_COUNTER,      "# hits on the warmup pool stored into the pool")           \
+    /* key behavior */                                                                                              \
+    ACTION( distinct_keys,          STATS_GAUGE,        "estimated # distinct keys over the last windows")          \
 
 #define STATS_SERVER_CODEC(ACTION)                                                                                  \
     /* server behavior */                                                                                           \
@@ -47,11 +70,20 @@
     ACTION( in_queue_bytes,         STATS_GAUGE,        "current request bytes in incoming queue")                  \
     ACTION( out_queue,              STATS_GAUGE,        "# requests in outgoing queue")                             \
     ACTION( out_queue_bytes,        STATS_GAUGE,        "current request bytes in outgoing queue")                  \
+    ACTION( distinct_keys,          STATS_GAUGE,        "estimated # distinct keys over the last windows")          \
 
 #define STATS_ADDR      "0.0.0.0"
 #define STATS_PORT      22222
 #define STATS_INTERVAL  (10 * 1000) /* in msec */
 
+#define STATS_QUERY_TIMEOUT 100  /* in msec, wait for a query after accept */
+#define STATS_QUERY_MAXLEN  1024 /* max length of a query line */
+#define STATS_NCONN         16   /* max # clients waiting to send a query */
+#define STATS_NTOKEN        8    /* # snapshots remembered for deltas */
+#define STATS_EXPORT_MTU    1400 /* max bytes in a stats export datagram */
+#define STATS_DUMP_BUFLEN   4096 /* initial size of a dump buffer */
+#define STATS_DUMP_TIMEOUT  100  /* in msec, to send a dump */
+
 typedef void (*stats_loop_t)(void *, void *);
 
 typedef enum stats_type {
@@ -82,6 +114,86 @@ struct stats_pool {
     struct array  server; /* stats_server[] */
 };
 
+/*
+ * Flat per-pool and per-server counters, one int64_t field per codec entry.
+ * The generator (worker thread) updates them with a single add at a constant
+ * offset; the aggregator converts them into the named stats_metric form when
+ * it renders the stats.
+ */
+#define DEFINE_ACTION(_name, _type, _desc) int64_t _name;
+struct stats_pool_counters {
+    STATS_POOL_CODEC(DEFINE_ACTION)
+};
+
+struct stats_server_counters {
+    STATS_SERVER_CODEC(DEFINE_ACTION)
+};
+#undef DEFINE_ACTION
+
+struct stats_counters {
+    uint32_t                     npool;   /* # pool counters */
+    struct stats_pool_counters   *pool;   /* pool counters[], by pool idx */
+    uint32_t                     nserver; /* # server counters */
+    struct stats_server_counters *server; /* server counters[], by server stats_idx */
+};
+
+/*
+ * Snapshot of the aggregated sum (c) of a worker, published through the
+ * worker's shared memory and rendered by the master. Values are laid out
+ * in sum (c) order: pool metrics of a pool followed by the server metrics
+ * of each of its servers, for every pool.
+ */
+struct stats_snapshot {
+    volatile uint32_t seq;         /* sequence, odd while being written */
+    pid_t             pid;         /* worker pid */
+    int64_t           start_ts;    /* worker start timestamp */
+    int64_t           ntotal_conn; /* # total connections */
+    int64_t           ncurr_conn;  /* # curr connections */
+    uint32_t          nvalue;      /* # value */
+    int64_t           value[1];    /* metric value[] */
+};
+
+/*
+ * Stats query sent by a client on the stats port, for example:
+ *   pool=alpha,beta server=127.0.0.1:6379 view=aggregate since=12
+ */
+struct stats_query {
+    struct string pool;     /* comma separated pool names, empty for all */
+    struct string server;   /* comma separated server names, empty for all */
+    uint64_t      since;    /* token to report counter deltas from */
+    unsigned      worker:1; /* per worker view? or aggregated? */
+    unsigned      token:1;  /* hand out a token? */
+};
+
+/* Counter values handed out to a client along with a token */
+struct stats_token_worker {
+    pid_t    pid;                        /* worker pid */
+    uint32_t start;                      /* index of its first value */
+    uint32_t nvalue;                     /* # its values */
+};
+
+struct stats_token {
+    uint64_t                  id;        /* token id (0 for unused) */
+    char                      key[STATS_QUERY_MAXLEN]; /* query of values */
+    uint32_t                  nvalue;    /* # value */
+    int64_t                   *value;    /* value[] in render order */
+    uint32_t                  nworker;   /* # worker */
+    struct stats_token_worker *worker;   /* worker[] in value, by pid */
+};
+
+struct stats_conn {
+    int      sd;                         /* client descriptor */
+    int64_t  deadline;                   /* in msec, to send a query by */
+    size_t   len;                        /* # query bytes read */
+    char     line[STATS_QUERY_MAXLEN];   /* query line */
+};
+
+typedef enum stats_export_type {
+    STATS_EXPORT_NONE,               /* no push export */
+    STATS_EXPORT_STATSD,             /* statsd line protocol */
+    STATS_EXPORT_INFLUX,             /* influx line protocol */
+} stats_export_type_t;
+
 struct stats_buffer {
     size_t   len;   /* buffer length */
     uint8_t  *data; /* buffer data */
@@ -99,12 +211,15 @@ struct stats {
     struct stats_buffer buf;             /* output buffer */
     stats_loop_t        loop;            /* loop handler */
 
-    struct array        current;         /* stats_pool[] (a) */
-    struct array        shadow;          /* stats_pool[] (b) */
+    struct stats_counters *current;      /* stats_counters (a) */
+    struct stats_counters *shadow;       /* stats_counters (b) */
+    struct stats_counters counters[2];   /* storage for current and shadow */
     struct array        sum;             /* stats_pool[] (c = a + b) */
 
     pthread_t           tid;             /* stats aggregator thread */
     int                 sd;              /* stats descriptor */
+    struct stats_conn   conn[STATS_NCONN]; /* clients yet to send a query */
+    uint32_t            nconn;           /* # conn */
 
     struct string       service_str;     /* service string */
     struct string       service;         /* service */
@@ -117,9 +232,18 @@ struct stats {
     struct string       pid_str;         /* pid string */
     struct string       ntotal_conn_str; /* total connections string */
     struct string       ncurr_conn_str;  /* curr connections string */
+    struct string       token_str;       /* token string */
+    struct string       since_str;       /* since string */
 
     volatile int        aggregate;       /* shadow (b) aggregate? */
-    volatile int        updated;         /* current (a) updated? */
+
+    struct stats_token  token[STATS_NTOKEN]; /* snapshots for deltas */
+    uint64_t            ntoken;          /* # tokens handed out */
+
+    stats_export_type_t export;          /* push export format */
+    int                 export_sd;       /* push export descriptor */
+    int64_t             export_ts;       /* last push export in msec */
+    int64_t             *exported;       /* sum (c) values at last export */
 };
 
 #define DEFINE_ACTION(_name, _type, _desc) STATS_POOL_##_name,
@@ -138,44 +262,51 @@ typedef enum stats_server_field {
 
 #if defined NC_STATS && NC_STATS == 1
 
+#define stats_pool_field(_ctx, _pool, _name)                            \
+    ((_ctx)->stats->current->pool[((struct server_pool *)(_pool))->idx]._name)
+
+#define stats_server_field(_ctx, _server, _name)                        \
+    ((_ctx)->stats->current->                                           \
+        server[((struct server *)(_server))->stats_idx]._name)
+
 #define stats_pool_incr(_ctx, _pool, _name) do {                        \
-    _stats_pool_incr(_ctx, _pool, STATS_POOL_##_name);                  \
+    stats_pool_field(_ctx, _pool, _name)++;                             \
 } while (0)
 
 #define stats_pool_decr(_ctx, _pool, _name) do {                        \
-    _stats_pool_decr(_ctx, _pool, STATS_POOL_##_name);                  \
+    stats_pool_field(_ctx, _pool, _name)--;                             \
 } while (0)
 
 #define stats_pool_incr_by(_ctx, _pool, _name, _val) do {               \
-    _stats_pool_incr_by(_ctx, _pool, STATS_POOL_##_name, _val);         \
+    stats_pool_field(_ctx, _pool, _name) += (int64_t)(_val);            \
 } while (0)
 
 #define stats_pool_decr_by(_ctx, _pool, _name, _val) do {               \
-    _stats_pool_decr_by(_ctx, _pool, STATS_POOL_##_name, _val);         \
+    stats_pool_field(_ctx, _pool, _name) -= (int64_t)(_val);            \
 } while (0)
 
 #define stats_pool_set_ts(_ctx, _pool, _name, _val) do {                \
-    _stats_pool_set_ts(_ctx, _pool, STATS_POOL_##_name, _val);          \
+    stats_pool_field(_ctx, _pool, _name) = (int64_t)(_val);             \
 } while (0)
 
 #define stats_server_incr(_ctx, _server, _name) do {                    \
-    _stats_server_incr(_ctx, _server, STATS_SERVER_##_name);            \
+    stats_server_field(_ctx, _server, _name)++;                         \
 } while (0)
 
 #define stats_server_decr(_ctx, _server, _name) do {                    \
-    _stats_server_decr(_ctx, _server, STATS_SERVER_##_name);            \
+    stats_server_field(_ctx, _server, _name)--;                         \
 } while (0)
 
 #define stats_server_incr_by(_ctx, _server, _name, _val) do {           \
-    _stats_server_incr_by(_ctx, _server, STATS_SERVER_##_name, _val);   \
+    stats_server_field(_ctx, _server, _name) += (int64_t)(_val);        \
 } while (0)
 
 #define stats_server_decr_by(_ctx, _server, _name, _val) do {           \
-    _stats_server_decr_by(_ctx, _server, STATS_SERVER_##_name, _val);   \
+    stats_server_field(_ctx, _server, _name) -= (int64_t)(_val);        \
 } while (0)
 
 #define stats_server_set_ts(_ctx, _server, _name, _val) do {            \
-     _stats_server_set_ts(_ctx, _server, STATS_SERVER_##_name, _val);   \
+    stats_server_field(_ctx, _server, _name) = (int64_t)(_val);         \
 } while (0)
 
 #else
@@ -188,6 +319,8 @@ typedef enum stats_server_field {
 
 #define stats_pool_decr_by(_ctx, _pool, _name, _val)
 
+#define stats_pool_set_ts(_ctx, _pool, _name, _val)
+
 #define stats_server_incr(_ctx, _server, _name)
 
 #define stats_server_decr(_ctx, _server, _name)
@@ -196,30 +329,24 @@ typedef enum stats_server_field {
 
 #define stats_server_decr_by(_ctx, _server, _name, _val)
 
+#define stats_server_set_ts(_ctx, _server, _name, _val)
+
 #endif
 
 #define stats_enabled   NC_STATS
 
 void stats_describe(void);
 
-void _stats_pool_incr(struct context *ctx, struct server_pool *pool, stats_pool_field_t fidx);
-void _stats_pool_decr(struct context *ctx, struct server_pool *pool, stats_pool_field_t fidx);
-void _stats_pool_incr_by(struct context *ctx, struct server_pool *pool, stats_pool_field_t fidx, int64_t val);
-void _stats_pool_decr_by(struct context *ctx, struct server_pool *pool, stats_pool_field_t fidx, int64_t val);
-void _stats_pool_set_ts(struct context *ctx, struct server_pool *pool, stats_pool_field_t fidx, int64_t val);
-
-void _stats_server_incr(struct context *ctx, struct server *server, stats_server_field_t fidx);
-void _stats_server_decr(struct context *ctx, struct server *server, stats_server_field_t fidx);
-void _stats_server_incr_by(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
-void _stats_server_decr_by(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
-void _stats_server_set_ts(struct context *ctx, struct server *server, stats_server_field_t fidx, int64_t val);
-
-struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *source, struct array *server_pool, stats_loop_t loop);
+struct stats *stats_create(uint16_t stats_port, char *stats_ip, int stats_interval, char *stats_export, char *source, struct array *server_pool, stats_loop_t loop, struct context *owner);
 void stats_destroy(struct stats *stats);
 void stats_swap(struct stats *stats);
+void stats_server_join(struct stats *stats, struct server *server);
 void stats_loop_callback(void *arg1, void *arg2);
 void stats_master_loop_callback(void *arg1, void *arg2);
 rstatus_t stats_shared_memory_init(struct stats *stats, int processes);
 void stats_shared_memory_deinit(struct stats *stats);
+rstatus_t stats_buf_printf(struct stats_buffer *buf, const char *fmt, ...);
+rstatus_t stats_buf_add_json(struct stats_buffer *buf, uint8_t *data, uint32_t len);
+void stats_dump(struct context *ctx, int sd, char *line);
 
 #endif
@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include <nc_core.h>
+#include <nc_server.h>
+#include <nc_talker.h>
+#include <hashkit/nc_hashkit.h>
+
+/*
+ * Traffic of a pool with client_top: broken down by client address, so that
+ * the clients sending the most requests stand out. Connections over unix
+ * sockets all count under the empty address.
+ *
+ * A pool tracks at most client_top: addresses, the top ones by requests, in
+ * the same kind of table as namespaces (see nc_topk.c): an address that shows
+ * up while all of them are taken replaces the one with the fewest requests,
+ * whose traffic is folded into "other", and starts from the requests of the
+ * address it replaced, its overcount.
+ *
+ * Each client connection remembers its address and the entry it was last
+ * counted to, so that a request costs a lookup only after that entry was
+ * given to another address.
+ */
+
+static struct talker_table *
+talker_create(uint32_t size)
+{
+    struct talker_table *tt;
+
+    tt = nc_zalloc(sizeof(*tt));
+    if (tt == NULL) {
+        return NULL;
+    }
+
+    tt->entry = nc_zalloc(size * sizeof(*tt->entry));
+    if (tt->entry == NULL || topk_init(&tt->topk, size) != NC_OK) {
+        if (tt->entry != NULL) {
+            nc_free(tt->entry);
+        }
+        nc_free(tt);
+        return NULL;
+    }
+
+    return tt;
+}
+
+void
+talker_deinit(struct server_pool *pool)
+{
+    struct talker_table *tt = pool->talker;
+
+    if (tt == NULL) {
+        return;
+    }
+
+    topk_deinit(&tt->topk);
+    nc_free(tt->entry);
+    nc_free(pool->talker);
+}
+
+/*
+ * Fold the traffic of e, an entry that is evicted, into other
+ */
+static void
+talker_fold(struct talker_table *tt, struct talker_entry *e)
+{
+    struct talker_entry *other = &tt->other;
+
+    other->connections += e->connections;
+    other->requests += e->requests;
+    other->request_bytes += e->request_bytes;
+    other->response_bytes += e->response_bytes;
+    other->outstanding += e->outstanding;
+    other->max_outstanding = MAX(other->max_outstanding, e->max_outstanding);
+}
+
+static bool
+talker_match(struct talker_entry *e, struct conn *c_conn)
+{
+    return e->addrlen == c_conn->peerlen &&
+           memcmp(e->addr, c_conn->peer, c_conn->peerlen) == 0;
+}
+
+/*
+ * Return the entry of the address of c_conn in the table of its pool,
+ * tracking the address if it is not yet
+ */
+static struct talker_entry *
+talker_lookup(struct conn *c_conn)
+{
+    struct server_pool *pool = c_conn->owner;
+    struct talker_table *tt;
+    struct talker_entry *e;
+    uint32_t hash;
+    int32_t i;
+    bool evicted;
+
+    if (pool->talker == NULL) {
+        pool->talker = talker_create(pool->client_top);
+        if (pool->talker == NULL) {
+            return NULL;
+        }
+    }
+    tt = pool->talker;
+
+    if (c_conn->talker >= 0 && (uint32_t)c_conn->talker < tt->topk.nitem) {
+        e = &tt->entry[c_conn->talker];
+        if (talker_match(e, c_conn)) {
+            return e;
+        }
+    }
+
+    hash = hash_murmur((char *)c_conn->peer, c_conn->peerlen);
+
+    for (i = topk_first(&tt->topk, hash); i >= 0; i = tt->topk.node[i].next) {
+        e = &tt->entry[i];
+        if (tt->topk.node[i].hash == hash && talker_match(e, c_conn)) {
+            c_conn->talker = i;
+            return e;
+        }
+    }
+
+    i = (int32_t)topk_insert(&tt->topk, hash, &evicted);
+    e = &tt->entry[i];
+    if (evicted) {
+        talker_fold(tt, e);
+    }
+
+    memset(e, 0, sizeof(*e));
+    nc_memcpy(e->addr, c_conn->peer, c_conn->peerlen);
+    e->addrlen = c_conn->peerlen;
+    e->overcount = tt->topk.node[i].count;
+
+    c_conn->talker = i;
+
+    return e;
+}
+
+/*
+ * Remember the address of c_conn, a newly accepted client connection, and
+ * count the connection to it
+ */
+void
+talker_accept(struct conn *c_conn)
+{
+    struct server_pool *pool = c_conn->owner;
+    struct sockaddr_storage ss;
+    struct sockaddr_in *sin;
+    struct sockaddr_in6 *sin6;
+    struct talker_entry *e;
+    socklen_t sslen;
+
+    if (pool->client_top == 0) {
+        return;
+    }
+
+    c_conn->peerlen = 0;
+
+    sslen = sizeof(ss);
+    if (getpeername(c_conn->sd, (struct sockaddr *)&ss, &sslen) == 0) {
+        switch (ss.ss_family) {
+        case AF_INET:
+            sin = (struct sockaddr_in *)&ss;
+            nc_memcpy(c_conn->peer, &sin->sin_addr, 4);
+            c_conn->peerlen = 4;
+            break;
+
+        case AF_INET6:
+            sin6 = (struct sockaddr_in6 *)&ss;
+            if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+                nc_memcpy(c_conn->peer, &sin6->sin6_addr.s6_addr[12], 4);
+                c_conn->peerlen = 4;
+            } else {
+                nc_memcpy(c_conn->peer, &sin6->sin6_addr, 16);
+                c_conn->peerlen = 16;
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    e = talker_lookup(c_conn);
+    if (e != NULL) {
+        e->connections++;
+    }
+}
+
+/*
+ * Count req, a request received on c_conn, and the requests of c_conn still
+ * outstanding ahead of it, to the address of c_conn
+ */
+void
+talker_request(struct conn *c_conn, struct msg *req)
+{
+    struct server_pool *pool = c_conn->owner;
+    struct talker_entry *e;
+
+    if (pool->client_top == 0) {
+        return;
+    }
+
+    e = talker_lookup(c_conn);
+    if (e == NULL) {
+        return;
+    }
+
+    e->requests++;
+    e->request_bytes += req->mlen;
+    topk_count(&pool->talker->topk, (uint32_t)(e - pool->talker->entry));
+    e->outstanding += c_conn->nomsg;
+    e->max_outstanding = MAX(e->max_outstanding, (int64_t)c_conn->nomsg);
+}
+
+/*
+ * Count rsp, the response to req sent on c_conn, to the address of c_conn.
+ * Fragments of a request are left out, as their owner stands for them.
+ */
+void
+talker_response(struct conn *c_conn, struct msg *req, struct msg *rsp)
+{
+    struct server_pool *pool = c_conn->owner;
+    struct talker_entry *e;
+
+    if (pool->client_top == 0) {
+        return;
+    }
+
+    if (req->frag_owner != NULL && req->frag_owner != req) {
+        return;
+    }
+
+    e = talker_lookup(c_conn);
+    if (e == NULL) {
+        return;
+    }
+
+    e->response_bytes += rsp->mlen;
+}
+
+static rstatus_t
+talker_dump_entry(struct stats_buffer *buf, struct talker_entry *e)
+{
+    return stats_buf_printf(buf, "{\"connections\":%"PRId64", \"requests\":"
+                            "%"PRId64", \"request_bytes\":%"PRId64", "
+                            "\"response_bytes\":%"PRId64", \"outstanding\":"
+                            "%"PRId64", \"max_outstanding\":%"PRId64", "
+                            "\"overcount\":%"PRId64"}", e->connections,
+                            e->requests, e->request_bytes, e->response_bytes,
+                            e->outstanding, e->max_outstanding, e->overcount);
+}
+
+static int
+talker_entry_cmp(const void *t1, const void *t2)
+{
+    const struct talker_entry *e1 = *(const struct talker_entry * const *)t1;
+    const struct talker_entry *e2 = *(const struct talker_entry * const *)t2;
+
+    if (e1->requests != e2->requests) {
+        return e1->requests > e2->requests ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static rstatus_t
+talker_dump_pool(struct stats_buffer *buf, struct server_pool *pool)
+{
+    rstatus_t status;
+    struct talker_table *tt = pool->talker;
+    struct talker_entry **sorted, *e;
+    char addr[INET6_ADDRSTRLEN];
+    uint32_t i;
+
+    sorted = nc_alloc(tt->topk.nitem * sizeof(*sorted) + 1);
+    if (sorted == NULL) {
+        return NC_ENOMEM;
+    }
+
+    for (i = 0; i < tt->topk.nitem; i++) {
+        sorted[i] = &tt->entry[i];
+    }
+    qsort(sorted, tt->topk.nitem, sizeof(*sorted), talker_entry_cmp);
+
+    status = stats_buf_printf(buf, ", \"%.*s\":{\"clients\":{",
+                              pool->name.len, pool->name.data);
+
+    for (i = 0; i < tt->topk.nitem && status == NC_OK; i++) {
+        e = sorted[i];
+
+        if (e->addrlen == 0 ||
+            inet_ntop(e->addrlen == 4 ? AF_INET : AF_INET6, e->addr, addr,
+                      sizeof(addr)) == NULL) {
+            addr[0] = '\0';
+        }
+
+        status = stats_buf_printf(buf, "%s\"%s\":", i > 0 ? ", " : "", addr);
+        if (status == NC_OK) {
+            status = talker_dump_entry(buf, e);
+        }
+    }
+
+    if (status == NC_OK) {
+        status = stats_buf_printf(buf, "}, \"other\":");
+    }
+    if (status == NC_OK) {
+        status = talker_dump_entry(buf, &tt->other);
+    }
+    if (status == NC_OK) {
+        status = stats_buf_printf(buf, "}");
+    }
+
+    nc_free(sorted);
+
+    return status;
+}
+
+/*
+ * Append the client addresses of every pool, or of the pool named by args,
+ * to buf
+ */
+rstatus_t
+talker_dump(struct context *ctx, struct stats_buffer *buf, char *args)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    uint32_t i;
+
+    for (i = 0; i < array_n(&ctx->pool); i++) {
+        pool = array_get(&ctx->pool, i);
+
+        if (pool->talker == NULL) {
+            continue;
+        }
+
+        if (args != NULL && (pool->name.len != strlen(args) ||
+            nc_strncmp(pool->name.data, args, pool->name.len) != 0)) {
+            continue;
+        }
+
+        status = talker_dump_pool(buf, pool);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
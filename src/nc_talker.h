@@ -0,0 +1,34 @@
+#ifndef _NC_TALKER_H_
+#define _NC_TALKER_H_
+
+#include <nc_core.h>
+#include <nc_topk.h>
+
+struct talker_entry {
+    uint8_t  addr[16];         /* client ipv4 or ipv6 address */
+    uint8_t  addrlen;          /* client address length, 0 for unix sockets */
+    int64_t  overcount;        /* # requests counted before it was tracked */
+    int64_t  connections;      /* # connections accepted */
+    int64_t  requests;         /* # requests */
+    int64_t  request_bytes;    /* total request bytes */
+    int64_t  response_bytes;   /* total response bytes */
+    int64_t  outstanding;      /* total # requests outstanding ahead of each request */
+    int64_t  max_outstanding;  /* max # requests outstanding ahead of a request */
+};
+
+/*
+ * Traffic of the top client addresses of a pool, and of all the others
+ */
+struct talker_table {
+    struct topk         topk;     /* top client_top: addresses by requests */
+    struct talker_entry other;    /* traffic of the evicted addresses */
+    struct talker_entry *entry;   /* entry[] of each item of topk */
+};
+
+void talker_accept(struct conn *c_conn);
+void talker_request(struct conn *c_conn, struct msg *req);
+void talker_response(struct conn *c_conn, struct msg *req, struct msg *rsp);
+rstatus_t talker_dump(struct context *ctx, struct stats_buffer *buf, char *args);
+void talker_deinit(struct server_pool *pool);
+
+#endif
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include <nc_core.h>
+#include <nc_tap.h>
+
+/*
+ * A tap streams one line per request that a client got a response to, to
+ * a subscriber that attached with the "tap" command on the stats port.
+ * A tap is attached to a single process, as lines of several processes
+ * would interleave on one socket; with several workers, the subscriber
+ * asks for one tap per worker. The process writes its lines without ever
+ * blocking on the subscriber: lines that do not fit into the socket buffer
+ * are dropped whole, the rest of a line that was sent in part is sent
+ * ahead of the next one, and a tap whose subscriber is gone is detached.
+ * Requests cost a single test of ntap while no tap is attached.
+ */
+
+uint32_t ntap;                      /* # attached taps */
+static struct tap taps[TAP_MAX];    /* attached taps */
+
+/*
+ * Parse a tap filter line of the form "[pool=..] [cmd=..] [prefix=..]
+ * [client=..] [sample=..] [worker=..]" into t
+ */
+rstatus_t
+tap_parse(struct tap *t, char *line)
+{
+    rstatus_t status;
+    struct string *field;
+    char *token, *value, *saveptr;
+    int sample, worker;
+
+    t->sd = -1;
+    string_init(&t->pool);
+    string_init(&t->cmd);
+    string_init(&t->prefix);
+    string_init(&t->client);
+    t->sample = 100;
+    t->worker = -1;
+    t->npending = 0;
+
+    for (token = strtok_r(line, " ", &saveptr); token != NULL;
+         token = strtok_r(NULL, " ", &saveptr)) {
+
+        value = strchr(token, '=');
+        if (value == NULL || value[1] == '\0') {
+            return NC_ERROR;
+        }
+        *value++ = '\0';
+
+        if (strcmp(token, "sample") == 0) {
+            sample = nc_atoi(value, strlen(value));
+            if (sample <= 0 || sample > 100) {
+                return NC_ERROR;
+            }
+            t->sample = (uint32_t)sample;
+            continue;
+        }
+
+        if (strcmp(token, "worker") == 0) {
+            worker = nc_atoi(value, strlen(value));
+            if (worker < 0) {
+                return NC_ERROR;
+            }
+            t->worker = worker;
+            continue;
+        }
+
+        if (strcmp(token, "pool") == 0) {
+            field = &t->pool;
+        } else if (strcmp(token, "cmd") == 0) {
+            field = &t->cmd;
+        } else if (strcmp(token, "prefix") == 0) {
+            field = &t->prefix;
+        } else if (strcmp(token, "client") == 0) {
+            field = &t->client;
+        } else {
+            return NC_ERROR;
+        }
+
+        string_deinit(field);
+        status = string_copy(field, (uint8_t *)value, (uint32_t)strlen(value));
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+void
+tap_deinit(struct tap *t)
+{
+    string_deinit(&t->pool);
+    string_deinit(&t->cmd);
+    string_deinit(&t->prefix);
+    string_deinit(&t->client);
+}
+
+static void
+tap_detach(uint32_t i)
+{
+    log_warn("tap %d detached", taps[i].sd);
+
+    close(taps[i].sd);
+    tap_deinit(&taps[i]);
+
+    ntap--;
+    taps[i] = taps[ntap];
+}
+
+/*
+ * Attach a tap with the filter in line to the subscriber socket sd, which
+ * the tap owns from now on
+ */
+void
+tap_attach(int sd, char *line)
+{
+    struct tap *t;
+
+    if (ntap == TAP_MAX) {
+        log_warn("tap %d not attached, %d taps attached already", sd,
+                 TAP_MAX);
+        close(sd);
+        return;
+    }
+
+    t = &taps[ntap];
+    if (tap_parse(t, line) != NC_OK) {
+        log_warn("tap %d not attached, invalid filter", sd);
+        tap_deinit(t);
+        close(sd);
+        return;
+    }
+    t->sd = sd;
+    ntap++;
+
+    log_warn("tap %d attached", sd);
+}
+
+static bool
+tap_prefix(struct string *prefix, uint8_t *data, uint32_t len)
+{
+    if (string_empty(prefix)) {
+        return true;
+    }
+
+    return len >= prefix->len && nc_strncmp(data, prefix->data, prefix->len) == 0;
+}
+
+/*
+ * Append a json string of data to buf at offset n, escaped and truncated
+ * to max bytes, and return the new offset
+ */
+static int
+tap_add_string(char *buf, int n, int size, uint8_t *data, uint32_t len,
+               uint32_t max)
+{
+    uint32_t i;
+
+    buf[n++] = '"';
+    for (i = 0; i < len && i < max && n < size - 8; i++) {
+        if (data[i] == '"' || data[i] == '\\') {
+            buf[n++] = '\\';
+            buf[n++] = (char)data[i];
+        } else if (data[i] < 0x20 || data[i] >= 0x7f) {
+            n += nc_scnprintf(buf + n, size - n, "\\u%04x", data[i]);
+        } else {
+            buf[n++] = (char)data[i];
+        }
+    }
+    buf[n++] = '"';
+
+    return n;
+}
+
+/*
+ * Send the n bytes of line to the subscriber of t, behind the rest of a
+ * line that was sent in part before, so that the stream only carries whole
+ * lines. Returns NC_ERROR once the subscriber is gone.
+ */
+static rstatus_t
+tap_send(struct tap *t, char *line, uint32_t n)
+{
+    ssize_t sent;
+
+    if (t->npending > 0) {
+        sent = send(t->sd, t->pending, t->npending,
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINTR) ? NC_OK : NC_ERROR;
+        }
+
+        t->npending -= (uint32_t)sent;
+        memmove(t->pending, t->pending + sent, t->npending);
+        if (t->npending > 0) {
+            /* line is dropped, as the socket buffer is still full */
+            return NC_OK;
+        }
+    }
+
+    sent = send(t->sd, line, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK ||
+                errno == EINTR) ? NC_OK : NC_ERROR;
+    }
+
+    if ((uint32_t)sent < n) {
+        t->npending = n - (uint32_t)sent;
+        nc_memcpy(t->pending, line + sent, t->npending);
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Send req, a request received on c_conn, and rsp, its response, to each
+ * tap whose filter matches. Fragments of a request are left out, as their
+ * owner stands for them.
+ */
+void
+tap_request(struct conn *c_conn, struct msg *req, struct msg *rsp)
+{
+    struct server_pool *pool;
+    struct keypos *kpos;
+    struct tap *t;
+    char line[TAP_LINE_MAXLEN], cmd[64], *client;
+    uint8_t *key;
+    uint32_t i, keylen, cmdlen, clientlen;
+    int64_t now;
+    int n;
+
+    if (req->frag_owner != NULL && req->frag_owner != req) {
+        return;
+    }
+
+    pool = c_conn->owner;
+
+    cmdlen = msg_type_cmd(req->type, cmd, sizeof(cmd));
+
+    if (array_n(req->keys) > 0) {
+        kpos = array_get(req->keys, 0);
+        key = kpos->start;
+        keylen = (uint32_t)(kpos->end - kpos->start);
+    } else {
+        key = NULL;
+        keylen = 0;
+    }
+
+    client = NULL;
+    clientlen = 0;
+    n = 0;
+
+    for (i = 0; i < ntap; i++) {
+        t = &taps[i];
+
+        if (!string_empty(&t->pool) && string_compare(&t->pool, &pool->name) != 0) {
+            continue;
+        }
+
+        if (!string_empty(&t->cmd) && (t->cmd.len != cmdlen ||
+            nc_strncmp(t->cmd.data, cmd, cmdlen) != 0)) {
+            continue;
+        }
+
+        if (!tap_prefix(&t->prefix, key, keylen)) {
+            continue;
+        }
+
+        if (client == NULL) {
+            client = nc_unresolve_peer_desc(c_conn->sd);
+            clientlen = (uint32_t)strlen(client);
+        }
+
+        if (!tap_prefix(&t->client, (uint8_t *)client, clientlen)) {
+            continue;
+        }
+
+        if (t->sample < 100 && (uint32_t)(random() % 100) >= t->sample) {
+            continue;
+        }
+
+        if (n == 0) {
+            now = nc_usec_now();
+
+            n = nc_scnprintf(line, sizeof(line), "{\"ts\":%"PRId64", \"pool\":",
+                             now);
+            n = tap_add_string(line, n, sizeof(line), pool->name.data,
+                               pool->name.len, pool->name.len);
+            n += nc_scnprintf(line + n, sizeof(line) - (size_t)n,
+                              ", \"client\":");
+            n = tap_add_string(line, n, sizeof(line), (uint8_t *)client,
+                               clientlen, clientlen);
+            n += nc_scnprintf(line + n, sizeof(line) - (size_t)n, ", \"cmd\":\"%.*s\", "
+                              "\"key\":", cmdlen, cmd);
+            n = tap_add_string(line, n, sizeof(line), key, keylen,
+                               TAP_KEY_MAXLEN);
+            n += nc_scnprintf(line + n, sizeof(line) - (size_t)n, ", \"nkey\":%"PRIu32", "
+                              "\"req_bytes\":%"PRIu32", \"rsp_bytes\":%"PRIu32", "
+                              "\"latency_us\":%"PRId64"}\n", array_n(req->keys),
+                              req->mlen, rsp->mlen,
+                              req->start_ts > 0 ? now - req->start_ts : 0);
+        }
+
+        if (tap_send(t, line, (uint32_t)n) != NC_OK) {
+            tap_detach(i);
+            i--;
+        }
+    }
+}
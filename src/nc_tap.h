@@ -0,0 +1,29 @@
+#ifndef _NC_TAP_H_
+#define _NC_TAP_H_
+
+#include <nc_core.h>
+
+#define TAP_MAX         8       /* max # taps attached to a process */
+#define TAP_LINE_MAXLEN 1024    /* max length of a tap line */
+#define TAP_KEY_MAXLEN  256     /* max # key bytes in a tap line */
+
+struct tap {
+    int           sd;       /* subscriber socket */
+    struct string pool;     /* pool= or empty for all */
+    struct string cmd;      /* cmd= or empty for all */
+    struct string prefix;   /* prefix= of keys or empty for all */
+    struct string client;   /* client= address prefix or empty for all */
+    uint32_t      sample;   /* sample= % of matching requests */
+    int           worker;   /* worker= index or -1 for the only process */
+    uint32_t      npending; /* # bytes of the line sent in part */
+    char          pending[TAP_LINE_MAXLEN]; /* unsent rest of that line */
+};
+
+extern uint32_t ntap;
+
+rstatus_t tap_parse(struct tap *t, char *line);
+void tap_deinit(struct tap *t);
+void tap_attach(int sd, char *line);
+void tap_request(struct conn *c_conn, struct msg *req, struct msg *rsp);
+
+#endif
@@ -0,0 +1,172 @@
+#include <nc_core.h>
+#include <nc_topk.h>
+
+/*
+ * Top items of a stream by space saving: once size items are tracked, an
+ * item that shows up replaces the one counted least, and starts from its
+ * count, the overcount of the new item. An item counted more often than
+ * the overcount of any other is thus always tracked.
+ *
+ * Items are found by the hash that the caller computes, in buckets of
+ * chained nodes, and are kept in a min-heap by count, so that the item
+ * counted least is at its root and a count costs O(log size) at most.
+ */
+
+rstatus_t
+topk_init(struct topk *tk, uint32_t size)
+{
+    uint32_t i;
+
+    tk->size = size;
+    tk->nitem = 0;
+    tk->nbucket = 2 * size;
+
+    tk->bucket = nc_alloc(tk->nbucket * sizeof(*tk->bucket));
+    tk->node = nc_zalloc(size * sizeof(*tk->node));
+    tk->heap = nc_alloc(size * sizeof(*tk->heap));
+    if (tk->bucket == NULL || tk->node == NULL || tk->heap == NULL) {
+        topk_deinit(tk);
+        return NC_ENOMEM;
+    }
+
+    for (i = 0; i < tk->nbucket; i++) {
+        tk->bucket[i] = -1;
+    }
+
+    return NC_OK;
+}
+
+void
+topk_deinit(struct topk *tk)
+{
+    if (tk->bucket != NULL) {
+        nc_free(tk->bucket);
+    }
+    if (tk->node != NULL) {
+        nc_free(tk->node);
+    }
+    if (tk->heap != NULL) {
+        nc_free(tk->heap);
+    }
+}
+
+static void
+topk_swap(struct topk *tk, uint32_t a, uint32_t b)
+{
+    uint32_t i = tk->heap[a];
+
+    tk->heap[a] = tk->heap[b];
+    tk->heap[b] = i;
+
+    tk->node[tk->heap[a]].heap = a;
+    tk->node[tk->heap[b]].heap = b;
+}
+
+static int64_t
+topk_heap_count(struct topk *tk, uint32_t k)
+{
+    return tk->node[tk->heap[k]].count;
+}
+
+static void
+topk_sift_up(struct topk *tk, uint32_t k)
+{
+    uint32_t parent;
+
+    while (k > 0) {
+        parent = (k - 1) / 2;
+        if (topk_heap_count(tk, parent) <= topk_heap_count(tk, k)) {
+            break;
+        }
+        topk_swap(tk, parent, k);
+        k = parent;
+    }
+}
+
+static void
+topk_sift_down(struct topk *tk, uint32_t k)
+{
+    uint32_t child;
+
+    for (;;) {
+        child = 2 * k + 1;
+        if (child >= tk->nitem) {
+            break;
+        }
+        if (child + 1 < tk->nitem &&
+            topk_heap_count(tk, child + 1) < topk_heap_count(tk, child)) {
+            child++;
+        }
+        if (topk_heap_count(tk, k) <= topk_heap_count(tk, child)) {
+            break;
+        }
+        topk_swap(tk, k, child);
+        k = child;
+    }
+}
+
+/*
+ * Return the first item in the bucket of hash, or -1; the next ones are
+ * chained by node[].next
+ */
+int32_t
+topk_first(struct topk *tk, uint32_t hash)
+{
+    return tk->bucket[hash % tk->nbucket];
+}
+
+static void
+topk_unlink(struct topk *tk, uint32_t i)
+{
+    int32_t *link;
+
+    for (link = &tk->bucket[tk->node[i].hash % tk->nbucket];
+         *link != (int32_t)i; link = &tk->node[*link].next) {
+        ASSERT(*link >= 0);
+    }
+    *link = tk->node[i].next;
+}
+
+/*
+ * Track an item with hash that is not tracked yet, and return its index:
+ * a free one, or else the one of the item counted least, which is evicted
+ * and whose count the new item starts from
+ */
+uint32_t
+topk_insert(struct topk *tk, uint32_t hash, bool *evicted)
+{
+    struct topk_node *node;
+    uint32_t i, idx;
+
+    if (tk->nitem < tk->size) {
+        i = tk->nitem++;
+        node = &tk->node[i];
+        node->count = 0;
+        node->heap = i;
+        tk->heap[i] = i;
+        topk_sift_up(tk, i);
+        *evicted = false;
+    } else {
+        i = tk->heap[0];
+        node = &tk->node[i];
+        topk_unlink(tk, i);
+        *evicted = true;
+    }
+
+    idx = hash % tk->nbucket;
+    node->hash = hash;
+    node->next = tk->bucket[idx];
+    tk->bucket[idx] = (int32_t)i;
+
+    return i;
+}
+
+/*
+ * Count item i once more
+ */
+void
+topk_count(struct topk *tk, uint32_t i)
+{
+    tk->node[i].count++;
+    topk_sift_down(tk, tk->node[i].heap);
+}
@@ -0,0 +1,32 @@
+#ifndef _NC_TOPK_H_
+#define _NC_TOPK_H_
+
+#include <nc_core.h>
+
+struct topk_node {
+    uint32_t hash;   /* item hash */
+    int32_t  next;   /* next item in bucket or -1 */
+    uint32_t heap;   /* index of the item in heap */
+    int64_t  count;  /* # counted, with the overcount */
+};
+
+/*
+ * Items of a stream with the highest counts, at most size of them. The
+ * caller keeps what it tracks of item i in its own i-th entry
+ */
+struct topk {
+    uint32_t         size;     /* max # items */
+    uint32_t         nitem;    /* # items tracked */
+    uint32_t         nbucket;  /* # buckets */
+    int32_t          *bucket;  /* first item of each bucket or -1 */
+    struct topk_node *node;    /* node[] of each item */
+    uint32_t         *heap;    /* items in a min-heap by count */
+};
+
+rstatus_t topk_init(struct topk *tk, uint32_t size);
+void topk_deinit(struct topk *tk);
+int32_t topk_first(struct topk *tk, uint32_t hash);
+uint32_t topk_insert(struct topk *tk, uint32_t hash, bool *evicted);
+void topk_count(struct topk *tk, uint32_t i);
+
+#endif
@@ -0,0 +1,534 @@
+#include <signal.h>
+
+#include <nc_core.h>
+#include <nc_conf.h>
+#include <nc_server.h>
+#include <nc_process.h>
+#include <nc_watch.h>
+
+#ifdef NC_HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#ifdef NC_HAVE_INOTIFY
+
+static struct array watch_files;    /* watch_file[] */
+static int watch_fd = -1;           /* inotify descriptor */
+static pthread_t watch_tid;         /* watch thread */
+static pthread_t watch_main;        /* thread waiting for reload signals */
+
+/* watch_files is rebuilt by the main thread on reload */
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct watch_server *
+watch_server_find(struct watch_file *wf, struct string *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < array_n(&wf->server); i++) {
+        struct watch_server *ws = array_get(&wf->server, i);
+
+        if (string_compare(&ws->name, name) == 0) {
+            return ws;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+watch_server_deinit(struct array *server)
+{
+    while (array_n(server) != 0) {
+        struct watch_server *ws = array_pop(server);
+
+        string_deinit(&ws->name);
+    }
+}
+
+static rstatus_t
+watch_server_add(struct watch_file *wf, struct conf_server *cs)
+{
+    rstatus_t status;
+    struct watch_server *ws;
+
+    ws = array_push(&wf->server);
+    if (ws == NULL) {
+        return NC_ENOMEM;
+    }
+
+    string_init(&ws->name);
+    status = string_duplicate(&ws->name, &cs->name);
+    if (status != NC_OK) {
+        array_pop(&wf->server);
+        return status;
+    }
+    ws->weight = (uint32_t)cs->weight;
+    ws->live = 1;
+
+    return NC_OK;
+}
+
+/*
+ * Reset the membership of the watched file to server (conf_server[]), all
+ * of which are live
+ */
+static rstatus_t
+watch_reset(struct watch_file *wf, struct array *server)
+{
+    rstatus_t status;
+    uint32_t i;
+
+    watch_server_deinit(&wf->server);
+
+    for (i = 0; i < array_n(server); i++) {
+        status = watch_server_add(wf, array_get(server, i));
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Membership changes that cannot be applied incrementally, like servers
+ * that do not fit in the spare room of their pool, need a reload of the
+ * configuration, which reads the servers file afresh
+ */
+static void
+watch_reload(struct watch_file *wf, struct array *server)
+{
+    if (array_n(&master_nci->workers) == 0) {
+        log_warn("servers file '%.*s' of pool '%.*s' changed membership, "
+                 "restart to apply", wf->path.len, wf->path.data,
+                 wf->pool.len, wf->pool.data);
+    } else {
+        log_warn("servers file '%.*s' of pool '%.*s' changed membership, "
+                 "reloading config", wf->path.len, wf->path.data,
+                 wf->pool.len, wf->pool.data);
+        pthread_kill(watch_main, SIGHUP);
+    }
+
+    if (watch_reset(wf, server) != NC_OK) {
+        log_error("failed to reset servers of file '%.*s'", wf->path.len,
+                  wf->path.data);
+    }
+}
+
+/*
+ * Send an admin command on the server named name, or for SERVER_ADMIN_JOIN
+ * on the server of the servers file line name, to the workers
+ */
+static bool
+watch_send(struct watch_file *wf, struct string *name,
+           server_admin_type_t type, uint32_t weight)
+{
+    struct chan_msg msg;
+    char *err;
+
+    if (wf->pool.len >= NC_CHAN_NAMELEN || name->len >= NC_CHAN_NAMELEN) {
+        return false;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.command = NC_CMD_ADMIN;
+    msg.admin = type;
+    msg.weight = weight;
+    nc_memcpy(msg.pool, wf->pool.data, wf->pool.len);
+    nc_memcpy(msg.server, name->data, name->len);
+
+    err = nc_admin_workers(&msg);
+    if (err != NULL) {
+        log_warn("servers file '%.*s' admin %d server '%.*s' failed: %s",
+                 wf->path.len, wf->path.data, type, name->len, name->data,
+                 err);
+        return false;
+    }
+
+    log_debug(LOG_NOTICE, "servers file '%.*s' admin %d server '%.*s' "
+              "weight %"PRIu32"", wf->path.len, wf->path.data, type,
+              name->len, name->data, weight);
+
+    return true;
+}
+
+/*
+ * Join a server that is not in the pool yet, sent as its servers file line
+ */
+static bool
+watch_join(struct watch_file *wf, struct conf_server *cs)
+{
+    char line[NC_CHAN_NAMELEN];
+    struct string str;
+    int n;
+
+    n = nc_snprintf(line, sizeof(line), "%.*s %.*s", cs->pname.len,
+                    cs->pname.data, cs->name.len, cs->name.data);
+    if (n <= 0 || n >= (int)sizeof(line)) {
+        return false;
+    }
+
+    str.len = (uint32_t)n;
+    str.data = (uint8_t *)line;
+
+    if (!watch_send(wf, &str, SERVER_ADMIN_JOIN, 0)) {
+        return false;
+    }
+
+    return watch_server_add(wf, cs) == NC_OK;
+}
+
+/*
+ * Diff the servers file against the membership last applied and push only
+ * the difference to the workers. Servers are joined, added and reweighted
+ * before any is removed, so that a pool never runs out of live servers
+ * midway.
+ */
+static void
+watch_apply(struct watch_file *wf)
+{
+    struct array server;
+    struct conf_server *cs;
+    struct watch_server *ws;
+    uint32_t i, j;
+
+    if (array_init(&server, CONF_DEFAULT_SERVERS,
+                   sizeof(struct conf_server)) != NC_OK) {
+        return;
+    }
+
+    if (conf_read_servers(&wf->path, &server) != NC_OK) {
+        goto done;
+    }
+
+    if (array_n(&server) == 0) {
+        log_warn("servers file '%.*s' has no servers, ignored", wf->path.len,
+                 wf->path.data);
+        goto done;
+    }
+
+    for (i = 0; i < array_n(&server); i++) {
+        cs = array_get(&server, i);
+
+        for (j = i + 1; j < array_n(&server); j++) {
+            if (string_compare(&cs->name, &((struct conf_server *)
+                               array_get(&server, j))->name) == 0) {
+                log_error("servers file '%.*s' has servers with same name "
+                          "'%.*s', ignored", wf->path.len, wf->path.data,
+                          cs->name.len, cs->name.data);
+                goto done;
+            }
+        }
+    }
+
+    for (i = 0; i < array_n(&server); i++) {
+        cs = array_get(&server, i);
+        ws = watch_server_find(wf, &cs->name);
+
+        if (ws == NULL) {
+            if (!watch_join(wf, cs)) {
+                watch_reload(wf, &server);
+                goto done;
+            }
+            continue;
+        }
+
+        if (!ws->live) {
+            if (!watch_send(wf, &ws->name, SERVER_ADMIN_ADD, 0)) {
+                watch_reload(wf, &server);
+                goto done;
+            }
+            ws->live = 1;
+        }
+
+        if (ws->weight != (uint32_t)cs->weight) {
+            if (!watch_send(wf, &ws->name, SERVER_ADMIN_WEIGHT,
+                            (uint32_t)cs->weight)) {
+                watch_reload(wf, &server);
+                goto done;
+            }
+            ws->weight = (uint32_t)cs->weight;
+        }
+    }
+
+    for (i = 0; i < array_n(&wf->server); i++) {
+        ws = array_get(&wf->server, i);
+
+        if (!ws->live) {
+            continue;
+        }
+
+        for (j = 0; j < array_n(&server); j++) {
+            cs = array_get(&server, j);
+            if (string_compare(&cs->name, &ws->name) == 0) {
+                break;
+            }
+        }
+        if (j < array_n(&server)) {
+            continue;
+        }
+
+        if (!watch_send(wf, &ws->name, SERVER_ADMIN_REMOVE, 0)) {
+            watch_reload(wf, &server);
+            goto done;
+        }
+        ws->live = 0;
+    }
+
+done:
+    conf_free_servers(&server);
+    array_deinit(&server);
+}
+
+static void *
+watch_loop(void *arg)
+{
+    char buf[WATCH_EVENT_BUFSIZE]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    struct watch_file *wf;
+    sigset_t set;
+    ssize_t n;
+    char *p;
+    uint32_t i;
+
+    /* signals are for the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;) {
+        n = read(watch_fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("read on watch %d failed: %s", watch_fd, strerror(errno));
+            break;
+        }
+
+        pthread_mutex_lock(&watch_lock);
+
+        for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (struct inotify_event *)p;
+
+            if (ev->len == 0) {
+                continue;
+            }
+
+            for (i = 0; i < array_n(&watch_files); i++) {
+                wf = array_get(&watch_files, i);
+
+                if (wf->wd == ev->wd && strcmp(wf->base, ev->name) == 0) {
+                    log_debug(LOG_INFO, "servers file '%.*s' changed",
+                              wf->path.len, wf->path.data);
+                    watch_apply(wf);
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&watch_lock);
+    }
+
+    return NULL;
+}
+
+static rstatus_t
+watch_add(struct watch_file *wf)
+{
+    char dir[PATH_MAX];
+    size_t len;
+
+    wf->base = strrchr((char *)wf->path.data, '/');
+    if (wf->base == NULL) {
+        wf->base = (char *)wf->path.data;
+        strcpy(dir, ".");
+    } else {
+        len = (size_t)(wf->base - (char *)wf->path.data);
+        wf->base++;
+        if (len == 0) {
+            strcpy(dir, "/");
+        } else if (len < sizeof(dir)) {
+            nc_memcpy(dir, wf->path.data, len);
+            dir[len] = '\0';
+        } else {
+            return NC_ERROR;
+        }
+    }
+
+    /* watch the directory to follow files that are replaced by rename */
+    wf->wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wf->wd < 0) {
+        log_error("watch '%s' of servers file '%.*s' failed: %s", dir,
+                  wf->path.len, wf->path.data, strerror(errno));
+        return NC_ERROR;
+    }
+
+    log_debug(LOG_NOTICE, "watching servers file '%.*s' of pool '%.*s'",
+              wf->path.len, wf->path.data, wf->pool.len, wf->pool.data);
+
+    return NC_OK;
+}
+
+static void
+watch_files_deinit(void)
+{
+    while (array_n(&watch_files) != 0) {
+        struct watch_file *wf = array_pop(&watch_files);
+
+        /* files in the same directory share its watch */
+        if (wf->wd >= 0) {
+            inotify_rm_watch(watch_fd, wf->wd);
+        }
+
+        watch_server_deinit(&wf->server);
+        array_deinit(&wf->server);
+        string_deinit(&wf->pool);
+        string_deinit(&wf->path);
+    }
+}
+
+static rstatus_t
+watch_files_init(struct array *pool)
+{
+    rstatus_t status;
+    struct watch_file *wf;
+    uint32_t i;
+
+    for (i = 0; i < array_n(pool); i++) {
+        struct conf_pool *cp = array_get(pool, i);
+
+        if (string_empty(&cp->servers_file)) {
+            continue;
+        }
+
+        wf = array_push(&watch_files);
+        if (wf == NULL) {
+            return NC_ENOMEM;
+        }
+        string_init(&wf->pool);
+        string_init(&wf->path);
+        wf->base = NULL;
+        wf->wd = -1;
+
+        status = array_init(&wf->server, array_n(&cp->server),
+                            sizeof(struct watch_server));
+        if (status != NC_OK) {
+            array_pop(&watch_files);
+            return status;
+        }
+
+        status = string_duplicate(&wf->pool, &cp->name);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = string_duplicate(&wf->path, &cp->servers_file);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = watch_reset(wf, &cp->server);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = watch_add(wf);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    return NC_OK;
+}
+
+/*
+ * Watch the servers files of pool (conf_pool[]). When called again on a
+ * reload, the watches and memberships are rebuilt from the new config, and
+ * the files are applied to the new workers, in case they changed after the
+ * config was read
+ */
+static rstatus_t
+watch_init(struct array *pool, uint32_t n)
+{
+    rstatus_t status;
+    uint32_t i;
+    bool restart;
+
+    pthread_mutex_lock(&watch_lock);
+
+    restart = watch_fd >= 0;
+
+    if (restart) {
+        watch_files_deinit();
+    } else if (n == 0) {
+        pthread_mutex_unlock(&watch_lock);
+        return NC_OK;
+    } else {
+        status = array_init(&watch_files, n, sizeof(struct watch_file));
+        if (status != NC_OK) {
+            pthread_mutex_unlock(&watch_lock);
+            return status;
+        }
+
+        watch_fd = inotify_init1(IN_CLOEXEC);
+        if (watch_fd < 0) {
+            log_error("inotify init failed: %s", strerror(errno));
+            pthread_mutex_unlock(&watch_lock);
+            return NC_ERROR;
+        }
+    }
+
+    status = watch_files_init(pool);
+
+    for (i = 0; status == NC_OK && restart && i < array_n(&watch_files); i++) {
+        watch_apply(array_get(&watch_files, i));
+    }
+
+    pthread_mutex_unlock(&watch_lock);
+
+    if (status != NC_OK || restart) {
+        return status;
+    }
+
+    watch_main = pthread_self();
+
+    status = pthread_create(&watch_tid, NULL, watch_loop, NULL);
+    if (status != 0) {
+        log_error("servers file watcher create failed: %s", strerror(status));
+        return NC_ERROR;
+    }
+
+    return NC_OK;
+}
+
+#endif
+
+/*
+ * Start watching the servers_file: of each pool, or on reload, watch those
+ * of the new config instead. Must be called from the thread that waits for
+ * reload signals.
+ */
+rstatus_t
+watch_start(struct context *ctx)
+{
+    struct array *pool = &ctx->cf->pool;
+    uint32_t i, n;
+
+    for (n = 0, i = 0; i < array_n(pool); i++) {
+        struct conf_pool *cp = array_get(pool, i);
+
+        n += string_empty(&cp->servers_file) ? 0 : 1;
+    }
+
+#ifdef NC_HAVE_INOTIFY
+    return watch_init(pool, n);
+#else
+    if (n != 0) {
+        log_warn("servers files are read only at startup, watching is not "
+                 "supported on this platform");
+    }
+
+    return NC_OK;
+#endif
+}
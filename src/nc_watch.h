@@ -0,0 +1,24 @@
+#ifndef _NC_WATCH_H_
+#define _NC_WATCH_H_
+
+#include <nc_core.h>
+
+#define WATCH_EVENT_BUFSIZE 4096
+
+struct watch_server {
+    struct string name;       /* server name */
+    uint32_t      weight;     /* weight */
+    unsigned      live:1;     /* listed in the servers file? */
+};
+
+struct watch_file {
+    struct string pool;       /* pool name */
+    struct string path;       /* servers_file: */
+    char          *base;      /* file name part of path */
+    int           wd;         /* watch descriptor of the parent directory */
+    struct array  server;     /* watch_server[] */
+};
+
+rstatus_t watch_start(struct context *ctx);
+
+#endif
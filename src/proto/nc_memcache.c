@@ -88,6 +88,16 @@ memcache_retrieval(struct msg *r)
     return false;
 }
 
+/*
+ * Return true, if the memcache command does not modify data, otherwise
+ * return false
+ */
+bool
+memcache_readonly(struct msg *r)
+{
+    return memcache_retrieval(r);
+}
+
 /*
  * Return true, if the memcache command is a arithmetic command, otherwise
  * return false
@@ -356,7 +366,7 @@ memcache_parse_req(struct msg *r)
                     goto error;
                 }
 
-                kpos = array_push(r->keys);
+                kpos = msg_key_push(r);
                 if (kpos == NULL) {
                     goto enomem;
                 }
@@ -1217,7 +1227,7 @@ memcache_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
         return NC_ENOMEM;
     }
 
-    kpos = array_push(r->keys);
+    kpos = msg_key_push(r);
     if (kpos == NULL) {
         return NC_ENOMEM;
     }
@@ -1250,9 +1260,8 @@ memcache_fragment_retrieval(struct msg *r, uint32_t ncontinuum,
         return NC_ENOMEM;
     }
 
-    ASSERT(r->frag_seq == NULL);
-    r->frag_seq = nc_alloc(array_n(r->keys) * sizeof(*r->frag_seq));
-    if (r->frag_seq == NULL) {
+    status = msg_frag_seq_alloc(r);
+    if (status != NC_OK) {
         nc_free(sub_msgs);
         return NC_ENOMEM;
     }
@@ -1535,6 +1544,91 @@ memcache_post_coalesce(struct msg *request)
     }
 }
 
+/*
+ * Return true, if the response to a single key 'get' or 'gets' is a miss
+ */
+bool
+memcache_miss(struct msg *r)
+{
+    struct mbuf *mbuf;
+
+    /* a hit is also typed MSG_RSP_MC_END, after its end marker */
+    if (r->type != MSG_RSP_MC_END) {
+        return false;
+    }
+
+    mbuf = STAILQ_FIRST(&r->mhdr);
+
+    return mbuf != NULL && mbuf->pos == r->end;
+}
+
+/*
+ * Build into request r an 'add' of the value in rsp, a hit for the single
+ * key 'get' or 'gets' req, with expiry ttl. An 'add' leaves alone a value
+ * that was stored on the server in the meantime.
+ */
+rstatus_t
+memcache_backfill(struct msg *r, struct msg *req, struct msg *rsp, uint32_t ttl)
+{
+    rstatus_t status;
+    struct mbuf *mbuf;
+    uint8_t *p, *key, *flags;
+    uint32_t keylen, flagslen, vlen, hlen;
+
+    mbuf = STAILQ_FIRST(&rsp->mhdr);
+    if (mbuf == NULL) {
+        return NC_ERROR;
+    }
+
+    /*
+     * This code is based on the assumption that 'VALUE key flags len'
+     * is located in a contiguous location, like in memcache_copy_bulk()
+     */
+    p = mbuf->pos + sizeof("VALUE ") - 1;
+
+    key = p;
+    for (; p < mbuf->last && *p != ' '; p++) {
+        ;
+    }
+    keylen = (uint32_t)(p - key);
+    p++;
+
+    flags = p;
+    for (; p < mbuf->last && *p != ' '; p++) {
+        ;
+    }
+    flagslen = (uint32_t)(p - flags);
+    p++;
+
+    vlen = 0;
+    for (; p < mbuf->last && isdigit(*p); p++) {
+        vlen = vlen * 10 + (uint32_t)(*p - '0');
+    }
+
+    for (; p < mbuf->last && *p != LF; p++) { /* eat cas for gets */
+        ;
+    }
+    if (p == mbuf->last || keylen == 0 || flagslen == 0) {
+        return NC_ERROR;
+    }
+    hlen = (uint32_t)(p + 1 - mbuf->pos);
+
+    status = msg_append_msg(r, rsp, hlen, vlen + CRLF_LEN);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = msg_prepend_format(r, "add %.*s %.*s %"PRIu32" %"PRIu32 CRLF,
+                                keylen, key, flagslen, flags, ttl, vlen);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    r->type = MSG_REQ_MC_ADD;
+
+    return NC_OK;
+}
+
 void
 memcache_post_connect(struct context *ctx, struct conn *conn, struct server *server)
 {
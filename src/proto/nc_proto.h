@@ -148,6 +148,9 @@ rstatus_t memcache_fragment(struct msg *r, uint32_t ncontinuum, struct msg_tqh *
 rstatus_t memcache_reply(struct msg *r);
 void memcache_post_connect(struct context *ctx, struct conn *conn, struct server *server);
 void memcache_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg);
+bool memcache_readonly(struct msg *r);
+bool memcache_miss(struct msg *r);
+rstatus_t memcache_backfill(struct msg *r, struct msg *req, struct msg *rsp, uint32_t ttl);
 
 void redis_parse_req(struct msg *r);
 void redis_parse_rsp(struct msg *r);
@@ -161,5 +164,10 @@ bool redis_readonly(struct msg *r);
 bool redis_master_slave_only(struct msg *r);
 void redis_post_connect(struct context *ctx, struct conn *conn, struct server *server);
 void redis_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg);
+bool redis_miss(struct msg *r);
+rstatus_t redis_backfill(struct msg *r, struct msg *req, struct msg *rsp, uint32_t ttl);
+rstatus_t redis_scan(struct msg *r, uint64_t cursor, uint32_t count);
+uint8_t *redis_scan_keys(struct msg *rsp, uint64_t *cursor, struct array *keys);
+rstatus_t redis_migrate(struct msg *r, struct server *target, uint8_t *key, uint32_t keylen, int timeout);
 
 #endif
@@ -21,6 +21,8 @@
 
 #include <nc_core.h>
 #include <nc_proto.h>
+#include <nc_migrate.h>
+#include <nc_slowlog.h>
 
 #define RSP_STRING(ACTION)                                                          \
     ACTION( ok,               "+OK\r\n"                                           ) \
@@ -29,12 +31,23 @@
     ACTION( invalid_password, "-ERR invalid password\r\n"                         ) \
     ACTION( auth_required,    "-NOAUTH Authentication required\r\n"               ) \
     ACTION( no_password,      "-ERR Client sent AUTH, but no password is set\r\n" ) \
+    ACTION( slowlog_syntax,   "-ERR Unknown SLOWLOG subcommand\r\n"               ) \
+    ACTION( queued,           "+QUEUED\r\n"                                       ) \
+    ACTION( empty_exec,       "*0\r\n"                                            ) \
+    ACTION( multi_nested,     "-ERR MULTI calls can not be nested\r\n"            ) \
+    ACTION( exec_no_multi,    "-ERR EXEC without MULTI\r\n"                       ) \
+    ACTION( discard_no_multi, "-ERR DISCARD without MULTI\r\n"                    ) \
+    ACTION( exec_abort,       "-EXECABORT Transaction discarded because of previous errors.\r\n" ) \
+    ACTION( tx_keyless,       "-ERR Command without a key not allowed in a transaction\r\n" ) \
+    ACTION( tx_cross_server,  "-CROSSSLOT Keys in transaction don't hash to the same server\r\n" ) \
 
 #define DEFINE_ACTION(_var, _str) static struct string rsp_##_var = string(_str);
     RSP_STRING( DEFINE_ACTION )
 #undef DEFINE_ACTION
 
 static rstatus_t redis_handle_auth_req(struct msg *request, struct msg *response);
+static rstatus_t redis_handle_slowlog_req(struct msg *request, struct msg *response);
+static rstatus_t redis_handle_tx_req(struct msg *request, struct msg *response);
 
 
 bool
@@ -128,6 +141,9 @@ redis_argz(struct msg *r)
     switch (r->type) {
     case MSG_REQ_REDIS_PING:
     case MSG_REQ_REDIS_QUIT:
+    case MSG_REQ_REDIS_MULTI:
+    case MSG_REQ_REDIS_EXEC:
+    case MSG_REQ_REDIS_DISCARD:
         return true;
 
     default:
@@ -355,6 +371,7 @@ redis_argx(struct msg *r)
     switch (r->type) {
     case MSG_REQ_REDIS_MGET:
     case MSG_REQ_REDIS_DEL:
+    case MSG_REQ_REDIS_SLOWLOG:
         return true;
 
     default:
@@ -771,6 +788,12 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str4icmp(m, 'e', 'x', 'e', 'c')) {
+                    r->type = MSG_REQ_REDIS_EXEC;
+                    r->noforward = 1;
+                    break;
+                }
+
                 break;
 
             case 5:
@@ -779,6 +802,12 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str5icmp(m, 'm', 'u', 'l', 't', 'i')) {
+                    r->type = MSG_REQ_REDIS_MULTI;
+                    r->noforward = 1;
+                    break;
+                }
+
                 if (str5icmp(m, 'h', 'k', 'e', 'y', 's')) {
                     r->type = MSG_REQ_REDIS_HKEYS;
                     break;
@@ -1045,6 +1074,18 @@ redis_parse_req(struct msg *r)
                     break;
                 }
 
+                if (str7icmp(m, 's', 'l', 'o', 'w', 'l', 'o', 'g')) {
+                    r->type = MSG_REQ_REDIS_SLOWLOG;
+                    r->noforward = 1;
+                    break;
+                }
+
+                if (str7icmp(m, 'd', 'i', 's', 'c', 'a', 'r', 'd')) {
+                    r->type = MSG_REQ_REDIS_DISCARD;
+                    r->noforward = 1;
+                    break;
+                }
+
                 break;
 
             case 8:
@@ -1300,7 +1341,7 @@ redis_parse_req(struct msg *r)
                 m = r->token;
                 r->token = NULL;
 
-                kpos = array_push(r->keys);
+                kpos = msg_key_push(r);
                 if (kpos == NULL) {
                     goto enomem;
                 }
@@ -1799,6 +1840,33 @@ error:
                 r->state);
 }
 
+/*
+ * Return the length in the header line of a bulk or a multi bulk element,
+ * whose digits are in [p, end), -1 for a null one, or -2 if it is malformed
+ */
+static int64_t
+redis_frame_len(uint8_t *p, uint8_t *end)
+{
+    int64_t len;
+
+    if (end - p == 2 && p[0] == '-' && p[1] == '1') {
+        return -1;
+    }
+
+    if (p == end || end - p > 10) {
+        return -2;
+    }
+
+    for (len = 0; p < end; p++) {
+        if (!isdigit(*p)) {
+            return -2;
+        }
+        len = len * 10 + (*p - '0');
+    }
+
+    return len;
+}
+
 /*
  * Reference: http://redis.io/topics/protocol
  *
@@ -1833,6 +1901,7 @@ redis_parse_rsp(struct msg *r)
     struct mbuf *b;
     uint8_t *p, *m;
     uint8_t ch;
+    int64_t len;
 
     enum {
         SW_START,
@@ -1840,17 +1909,15 @@ redis_parse_rsp(struct msg *r)
         SW_ERROR,
         SW_INTEGER,
         SW_INTEGER_START,
-        SW_SIMPLE,
         SW_BULK,
         SW_BULK_LF,
         SW_BULK_ARG,
         SW_BULK_ARG_LF,
         SW_MULTIBULK,
         SW_MULTIBULK_NARG_LF,
-        SW_MULTIBULK_ARGN_LEN,
-        SW_MULTIBULK_ARGN_LEN_LF,
-        SW_MULTIBULK_ARGN,
-        SW_MULTIBULK_ARGN_LF,
+        SW_FRAME,
+        SW_FRAME_BULK,
+        SW_FRAME_BULK_LF,
         SW_RUNTO_CRLF,
         SW_ALMOST_DONE,
         SW_SENTINEL
@@ -2044,13 +2111,6 @@ redis_parse_rsp(struct msg *r)
             r->integer = 0;
             break;
 
-        case SW_SIMPLE:
-            if (ch == CR) {
-              state = SW_MULTIBULK_ARGN_LF;
-              r->rnarg--;
-            }
-            break;
-
         case SW_INTEGER_START:
             if (ch == CR) {
                 state = SW_ALMOST_DONE;
@@ -2191,7 +2251,7 @@ redis_parse_rsp(struct msg *r)
                     goto done;
                 }
 
-                state = SW_MULTIBULK_ARGN_LEN;
+                state = SW_FRAME;
                 break;
 
             default:
@@ -2200,87 +2260,85 @@ redis_parse_rsp(struct msg *r)
 
             break;
 
-        case SW_MULTIBULK_ARGN_LEN:
-            if (r->token == NULL) {
-                /*
-                 * From: http://redis.io/topics/protocol, a multi bulk reply
-                 * is used to return an array of other replies. Every element
-                 * of a multi bulk reply can be of any kind, including a
-                 * nested multi bulk reply.
-                 *
-                 * Here, we only handle a multi bulk reply element that
-                 * are either integer reply or bulk reply.
-                 *
-                 * there is a special case for sscan/hscan/zscan, these command
-                 * replay a nested multi-bulk with a number and a multi bulk like this:
-                 *
-                 * - mulit-bulk
-                 *    - cursor
-                 *    - mulit-bulk
-                 *       - val1
-                 *       - val2
-                 *       - val3
-                 *
-                 * in this case, there is only one sub-multi-bulk,
-                 * and it's the last element of parent,
-                 * we can handle it like tail-recursive.
-                 *
-                 */
-                if (ch == '*') {    /* for sscan/hscan/zscan only */
-                    p = p - 1;      /* go back by 1 byte */
-                    state = SW_MULTIBULK;
-                    break;
-                }
+        case SW_FRAME:
+            /*
+             * The elements of a multi bulk reply are only framed, as they are
+             * forwarded untouched: a bulk is skipped by its length, and the
+             * elements of a nested multi bulk are added to rnarg, the
+             * # elements yet to be framed, wherever it is nested. Only the
+             * header line of an element is looked at, in a loop over the
+             * elements in b.
+             */
+            if (r->token != NULL) {
+                /* header line of an element was incomplete */
+                p = r->token;
+                r->token = NULL;
+            }
 
-                if (ch == ':' || ch == '+' || ch == '-') {
-                    /* handles not-found reply = '$-1' or integer reply = ':<num>' */
-                    /* and *2\r\n$2\r\nr0\r\n+OK\r\n or *1\r\n+OK\r\n */
-                    state = SW_SIMPLE;
+            while (p < b->last) {
+                m = nc_memchr(p, LF, b->last - p);
+                if (m == NULL) {
+                    r->token = p;
                     break;
                 }
 
-                if (ch != '$') {
+                if (m - p < 2 || *(m - 1) != CR) {
                     goto error;
                 }
 
-                r->token = p;
-                r->rlen = 0;
-            } else if (isdigit(ch)) {
-                r->rlen = r->rlen * 10 + (uint32_t)(ch - '0');
-            } else if (ch == '-') {
-                ;
-            } else if (ch == CR) {
-                if ((p - r->token) <= 1 || r->rnarg == 0) {
+                ch = *p;
+                switch (ch) {
+                case '$':
+                case '*':
+                    len = redis_frame_len(p + 1, m - 1);
+                    if (len < -1) {
+                        goto error;
+                    }
+                    break;
+
+                case ':':
+                case '+':
+                case '-':
+                    len = 0;
+                    break;
+
+                default:
                     goto error;
                 }
 
-                if ((r->rlen == 1 && (p - r->token) == 3)) {
-                    r->rlen = 0;
-                    state = SW_MULTIBULK_ARGN_LF;
-                } else {
-                    state = SW_MULTIBULK_ARGN_LEN_LF;
-                }
                 r->rnarg--;
-                r->token = NULL;
-            } else {
-                goto error;
-            }
+                if (ch == '*' && len > 0) {
+                    r->rnarg += (uint32_t)len;
+                }
+                p = m + 1;
 
-            break;
+                if (ch == '$' && len >= 0) {
+                    if (b->last - p < len + (int64_t)CRLF_LEN) {
+                        r->rlen = (uint32_t)len;
+                        state = SW_FRAME_BULK;
+                        break;
+                    }
 
-        case SW_MULTIBULK_ARGN_LEN_LF:
-            switch (ch) {
-            case LF:
-                state = SW_MULTIBULK_ARGN;
-                break;
+                    if (p[len] != CR || p[len + 1] != LF) {
+                        goto error;
+                    }
+                    p += len + CRLF_LEN;
+                }
 
-            default:
-                goto error;
+                if (r->rnarg == 0) {
+                    p = p - 1;
+                    goto done;
+                }
+            }
+
+            if (r->token != NULL) {
+                p = b->last;
             }
+            p = p - 1; /* go back by 1 byte */
 
             break;
 
-        case SW_MULTIBULK_ARGN:
+        case SW_FRAME_BULK:
             m = p + r->rlen;
             if (m >= b->last) {
                 r->rlen -= (uint32_t)(b->last - p);
@@ -2293,21 +2351,21 @@ redis_parse_rsp(struct msg *r)
                 goto error;
             }
 
-            p += r->rlen; /* move forward by rlen bytes */
+            p = m; /* move forward by rlen bytes */
             r->rlen = 0;
 
-            state = SW_MULTIBULK_ARGN_LF;
+            state = SW_FRAME_BULK_LF;
 
             break;
 
-        case SW_MULTIBULK_ARGN_LF:
+        case SW_FRAME_BULK_LF:
             switch (ch) {
             case LF:
                 if (r->rnarg == 0) {
                     goto done;
                 }
 
-                state = SW_MULTIBULK_ARGN_LEN;
+                state = SW_FRAME;
                 break;
 
             default:
@@ -2335,6 +2393,9 @@ redis_parse_rsp(struct msg *r)
         r->result = MSG_PARSE_AGAIN;
     }
 
+    /* only the value of a bulk reply and its crlf are left to receive */
+    r->vleft = state == SW_BULK_ARG ? r->rlen + (uint32_t)CRLF_LEN : 0;
+
     log_hexdump(LOG_VERB, b->pos, mbuf_length(b), "parsed rsp %"PRIu64" res %d "
                 "type %d state %d rpos %d of %d", r->id, r->result, r->type,
                 r->state, r->pos - b->pos, b->last - b->pos);
@@ -2579,7 +2640,7 @@ redis_append_key(struct msg *r, uint8_t *key, uint32_t keylen)
         return NC_ENOMEM;
     }
 
-    kpos = array_push(r->keys);
+    kpos = msg_key_push(r);
     if (kpos == NULL) {
         return NC_ENOMEM;
     }
@@ -2668,9 +2729,8 @@ redis_fragment_argx(struct msg *r, uint32_t ncontinuum, struct msg_tqh *frag_msg
         return NC_ENOMEM;
     }
 
-    ASSERT(r->frag_seq == NULL);
-    r->frag_seq = nc_alloc(array_n(r->keys) * sizeof(*r->frag_seq));
-    if (r->frag_seq == NULL) {
+    status = msg_frag_seq_alloc(r);
+    if (status != NC_OK) {
         nc_free(sub_msgs);
         return NC_ENOMEM;
     }
@@ -2811,9 +2871,23 @@ redis_reply(struct msg *r)
         return msg_append(response, rsp_unknown_command.data, rsp_unknown_command.len);
     }
 
+    if (c_conn->multi) {
+        return redis_handle_tx_req(r, response);
+    }
+
     switch (r->type) {
     case MSG_REQ_REDIS_PING:
         return msg_append(response, rsp_pong.data, rsp_pong.len);
+    case MSG_REQ_REDIS_SLOWLOG:
+        return redis_handle_slowlog_req(r, response);
+    case MSG_REQ_REDIS_MULTI:
+        c_conn->multi = 1;
+        return msg_append(response, rsp_ok.data, rsp_ok.len);
+    case MSG_REQ_REDIS_EXEC:
+        return msg_append(response, rsp_exec_no_multi.data, rsp_exec_no_multi.len);
+    case MSG_REQ_REDIS_DISCARD:
+        return msg_append(response, rsp_discard_no_multi.data,
+                          rsp_discard_no_multi.len);
     default:
         NOT_REACHED();
         return NC_ERROR;
@@ -2954,6 +3028,183 @@ redis_handle_auth_req(struct msg *req, struct msg *rsp)
     return msg_append(rsp, rsp_invalid_password.data, rsp_invalid_password.len);
 }
 
+/*
+ * Answer req, received after MULTI: queue it as a command of the transaction,
+ * or end the transaction on DISCARD, or on an EXEC that has nothing to send
+ */
+static rstatus_t
+redis_handle_tx_req(struct msg *req, struct msg *rsp)
+{
+    struct conn *conn = (struct conn *)rsp->owner;
+    rstatus_t status;
+
+    ASSERT(conn->client && conn->multi);
+
+    switch (req->type) {
+    case MSG_REQ_REDIS_MULTI:
+        return msg_append(rsp, rsp_multi_nested.data, rsp_multi_nested.len);
+
+    case MSG_REQ_REDIS_DISCARD:
+        req_tx_discard(conn);
+        return msg_append(rsp, rsp_ok.data, rsp_ok.len);
+
+    case MSG_REQ_REDIS_EXEC:
+        ASSERT(conn->tx_abort || TAILQ_EMPTY(&conn->tx_q));
+        status = conn->tx_abort ?
+                 msg_append(rsp, rsp_exec_abort.data, rsp_exec_abort.len) :
+                 msg_append(rsp, rsp_empty_exec.data, rsp_empty_exec.len);
+        req_tx_discard(conn);
+        return status;
+
+    default:
+        break;
+    }
+
+    if (array_n(req->keys) == 0 || req->type == MSG_REQ_REDIS_SLOWLOG) {
+        conn->tx_abort = 1;
+        return msg_append(rsp, rsp_tx_keyless.data, rsp_tx_keyless.len);
+    }
+
+    status = req_tx_queue(conn, req);
+    if (status == NC_ERROR) {
+        return msg_append(rsp, rsp_tx_cross_server.data,
+                          rsp_tx_cross_server.len);
+    }
+    if (status != NC_OK) {
+        return status;
+    }
+
+    return msg_append(rsp, rsp_queued.data, rsp_queued.len);
+}
+
+/*
+ * Append entry e of the slowlog to rsp the way redis does: id, timestamp,
+ * duration, arguments, client and client name, followed by the server and
+ * the time spent on it
+ */
+static rstatus_t
+redis_append_slowlog_entry(struct msg *rsp, struct slowlog_entry *e)
+{
+    rstatus_t status;
+    char cmd[64], more[64], line[512];
+    uint32_t cmdlen, keylen, nargs;
+    struct string *server;
+    int n;
+
+    cmdlen = msg_type_cmd(e->type, cmd, sizeof(cmd));
+    keylen = MIN(e->keylen, SLOWLOG_KEY_MAXLEN);
+    nargs = 1 + (e->nkey > 0 ? 1 : 0) + (e->nkey > 1 ? 1 : 0);
+    server = e->server != NULL ? &e->server->name : NULL;
+
+    n = nc_scnprintf(line, sizeof(line), "*8\r\n:%"PRIu64"\r\n:%"PRId64"\r\n"
+                     ":%"PRId64"\r\n*%"PRIu32"\r\n$%"PRIu32"\r\n%s\r\n",
+                     e->id, e->ts / 1000000LL, e->duration_us, nargs, cmdlen,
+                     cmd);
+    status = msg_append(rsp, (uint8_t *)line, (size_t)n);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    if (e->nkey > 0) {
+        n = nc_scnprintf(line, sizeof(line), "$%"PRIu32"\r\n", keylen);
+        status = msg_append(rsp, (uint8_t *)line, (size_t)n);
+        if (status == NC_OK) {
+            status = msg_append(rsp, e->key, keylen);
+        }
+        if (status == NC_OK) {
+            status = msg_append(rsp, (uint8_t *)CRLF, CRLF_LEN);
+        }
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    n = 0;
+    if (e->nkey > 1) {
+        n = nc_scnprintf(more, sizeof(more), "... (%"PRIu32" more keys)",
+                         e->nkey - 1);
+        n = nc_scnprintf(line, sizeof(line), "$%d\r\n%s\r\n", n, more);
+    }
+
+    n += nc_scnprintf(line + n, sizeof(line) - n, "$%d\r\n%s\r\n$0\r\n\r\n",
+                      (int)strlen(e->client), e->client);
+    if (server != NULL) {
+        n += nc_scnprintf(line + n, sizeof(line) - n, "$%"PRIu32"\r\n%.*s\r\n",
+                          server->len, server->len, server->data);
+    } else {
+        n += nc_scnprintf(line + n, sizeof(line) - n, "$-1\r\n");
+    }
+    n += nc_scnprintf(line + n, sizeof(line) - n, ":%"PRId64"\r\n",
+                      e->backend_us);
+
+    return msg_append(rsp, (uint8_t *)line, (size_t)n);
+}
+
+/*
+ * Answer 'SLOWLOG GET [count] | LEN | RESET' from the slowlog that this
+ * worker keeps for the pool of the client
+ */
+static rstatus_t
+redis_handle_slowlog_req(struct msg *req, struct msg *rsp)
+{
+    struct conn *conn = (struct conn *)rsp->owner;
+    struct server_pool *pool;
+    struct keypos *kpos;
+    uint8_t *arg;
+    uint32_t arglen, i, len;
+    int count;
+    rstatus_t status;
+
+    ASSERT(conn->client && !conn->proxy);
+
+    pool = (struct server_pool *)conn->owner;
+
+    kpos = array_get(req->keys, 0);
+    arg = kpos->start;
+    arglen = (uint32_t)(kpos->end - kpos->start);
+    len = slowlog_len(pool);
+
+    if (arglen == 3 && str3icmp(arg, 'l', 'e', 'n') && array_n(req->keys) == 1) {
+        return msg_prepend_format(rsp, ":%"PRIu32"\r\n", len);
+    }
+
+    if (arglen == 5 && str5icmp(arg, 'r', 'e', 's', 'e', 't') &&
+        array_n(req->keys) == 1) {
+        slowlog_reset(pool);
+        return msg_append(rsp, rsp_ok.data, rsp_ok.len);
+    }
+
+    if (arglen != 3 || !str3icmp(arg, 'g', 'e', 't') || array_n(req->keys) > 2) {
+        return msg_append(rsp, rsp_slowlog_syntax.data, rsp_slowlog_syntax.len);
+    }
+
+    count = 10;
+    if (array_n(req->keys) == 2) {
+        kpos = array_get(req->keys, 1);
+        arglen = (uint32_t)(kpos->end - kpos->start);
+        if (arglen == 2 && kpos->start[0] == '-' && kpos->start[1] == '1') {
+            count = -1;
+        } else {
+            count = nc_atoi(kpos->start, arglen);
+            if (count < 0) {
+                return msg_append(rsp, rsp_slowlog_syntax.data,
+                                  rsp_slowlog_syntax.len);
+            }
+        }
+    }
+
+    if (count >= 0 && (uint32_t)count < len) {
+        len = (uint32_t)count;
+    }
+
+    status = msg_prepend_format(rsp, "*%"PRIu32"\r\n", len);
+    for (i = 0; i < len && status == NC_OK; i++) {
+        status = redis_append_slowlog_entry(rsp, slowlog_get(pool, i));
+    }
+
+    return status;
+}
+
 rstatus_t
 redis_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
 {
@@ -2964,7 +3215,8 @@ redis_add_auth(struct context *ctx, struct conn *c_conn, struct conn *s_conn)
     ASSERT(!s_conn->client && !s_conn->proxy);
     ASSERT(!conn_authenticated(s_conn));
 
-    pool = c_conn->owner;
+    /* the server may belong to a pool that c_conn reaches through routes */
+    pool = ((struct server *)s_conn->owner)->owner;
 
     msg = msg_get(c_conn, true, c_conn->redis);
     if (msg == NULL) {
@@ -3036,9 +3288,292 @@ redis_post_connect(struct context *ctx, struct conn *conn, struct server *server
               pool->name.data, server->name.data);
 }
 
+/*
+ * Return true, if the response to a 'get' is a miss
+ */
+bool
+redis_miss(struct msg *r)
+{
+    struct mbuf *mbuf;
+
+    if (r->type != MSG_RSP_REDIS_BULK) {
+        return false;
+    }
+
+    mbuf = STAILQ_FIRST(&r->mhdr);
+
+    return mbuf_length(mbuf) >= 3 && mbuf->pos[1] == '-' && mbuf->pos[2] == '1';
+}
+
+/*
+ * Build into request r a 'SET key value [EX ttl] NX' of the value in rsp,
+ * a hit for the 'get' req, with expiry ttl or no expiry if ttl is 0. NX
+ * leaves alone a value that was stored on the server in the meantime.
+ */
+rstatus_t
+redis_backfill(struct msg *r, struct msg *req, struct msg *rsp, uint32_t ttl)
+{
+    rstatus_t status;
+    struct keypos *kpos;
+    uint8_t tail[64];
+    int n;
+
+    ASSERT(rsp->type == MSG_RSP_REDIS_BULK);
+
+    kpos = array_get(req->keys, 0);
+
+    /* value bulk is copied as is */
+    status = msg_append_msg(r, rsp, 0, rsp->mlen);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    if (ttl > 0) {
+        uint8_t ex[NC_UINT32_MAXLEN];
+        int exlen;
+
+        exlen = nc_snprintf(ex, sizeof(ex), "%"PRIu32, ttl);
+        n = nc_snprintf(tail, sizeof(tail), "$2\r\nEX\r\n$%d\r\n%.*s\r\n"
+                        "$2\r\nNX\r\n", exlen, exlen, ex);
+    } else {
+        n = nc_snprintf(tail, sizeof(tail), "$2\r\nNX\r\n");
+    }
+
+    status = msg_append(r, tail, (size_t)n);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    status = msg_prepend_format(r, "*%d\r\n$3\r\nSET\r\n$%d\r\n%.*s\r\n",
+                                ttl > 0 ? 6 : 4,
+                                (int)(kpos->end - kpos->start),
+                                (int)(kpos->end - kpos->start), kpos->start);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    r->type = MSG_REQ_REDIS_SET;
+
+    return NC_OK;
+}
+
+/*
+ * Build into request r a 'SCAN cursor COUNT count'
+ */
+rstatus_t
+redis_scan(struct msg *r, uint64_t cursor, uint32_t count)
+{
+    rstatus_t status;
+    uint8_t cur[NC_UINT64_MAXLEN], cnt[NC_UINT32_MAXLEN];
+    int curlen, cntlen;
+
+    curlen = nc_snprintf(cur, sizeof(cur), "%"PRIu64, cursor);
+    cntlen = nc_snprintf(cnt, sizeof(cnt), "%"PRIu32, count);
+
+    status = msg_prepend_format(r, "*4\r\n$4\r\nSCAN\r\n$%d\r\n%.*s\r\n"
+                                "$5\r\nCOUNT\r\n$%d\r\n%.*s\r\n", curlen,
+                                curlen, cur, cntlen, cntlen, cnt);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    r->type = MSG_REQ_REDIS_SCAN;
+
+    return NC_OK;
+}
+
+/*
+ * Read the length n of a '<type><n>\r\n' header at *pos, before end
+ */
+static rstatus_t
+redis_scan_len(uint8_t **pos, uint8_t *end, uint8_t type, uint64_t *n)
+{
+    uint8_t *p;
+
+    p = *pos;
+    if (p >= end || *p != type) {
+        return NC_ERROR;
+    }
+
+    for (p++, *n = 0; p < end && isdigit(*p); p++) {
+        *n = *n * 10 + (uint64_t)(*p - '0');
+    }
+
+    if (end - p < (int64_t)CRLF_LEN || p[0] != CR || p[1] != LF) {
+        return NC_ERROR;
+    }
+
+    *pos = p + CRLF_LEN;
+
+    return NC_OK;
+}
+
+/*
+ * Parse rsp, the '*2 $cursor *n $key..' reply to a 'SCAN', into the next
+ * cursor and keys, a keypos[] that points into a contiguous copy of rsp.
+ * Return that copy, which the caller frees, or NULL on error, in which
+ * case keys may hold some garbage.
+ */
+uint8_t *
+redis_scan_keys(struct msg *rsp, uint64_t *cursor, struct array *keys)
+{
+    struct mbuf *mbuf;
+    struct keypos *kpos;
+    uint8_t *buf, *p, *end;
+    uint64_t i, n, len;
+    size_t size;
+
+    if (rsp->type != MSG_RSP_REDIS_MULTIBULK) {
+        return NULL;
+    }
+
+    size = 0;
+    STAILQ_FOREACH(mbuf, &rsp->mhdr, next) {
+        size += mbuf_length(mbuf);
+    }
+
+    buf = nc_alloc(size);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    p = buf;
+    STAILQ_FOREACH(mbuf, &rsp->mhdr, next) {
+        nc_memcpy(p, mbuf->pos, mbuf_length(mbuf));
+        p += mbuf_length(mbuf);
+    }
+    end = p;
+    p = buf;
+
+    if (redis_scan_len(&p, end, '*', &n) != NC_OK || n != 2) {
+        goto error;
+    }
+
+    /* cursor is a bulk of digits */
+    if (redis_scan_len(&p, end, '$', &len) != NC_OK ||
+        (uint64_t)(end - p) < len + CRLF_LEN) {
+        goto error;
+    }
+    for (*cursor = 0, i = 0; i < len; i++) {
+        if (!isdigit(p[i])) {
+            goto error;
+        }
+        *cursor = *cursor * 10 + (uint64_t)(p[i] - '0');
+    }
+    p += len + CRLF_LEN;
+
+    if (redis_scan_len(&p, end, '*', &n) != NC_OK) {
+        goto error;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (redis_scan_len(&p, end, '$', &len) != NC_OK ||
+            (uint64_t)(end - p) < len + CRLF_LEN) {
+            goto error;
+        }
+
+        kpos = array_push(keys);
+        if (kpos == NULL) {
+            goto error;
+        }
+        kpos->start = p;
+        kpos->end = p + len;
+
+        p += len + CRLF_LEN;
+    }
+
+    return buf;
+
+error:
+    nc_free(buf);
+    return NULL;
+}
+
+/*
+ * Build into request r a 'MIGRATE host port key db timeout [AUTH pass]',
+ * that moves {key, keylen} from the server r is sent to to server target,
+ * without replacing a key that target already holds
+ */
+rstatus_t
+redis_migrate(struct msg *r, struct server *target, uint8_t *key,
+              uint32_t keylen, int timeout)
+{
+    rstatus_t status;
+    struct server_pool *pool;
+    uint8_t port[NC_UINT32_MAXLEN], db[NC_UINT32_MAXLEN], tmo[NC_UINT32_MAXLEN];
+    uint8_t tail[128];
+    int portlen, dblen, tmolen, n;
+
+    pool = target->owner;
+
+    portlen = nc_snprintf(port, sizeof(port), "%"PRIu16, target->port);
+    dblen = nc_snprintf(db, sizeof(db), "%d", MAX(pool->redis_db, 0));
+    tmolen = nc_snprintf(tmo, sizeof(tmo), "%d", timeout);
+
+    status = msg_append(r, key, keylen);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    n = nc_snprintf(tail, sizeof(tail), "\r\n$%d\r\n%.*s\r\n$%d\r\n%.*s\r\n",
+                    dblen, dblen, db, tmolen, tmolen, tmo);
+    status = msg_append(r, tail, (size_t)n);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    if (pool->redis_auth.len > 0) {
+        n = nc_snprintf(tail, sizeof(tail), "$4\r\nAUTH\r\n$%d\r\n",
+                        pool->redis_auth.len);
+        status = msg_append(r, tail, (size_t)n);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = msg_append(r, pool->redis_auth.data, pool->redis_auth.len);
+        if (status != NC_OK) {
+            return status;
+        }
+
+        status = msg_append(r, (uint8_t *)CRLF, CRLF_LEN);
+        if (status != NC_OK) {
+            return status;
+        }
+    }
+
+    status = msg_prepend_format(r, "*%d\r\n$7\r\nMIGRATE\r\n$%d\r\n%.*s\r\n"
+                                "$%d\r\n%.*s\r\n$%d\r\n",
+                                pool->redis_auth.len > 0 ? 8 : 6,
+                                target->addrstr.len, target->addrstr.len,
+                                target->addrstr.data, portlen, portlen, port,
+                                keylen);
+    if (status != NC_OK) {
+        return status;
+    }
+
+    r->type = MSG_REQ_REDIS_MIGRATE;
+
+    return NC_OK;
+}
+
 void
 redis_swallow_msg(struct conn *conn, struct msg *pmsg, struct msg *msg)
 {
+    if (pmsg != NULL && msg != NULL) {
+        switch (pmsg->type) {
+        case MSG_REQ_REDIS_SCAN:
+            migrate_scan_done(conn, pmsg, msg);
+            return;
+
+        case MSG_REQ_REDIS_MIGRATE:
+            migrate_move_done(conn, pmsg, msg);
+            return;
+
+        default:
+            break;
+        }
+    }
+
     if (pmsg != NULL && pmsg->type == MSG_REQ_REDIS_SELECT &&
         msg != NULL && redis_error(msg)) {
         struct server* conn_server;
@@ -7,7 +7,14 @@ redis_passwd = "foobared"
 nc_servers = {
         'redis-ms': {'host': 'twemproxy',  'port': 32121},
         'redis-shards': {'host': 'twemproxy',  'port': 32122},
-        'mc-shards': {'host': 'twemproxy',  'port': 32123}
+        'mc-shards': {'host': 'twemproxy',  'port': 32123},
+        'redis-failover': {'host': 'twemproxy',  'port': 32124},
+        'redis-mirror': {'host': 'twemproxy',  'port': 32126},
+        'redis-mirror-down': {'host': 'twemproxy',  'port': 32128},
+        'redis-route': {'host': 'twemproxy',  'port': 32130},
+        'redis-delegate': {'host': 'twemproxy',  'port': 32132},
+        'redis-replicas': {'host': 'twemproxy',  'port': 32134},
+        'redis-replicas-down': {'host': 'twemproxy',  'port': 32135}
         }
 
 redis_servers = {
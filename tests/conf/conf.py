@@ -7,7 +7,14 @@ redis_passwd = "foobared"
 nc_servers = {
         'redis-ms': {'host': '127.0.0.1',  'port': 32121},
         'redis-shards': {'host': '127.0.0.1',  'port': 32122},
-        'mc-shards': {'host': '127.0.0.1',  'port': 32123}
+        'mc-shards': {'host': '127.0.0.1',  'port': 32123},
+        'redis-failover': {'host': '127.0.0.1',  'port': 32124},
+        'redis-mirror': {'host': '127.0.0.1',  'port': 32126},
+        'redis-mirror-down': {'host': '127.0.0.1',  'port': 32128},
+        'redis-route': {'host': '127.0.0.1',  'port': 32130},
+        'redis-delegate': {'host': '127.0.0.1',  'port': 32132},
+        'redis-replicas': {'host': '127.0.0.1',  'port': 32134},
+        'redis-replicas-down': {'host': '127.0.0.1',  'port': 32135}
         }
 
 redis_servers = {
@@ -0,0 +1,51 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+
+def _cmd(*args):
+    return '*%d\r\n' % len(args) + ''.join('$%d\r\n%s\r\n' % (len(a), a) for a in args)
+
+def _call(server, *args):
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((server['host'], server['port']))
+    s.settimeout(3)
+    s.sendall(_cmd(*args))
+    data = s.recv(10000)
+    s.close()
+    return data
+
+def _bulk(v):
+    return '$%d\r\n%s\r\n' % (len(v), v)
+
+def test_delegate_pool():
+    nc = nc_servers['redis-delegate']
+    shards = [redis_servers['redis-shard%d' % i] for i in (1, 2, 3)]
+    keys = ['%d-dg' % (i * 7919) for i in range(64)]
+
+    for k in keys:
+        for shard in shards:
+            _call(shard, 'DEL', k)
+        assert_equal(_call(nc, 'SET', k, k), '+OK\r\n')
+
+    # each key is on exactly one server: the pool's own, or one of the
+    # pool that the @nu server hands keys to
+    held = [0, 0, 0]
+    for k in keys:
+        assert_equal(_call(nc, 'GET', k), _bulk(k))
+        on = [i for i, shard in enumerate(shards)
+              if _call(shard, 'GET', k) == _bulk(k)]
+        assert_equal(len(on), 1)
+        held[on[0]] += 1
+    assert(held[0] > 0 and held[1] > 0 and held[2] > 0)
+
+def test_delegate_multi_key():
+    nc = nc_servers['redis-delegate']
+    keys = ['dm-%d' % i for i in range(16)]
+
+    args = []
+    for k in keys:
+        args += [k, k]
+    assert_equal(_call(nc, 'MSET', *args), '+OK\r\n')
+    assert_equal(_call(nc, 'MGET', *keys),
+                 '*%d\r\n' % len(keys) + ''.join(_bulk(k) for k in keys))
@@ -0,0 +1,74 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+import tempfile
+
+from common import *
+
+nc_bin = os.path.join(WORKDIR, '_binaries/nutcracker')
+
+def _cmd(*args):
+    return '*%d\r\n' % len(args) + ''.join('$%d\r\n%s\r\n' % (len(a), a) for a in args)
+
+def _call(server, *args):
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((server['host'], server['port']))
+    s.settimeout(3)
+    s.sendall(_cmd(*args))
+    data = s.recv(10000)
+    s.close()
+    return data
+
+def _test_conf(conf):
+    f = tempfile.NamedTemporaryFile(suffix='.yml')
+    f.write(conf)
+    f.flush()
+    return os.system('%s -t -c %s >/dev/null 2>&1' % (nc_bin, f.name)) == 0
+
+pool_conf = '''
+  %s:
+    listen: 127.0.0.1:%d
+    redis: true
+    distribution: ketama
+    auto_eject_hosts: true
+%s    servers:
+     - 127.0.0.1:%d:1
+%s'''
+
+def test_conf_failover_loop():
+    # a key of a down server of b fails over to a, which hands it back to b
+    b = pool_conf % ('b', 32141, '    failover: a\n', 3101, '')
+    a = pool_conf % ('a', 32140, '', 3100, '     - "@b:1"\n')
+    assert(not _test_conf('pools:' + a + b))
+
+    # with a failover pool outside the loop, the same references are fine
+    b = pool_conf % ('b', 32141, '    failover: c\n', 3101, '')
+    c = pool_conf % ('c', 32142, '', 3102, '')
+    assert(_test_conf('pools:' + a + b + c))
+
+def test_failover_ejected():
+    nc = nc_servers['redis-failover']
+    keys = ['fo-%d' % i for i in range(64)]
+
+    # keys of the down server fail until it is ejected, then go to the
+    # failover pool
+    for k in keys:
+        for i in range(3):
+            if _call(nc, 'SET', k, k) == '+OK\r\n':
+                break
+        else:
+            assert False, 'SET %s failed' % k
+
+    for k in keys:
+        assert_equal(_call(nc, 'GET', k), '$%d\r\n%s\r\n' % (len(k), k))
+
+    # the keys are on the healthy server or the spare of the failover pool
+    shard1 = redis_servers['redis-shard1']
+    spare = redis_servers['redis-shard3']
+    nspare = 0
+    for k in keys:
+        if _call(spare, 'GET', k) != '$-1\r\n':
+            nspare += 1
+        else:
+            assert_equal(_call(shard1, 'GET', k), '$%d\r\n%s\r\n' % (len(k), k))
+    assert(nspare > 0)
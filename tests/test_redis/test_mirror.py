@@ -0,0 +1,53 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+
+def _cmd(*args):
+    return '*%d\r\n' % len(args) + ''.join('$%d\r\n%s\r\n' % (len(a), a) for a in args)
+
+def _call(server, *args):
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((server['host'], server['port']))
+    s.settimeout(3)
+    s.sendall(_cmd(*args))
+    data = ''
+    while not data.endswith('\r\n') or \
+          (data.startswith('$') and len(data) < _bulk_len(data)):
+        buf = s.recv(65536)
+        if not buf:
+            break
+        data += buf
+    s.close()
+    return data
+
+def _bulk_len(data):
+    n = int(data[1:data.index('\r\n')])
+    return data.index('\r\n') + 2 + max(n, 0) + 2 if n >= 0 else 5
+
+def _bulk(v):
+    return '$%d\r\n%s\r\n' % (len(v), v)
+
+def test_mirror_copy():
+    nc = nc_servers['redis-mirror']
+    shadow = redis_servers['redis-shard2']
+
+    # values beyond the mbuf size are copied across several mbufs
+    kv = [('mi-%d' % i, chr(ord('a') + i) * (i * 9973)) for i in range(16)]
+    for k, v in kv:
+        assert_equal(_call(nc, 'SET', k, v), '+OK\r\n')
+
+    # copies are fire and forget; give the last ones time to arrive
+    time.sleep(.5)
+
+    for k, v in kv:
+        assert_equal(_call(shadow, 'GET', k), _bulk(v))
+
+def test_mirror_down():
+    nc = nc_servers['redis-mirror-down']
+
+    # the mirror pool has no server up, which never reaches the client
+    for i in range(64):
+        k = 'md-%d' % i
+        assert_equal(_call(nc, 'SET', k, k), '+OK\r\n')
+        assert_equal(_call(nc, 'GET', k), _bulk(k))
@@ -0,0 +1,116 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+
+def get_conn():
+    host = nc_servers['redis-shards']['host']
+    port = nc_servers['redis-shards']['port']
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((host, port))
+    s.settimeout(.3)
+    return s
+
+def _cmd(*args):
+    return '*%d\r\n' % len(args) + ''.join('$%d\r\n%s\r\n' % (len(a), a) for a in args)
+
+def _test(s, req, resp):
+    s.sendall(req)
+
+    data = ''
+    while len(data) < len(resp):
+        buf = s.recv(10000)
+        if not buf:
+            break
+        data += buf
+    assert(data == resp)
+
+def test_multi_exec():
+    r = get_redis_conn(is_ms=False)
+    r.delete('tx-k')
+
+    s = get_conn()
+    _test(s, _cmd('MULTI'), '+OK\r\n')
+    _test(s, _cmd('SET', 'tx-k', '1'), '+QUEUED\r\n')
+    _test(s, _cmd('INCR', 'tx-k'), '+QUEUED\r\n')
+    _test(s, _cmd('GET', 'tx-k'), '+QUEUED\r\n')
+    _test(s, _cmd('EXEC'), '*3\r\n+OK\r\n:2\r\n$1\r\n2\r\n')
+
+    assert(r.get('tx-k') == '2')
+
+def test_multi_exec_pipelined():
+    r = get_redis_conn(is_ms=False)
+    r.delete('tx-p')
+
+    s = get_conn()
+    req = _cmd('MULTI') + _cmd('RPUSH', 'tx-p', 'a', 'b') + \
+          _cmd('LRANGE', 'tx-p', '0', '-1') + _cmd('EXEC') + _cmd('PING')
+    resp = '+OK\r\n+QUEUED\r\n+QUEUED\r\n' + \
+           '*2\r\n:2\r\n*2\r\n$1\r\na\r\n$1\r\nb\r\n' + '+PONG\r\n'
+    _test(s, req, resp)
+
+def test_multi_empty_exec():
+    s = get_conn()
+    _test(s, _cmd('MULTI'), '+OK\r\n')
+    _test(s, _cmd('EXEC'), '*0\r\n')
+
+def test_multi_discard():
+    r = get_redis_conn(is_ms=False)
+    r.delete('tx-d')
+
+    s = get_conn()
+    _test(s, _cmd('MULTI'), '+OK\r\n')
+    _test(s, _cmd('SET', 'tx-d', 'v'), '+QUEUED\r\n')
+    _test(s, _cmd('DISCARD'), '+OK\r\n')
+    _test(s, _cmd('GET', 'tx-d'), '$-1\r\n')
+
+    assert(r.get('tx-d') == None)
+
+def test_multi_errors():
+    s = get_conn()
+    _test(s, _cmd('EXEC'), '-ERR EXEC without MULTI\r\n')
+    _test(s, _cmd('DISCARD'), '-ERR DISCARD without MULTI\r\n')
+    _test(s, _cmd('MULTI'), '+OK\r\n')
+    _test(s, _cmd('MULTI'), '-ERR MULTI calls can not be nested\r\n')
+    _test(s, _cmd('DISCARD'), '+OK\r\n')
+
+def test_execabort_keyless():
+    r = get_redis_conn(is_ms=False)
+    r.delete('tx-a')
+
+    s = get_conn()
+    _test(s, _cmd('MULTI'), '+OK\r\n')
+    _test(s, _cmd('SET', 'tx-a', 'v'), '+QUEUED\r\n')
+    _test(s, _cmd('PING'),
+          '-ERR Command without a key not allowed in a transaction\r\n')
+    _test(s, _cmd('EXEC'),
+          '-EXECABORT Transaction discarded because of previous errors.\r\n')
+
+    # nothing of the transaction was sent, and the connection is usable
+    _test(s, _cmd('GET', 'tx-a'), '$-1\r\n')
+
+def test_execabort_cross_server():
+    r = get_redis_conn(is_ms=False)
+    keys = ['%d-tx-x' % (i * 7919) for i in range(20)]
+    r.delete(*keys)
+
+    s = get_conn()
+    _test(s, _cmd('MULTI'), '+OK\r\n')
+
+    # with several shards, some of these keys go to another server than the
+    # first one, and are rejected
+    crossed = 0
+    for k in keys:
+        s.sendall(_cmd('SET', k, 'v'))
+        data = s.recv(10000)
+        if data == '+QUEUED\r\n':
+            continue
+        assert(data.startswith('-CROSSSLOT '))
+        crossed += 1
+    assert(crossed > 0)
+
+    _test(s, _cmd('EXEC'),
+          '-EXECABORT Transaction discarded because of previous errors.\r\n')
+
+    for k in keys:
+        assert(r.get(k) == None)
@@ -0,0 +1,76 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+
+def get_conn():
+    host = nc_servers['redis-shards']['host']
+    port = nc_servers['redis-shards']['port']
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((host, port))
+    s.settimeout(3)
+    return s
+
+def _cmd(*args):
+    return '*%d\r\n' % len(args) + ''.join('$%d\r\n%s\r\n' % (len(a), a) for a in args)
+
+def _bulks(values):
+    return '*%d\r\n' % len(values) + ''.join('$%d\r\n%s\r\n' % (len(v), v) for v in values)
+
+def _test(req, resp):
+    s = get_conn()
+
+    # a PING behind the request checks that the reply is framed at its end
+    s.sendall(req + _cmd('PING'))
+    resp += '+PONG\r\n'
+
+    data = ''
+    while len(data) < len(resp):
+        buf = s.recv(65536)
+        if not buf:
+            break
+        data += buf
+    assert(data == resp)
+
+def test_nested_arrays():
+    script = "return {1, {2, {3, 'x'}, 'y'}, {}, 'z'}"
+    resp = '*4\r\n:1\r\n*3\r\n:2\r\n*2\r\n:3\r\n$1\r\nx\r\n$1\r\ny\r\n' + \
+           '*0\r\n$1\r\nz\r\n'
+    _test(_cmd('EVAL', script, '1', 'mb-nested'), resp)
+
+def test_null_and_empty_elements():
+    script = "return {'', false, 'a', {false, ''}}"
+    resp = '*4\r\n$0\r\n\r\n$-1\r\n$1\r\na\r\n*2\r\n$-1\r\n$0\r\n\r\n'
+    _test(_cmd('EVAL', script, '1', 'mb-null'), resp)
+
+def test_bulks_split_across_mbufs():
+    r = get_redis_conn(is_ms=False)
+    r.delete('mb-split')
+
+    # values around and beyond the mbuf size end up split across mbufs
+    values = ['%s' % chr(ord('a') + i % 26) * (i * 97 % 3000) for i in range(64)]
+    r.rpush('mb-split', *values)
+
+    _test(_cmd('LRANGE', 'mb-split', '0', '-1'), _bulks(values))
+
+def test_repair_split_headers():
+    r = get_redis_conn(is_ms=False)
+    r.delete('mb-repair')
+
+    # many short elements of varied length put element headers, and the
+    # reply header of a large count, across the end of an mbuf, which the
+    # parser repairs by moving the partial token to a new mbuf
+    values = ['v' * (i % 37) for i in range(5000)]
+    for i in range(0, len(values), 500):
+        r.rpush('mb-repair', *values[i:i + 500])
+
+    _test(_cmd('LRANGE', 'mb-repair', '0', '-1'), _bulks(values))
+
+def test_pipelined_multibulk():
+    r = get_redis_conn(is_ms=False)
+    r.delete('mb-pipe')
+    r.rpush('mb-pipe', 'a', '', 'ccc')
+
+    req = _cmd('LRANGE', 'mb-pipe', '0', '-1') * 100
+    resp = _bulks(['a', '', 'ccc']) * 100
+    _test(req, resp)
@@ -0,0 +1,50 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+
+def _cmd(*args):
+    return '*%d\r\n' % len(args) + ''.join('$%d\r\n%s\r\n' % (len(a), a) for a in args)
+
+def _call(server, *args):
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((server['host'], server['port']))
+    s.settimeout(3)
+    s.sendall(_cmd(*args))
+    data = s.recv(10000)
+    s.close()
+    return data
+
+def _bulk(v):
+    return '$%d\r\n%s\r\n' % (len(v), v)
+
+def test_replicas_write():
+    nc = nc_servers['redis-replicas']
+    shards = [redis_servers['redis-shard1'], redis_servers['redis-shard2']]
+    keys = ['%d-rp' % (i * 7919) for i in range(64)]
+
+    for k in keys:
+        assert_equal(_call(nc, 'SET', k, k), '+OK\r\n')
+
+    # the copies to the other replica are fire and forget
+    time.sleep(.5)
+
+    # with as many replicas as servers, every key is on every server
+    for k in keys:
+        assert_equal(_call(nc, 'GET', k), _bulk(k))
+        for shard in shards:
+            assert_equal(_call(shard, 'GET', k), _bulk(k))
+
+def test_replicas_read_down():
+    nc = nc_servers['redis-replicas-down']
+    shard1 = redis_servers['redis-shard1']
+    keys = ['%d-rd' % (i * 7919) for i in range(64)]
+
+    for k in keys:
+        assert_equal(_call(shard1, 'SET', k, k), '+OK\r\n')
+
+    # reads spread over both replicas; one that fails on the down server,
+    # which is never ejected, is retried on the next replica
+    for i in range(4):
+        for k in keys:
+            assert_equal(_call(nc, 'GET', k), _bulk(k))
@@ -0,0 +1,48 @@
+#!/usr/bin/env python
+#coding: utf-8
+
+from common import *
+
+def _cmd(*args):
+    return '*%d\r\n' % len(args) + ''.join('$%d\r\n%s\r\n' % (len(a), a) for a in args)
+
+def _call(server, *args):
+    s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    s.connect((server['host'], server['port']))
+    s.settimeout(3)
+    s.sendall(_cmd(*args))
+    data = s.recv(10000)
+    s.close()
+    return data
+
+def _bulk(v):
+    return '$%d\r\n%s\r\n' % (len(v), v)
+
+def test_route_prefix():
+    nc = nc_servers['redis-route']
+    shard1 = redis_servers['redis-shard1']
+    shard2 = redis_servers['redis-shard2']
+
+    # keys with the rt: prefix go to the servers of the routed pool, the
+    # others to the pool's own servers
+    for k in ['rt:a', 'rt:b', 'rt-c', 'rtd', 'xrt:e']:
+        _call(shard1, 'DEL', k)
+        _call(shard2, 'DEL', k)
+        assert_equal(_call(nc, 'SET', k, k), '+OK\r\n')
+        assert_equal(_call(nc, 'GET', k), _bulk(k))
+
+    for k in ['rt:a', 'rt:b']:
+        assert_equal(_call(shard2, 'GET', k), _bulk(k))
+        assert_equal(_call(shard1, 'GET', k), '$-1\r\n')
+
+    for k in ['rt-c', 'rtd', 'xrt:e']:
+        assert_equal(_call(shard1, 'GET', k), _bulk(k))
+        assert_equal(_call(shard2, 'GET', k), '$-1\r\n')
+
+def test_route_multi_key():
+    nc = nc_servers['redis-route']
+
+    # a multi-key request spans the routed and the own pool
+    assert_equal(_call(nc, 'MSET', 'rt:m1', '1', 'm2', '2'), '+OK\r\n')
+    assert_equal(_call(nc, 'MGET', 'rt:m1', 'm2', 'rt:m3'),
+                 '*3\r\n' + _bulk('1') + _bulk('2') + '$-1\r\n')